@@ -1,7 +1,7 @@
 //
 //    FILE: HX711.cpp
 //  AUTHOR: Rob Tillaart
-// VERSION: 0.6.1
+// VERSION: 0.7.6
 // PURPOSE: Library for load cells for UNO
 //     URL: https://github.com/RobTillaart/HX711_MP
 //     URL: https://github.com/RobTillaart/HX711
@@ -9,6 +9,10 @@
 
 #include "HX711.h"
 
+#if defined(ARDUINO_ARCH_ESP8266)
+#include <SPI.h>
+#endif
+
 
 HX711::HX711()
 {
@@ -19,6 +23,13 @@ HX711::HX711()
   _price    = 0;
   _mode     = HX711_AVERAGE_MODE;
   _fastProcessor = false;
+  _transport     = HX711_BITBANG;
+  _readCallback  = NULL;
+  _lastSampleCount = 0;
+  reset_noise();
+  set_kalman_noise();
+  reset_kalman();
+  clear_slots();
 }
 
 
@@ -32,6 +43,7 @@ void HX711::begin(uint8_t dataPin, uint8_t clockPin, bool fastProcessor )
   _dataPin  = dataPin;
   _clockPin = clockPin;
   _fastProcessor = fastProcessor;
+  _transport     = HX711_BITBANG;
 
   pinMode(_dataPin, INPUT_PULLUP);
   pinMode(_clockPin, OUTPUT);
@@ -51,6 +63,42 @@ void HX711::reset()
   _lastTimeRead = 0;
   _price    = 0;
   _mode     = HX711_AVERAGE_MODE;
+  _lastSampleCount = 0;
+  reset_noise();
+  set_kalman_noise();
+  reset_kalman();
+  clear_slots();
+}
+
+
+bool HX711::use_hspi(bool enable)
+{
+#if defined(ARDUINO_ARCH_ESP8266)
+  if (enable && _clockPin == SCK && _dataPin == MISO)
+  {
+    SPI.begin();
+    //  the transfer drives MOSI, nothing needs it
+    pinMode(MOSI, INPUT);
+    SPI.setFrequency(HX711_SPI_FREQUENCY);
+    SPI.setBitOrder(MSBFIRST);
+    //  SCK idles LOW, DOUT changes after the rising edge and is
+    //  read at the falling one
+    SPI.setDataMode(SPI_MODE1);
+    _transport = HX711_HSPI;
+    return true;
+  }
+  if (_transport == HX711_HSPI)
+  {
+    //  not SPI.end(), that would take MOSI too
+    pinMode(_clockPin, OUTPUT);
+    digitalWrite(_clockPin, LOW);
+    pinMode(_dataPin, INPUT_PULLUP);
+  }
+#else
+  (void) enable;
+#endif
+  _transport = HX711_BITBANG;
+  return false;
 }
 
 
@@ -102,6 +150,16 @@ bool HX711::wait_ready_timeout(uint32_t timeout, uint32_t ms)
 //  Serial clock input PD_SCK should be LOW.
 //  When DOUT goes to LOW, it indicates data is ready for retrieval.
 float HX711::read()
+{
+  float value = _read(_gain);
+  _noiseAdd(value);
+  return value;
+}
+
+
+//  clocks out the conversion and selects the channel / gain
+//  of the next one.
+float HX711::_read(uint8_t nextGain)
 {
   //  this BLOCKING wait takes most time...
   while (digitalRead(_dataPin) == HIGH) yield();
@@ -112,17 +170,6 @@ float HX711::read()
     uint8_t data[4];
   } v;
 
-  //  blocking part ...
-  noInterrupts();
-
-  //  Pulse the clock pin 24 times to read the data.
-  //  v.data[2] = shiftIn(_dataPin, _clockPin, MSBFIRST);
-  //  v.data[1] = shiftIn(_dataPin, _clockPin, MSBFIRST);
-  //  v.data[0] = shiftIn(_dataPin, _clockPin, MSBFIRST);
-  v.data[2] = _shiftIn();
-  v.data[1] = _shiftIn();
-  v.data[0] = _shiftIn();
-
   //  TABLE 3 page 4 datasheet
   //
   //  CLOCK      CHANNEL      GAIN      m
@@ -135,29 +182,48 @@ float HX711::read()
   //  selection goes through the set_gain(gain)
   //
   uint8_t m = 1;
-  if      (_gain == HX711_CHANNEL_A_GAIN_128) m = 1;
-  else if (_gain == HX711_CHANNEL_A_GAIN_64)  m = 3;
-  else if (_gain == HX711_CHANNEL_B_GAIN_32)  m = 2;
+  if      (nextGain == HX711_CHANNEL_A_GAIN_128) m = 1;
+  else if (nextGain == HX711_CHANNEL_A_GAIN_64)  m = 3;
+  else if (nextGain == HX711_CHANNEL_B_GAIN_32)  m = 2;
 
-  while (m > 0)
+  if (_transport == HX711_HSPI)
   {
-    //  delayMicroSeconds(1) is needed for fast processors
-    //  T2  >= 0.2 us
-    digitalWrite(_clockPin, HIGH);
-    if (_fastProcessor) delayMicroseconds(1);
-    digitalWrite(_clockPin, LOW);
-    //  keep duty cycle ~50%
-    if (_fastProcessor) delayMicroseconds(1);
-    m--;
+    v.value = _transferHspi(m);
   }
+  else
+  {
+    //  blocking part ...
+    noInterrupts();
+
+    //  Pulse the clock pin 24 times to read the data.
+    //  v.data[2] = shiftIn(_dataPin, _clockPin, MSBFIRST);
+    //  v.data[1] = shiftIn(_dataPin, _clockPin, MSBFIRST);
+    //  v.data[0] = shiftIn(_dataPin, _clockPin, MSBFIRST);
+    v.data[2] = _shiftIn();
+    v.data[1] = _shiftIn();
+    v.data[0] = _shiftIn();
+
+    while (m > 0)
+    {
+      //  delayMicroSeconds(1) is needed for fast processors
+      //  T2  >= 0.2 us
+      digitalWrite(_clockPin, HIGH);
+      if (_fastProcessor) delayMicroseconds(1);
+      digitalWrite(_clockPin, LOW);
+      //  keep duty cycle ~50%
+      if (_fastProcessor) delayMicroseconds(1);
+      m--;
+    }
 
-  interrupts();
-  //  yield();
+    interrupts();
+    //  yield();
+  }
 
   //  SIGN extend
   if (v.data[2] & 0x80) v.data[3] = 0xFF;
 
   _lastTimeRead = millis();
+  if (_readCallback) _readCallback(v.value);
   return 1.0 * v.value;
 }
 
@@ -185,9 +251,7 @@ float HX711::read_median(uint8_t times)
     samples[i] = read();
     yield();
   }
-  _insertSort(samples, times);
-  if (times & 0x01) return samples[times/2];
-  return (samples[times/2] + samples[times/2 + 1]) / 2;
+  return median_of(samples, times);
 }
 
 
@@ -201,18 +265,7 @@ float HX711::read_medavg(uint8_t times)
     samples[i] = read();
     yield();
   }
-  _insertSort(samples, times);
-  float sum = 0;
-  //  iterate over 1/4 to 3/4 of the array
-  uint8_t count = 0;
-  uint8_t first = (times + 2) / 4;
-  uint8_t last  = times - first - 1;
-  for (uint8_t i = first; i <= last; i++)  //  !! include last one too
-  {
-    sum += samples[i];
-    count++;
-  }
-  return sum / count;
+  return medavg_of(samples, times);
 }
 
 
@@ -231,6 +284,161 @@ float HX711::read_runavg(uint8_t times, float alpha)
 }
 
 
+///////////////////////////////////////////////////////////////
+//
+//  MATH ON SAMPLES
+//
+void HX711::sort_samples(float * samples, uint8_t count)
+{
+  _insertSort(samples, count);
+}
+
+
+float HX711::median_of(float * samples, uint8_t count)
+{
+  if (count == 0) return 0;
+  _insertSort(samples, count);
+  if (count & 0x01) return samples[count/2];
+  return (samples[count/2 - 1] + samples[count/2]) / 2;
+}
+
+
+float HX711::medavg_of(float * samples, uint8_t count)
+{
+  if (count == 0) return 0;
+  _insertSort(samples, count);
+  float sum = 0;
+  //  iterate over 1/4 to 3/4 of the array
+  uint8_t n = 0;
+  uint8_t first = (count + 2) / 4;
+  uint8_t last  = count - first - 1;
+  for (uint8_t i = first; i <= last; i++)  //  !! include last one too
+  {
+    sum += samples[i];
+    n++;
+  }
+  return sum / n;
+}
+
+
+float HX711::runavg_of(const float * samples, uint8_t count, float alpha)
+{
+  if (count == 0) return 0;
+  if (alpha < 0)  alpha = 0;
+  if (alpha > 1)  alpha = 1;
+  float val = samples[0];
+  for (uint8_t i = 1; i < count; i++)
+  {
+    val += alpha * (samples[i] - val);
+  }
+  return val;
+}
+
+
+//  Predict with the time since the previous call, then correct
+//  with one read. An innovation outside the gate means the weight
+//  changed: the covariance is opened up so the next few reads are
+//  followed closely instead of being smoothed away.
+//
+//  Without a set measurement noise the read noise is learned from
+//  the differences of successive reads: half their variance is the
+//  variance of one read, and unlike the spread of the reads
+//  themselves it does not grow while the weight runs down a slope.
+float HX711::read_kalman()
+{
+  float raw = read();
+  uint32_t now = micros();
+
+  //  filter works in raw units
+  float R;
+  if (_kalmanR > 0)
+  {
+    R = _kalmanR / _scale;
+    R = R * R;
+  }
+  else if (_diffCount >= 2)
+  {
+    R = _diffM2 / (_diffCount - 1) / 2;
+  }
+  else
+  {
+    R = get_noise_variance();
+  }
+  if (R <= 0) R = 1;
+  float q = _kalmanQ / _scale;
+  q = q * q;
+
+  //  after a long pause the rate is stale: start over from this read,
+  //  keep the learned noise. measured in millis(), micros() wraps
+  //  every 71.6 minutes and a pause can be as long as that.
+  uint32_t nowMs = millis();
+  if (_kalmanInit && nowMs - _kalmanMillis > HX711_KALMAN_MAX_GAP / 1000)
+  {
+    _kalmanInit    = false;
+    _kalmanSettled = 0;
+  }
+
+  //  first read: weight known to within one read, rate unknown
+  if (!_kalmanInit)
+  {
+    _kalmanBase    = raw;
+    _kalmanLastRaw = raw;
+    _kalmanWeight  = 0;
+    _kalmanRate    = 0;
+    _kalmanP00     = R;
+    _kalmanP01     = 0;
+    _kalmanP11     = R;
+    _kalmanTime    = now;
+    _kalmanMillis  = nowMs;
+    _kalmanInit    = true;
+    return raw;
+  }
+
+  //  PREDICT  x = F x,  P = F P F' + Q
+  float dt  = (now - _kalmanTime) * 1e-6;
+  float dt2 = dt * dt;
+  _kalmanTime = now;
+  _kalmanMillis = nowMs;
+  _kalmanWeight += _kalmanRate * dt;
+  _kalmanP00 += dt * (2 * _kalmanP01 + dt * _kalmanP11) + q * dt2 * dt2 / 4;
+  _kalmanP01 += dt * _kalmanP11 + q * dt2 * dt / 2;
+  _kalmanP11 += q * dt2;
+
+  //  CORRECT
+  float y = raw - _kalmanBase - _kalmanWeight;
+  float S = _kalmanP00 + R;
+  if (y * y > HX711_KALMAN_GATE * HX711_KALMAN_GATE * S)
+  {
+    _kalmanSettled = 0;
+    _kalmanP00 += y * y;
+    if (dt > 0) _kalmanP11 += (y * y) / dt2;
+    S = _kalmanP00 + R;
+  }
+  else
+  {
+    if (_kalmanSettled < 255) _kalmanSettled++;
+    //  a jump would be taken for noise, learn from quiet reads only
+    if (_diffCount < HX711_NOISE_WINDOW) _diffCount++;
+    else _diffM2 -= _diffM2 / _diffCount;
+    float d = raw - _kalmanLastRaw;
+    float delta = d - _diffMean;
+    _diffMean += delta / _diffCount;
+    _diffM2   += delta * (d - _diffMean);
+  }
+  _kalmanLastRaw = raw;
+
+  float K0 = _kalmanP00 / S;
+  float K1 = _kalmanP01 / S;
+  _kalmanWeight += K0 * y;
+  _kalmanRate   += K1 * y;
+  _kalmanP11 -= K1 * _kalmanP01;
+  _kalmanP01 -= K0 * _kalmanP01;
+  _kalmanP00 -= K0 * _kalmanP00;
+
+  return _kalmanBase + _kalmanWeight;
+}
+
+
 ///////////////////////////////////////////////////////
 //
 //  MODE
@@ -266,6 +474,12 @@ void HX711::set_runavg_mode()
 }
 
 
+void HX711::set_kalman_mode()
+{
+  _mode = HX711_KALMAN_MODE;
+}
+
+
 uint8_t HX711::get_mode()
 {
   return _mode;
@@ -280,6 +494,9 @@ float HX711::get_value(uint8_t times)
     case HX711_RAW_MODE:
       raw = read();
       break;
+    case HX711_KALMAN_MODE:
+      raw = read_kalman();
+      break;
     case HX711_RUNAVG_MODE:
       raw = read_runavg(times);
       break;
@@ -305,6 +522,269 @@ float HX711::get_units(uint8_t times)
 }
 
 
+float HX711::get_units_adaptive(float maxNoise, uint8_t maxTimes)
+{
+  if (maxTimes < 1) maxTimes = 1;
+  float sum = 0;
+  uint8_t count = 0;
+  while (count < maxTimes)
+  {
+    sum += read();
+    count++;
+    //  read() just added to the statistics, so the estimate
+    //  of how many reads are needed improves on every pass.
+    uint16_t needed = get_noise_samples(maxNoise);
+    if (needed != 0 && count >= needed) break;
+    yield();
+  }
+  _lastSampleCount = count;
+  return (sum / count - _offset) * _scale;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  NOISE STATISTICS
+//
+void HX711::reset_noise()
+{
+  _noiseCount = 0;
+  _noiseMean  = 0;
+  _noiseM2    = 0;
+}
+
+
+float HX711::get_noise_variance()
+{
+  if (_noiseCount < 2) return 0;
+  return _noiseM2 / (_noiseCount - 1);
+}
+
+
+float HX711::get_noise_stddev()
+{
+  return sqrt(get_noise_variance()) * fabs(_scale);
+}
+
+
+uint16_t HX711::get_noise_samples(float maxNoise)
+{
+  if (_noiseCount < 2) return 0;
+  if (maxNoise <= 0) return 0xFFFF;
+  //  standard error = stddev / sqrt(n)  <=  maxNoise
+  float ratio = get_noise_stddev() / maxNoise;
+  float n = ceil(ratio * ratio);
+  if (n < 1) return 1;
+  if (n > 0xFFFF) return 0xFFFF;
+  return n;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  KALMAN
+//
+void HX711::set_kalman_noise(float processNoise, float measurementNoise)
+{
+  _kalmanQ = fabs(processNoise);
+  _kalmanR = fabs(measurementNoise);
+}
+
+
+void HX711::reset_kalman()
+{
+  _kalmanBase     = 0;
+  _kalmanWeight   = 0;
+  _kalmanRate     = 0;
+  _kalmanP00      = 0;
+  _kalmanP01      = 0;
+  _kalmanP11      = 0;
+  _kalmanLastRaw  = 0;
+  _diffCount      = 0;
+  _diffMean       = 0;
+  _diffM2         = 0;
+  _kalmanTime     = 0;
+  _kalmanMillis   = 0;
+  _kalmanSettled  = 0;
+  _kalmanInit     = false;
+}
+
+
+float HX711::get_rate()
+{
+  return _kalmanRate * _scale;
+}
+
+
+bool HX711::is_stable(float maxRate)
+{
+  if (!_kalmanInit) return false;
+  if (_kalmanSettled < HX711_KALMAN_SETTLE) return false;
+  return fabs(get_rate()) < maxRate;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  INTERLEAVED CHANNELS
+//
+uint8_t HX711::add_slot(uint8_t gain, uint8_t samples, uint8_t discard)
+{
+  if (_slotCount >= HX711_MAX_SLOTS) return HX711_NO_SLOT;
+  if ((gain != HX711_CHANNEL_A_GAIN_128) &&
+      (gain != HX711_CHANNEL_A_GAIN_64)  &&
+      (gain != HX711_CHANNEL_B_GAIN_32)) return HX711_NO_SLOT;
+  if (samples < 1) samples = 1;
+  Slot &s   = _slots[_slotCount];
+  s.gain    = gain;
+  s.samples = samples;
+  s.discard = discard;
+  s.offset  = 0;
+  s.scale   = 1;
+  s.value   = 0;
+  s.count   = 0;
+  _slotSynced = false;
+  return _slotCount++;
+}
+
+
+void HX711::clear_slots()
+{
+  _slotCount   = 0;
+  _slotCurrent = 0;
+  _slotTaken   = 0;
+  _slotDiscard = 0;
+  _slotSynced  = false;
+  _discarded   = 0;
+}
+
+
+uint8_t HX711::poll()
+{
+  if (_slotCount == 0) return HX711_NO_SLOT;
+  if (!is_ready()) return HX711_NO_SLOT;
+
+  //  first poll: the conversion in progress has whatever gain was
+  //  last selected, drop it and select the first slot.
+  if (!_slotSynced)
+  {
+    _slotCurrent = 0;
+    _slotTaken   = 0;
+    _read(_slots[0].gain);
+    _slotDiscard = (_gain == _slots[0].gain) ? 0 : _slots[0].discard;
+    _gain = _slots[0].gain;
+    _slotSynced = true;
+    _discarded++;
+    return HX711_NO_SLOT;
+  }
+
+  //  does this conversion complete the turn of the current slot?
+  Slot &cur = _slots[_slotCurrent];
+  uint8_t next = _slotCurrent;
+  if ((_slotDiscard == 0) && (_slotTaken + 1 >= cur.samples))
+  {
+    next = (_slotCurrent + 1) % _slotCount;
+  }
+
+  //  clock out and select the gain of the next conversion at once
+  float raw = _read(_slots[next].gain);
+
+  uint8_t delivered = HX711_NO_SLOT;
+  if (_slotDiscard > 0)
+  {
+    _slotDiscard--;
+    _discarded++;
+  }
+  else
+  {
+    cur.value = raw;
+    cur.count++;
+    _slotTaken++;
+    delivered = _slotCurrent;
+  }
+
+  if (next != _slotCurrent)
+  {
+    //  same gain twice needs no settling
+    _slotDiscard = (_slots[next].gain == cur.gain) ? 0 : _slots[next].discard;
+    _slotCurrent = next;
+    _slotTaken   = 0;
+  }
+  _gain = _slots[next].gain;
+  return delivered;
+}
+
+
+float HX711::get_slot_value(uint8_t slot)
+{
+  if (slot >= _slotCount) return 0;
+  return _slots[slot].value - _slots[slot].offset;
+}
+
+
+float HX711::get_slot_units(uint8_t slot)
+{
+  if (slot >= _slotCount) return 0;
+  return get_slot_value(slot) * _slots[slot].scale;
+}
+
+
+uint32_t HX711::get_slot_samples(uint8_t slot)
+{
+  if (slot >= _slotCount) return 0;
+  return _slots[slot].count;
+}
+
+
+void HX711::set_slot_offset(uint8_t slot, int32_t offset)
+{
+  if (slot >= _slotCount) return;
+  _slots[slot].offset = offset;
+}
+
+
+int32_t HX711::get_slot_offset(uint8_t slot)
+{
+  if (slot >= _slotCount) return 0;
+  return _slots[slot].offset;
+}
+
+
+bool HX711::set_slot_scale(uint8_t slot, float scale)
+{
+  if (slot >= _slotCount) return false;
+  if (scale == 0) return false;
+  _slots[slot].scale = 1.0 / scale;
+  return true;
+}
+
+
+float HX711::get_slot_scale(uint8_t slot)
+{
+  if (slot >= _slotCount) return 0;
+  return 1.0 / _slots[slot].scale;
+}
+
+
+void HX711::tare_slot(uint8_t slot, uint8_t times)
+{
+  if (slot >= _slotCount) return;
+  if (times < 1) times = 1;
+  float sum = 0;
+  uint8_t count = 0;
+  while (count < times)
+  {
+    if (poll() == slot)
+    {
+      sum += _slots[slot].value;
+      count++;
+    }
+    yield();
+  }
+  _slots[slot].offset = sum / times;
+}
+
+
 ///////////////////////////////////////////////////////////////
 //
 //  GAIN
@@ -323,6 +803,8 @@ bool HX711::set_gain(uint8_t gain, bool forced)
     case HX711_CHANNEL_A_GAIN_128:
       _gain = gain;
       read();     //  next user read() is from right channel / gain
+      reset_noise();
+      reset_kalman();
       return true;
   }
   return false;   //  unchanged, but incorrect value.
@@ -400,6 +882,8 @@ void HX711::calibrate_scale(float weight, uint8_t times)
 //
 void HX711::power_down()
 {
+  //  the HSPI transport hands SCK back to the GPIO meanwhile
+  if (_transport == HX711_HSPI) pinMode(_clockPin, OUTPUT);
   //  at least 60 us HIGH
   digitalWrite(_clockPin, HIGH);
   delayMicroseconds(64);
@@ -409,6 +893,9 @@ void HX711::power_down()
 void HX711::power_up()
 {
   digitalWrite(_clockPin, LOW);
+#if defined(ARDUINO_ARCH_ESP8266)
+  if (_transport == HX711_HSPI) pinMode(_clockPin, SPECIAL);
+#endif
 }
 
 
@@ -452,6 +939,41 @@ void HX711::_insertSort(float * array, uint8_t size)
 }
 
 
+//  Welford with a fading window: once the window is full the
+//  accumulated squares lose the share of one conversion before
+//  the new one is added, so old noise ages out.
+void HX711::_noiseAdd(float raw)
+{
+  if (_noiseCount < HX711_NOISE_WINDOW)
+  {
+    _noiseCount++;
+  }
+  else
+  {
+    _noiseM2 -= _noiseM2 / _noiseCount;
+  }
+  float delta = raw - _noiseMean;
+  _noiseMean += delta / _noiseCount;
+  _noiseM2   += delta * (raw - _noiseMean);
+}
+
+
+//  24 data bits and the gain pulses as trailing bits of one transfer,
+//  their data is ignored. the peripheral clocks on its own, so an
+//  interrupt meanwhile cannot stretch SCK HIGH into a power down.
+uint32_t HX711::_transferHspi(uint8_t pulses)
+{
+  uint32_t word = 0;
+#if defined(ARDUINO_ARCH_ESP8266)
+  SPI.transferBits(0, &word, 24 + pulses);
+#else
+  (void) pulses;
+#endif
+  //  received MSB first, the first byte in the low byte of the word
+  return ((word & 0xFF) << 16) | (word & 0xFF00) | ((word >> 16) & 0xFF);
+}
+
+
 //  MSB_FIRST optimized shiftIn
 //  see datasheet page 5 for timing
 uint8_t HX711::_shiftIn()
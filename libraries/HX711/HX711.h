@@ -2,7 +2,7 @@
 //
 //    FILE: HX711.h
 //  AUTHOR: Rob Tillaart
-// VERSION: 0.6.1
+// VERSION: 0.7.6
 // PURPOSE: Library for load cells for Arduino
 //     URL: https://github.com/RobTillaart/HX711_MP
 //     URL: https://github.com/RobTillaart/HX711
@@ -15,7 +15,43 @@
 
 #include "Arduino.h"
 
-#define HX711_LIB_VERSION               (F("0.6.1"))
+#define HX711_LIB_VERSION               (F("0.7.6"))
+
+
+//  conversions the online noise statistics remember
+#ifndef HX711_NOISE_WINDOW
+#define HX711_NOISE_WINDOW              16
+#endif
+
+//  innovations beyond this many sigma count as a change of weight
+#ifndef HX711_KALMAN_GATE
+#define HX711_KALMAN_GATE               3.0
+#endif
+//  us between reads after which the filter starts over
+#ifndef HX711_KALMAN_MAX_GAP
+#define HX711_KALMAN_MAX_GAP            5000000UL
+#endif
+//  in-gate updates needed before is_stable() can be true
+#ifndef HX711_KALMAN_SETTLE
+#define HX711_KALMAN_SETTLE             5
+#endif
+
+//  channel / gain slots of the interleaved scheduler
+#ifndef HX711_MAX_SLOTS
+#define HX711_MAX_SLOTS                 3
+#endif
+#define HX711_NO_SLOT                   0xFF
+//  conversions discarded after a switch by default, the settle time
+//  the datasheet allows for a channel / gain change
+#ifndef HX711_SLOT_SETTLE
+#define HX711_SLOT_SETTLE               4
+#endif
+
+//  clock of the HSPI transport, SCK HIGH and LOW must each last
+//  0.2 us or more and HIGH less than 50 us (datasheet page 5)
+#ifndef HX711_SPI_FREQUENCY
+#define HX711_SPI_FREQUENCY             1000000
+#endif
 
 
 const uint8_t HX711_AVERAGE_MODE = 0x00;
@@ -28,6 +64,13 @@ const uint8_t HX711_MEDAVG_MODE  = 0x02;
 const uint8_t HX711_RUNAVG_MODE  = 0x03;
 //  causes read() to be called only once!
 const uint8_t HX711_RAW_MODE     = 0x04;
+//  kalman = constant velocity filter, one read() per call.
+const uint8_t HX711_KALMAN_MODE  = 0x05;
+
+
+//  how the bits are clocked out
+const uint8_t HX711_BITBANG = 0x00;
+const uint8_t HX711_HSPI    = 0x01;
 
 
 //  supported values for set_gain()
@@ -36,6 +79,10 @@ const uint8_t HX711_CHANNEL_A_GAIN_64 = 64;
 const uint8_t HX711_CHANNEL_B_GAIN_32 = 32;
 
 
+//  called with every conversion clocked out, e.g. to record it
+typedef void (*HX711_read_callback)(int32_t raw);
+
+
 class HX711
 {
 public:
@@ -47,6 +94,14 @@ public:
 
   void     reset();
 
+  //  ESP8266 only: clock the conversions out with the HSPI peripheral
+  //  in one transfer, without the interrupts off. needs SCK on GPIO14
+  //  (D5) and DOUT on GPIO12 (D6, MISO); MOSI (GPIO13) is not used and
+  //  left as INPUT, set it up after this call. one HX711 per board.
+  //  returns false and stays on bit-bang on other pins or processors.
+  bool     use_hspi(bool enable = true);
+  uint8_t  get_transport()  { return _transport; };
+
   //  checks if load cell is ready to read.
   bool     is_ready();
 
@@ -65,6 +120,9 @@ public:
   //
   //  raw read
   float    read();
+  //  every conversion clocked out, whatever read it is part of,
+  //  goes to the callback; NULL to stop.
+  void     set_read_callback(HX711_read_callback callback) { _readCallback = callback; };
 
   //  get average of multiple raw reads
   //  times = 1 or more
@@ -83,6 +141,17 @@ public:
   //  times = 1 or more.
   float    read_runavg(uint8_t times = 7, float alpha = 0.5);
 
+  //  one raw read, filtered by the kalman filter.
+  //  the filter keeps weight and rate of change between calls.
+  float    read_kalman();
+
+  //  the math of the reads above on samples already read,
+  //  e.g. recorded ones. sort and median functions sort in place.
+  static void  sort_samples(float * samples, uint8_t count);
+  static float median_of(float * samples, uint8_t count);
+  static float medavg_of(float * samples, uint8_t count);
+  static float runavg_of(const float * samples, uint8_t count, float alpha = 0.5);
+
 
   ///////////////////////////////////////////////////////////////
   //
@@ -96,6 +165,7 @@ public:
   void     set_medavg_mode();
   //  set_run_avg will use a default alpha of 0.5.
   void     set_runavg_mode();
+  void     set_kalman_mode();
   uint8_t  get_mode();
 
   //  corrected for offset.
@@ -104,6 +174,85 @@ public:
   //  converted to proper units, corrected for scale.
   //  in HX711_RAW_MODE the parameter times will be ignored.
   float    get_units(uint8_t times = 1);
+  //  averages as few reads as needed for a standard error of the
+  //  mean below maxNoise (in units), based on the noise statistics.
+  //  reads at most maxTimes, ignores the mode.
+  float    get_units_adaptive(float maxNoise, uint8_t maxTimes = 15);
+  //  number of reads the last get_units_adaptive() took.
+  uint8_t  last_sample_count() { return _lastSampleCount; };
+
+
+  ///////////////////////////////////////////////////////////////
+  //
+  //  NOISE STATISTICS
+  //
+  //  Welford mean and variance over the last HX711_NOISE_WINDOW
+  //  conversions (older ones fade out), updated by every read().
+  //  set_gain() restarts them as the raw values change meaning.
+  void     reset_noise();
+  uint16_t get_noise_count()    { return _noiseCount; };
+  //  raw
+  float    get_noise_mean()     { return _noiseMean; };
+  float    get_noise_variance();
+  //  standard deviation of a single read in units.
+  float    get_noise_stddev();
+  //  reads needed to get the standard error below maxNoise (in units).
+  //  returns 0 while there are less than 2 conversions to judge by.
+  uint16_t get_noise_samples(float maxNoise);
+
+
+  ///////////////////////////////////////////////////////////////
+  //
+  //  INTERLEAVED CHANNELS
+  //
+  //  rotates over up to HX711_MAX_SLOTS channel / gain slots.
+  //  the channel of the next conversion is selected while the
+  //  current one is clocked out, so no dummy read is needed, and
+  //  the conversions during the settle time after a switch are
+  //  discarded. each slot has its own offset and scale.
+  //  while slots are used, use poll() instead of read() & co.
+  //
+  //  samples = conversions kept per turn before switching
+  //  discard = conversions dropped after switching to this slot
+  //  returns the slot index or HX711_NO_SLOT if full / invalid gain.
+  uint8_t  add_slot(uint8_t gain, uint8_t samples = 1, uint8_t discard = HX711_SLOT_SETTLE);
+  void     clear_slots();
+  uint8_t  slot_count()  { return _slotCount; };
+  //  non blocking, one conversion if ready.
+  //  returns the slot that got a new sample or HX711_NO_SLOT.
+  uint8_t  poll();
+  //  last sample of a slot, corrected for the slot's offset (and scale).
+  float    get_slot_value(uint8_t slot);
+  float    get_slot_units(uint8_t slot);
+  //  samples delivered to a slot since add_slot().
+  uint32_t get_slot_samples(uint8_t slot);
+  //  conversions discarded because of settling, all slots.
+  uint32_t get_discarded()  { return _discarded; };
+
+  void     set_slot_offset(uint8_t slot, int32_t offset = 0);
+  int32_t  get_slot_offset(uint8_t slot);
+  bool     set_slot_scale(uint8_t slot, float scale = 1.0);
+  float    get_slot_scale(uint8_t slot);
+  //  blocking, averages times samples of the slot.
+  void     tare_slot(uint8_t slot, uint8_t times = 10);
+
+
+  ///////////////////////////////////////////////////////////////
+  //
+  //  KALMAN
+  //
+  //  state = weight + rate of change, constant velocity model.
+  //  processNoise in units/s2 - how fast the rate may change,
+  //    larger follows changes faster, smaller smooths more at rest.
+  //  measurementNoise in units - stddev of a single read,
+  //    0 = learn it from the reads.
+  void     set_kalman_noise(float processNoise = 2.0, float measurementNoise = 0);
+  void     reset_kalman();
+  //  rate of change of the filtered weight in units per second.
+  float    get_rate();
+  //  true when the rate is below maxRate (units/s) and the last
+  //  HX711_KALMAN_SETTLE reads matched the filter.
+  bool     is_stable(float maxRate = 0.5);
 
 
   ///////////////////////////////////////////////////////////////
@@ -186,9 +335,55 @@ private:
   float    _price;
   uint8_t  _mode;
   bool     _fastProcessor;
-
-  void     _insertSort(float * array, uint8_t size);
+  uint8_t  _transport;
+  HX711_read_callback _readCallback;
+
+  uint16_t _noiseCount;
+  float    _noiseMean;
+  float    _noiseM2;
+  uint8_t  _lastSampleCount;
+
+  //  kalman state in raw units relative to _kalmanBase
+  float    _kalmanBase;
+  float    _kalmanWeight;
+  float    _kalmanRate;        //  per second
+  float    _kalmanP00;
+  float    _kalmanP01;
+  float    _kalmanP11;
+  float    _kalmanQ;           //  units/s2
+  float    _kalmanR;           //  units, 0 = learn
+  float    _kalmanLastRaw;
+  uint16_t _diffCount;         //  noise of successive differences
+  float    _diffMean;
+  float    _diffM2;
+  uint32_t _kalmanTime;
+  uint32_t _kalmanMillis;      //  of _kalmanTime, for the gap check
+  uint8_t  _kalmanSettled;
+  bool     _kalmanInit;
+
+  struct Slot
+  {
+    uint8_t  gain;
+    uint8_t  samples;
+    uint8_t  discard;
+    int32_t  offset;
+    float    scale;
+    float    value;
+    uint32_t count;
+  };
+  Slot     _slots[HX711_MAX_SLOTS];
+  uint8_t  _slotCount;
+  uint8_t  _slotCurrent;       //  slot of the conversion in progress
+  uint8_t  _slotTaken;         //  samples kept this turn
+  uint8_t  _slotDiscard;       //  conversions still to drop
+  bool     _slotSynced;        //  HX711 selection matches _slotCurrent
+  uint32_t _discarded;
+
+  float    _read(uint8_t nextGain);
+  void     _noiseAdd(float raw);
+  static void _insertSort(float * array, uint8_t size);
   uint8_t  _shiftIn();
+  uint32_t _transferHspi(uint8_t pulses);
 };
 
 
@@ -0,0 +1,64 @@
+//
+//    FILE: HX_interleaved_channels.ino
+// PURPOSE: HX711 demo, two load cells on one HX711
+//     URL: https://github.com/RobTillaart/HX711
+//
+//  channel A (gain 128) weighs the feed hopper,
+//  channel B (gain 32) weighs a water tank.
+//  the scheduler takes 4 samples of A, then 1 of B, and drops
+//  the conversions that follow a channel switch.
+
+
+#include "HX711.h"
+
+HX711 scale;
+
+//  adjust pins if needed
+uint8_t dataPin = 6;
+uint8_t clockPin = 7;
+
+uint8_t hopper;
+uint8_t tank;
+
+
+void setup()
+{
+  Serial.begin(115200);
+  Serial.println();
+  Serial.println(__FILE__);
+  Serial.print("HX711_LIB_VERSION: ");
+  Serial.println(HX711_LIB_VERSION);
+  Serial.println();
+
+  scale.begin(dataPin, clockPin);
+
+  hopper = scale.add_slot(HX711_CHANNEL_A_GAIN_128, 4);
+  tank   = scale.add_slot(HX711_CHANNEL_B_GAIN_32, 1);
+
+  //  TODO you need to calibrate these yourself.
+  scale.set_slot_scale(hopper, 420.0983);
+  scale.set_slot_scale(tank, 105.0246);
+
+  //  both scales empty
+  scale.tare_slot(hopper, 10);
+  scale.tare_slot(tank, 5);
+}
+
+
+void loop()
+{
+  uint8_t slot = scale.poll();
+  if (slot == hopper)
+  {
+    Serial.print("hopper\t");
+    Serial.println(scale.get_slot_units(hopper));
+  }
+  else if (slot == tank)
+  {
+    Serial.print("tank\t");
+    Serial.println(scale.get_slot_units(tank));
+  }
+}
+
+
+//  -- END OF FILE --
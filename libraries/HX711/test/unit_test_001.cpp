@@ -49,10 +49,14 @@ unittest(test_constants)
   assertEqual(0x02, HX711_MEDAVG_MODE);
   assertEqual(0x03, HX711_RUNAVG_MODE);
   assertEqual(0x04, HX711_RAW_MODE);
+  assertEqual(0x05, HX711_KALMAN_MODE);
 
   assertEqual(128,  HX711_CHANNEL_A_GAIN_128);
   assertEqual(64,   HX711_CHANNEL_A_GAIN_64);
   assertEqual(32,   HX711_CHANNEL_B_GAIN_32);
+
+  assertEqual(0x00, HX711_BITBANG);
+  assertEqual(0x01, HX711_HSPI);
 }
 
 
@@ -183,6 +187,205 @@ unittest(test_operational_mode)
   assertEqual(0x01, scale.get_mode());
   scale.set_average_mode();
   assertEqual(0x00, scale.get_mode());
+  scale.set_kalman_mode();
+  assertEqual(0x05, scale.get_mode());
+}
+
+
+unittest(test_noise_statistics)
+{
+  HX711 scale;
+  scale.begin(dataPin, clockPin);
+
+  //  nothing read yet
+  assertEqual(0, scale.get_noise_count());
+  assertEqualFloat(0, scale.get_noise_variance(), 0.001);
+  assertEqual(0, scale.get_noise_samples(1.0));
+  assertEqual(0, scale.last_sample_count());
+
+  //  pins are LOW, every read is the same value
+  for (int i = 0; i < 20; i++) scale.read();
+  assertEqual(HX711_NOISE_WINDOW, scale.get_noise_count());
+  assertEqualFloat(0, scale.get_noise_stddev(), 0.001);
+  assertEqual(1, scale.get_noise_samples(1.0));
+
+  //  a quiet signal needs a single read
+  scale.get_units_adaptive(1.0, 10);
+  assertEqual(1, scale.last_sample_count());
+
+  scale.reset_noise();
+  assertEqual(0, scale.get_noise_count());
+}
+
+
+unittest(test_kalman)
+{
+  HX711 scale;
+  scale.begin(dataPin, clockPin);
+
+  //  no reads yet
+  assertFalse(scale.is_stable());
+  assertEqualFloat(0, scale.get_rate(), 0.001);
+
+  //  pins are LOW, a constant weight
+  scale.set_kalman_mode();
+  for (int i = 0; i < 10; i++) scale.get_units();
+  assertTrue(scale.is_stable());
+  assertEqualFloat(0, scale.get_rate(), 0.001);
+  assertEqualFloat(0, scale.get_units(), 0.001);
+
+  scale.reset_kalman();
+  assertFalse(scale.is_stable());
+}
+
+
+unittest(test_kalman_gap)
+{
+  GodmodeState* state = GODMODE();
+  state->reset();
+  HX711 scale;
+  scale.begin(dataPin, clockPin);
+
+  scale.set_kalman_mode();
+  for (int i = 0; i < 10; i++)
+  {
+    scale.get_units();
+    state->micros += 100000;
+  }
+  assertTrue(scale.is_stable());
+
+  //  a longer pause: the filter starts over with the next read
+  state->micros += HX711_KALMAN_MAX_GAP + 1;
+  assertEqualFloat(0, scale.get_units(), 0.001);
+  assertFalse(scale.is_stable());
+  assertEqualFloat(0, scale.get_rate(), 0.001);
+
+  //  a pause of 2^32 us and a second, micros() wraps to one second later
+  for (int i = 0; i < 10; i++)
+  {
+    scale.get_units();
+    state->micros += 100000;
+  }
+  assertTrue(scale.is_stable());
+  state->micros += 0x100000000ULL + 1000000;
+  scale.get_units();
+  assertFalse(scale.is_stable());
+  assertEqualFloat(0, scale.get_rate(), 0.001);
+}
+
+
+unittest(test_slots)
+{
+  HX711 scale;
+  scale.begin(dataPin, clockPin);
+
+  assertEqual(0, scale.slot_count());
+  assertEqual(HX711_NO_SLOT, scale.poll());
+
+  assertEqual(0, scale.add_slot(HX711_CHANNEL_A_GAIN_128, 4));
+  assertEqual(1, scale.add_slot(HX711_CHANNEL_B_GAIN_32));
+  assertEqual(2, scale.add_slot(HX711_CHANNEL_A_GAIN_64));
+  assertEqual(HX711_NO_SLOT, scale.add_slot(HX711_CHANNEL_A_GAIN_128));
+  assertEqual(3, scale.slot_count());
+
+  scale.clear_slots();
+  assertEqual(HX711_NO_SLOT, scale.add_slot(100));
+  assertEqual(0, scale.add_slot(HX711_CHANNEL_B_GAIN_32));
+
+  assertTrue(scale.set_slot_scale(0, 2.0));
+  assertEqualFloat(2.0, scale.get_slot_scale(0), 0.001);
+  assertFalse(scale.set_slot_scale(0, 0));
+  assertFalse(scale.set_slot_scale(1, 2.0));
+  scale.set_slot_offset(0, 123);
+  assertEqual(123, scale.get_slot_offset(0));
+  assertEqual(0, scale.get_slot_samples(0));
+}
+
+
+unittest(test_slot_settle)
+{
+  HX711 scale;
+  scale.begin(dataPin, clockPin);
+
+  assertEqual(4, HX711_SLOT_SETTLE);
+  scale.add_slot(HX711_CHANNEL_A_GAIN_128);
+  scale.add_slot(HX711_CHANNEL_B_GAIN_32);
+
+  //  sync, A, 4 settling on B, B, 4 settling on A, A
+  for (int i = 0; i < 12; i++) scale.poll();
+  assertEqual(2, scale.get_slot_samples(0));
+  assertEqual(1, scale.get_slot_samples(1));
+  assertEqual(1 + 2 * HX711_SLOT_SETTLE, scale.get_discarded());
+
+  //  same gain twice in a row needs no settling
+  HX711 twin;
+  twin.begin(dataPin, clockPin);
+  twin.add_slot(HX711_CHANNEL_A_GAIN_128);
+  twin.add_slot(HX711_CHANNEL_A_GAIN_128);
+  for (int i = 0; i < 5; i++) twin.poll();
+  assertEqual(2, twin.get_slot_samples(0));
+  assertEqual(2, twin.get_slot_samples(1));
+  assertEqual(1, twin.get_discarded());
+}
+
+
+uint32_t callbackCount = 0;
+void countConversion(int32_t raw)
+{
+  (void) raw;
+  callbackCount++;
+}
+
+
+unittest(test_read_callback)
+{
+  HX711 scale;
+  scale.begin(dataPin, clockPin);
+
+  callbackCount = 0;
+  scale.set_read_callback(countConversion);
+  scale.read();
+  assertEqual(1, callbackCount);
+  scale.read_average(5);
+  assertEqual(6, callbackCount);
+
+  scale.set_read_callback(NULL);
+  scale.read();
+  assertEqual(6, callbackCount);
+}
+
+
+unittest(test_math_on_samples)
+{
+  float odd[5] = { 5, 1, 4, 2, 3 };
+  HX711::sort_samples(odd, 5);
+  for (int i = 0; i < 5; i++) assertEqualFloat(i + 1, odd[i], 0.001);
+
+  float a[5] = { 9, 1, 3, 100, 2 };
+  assertEqualFloat(3, HX711::median_of(a, 5), 0.001);
+  float b[4] = { 4, 1, 3, 2 };
+  assertEqualFloat(2.5, HX711::median_of(b, 4), 0.001);
+  float c[7] = { 7, 1, 6, 2, 5, 3, 4 };
+  assertEqualFloat(4, HX711::medavg_of(c, 7), 0.001);
+
+  float d[3] = { 0, 10, 10 };
+  assertEqualFloat(7.5, HX711::runavg_of(d, 3, 0.5), 0.001);
+  assertEqualFloat(0, HX711::runavg_of(d, 3, 0), 0.001);
+  assertEqualFloat(0, HX711::median_of(d, 0), 0.001);
+}
+
+
+unittest(test_transport)
+{
+  HX711 scale;
+  scale.begin(dataPin, clockPin);
+  assertEqual(HX711_BITBANG, scale.get_transport());
+
+  //  not the HSPI pins, and not an ESP8266 either
+  assertFalse(scale.use_hspi());
+  assertEqual(HX711_BITBANG, scale.get_transport());
+  scale.read();
+  assertEqual(HX711_BITBANG, scale.get_transport());
 }
 
 
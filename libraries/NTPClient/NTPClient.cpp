@@ -21,6 +21,12 @@
 
 #include "NTPClient.h"
 
+#if defined(ARDUINO_ARCH_ESP8266)
+#include <ESP8266WiFi.h>
+#elif defined(ARDUINO_ARCH_ESP32)
+#include <WiFi.h>
+#endif
+
 NTPClient::NTPClient(UDP& udp) {
   this->_udp            = &udp;
 }
@@ -81,6 +87,44 @@ void NTPClient::begin(unsigned int port) {
   this->_udpSetup = true;
 }
 
+static uint64_t readTimestamp(const byte* p) {
+  uint64_t t = 0;
+  for (int i = 0; i < 8; i++) t = (t << 8) | p[i];
+  return t;
+}
+
+static void writeTimestamp(byte* p, uint64_t t) {
+  for (int i = 7; i >= 0; i--) {
+    p[i] = t & 0xFF;
+    t >>= 8;
+  }
+}
+
+// NTP 32.32 fixed point difference to microseconds, |d| < 2000 s
+static int64_t timestampToMicros(int64_t d) {
+  return (d >> 32) * 1000000 + (int64_t)(((d & 0xFFFFFFFFLL) * 1000000) >> 32);
+}
+
+#if defined(ARDUINO_ARCH_ESP8266) || defined(ARDUINO_ARCH_ESP32)
+static bool wifiResolver(const char* name, IPAddress& ip) {
+  return WiFi.hostByName(name, ip) == 1;
+}
+#define NTP_DEFAULT_RESOLVER wifiResolver
+#else
+#define NTP_DEFAULT_RESOLVER NULL
+#endif
+
+struct NTPSample {
+  uint64_t      transmit;       // of the request, echoed as origin
+  unsigned long sent;           // micros()
+  bool          valid;
+  uint64_t      time;           // server time at received, NTP 32.32
+  unsigned long received;       // micros()
+  unsigned long receivedMs;     // millis()
+  unsigned long delay;          // round trip in us
+  int64_t       offset;         // us, relative to the first valid sample
+};
+
 bool NTPClient::forceUpdate() {
   #ifdef DEBUG_NTPClient
     Serial.println("Update from NTP Server");
@@ -90,29 +134,139 @@ bool NTPClient::forceUpdate() {
   while(this->_udp->parsePacket() != 0)
     this->_udp->flush();
 
-  this->sendNTPPacket();
-
-  // Wait till data is there or timeout...
-  byte timeout = 0;
-  int cb = 0;
-  do {
-    delay ( 10 );
-    cb = this->_udp->parsePacket();
-    if (timeout > 100) return false; // timeout after 1000 ms
-    timeout++;
-  } while (cb == 0);
-
-  this->_lastUpdate = millis() - (10 * (timeout + 1)); // Account for delay in reading the time
+  NTPServer pool;
+  const NTPServer* servers = this->_servers;
+  uint8_t count = this->_serverCount;
+  if (count == 0) {
+    pool.name = this->_poolServerName;
+    pool.ip   = this->_poolServerIP;
+    pool.port = NTP_SERVER_PORT;
+    servers = &pool;
+    count = 1;
+  }
 
-  this->_udp->read(this->_packetBuffer, NTP_PACKET_SIZE);
+  // Look the names up first: a lookup must not count into a round trip,
+  // nor keep the replies of the servers already asked waiting
+  NTPServer targets[NTP_MAX_SERVERS];
+  bool found[NTP_MAX_SERVERS];
+  NTPResolver resolver = this->_resolver ? this->_resolver : NTP_DEFAULT_RESOLVER;
+  for (uint8_t i = 0; i < count; i++) {
+    targets[i] = servers[i];
+    found[i]   = true;
+    if (targets[i].name && resolver) {
+      found[i] = resolver(targets[i].name, targets[i].ip);
+      targets[i].name = NULL;
+    }
+  }
 
-  unsigned long highWord = word(this->_packetBuffer[40], this->_packetBuffer[41]);
-  unsigned long lowWord = word(this->_packetBuffer[42], this->_packetBuffer[43]);
-  // combine the four bytes (two words) into a long integer
-  // this is NTP time (seconds since Jan 1 1900):
-  unsigned long secsSince1900 = highWord << 16 | lowWord;
+  // One request per server from the same socket. The transmit timestamp
+  // is random, a server echoes it as origin timestamp: that tells the
+  // replies apart and drops stale or forged ones.
+  NTPSample samples[NTP_MAX_SERVERS];
+  uint8_t asked = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    samples[i].transmit = ((uint64_t)this->nextNonce() << 32) | this->nextNonce();
+    samples[i].valid    = false;
+    if (!found[i]) continue;
+    samples[i].sent     = this->sendNTPPacket(targets[i], samples[i].transmit);
+    asked++;
+  }
 
-  this->_currentEpoc = secsSince1900 - SEVENZYYEARS;
+  // Wait till every server replied or timeout...
+  uint8_t replies = 0;
+  unsigned long start = millis();
+  while (replies < asked && millis() - start < NTP_TIMEOUT) {
+    int cb = this->_udp->parsePacket();
+    if (cb == 0) {
+      delay(1);
+      continue;
+    }
+    unsigned long received   = micros();
+    unsigned long receivedMs = millis();
+    if (cb < NTP_PACKET_SIZE) {
+      this->_udp->flush();
+      continue;
+    }
+    this->_udp->read(this->_packetBuffer, NTP_PACKET_SIZE);
+
+    uint64_t origin = readTimestamp(this->_packetBuffer + 24);
+    NTPSample* sample = NULL;
+    for (uint8_t i = 0; i < count; i++) {
+      if (!samples[i].valid && samples[i].transmit == origin) sample = &samples[i];
+    }
+    if (sample == NULL) continue;
+
+    // a server reply, synchronized (stratum 0 is a kiss-o'-death)
+    byte leap    = this->_packetBuffer[0] >> 6;
+    byte mode    = this->_packetBuffer[0] & 0x07;
+    byte stratum = this->_packetBuffer[1];
+    uint64_t serverReceive  = readTimestamp(this->_packetBuffer + 32);
+    uint64_t serverTransmit = readTimestamp(this->_packetBuffer + 40);
+    int64_t  hold = (int64_t)(serverTransmit - serverReceive);
+    if (mode != 4 || leap == 3 || stratum == 0 || stratum > 15) continue;
+    if (serverTransmit == 0 || hold < 0 || hold > (1LL << 32)) continue;
+
+    // round trip less the time the server held the request; the server
+    // time at received is its transmit time plus the way back, taken as
+    // half the round trip
+    int64_t roundTrip = (int64_t)(received - sample->sent) - timestampToMicros(hold);
+    if (roundTrip < 0) roundTrip = 0;
+    sample->valid      = true;
+    sample->time       = serverTransmit + (((uint64_t)roundTrip << 31) / 1000000);
+    sample->received   = received;
+    sample->receivedMs = receivedMs;
+    sample->delay      = roundTrip;
+    replies++;
+  }
+  if (replies == 0) return false; // timeout
+
+  // offsets of the samples to each other, on the local clock
+  NTPSample* first = NULL;
+  int64_t sorted[NTP_MAX_SERVERS];
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    NTPSample& sample = samples[i];
+    if (!sample.valid) continue;
+    if (first == NULL) first = &sample;
+    sample.offset = timestampToMicros((int64_t)(sample.time - first->time))
+                  - (int64_t)(sample.received - first->received);
+    int64_t offset = sample.offset;
+    uint8_t j = n++;
+    for (; j > 0 && sorted[j - 1] > offset; j--) sorted[j] = sorted[j - 1];
+    sorted[j] = offset;
+  }
+  int64_t median = (sorted[(n - 1) / 2] + sorted[n / 2]) / 2;
+
+  // the majority has to agree on the time, the shortest round trip of
+  // those is the most accurate
+  NTPSample* best = NULL;
+  int bestServer = -1;
+  uint8_t agree = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    NTPSample& sample = samples[i];
+    if (!sample.valid) continue;
+    int64_t distance = sample.offset - median;
+    if (distance < 0) distance = -distance;
+    if (distance > NTP_OUTLIER_MS * 1000LL) continue;
+    agree++;
+    if (best == NULL || sample.delay < best->delay) {
+      best = &sample;
+      bestServer = i;
+    }
+  }
+  if (agree * 2 <= n) return false;
+
+  // seconds roll over on the local clock where they did on the server's
+  unsigned long fraction = ((best->time & 0xFFFFFFFF) * 1000) >> 32;
+  this->_currentEpoc = (unsigned long)(best->time >> 32) - SEVENZYYEARS;
+  this->_lastUpdate  = best->receivedMs - fraction;
+  if (this->_lastUpdate == 0) {
+    this->_lastUpdate = 1000;
+    this->_currentEpoc++;
+  }
+  this->_lastServer  = bestServer;
+  this->_lastDelay   = best->delay;
+  this->_lastReplies = replies;
 
   return true;  // return true after successful update
 }
@@ -130,6 +284,18 @@ bool NTPClient::isTimeSet() const {
   return (this->_lastUpdate != 0); // returns true if the time has been set, else false
 }
 
+int NTPClient::getLastServer() const {
+  return this->_lastServer;
+}
+
+unsigned long NTPClient::getLastDelay() const {
+  return this->_lastDelay;
+}
+
+uint8_t NTPClient::getLastReplies() const {
+  return this->_lastReplies;
+}
+
 unsigned long NTPClient::getEpochTime() const {
   return this->_timeOffset + // User offset
          this->_currentEpoc + // Epoch returned by the NTP server
@@ -181,7 +347,33 @@ void NTPClient::setPoolServerName(const char* poolServerName) {
     this->_poolServerName = poolServerName;
 }
 
-void NTPClient::sendNTPPacket() {
+bool NTPClient::addServer(const char* serverName, uint16_t port) {
+  if (this->_serverCount >= NTP_MAX_SERVERS) return false;
+  NTPServer& server = this->_servers[this->_serverCount++];
+  server.name = serverName;
+  server.port = port;
+  return true;
+}
+
+bool NTPClient::addServer(IPAddress serverIP, uint16_t port) {
+  if (this->_serverCount >= NTP_MAX_SERVERS) return false;
+  NTPServer& server = this->_servers[this->_serverCount++];
+  server.name = NULL;
+  server.ip   = serverIP;
+  server.port = port;
+  return true;
+}
+
+void NTPClient::clearServers() {
+  this->_serverCount = 0;
+}
+
+void NTPClient::setResolver(NTPResolver resolver) {
+  this->_resolver = resolver;
+}
+
+// returns micros() as the request goes out
+unsigned long NTPClient::sendNTPPacket(const NTPServer& server, uint64_t transmit) {
   // set all bytes in the buffer to 0
   memset(this->_packetBuffer, 0, NTP_PACKET_SIZE);
   // Initialize values needed to form NTP request
@@ -194,16 +386,29 @@ void NTPClient::sendNTPPacket() {
   this->_packetBuffer[13]  = 0x4E;
   this->_packetBuffer[14]  = 49;
   this->_packetBuffer[15]  = 52;
+  // the server echoes it in the origin timestamp
+  writeTimestamp(this->_packetBuffer + 40, transmit);
 
   // all NTP fields have been given values, now
   // you can send a packet requesting a timestamp:
-  if  (this->_poolServerName) {
-    this->_udp->beginPacket(this->_poolServerName, 123);
+  if  (server.name) {
+    this->_udp->beginPacket(server.name, server.port);
   } else {
-    this->_udp->beginPacket(this->_poolServerIP, 123);
+    this->_udp->beginPacket(server.ip, server.port);
   }
   this->_udp->write(this->_packetBuffer, NTP_PACKET_SIZE);
+  unsigned long sent = micros();
   this->_udp->endPacket();
+  return sent;
+}
+
+// xorshift32, seeded from the clock; only has to differ between requests
+uint32_t NTPClient::nextNonce() {
+  if (this->_nonce == 0) this->_nonce = micros() ^ 0x9E3779B9;
+  this->_nonce ^= this->_nonce << 13;
+  this->_nonce ^= this->_nonce >> 17;
+  this->_nonce ^= this->_nonce << 5;
+  return this->_nonce;
 }
 
 void NTPClient::setRandomPort(unsigned int minValue, unsigned int maxValue) {
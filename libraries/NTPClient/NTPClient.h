@@ -7,6 +7,19 @@
 #define SEVENZYYEARS 2208988800UL
 #define NTP_PACKET_SIZE 48
 #define NTP_DEFAULT_LOCAL_PORT 1337
+#define NTP_SERVER_PORT 123
+#define NTP_MAX_SERVERS 4
+#define NTP_TIMEOUT 1000    // ms an update waits for the replies
+#define NTP_OUTLIER_MS 128  // samples further from the median are rejected
+
+// Looks up a server name, true and ip set if found
+typedef bool (*NTPResolver)(const char* name, IPAddress& ip);
+
+struct NTPServer {
+  const char*   name;                   // NULL: ip
+  IPAddress     ip;
+  uint16_t      port;
+};
 
 class NTPClient {
   private:
@@ -23,9 +36,18 @@ class NTPClient {
     unsigned long _currentEpoc    = 0;      // In s
     unsigned long _lastUpdate     = 0;      // In ms
 
+    NTPServer     _servers[NTP_MAX_SERVERS];
+    uint8_t       _serverCount    = 0;
+    uint32_t      _nonce          = 0;
+    int           _lastServer     = -1;
+    unsigned long _lastDelay      = 0;      // In us
+    uint8_t       _lastReplies    = 0;
+    NTPResolver   _resolver       = NULL;
+
     byte          _packetBuffer[NTP_PACKET_SIZE];
 
-    void          sendNTPPacket();
+    unsigned long sendNTPPacket(const NTPServer& server, uint64_t transmit);
+    uint32_t      nextNonce();
 
   public:
     NTPClient(UDP& udp);
@@ -44,6 +66,28 @@ class NTPClient {
      */
     void setPoolServerName(const char* poolServerName);
 
+    /**
+     * Add a server to query, up to NTP_MAX_SERVERS. An update asks all of
+     * them at once from the one UDP socket, rejects the samples that
+     * disagree with the majority and takes the one with the shortest
+     * round trip. Without servers added the pool server name or IP is
+     * the only one.
+     *
+     * @return false if the list is full
+     */
+    bool addServer(const char* serverName, uint16_t port = NTP_SERVER_PORT);
+    bool addServer(IPAddress serverIP, uint16_t port = NTP_SERVER_PORT);
+    void clearServers();
+
+    /**
+     * Set the function that looks up the server names. An update looks
+     * them all up before it sends the first request, so the lookups do
+     * not count into the round trips. On the ESP8266 and ESP32 it is
+     * WiFi.hostByName by default; elsewhere, without one, the name is
+     * given to the UDP client and looked up as the request goes out.
+     */
+    void setResolver(NTPResolver resolver);
+
      /**
      * Set random local port
      */
@@ -81,6 +125,15 @@ class NTPClient {
      */
     bool isTimeSet() const;
 
+    /**
+     * The sample of the last successful update: the index of its server
+     * (0 for the pool server), -1 before the first; its round trip in
+     * microseconds; and how many servers had replied.
+     */
+    int getLastServer() const;
+    unsigned long getLastDelay() const;
+    uint8_t getLastReplies() const;
+
     int getDay() const;
     int getHours() const;
     int getMinutes() const;
@@ -0,0 +1,215 @@
+//
+//    FILE: actuator_queue.cpp
+// PURPOSE: Time ordered command queue for the feed gate servo and the
+//          wash relay, with interlocks, executed by a hardware timer.
+//
+
+
+#include "actuator_queue.h"
+
+
+//  keep the compiler from moving ring entry writes past the index update
+#define ACTUATOR_BARRIER()   __asm__ __volatile__("" ::: "memory")
+
+
+static inline bool ACTUATOR_ISR isDue(uint32_t deadline, uint32_t now)
+{
+  return (int32_t)(deadline - now) <= 0;
+}
+
+
+static inline bool isStart(uint8_t command)
+{
+  return command == ACTUATOR_SERVO_OPEN || command == ACTUATOR_WASH_START;
+}
+
+
+ActuatorQueue::ActuatorQueue()
+{
+  _inboxHead       = 0;
+  _inboxTail       = 0;
+  _count           = 0;
+  _eventHead       = 0;
+  _eventTail       = 0;
+  _servoOpen       = false;
+  _washing         = false;
+  _rejected        = 0;
+  _servoActivation = 0;
+  _washActivation  = 0;
+  _nextActivation  = 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  LOOP SIDE
+//
+uint8_t ActuatorQueue::submit(uint8_t command, uint32_t deadlineUs, uint32_t durationUs, uint16_t argument)
+{
+  //  early answer for the caller, run() checks again at the deadline
+  if (command == ACTUATOR_SERVO_OPEN)
+  {
+    if (_washing)   return ACTUATOR_INTERLOCK;
+    if (_servoOpen) return ACTUATOR_ALREADY;
+  }
+  if (command == ACTUATOR_WASH_START)
+  {
+    if (_servoOpen) return ACTUATOR_INTERLOCK;
+    if (_washing)   return ACTUATOR_ALREADY;
+  }
+  if (command == ACTUATOR_SERVO_MOVE && !_servoOpen) return ACTUATOR_NOT_ACTIVE;
+
+  uint8_t head = _inboxHead;
+  if ((uint8_t)(head - _inboxTail) >= ACTUATOR_INBOX_SIZE) return ACTUATOR_QUEUE_FULL;
+  Entry &e     = _inbox[head & (ACTUATOR_INBOX_SIZE - 1)];
+  e.deadline   = deadlineUs;
+  e.duration   = isStart(command) ? durationUs : 0;
+  e.activation = 0;
+  e.argument   = argument;
+  e.command    = command;
+  e.timed      = false;
+  ACTUATOR_BARRIER();
+  _inboxHead = head + 1;
+  return ACTUATOR_QUEUED;
+}
+
+
+bool ActuatorQueue::nextEvent(ActuatorEvent &event)
+{
+  uint8_t tail = _eventTail;
+  if (tail == _eventHead) return false;
+  event = _events[tail & (ACTUATOR_EVENT_SIZE - 1)];
+  ACTUATOR_BARRIER();
+  _eventTail = tail + 1;
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  TIMER SIDE
+//
+uint32_t ACTUATOR_ISR ActuatorQueue::run(uint32_t nowUs, ActuatorOutput output)
+{
+  //  take over submitted commands
+  while (_inboxTail != _inboxHead)
+  {
+    Entry e = _inbox[_inboxTail & (ACTUATOR_INBOX_SIZE - 1)];
+    ACTUATOR_BARRIER();
+    _inboxTail = _inboxTail + 1;
+
+    uint8_t needed = e.duration ? 2 : 1;
+    if (_count + needed > ACTUATOR_QUEUE_SIZE)
+    {
+      _event(e, ACTUATOR_QUEUE_FULL, nowUs);
+      continue;
+    }
+    if (e.duration)
+    {
+      e.activation = ++_nextActivation;
+      Entry stop;
+      stop.deadline   = e.deadline + e.duration;
+      stop.duration   = 0;
+      stop.activation = e.activation;
+      stop.argument   = 0;
+      stop.command    = e.command == ACTUATOR_SERVO_OPEN ? ACTUATOR_SERVO_CLOSE : ACTUATOR_WASH_STOP;
+      stop.timed      = true;
+      _insert(stop);
+    }
+    _insert(e);
+  }
+
+  //  execute what is due, earliest first
+  while (_count > 0 && isDue(_queue[0].deadline, nowUs))
+  {
+    Entry e = _queue[0];
+    _count--;
+    for (uint8_t i = 0; i < _count; i++) _queue[i] = _queue[i + 1];
+    _execute(e, nowUs, output);
+  }
+
+  if (_count == 0) return ACTUATOR_IDLE;
+  return _queue[0].deadline - nowUs;
+}
+
+
+//  stable: equal deadlines keep submission order
+void ACTUATOR_ISR ActuatorQueue::_insert(const Entry &e)
+{
+  uint8_t i = _count;
+  while (i > 0 && (int32_t)(_queue[i - 1].deadline - e.deadline) > 0)
+  {
+    _queue[i] = _queue[i - 1];
+    i--;
+  }
+  _queue[i] = e;
+  _count++;
+}
+
+
+void ACTUATOR_ISR ActuatorQueue::_execute(const Entry &e, uint32_t nowUs, ActuatorOutput output)
+{
+  switch (e.command)
+  {
+    case ACTUATOR_SERVO_OPEN:
+      if (_washing)   { _event(e, ACTUATOR_INTERLOCK, nowUs); return; }
+      if (_servoOpen) { _event(e, ACTUATOR_ALREADY, nowUs);   return; }
+      _servoOpen       = true;
+      _servoActivation = e.activation;
+      break;
+    case ACTUATOR_SERVO_MOVE:
+      if (!_servoOpen) { _event(e, ACTUATOR_NOT_ACTIVE, nowUs); return; }
+      break;
+    case ACTUATOR_WASH_START:
+      if (_servoOpen) { _event(e, ACTUATOR_INTERLOCK, nowUs); return; }
+      if (_washing)   { _event(e, ACTUATOR_ALREADY, nowUs);   return; }
+      _washing        = true;
+      _washActivation = e.activation;
+      break;
+    case ACTUATOR_SERVO_CLOSE:
+      if (e.timed && (!_servoOpen || _servoActivation != e.activation))
+      {
+        _event(e, ACTUATOR_CANCELLED, nowUs);
+        return;
+      }
+      //  the pin is set anyway, but only a gate that was open is reported closed
+      output(e.command, e.argument);
+      _event(e, _servoOpen ? ACTUATOR_DONE : ACTUATOR_ALREADY, nowUs);
+      _servoOpen = false;
+      return;
+    case ACTUATOR_WASH_STOP:
+      if (e.timed && (!_washing || _washActivation != e.activation))
+      {
+        _event(e, ACTUATOR_CANCELLED, nowUs);
+        return;
+      }
+      output(e.command, e.argument);
+      _event(e, _washing ? ACTUATOR_DONE : ACTUATOR_ALREADY, nowUs);
+      _washing = false;
+      return;
+    default:
+      return;
+  }
+  output(e.command, e.argument);
+  _event(e, ACTUATOR_DONE, nowUs);
+}
+
+
+void ACTUATOR_ISR ActuatorQueue::_event(const Entry &e, uint8_t result, uint32_t nowUs)
+{
+  if (result == ACTUATOR_INTERLOCK || result == ACTUATOR_QUEUE_FULL) _rejected = _rejected + 1;
+  uint8_t head = _eventHead;
+  //  the loop fell behind, drop rather than overwrite unread events
+  if ((uint8_t)(head - _eventTail) >= ACTUATOR_EVENT_SIZE) return;
+  ActuatorEvent &ev = _events[head & (ACTUATOR_EVENT_SIZE - 1)];
+  ev.command  = e.command;
+  ev.result   = result;
+  ev.timed    = e.timed;
+  ev.argument = e.argument;
+  ev.timeUs   = nowUs;
+  ACTUATOR_BARRIER();
+  _eventHead = head + 1;
+}
+
+
+//  -- END OF FILE --
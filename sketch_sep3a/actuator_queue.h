@@ -0,0 +1,141 @@
+#pragma once
+//
+//    FILE: actuator_queue.h
+// PURPOSE: Time ordered command queue for the feed gate servo and the
+//          wash relay, with interlocks, executed by a hardware timer.
+//
+//  NOTES
+//  submit() is called from loop(), run() from the timer interrupt.
+//  submit() only appends to an inbox ring and run() alone owns the
+//  ordered queue and the actuator state, so the two never need a lock
+//  (the ESP8266 timer1 interrupt is an NMI and cannot be masked anyway).
+//  Executed and rejected commands come back through nextEvent().
+//
+//  A command with a duration also schedules its stop. A stop created
+//  that way only fires if the actuator is still in the activation that
+//  scheduled it; a manual stop followed by a new start is never cut
+//  short by a stale timed stop.
+//
+//  INTERLOCKS
+//  - the gate does not open while a wash is running
+//  - a wash does not start while the gate is open
+//  - the gate is only moved while it is open
+//  - stops are always accepted and set the output; a stop of an actuator
+//    that is not active reports ACTUATOR_ALREADY, not ACTUATOR_DONE
+//
+//  Times are micros() values; comparisons are wrap safe, so deadlines
+//  and durations must stay below 2^31 us (~35 minutes) ahead.
+//  No Arduino dependency, host tools can drive it with simulated time.
+
+
+#include <stdint.h>
+
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define ACTUATOR_ISR  IRAM_ATTR
+#else
+#define ACTUATOR_ISR
+#endif
+
+
+#define ACTUATOR_QUEUE_SIZE   16
+#define ACTUATOR_INBOX_SIZE   8      //  power of 2
+#define ACTUATOR_EVENT_SIZE   16     //  power of 2
+#define ACTUATOR_IDLE         0xFFFFFFFF
+
+
+enum ActuatorCommand : uint8_t
+{
+  ACTUATOR_SERVO_OPEN = 0,
+  ACTUATOR_SERVO_CLOSE,
+  ACTUATOR_WASH_START,
+  ACTUATOR_WASH_STOP,
+  ACTUATOR_SERVO_MOVE       //  new position for a gate that is already open
+};
+
+
+enum ActuatorResult : uint8_t
+{
+  ACTUATOR_DONE = 0,        //  executed
+  ACTUATOR_QUEUED,          //  accepted by submit()
+  ACTUATOR_QUEUE_FULL,
+  ACTUATOR_INTERLOCK,       //  conflicts with the other actuator
+  ACTUATOR_ALREADY,         //  actuator already in that state
+  ACTUATOR_CANCELLED,       //  timed stop of an activation that already ended
+  ACTUATOR_NOT_ACTIVE       //  adjusts an actuator that is not running
+};
+
+
+struct ActuatorEvent
+{
+  uint8_t  command;
+  uint8_t  result;
+  bool     timed;           //  stop scheduled by a duration
+  uint16_t argument;
+  uint32_t timeUs;          //  when it was executed or rejected
+};
+
+
+typedef void (*ActuatorOutput)(uint8_t command, uint16_t argument);
+
+
+class ActuatorQueue
+{
+public:
+  ActuatorQueue();
+
+  //  LOOP SIDE
+  //  returns ACTUATOR_QUEUED or the reason the command is refused.
+  //  the interlock check is repeated when the command executes.
+  //  argument is passed through to output(), e.g. a gate position.
+  uint8_t  submit(uint8_t command, uint32_t deadlineUs, uint32_t durationUs = 0, uint16_t argument = 0);
+  bool     nextEvent(ActuatorEvent &event);
+  bool     servoOpen() const  { return _servoOpen; };
+  bool     washing() const    { return _washing; };
+  uint32_t rejected() const   { return _rejected; };
+
+  //  TIMER SIDE
+  //  executes every command due at nowUs through output(),
+  //  returns us until the next deadline or ACTUATOR_IDLE.
+  uint32_t run(uint32_t nowUs, ActuatorOutput output);
+
+private:
+  struct Entry
+  {
+    uint32_t deadline;
+    uint32_t duration;
+    uint16_t activation;    //  timed stops: activation they belong to
+    uint16_t argument;
+    uint8_t  command;
+    bool     timed;
+  };
+
+  void     _insert(const Entry &e);
+  void     _execute(const Entry &e, uint32_t nowUs, ActuatorOutput output);
+  void     _event(const Entry &e, uint8_t result, uint32_t nowUs);
+
+  //  loop -> timer
+  Entry             _inbox[ACTUATOR_INBOX_SIZE];
+  volatile uint8_t  _inboxHead;
+  volatile uint8_t  _inboxTail;
+
+  //  timer owned, sorted by deadline
+  Entry             _queue[ACTUATOR_QUEUE_SIZE];
+  uint8_t           _count;
+
+  //  timer -> loop
+  ActuatorEvent     _events[ACTUATOR_EVENT_SIZE];
+  volatile uint8_t  _eventHead;
+  volatile uint8_t  _eventTail;
+
+  volatile bool     _servoOpen;
+  volatile bool     _washing;
+  volatile uint32_t _rejected;
+  uint16_t          _servoActivation;
+  uint16_t          _washActivation;
+  uint16_t          _nextActivation;
+};
+
+
+//  -- END OF FILE --
@@ -0,0 +1,47 @@
+//
+//    FILE: arena.cpp
+// PURPOSE: Bump allocator for the scratch memory of one HTTP request
+//          of the pig pen controller.
+//
+
+
+#include "arena.h"
+
+#include <string.h>
+
+
+Arena::Arena(uint8_t *buffer, size_t size)
+{
+  _buffer   = buffer;
+  _size     = size;
+  _used     = 0;
+  _peak     = 0;
+  _failures = 0;
+}
+
+
+void *Arena::alloc(size_t size)
+{
+  size_t start = (_used + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+  if (start > _size || size > _size - start)
+  {
+    if (_failures < 0xFFFF) _failures++;
+    return NULL;
+  }
+  _used = start + size;
+  if (_used > _peak) _peak = _used;
+  return _buffer + start;
+}
+
+
+char *Arena::copy(const char *text, size_t length)
+{
+  char *out = (char *)alloc(length + 1);
+  if (out == NULL) return NULL;
+  memcpy(out, text, length);
+  out[length] = 0;
+  return out;
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,48 @@
+#pragma once
+//
+//    FILE: arena.h
+// PURPOSE: Bump allocator for the scratch memory of one HTTP request
+//          of the pig pen controller.
+//
+//  NOTES
+//  Handlers take what they need from one fixed buffer instead of the
+//  heap; nothing is freed one by one, the server resets the whole arena
+//  when the request is answered. The heap then never sees the short-lived
+//  blocks of a request, which were what cut it up over days of uptime.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define ARENA_ALIGN     4
+
+
+class Arena
+{
+public:
+  Arena(uint8_t *buffer, size_t size);
+
+  //  ARENA_ALIGN aligned, NULL when the arena is full
+  void    *alloc(size_t size);
+  //  a NUL terminated copy of length bytes of text, NULL when full
+  char    *copy(const char *text, size_t length);
+  void     reset()             { _used = 0; };
+
+  size_t   size() const        { return _size; };
+  size_t   used() const        { return _used; };
+  size_t   peak() const        { return _peak; };      //  most used since boot
+  uint16_t failures() const    { return _failures; };  //  allocations refused
+
+private:
+  uint8_t *_buffer;
+  size_t   _size;
+  size_t   _used;
+  size_t   _peak;
+  uint16_t _failures;
+};
+
+
+//  -- END OF FILE --
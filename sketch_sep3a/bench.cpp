@@ -0,0 +1,263 @@
+//
+//    FILE: bench.cpp
+// PURPOSE: Micro-benchmarks of the HX711 sample math, the JSON and CBOR
+//          response writers and the schedule matching, on the ESP8266
+//          and on a host.
+//
+
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <HX711.h>
+
+#include "feed_control.h"
+#include "responses.h"
+
+
+#ifdef ARDUINO
+#define BENCH_UNIT      "cycles"
+#define BENCH_PLATFORM  "esp8266"
+#define BENCH_TARGET    4000000UL       //  cycles of a timed round, 50 ms at 80 MHz
+static uint32_t benchNow()  { return ESP.getCycleCount(); }
+#else
+#include <chrono>
+#define BENCH_UNIT      "ns"
+#define BENCH_PLATFORM  "host"
+#define BENCH_TARGET    20000000UL      //  ns of a timed round
+static uint32_t benchNow()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#define BENCH_MAX_WINDOW        15
+#define BENCH_MAX_ITERATIONS    (1UL << 20)
+#define BENCH_ROUNDS            3
+
+
+///////////////////////////////////////////////////////////////
+//
+//  BENCHMARKS
+//
+//  the math works on a copy, sort and median sort in place
+static float benchSort(const float *samples, uint8_t window)
+{
+  float copy[BENCH_MAX_WINDOW];
+  memcpy(copy, samples, window * sizeof(float));
+  HX711::sort_samples(copy, window);
+  return copy[window / 2];
+}
+
+
+static float benchMedian(const float *samples, uint8_t window)
+{
+  float copy[BENCH_MAX_WINDOW];
+  memcpy(copy, samples, window * sizeof(float));
+  return HX711::median_of(copy, window);
+}
+
+
+static float benchMedavg(const float *samples, uint8_t window)
+{
+  float copy[BENCH_MAX_WINDOW];
+  memcpy(copy, samples, window * sizeof(float));
+  return HX711::medavg_of(copy, window);
+}
+
+
+static float benchRunavg(const float *samples, uint8_t window)
+{
+  return HX711::runavg_of(samples, window);
+}
+
+
+static const char *const benchFeed[] = { "08:00", "12:00", "18:00" };
+static const char *const benchWash[] = { "07:00", "17:00" };
+
+
+static float benchStatus(const float *samples, uint8_t window, uint8_t format)
+{
+  uint8_t body[320];
+  Encoder encoder(format, body, sizeof(body));
+  StatusView view = {
+    true, "12:34:56", true, true, true, 900, false,
+    samples[0], samples[0] - samples[window - 1], true, samples[1] - samples[0], 12.5, 0
+  };
+  writeStatus(encoder, view);
+  return encoder.finish();
+}
+
+
+static float benchStatusJson(const float *samples, uint8_t window)
+{
+  return benchStatus(samples, window, ENCODE_JSON);
+}
+
+
+static float benchStatusCbor(const float *samples, uint8_t window)
+{
+  return benchStatus(samples, window, ENCODE_CBOR);
+}
+
+
+static float benchScheduleJson(const float *, uint8_t)
+{
+  uint8_t body[320];
+  Encoder encoder(ENCODE_JSON, body, sizeof(body));
+  writeSchedule(encoder, benchFeed, 3, benchWash, 2);
+  return encoder.finish();
+}
+
+
+static float benchTimeJson(const float *samples, uint8_t)
+{
+  uint8_t body[64];
+  char    clock[9];
+  Encoder encoder(ENCODE_JSON, body, sizeof(body));
+  formatClock(clock, 43200UL + (uint32_t)samples[0]);
+  writeTime(encoder, clock);
+  return encoder.finish();
+}
+
+
+//  a pass of checkSchedules(): parse every schedule, match the minute
+static float benchScheduleMatch(const float *samples, uint8_t)
+{
+  static bool triggered[5];
+  uint16_t minute = (uint16_t)samples[0] % 1440;
+  uint8_t  due = 0;
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    due += scheduleDue(minute, scheduleMinute(benchFeed[i]), triggered[i]);
+  }
+  for (uint8_t i = 0; i < 2; i++)
+  {
+    due += scheduleDue(minute, scheduleMinute(benchWash[i]), triggered[3 + i]);
+  }
+  return due;
+}
+
+
+//  a fresh controller through a window of conversions while feeding
+static float benchFeedUpdate(const float *samples, uint8_t window)
+{
+  GateFlowMap    flow(0, 900, 40.0);
+  FeedController feeder(flow, 50.0, 15.0, 5.0);
+  feeder.start(samples[0] + 40.0);
+  uint16_t position = 900;
+  uint8_t  actions = 0;
+  for (uint8_t i = 1; i < window; i++)
+  {
+    uint16_t newPosition = position;
+    FeedAction action = feeder.update(samples[i], (samples[i] - samples[i - 1]) * 10, position, position, false, newPosition);
+    if (action != FEED_HOLD) actions++;
+    position = newPosition;
+  }
+  return actions * 1000.0 + position;
+}
+
+
+static const BenchCase benchCases[] =
+{
+  { "sort_15",        15, benchSort },
+  { "median_7",        7, benchMedian },
+  { "median_15",      15, benchMedian },
+  { "medavg_15",      15, benchMedavg },
+  { "runavg_15",      15, benchRunavg },
+  { "status_json",     2, benchStatusJson },
+  { "status_cbor",     2, benchStatusCbor },
+  { "schedule_json",   1, benchScheduleJson },
+  { "time_json",       1, benchTimeJson },
+  { "schedule_match",  1, benchScheduleMatch },
+  { "feed_update_15", 15, benchFeedUpdate }
+};
+
+
+///////////////////////////////////////////////////////////////
+//
+//  RUNNER
+//
+void benchSamples(float *samples, uint16_t count)
+{
+  uint32_t x = 12345;
+  for (uint16_t i = 0; i < count; i++)
+  {
+    x = x * 1664525UL + 1013904223UL;
+    //  +-1 g of noise, every 16th sample a knock on the pen
+    samples[i] = 1000.0 + ((x >> 8) & 0xFFFF) / 32768.0 - 1.0;
+    if ((i & 15) == 15) samples[i] += 25.0;
+  }
+}
+
+
+void benchMeasure(const BenchCase &bench, const float *samples, uint16_t count, BenchPrint print)
+{
+  if (bench.window == 0 || bench.window > count) return;
+  uint16_t positions = count - bench.window + 1;
+  float    check = bench.run(samples, bench.window);
+  volatile float sink = 0;
+
+  //  double the iterations until a round takes BENCH_TARGET, then
+  //  keep the fastest of BENCH_ROUNDS rounds, the others were disturbed
+  uint32_t iterations = 16;
+  uint32_t elapsed = 0xFFFFFFFF;
+  uint8_t  rounds = 0;
+  while (rounds < BENCH_ROUNDS)
+  {
+    uint32_t start = benchNow();
+    uint16_t offset = 0;
+    for (uint32_t i = 0; i < iterations; i++)
+    {
+      sink = sink + bench.run(samples + offset, bench.window);
+      if (++offset == positions) offset = 0;
+    }
+    uint32_t took = benchNow() - start;
+    if (rounds > 0 || took >= BENCH_TARGET || iterations >= BENCH_MAX_ITERATIONS)
+    {
+      if (took < elapsed) elapsed = took;
+      rounds++;
+    }
+    else iterations *= 2;
+#ifdef ARDUINO
+    yield();
+#endif
+  }
+
+  char line[BENCH_LINE_SIZE];
+  snprintf(line, sizeof(line),
+    "{\"bench\":\"%s\",\"window\":%u,\"iterations\":%lu,\"per_op\":%.1f,"
+    "\"unit\":\"" BENCH_UNIT "\",\"platform\":\"" BENCH_PLATFORM "\",\"check\":%.2f}",
+    bench.name, bench.window, (unsigned long)iterations,
+    (double)elapsed / iterations, check);
+  print(line);
+}
+
+
+uint8_t benchRun(const float *samples, uint16_t count, const char *filter, BenchPrint print)
+{
+  float fixed[BENCH_DEFAULT_SAMPLES];
+  if (samples == NULL)
+  {
+    benchSamples(fixed, BENCH_DEFAULT_SAMPLES);
+    samples = fixed;
+    count   = BENCH_DEFAULT_SAMPLES;
+  }
+  uint8_t ran = 0;
+  for (uint8_t i = 0; i < sizeof(benchCases) / sizeof(benchCases[0]); i++)
+  {
+    if (filter && !strstr(benchCases[i].name, filter)) continue;
+    benchMeasure(benchCases[i], samples, count, print);
+    ran++;
+#ifdef ARDUINO
+    yield();
+#endif
+  }
+  return ran;
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,51 @@
+#pragma once
+//
+//    FILE: bench.h
+// PURPOSE: Micro-benchmarks of the HX711 sample math, the JSON and CBOR
+//          response writers and the schedule matching, on the ESP8266
+//          and on a host.
+//
+//  NOTES
+//  Every benchmark prints one JSON line:
+//    {"bench":"median_15","window":15,"iterations":4096,
+//     "per_op":1234.5,"unit":"cycles","platform":"esp8266","check":1000.25}
+//  On the ESP8266 (serial "bench" command) the time is in CPU cycles
+//  from ESP.getCycleCount(), on a host (tools/bench) in nanoseconds.
+//  check is a result of the benchmarked code: equal samples give an
+//  equal check on both, so a run on other data is easy to spot.
+//
+//  A benchmark works on a window of the samples, the window moves by
+//  one sample per iteration. Without samples the suite uses a fixed
+//  pseudo random set around 1000 g, so runs compare across builds.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define BENCH_DEFAULT_SAMPLES   64
+#define BENCH_LINE_SIZE         160
+
+typedef void (*BenchPrint)(const char *line);
+
+struct BenchCase
+{
+  const char *name;
+  uint8_t     window;           //  samples one run uses, at most the sample count
+  //  one run on samples[0 .. window - 1], returns a value of the result
+  float     (*run)(const float *samples, uint8_t window);
+};
+
+
+//  runs the built in benchmarks whose name contains filter (NULL: all),
+//  samples NULL uses the fixed set. Returns the number run.
+uint8_t  benchRun(const float *samples, uint16_t count, const char *filter, BenchPrint print);
+
+//  times one benchmark, e.g. one only a host can run
+void     benchMeasure(const BenchCase &bench, const float *samples, uint16_t count, BenchPrint print);
+
+//  the fixed sample set, samples holds count floats
+void     benchSamples(float *samples, uint16_t count);
+
+
+//  -- END OF FILE --
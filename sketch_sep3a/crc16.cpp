@@ -0,0 +1,25 @@
+//
+//    FILE: crc16.cpp
+// PURPOSE: CRC-16/CCITT of the records the pig pen controller keeps
+//          in flash: trace blocks, journal records, rollup images.
+//
+
+
+#include "crc16.h"
+
+
+uint16_t crc16(uint16_t crc, const uint8_t *p, size_t length)
+{
+  while (length--)
+  {
+    crc ^= (uint16_t)(*p++) << 8;
+    for (uint8_t i = 0; i < 8; i++)
+    {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,25 @@
+#pragma once
+//
+//    FILE: crc16.h
+// PURPOSE: CRC-16/CCITT of the records the pig pen controller keeps
+//          in flash: trace blocks, journal records, rollup images.
+//
+//  NOTES
+//  Polynomial 0x1021, MSB first, no reflection, no final xor. Start
+//  with CRC16_INIT; a CRC over several pieces passes the result of one
+//  piece as crc of the next.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define CRC16_INIT      0xFFFF
+
+
+uint16_t crc16(uint16_t crc, const uint8_t *p, size_t length);
+
+
+//  -- END OF FILE --
@@ -0,0 +1,283 @@
+//
+//    FILE: delta_patch.cpp
+// PURPOSE: Applies a binary delta to the running firmware image as the
+//          patch streams in, for over the air updates of the pig pen
+//          controller.
+//
+
+
+#include "delta_patch.h"
+
+#include <string.h>
+
+
+static void put32(uint8_t *p, uint32_t value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+
+static uint32_t get32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+DeltaPatch::DeltaPatch()
+{
+  begin(NULL, NULL);
+}
+
+
+void DeltaPatch::begin(DeltaRead read, DeltaWrite write, DeltaCheck check)
+{
+  _read       = read;
+  _write      = write;
+  _check      = check;
+  memset(&_header, 0, sizeof(_header));
+  _state      = STATE_HEADER;
+  _error      = DELTA_OK;
+  _headerUsed = 0;
+  _shift      = 0;
+  _value      = 0;
+  _literal    = 0;
+  _add        = 0;
+  _changed    = 0;
+  _oldPos     = 0;
+  _written    = 0;
+  _used       = 0;
+}
+
+
+bool DeltaPatch::feed(const uint8_t *data, size_t length)
+{
+  while (length > 0)
+  {
+    switch (_state)
+    {
+      case STATE_HEADER:
+      {
+        size_t n = DELTA_HEADER_SIZE - _headerUsed;
+        if (n > length) n = length;
+        memcpy(_buffer + _headerUsed, data, n);
+        _headerUsed += n;
+        data   += n;
+        length -= n;
+        if (_headerUsed < DELTA_HEADER_SIZE) break;
+        if (!decodeHeader(_buffer, _header)) return _fail(DELTA_BAD_HEADER);
+        if (_check && !_check(_header)) return _fail(DELTA_WRONG_SOURCE);
+        _state = STATE_LITERAL_LENGTH;
+        _entryDone();
+        break;
+      }
+
+      case STATE_LITERAL_LENGTH:
+      case STATE_ADD_LENGTH:
+      case STATE_SEEK:
+      case STATE_SAME:
+      case STATE_CHANGED_LENGTH:
+      {
+        length--;
+        if (!_varint(*data++)) break;
+        if (_state == STATE_FAILED) return false;
+        uint32_t value = _value;
+        _value = 0;
+        _shift = 0;
+        if (_state == STATE_LITERAL_LENGTH)
+        {
+          _literal = value;
+          _state   = STATE_ADD_LENGTH;
+        }
+        else if (_state == STATE_ADD_LENGTH)
+        {
+          _add   = value;
+          _state = STATE_SEEK;
+        }
+        else if (_state == STATE_SEEK)
+        {
+          //  the whole entry must fit, the add run in the old image
+          if ((uint64_t)_written + _literal + _add > _header.newSize) return _fail(DELTA_BAD_PATCH);
+          _oldPos += (uint32_t)((value >> 1) ^ (0 - (value & 1)));
+          if (_add > 0 && (uint64_t)_oldPos + _add > _header.oldSize) return _fail(DELTA_BAD_PATCH);
+          if (_literal > 0)  _state = STATE_LITERAL;
+          else if (_add > 0) _state = STATE_SAME;
+          else               _entryDone();
+        }
+        else if (_state == STATE_SAME)
+        {
+          if (value > _add) return _fail(DELTA_BAD_PATCH);
+          if (!_emitOld(value)) return false;
+          _add  -= value;
+          _state = STATE_CHANGED_LENGTH;
+        }
+        else
+        {
+          if (value > _add) return _fail(DELTA_BAD_PATCH);
+          _changed = value;
+          _state   = STATE_CHANGED;
+          if (_changed == 0)
+          {
+            if (_add > 0) _state = STATE_SAME;
+            else          _entryDone();
+          }
+        }
+        if (_state == STATE_DONE && !_flush()) return false;
+        break;
+      }
+
+      case STATE_LITERAL:
+      {
+        size_t n = _literal < length ? _literal : length;
+        if (!_emit(data, n)) return false;
+        data     += n;
+        length   -= n;
+        _literal -= n;
+        if (_literal > 0) break;
+        if (_add > 0) _state = STATE_SAME;
+        else          _entryDone();
+        if (_state == STATE_DONE && !_flush()) return false;
+        break;
+      }
+
+      case STATE_CHANGED:
+      {
+        //  old bytes straight into the buffer, the differences added there
+        if (_used == DELTA_OUT_BUFFER && !_flush()) return false;
+        size_t n = DELTA_OUT_BUFFER - _used;
+        if (n > _changed) n = _changed;
+        if (n > length)   n = length;
+        uint8_t *out = _buffer + _used;
+        if (!_read(_oldPos, out, n)) return _fail(DELTA_READ_FAILED);
+        for (size_t i = 0; i < n; i++) out[i] += data[i];
+        _used    += n;
+        _written += n;
+        _oldPos  += n;
+        _add     -= n;
+        _changed -= n;
+        data     += n;
+        length   -= n;
+        if (_changed > 0) break;
+        if (_add > 0) _state = STATE_SAME;
+        else          _entryDone();
+        if (_state == STATE_DONE && !_flush()) return false;
+        break;
+      }
+
+      case STATE_DONE:
+        return _fail(DELTA_TRAILING);
+
+      default:
+        return false;
+    }
+  }
+  return _state != STATE_FAILED;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  HEADER
+//
+void DeltaPatch::encodeHeader(const DeltaHeader &header, uint8_t *out)
+{
+  out[0] = 'P';
+  out[1] = 'D';
+  out[2] = DELTA_VERSION;
+  out[3] = 0;
+  put32(out + 4, header.oldSize);
+  memcpy(out + 8, header.oldMd5, 16);
+  put32(out + 24, header.newSize);
+  memcpy(out + 28, header.newMd5, 16);
+}
+
+
+bool DeltaPatch::decodeHeader(const uint8_t *in, DeltaHeader &header)
+{
+  if (in[0] != 'P' || in[1] != 'D' || in[2] != DELTA_VERSION) return false;
+  header.oldSize = get32(in + 4);
+  memcpy(header.oldMd5, in + 8, 16);
+  header.newSize = get32(in + 24);
+  memcpy(header.newMd5, in + 28, 16);
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  PRIVATE
+//
+//  true once the value is complete, or the patch failed
+bool DeltaPatch::_varint(uint8_t byte)
+{
+  if (_shift > 28)
+  {
+    _fail(DELTA_BAD_PATCH);
+    return true;
+  }
+  _value |= (uint32_t)(byte & 0x7F) << _shift;
+  _shift += 7;
+  return (byte & 0x80) == 0;
+}
+
+
+void DeltaPatch::_entryDone()
+{
+  _state = _written == _header.newSize ? STATE_DONE : STATE_LITERAL_LENGTH;
+}
+
+
+bool DeltaPatch::_emitOld(uint32_t length)
+{
+  while (length > 0)
+  {
+    if (_used == DELTA_OUT_BUFFER && !_flush()) return false;
+    uint32_t n = DELTA_OUT_BUFFER - _used;
+    if (n > length) n = length;
+    if (!_read(_oldPos, _buffer + _used, n)) return _fail(DELTA_READ_FAILED);
+    _used    += n;
+    _written += n;
+    _oldPos  += n;
+    length   -= n;
+  }
+  return true;
+}
+
+
+bool DeltaPatch::_emit(const uint8_t *data, size_t length)
+{
+  while (length > 0)
+  {
+    if (_used == DELTA_OUT_BUFFER && !_flush()) return false;
+    size_t n = DELTA_OUT_BUFFER - _used;
+    if (n > length) n = length;
+    memcpy(_buffer + _used, data, n);
+    _used    += n;
+    _written += n;
+    data     += n;
+    length   -= n;
+  }
+  return true;
+}
+
+
+bool DeltaPatch::_flush()
+{
+  if (_used == 0) return true;
+  if (!_write(_buffer, _used)) return _fail(DELTA_WRITE_FAILED);
+  _used = 0;
+  return true;
+}
+
+
+bool DeltaPatch::_fail(uint8_t error)
+{
+  _state = STATE_FAILED;
+  _error = error;
+  return false;
+}
+
+
+//  -- END OF FILE --
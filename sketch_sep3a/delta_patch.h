@@ -0,0 +1,137 @@
+#pragma once
+//
+//    FILE: delta_patch.h
+// PURPOSE: Applies a binary delta to the running firmware image as the
+//          patch streams in, for over the air updates of the pig pen
+//          controller.
+//
+//  NOTES
+//  A patch describes the new image as runs of the old one, bsdiff
+//  style: an "add" run takes old bytes at a moving position and adds
+//  a difference to each, mostly zero where code only moved; a literal
+//  run carries new bytes. The patch is fed in pieces of any size, the
+//  new image comes out in order through write() in pieces of at most
+//  DELTA_OUT_BUFFER bytes, old bytes are fetched with read() - RAM use
+//  is the object itself, whatever the image size.
+//
+//  The header names the image the patch was made against and the one
+//  it makes (size and MD5); the caller checks the first before anything
+//  is written and the MD5 of the second before it boots it.
+//
+//  HEADER (DELTA_HEADER_SIZE bytes, little endian)
+//    0   2   magic 'P' 'D'
+//    2   1   DELTA_VERSION
+//    3   1   0
+//    4   4   size of the old image
+//    8  16   MD5 of the old image
+//   24   4   size of the new image
+//   28  16   MD5 of the new image
+//
+//  ENTRY, repeated until the new image is complete
+//    varint literal bytes, varint add bytes, zigzag varint old seek
+//    the literal bytes
+//    the add run, after the seek: (varint same, varint changed,
+//    changed difference bytes) pairs until it is complete
+//
+//  No Arduino dependency, tools/delta_patch makes and applies patches
+//  on a host with it.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define DELTA_VERSION           1
+#define DELTA_HEADER_SIZE       44
+#define DELTA_OUT_BUFFER        256
+
+
+enum DeltaError : uint8_t
+{
+  DELTA_OK = 0,
+  DELTA_BAD_HEADER,             //  not a patch, or of another version
+  DELTA_WRONG_SOURCE,           //  refused by the header check
+  DELTA_BAD_PATCH,              //  runs outside the old or past the new image
+  DELTA_READ_FAILED,
+  DELTA_WRITE_FAILED,
+  DELTA_TRAILING                //  bytes after the new image is complete
+};
+
+
+struct DeltaHeader
+{
+  uint32_t oldSize;
+  uint8_t  oldMd5[16];
+  uint32_t newSize;
+  uint8_t  newMd5[16];
+};
+
+
+typedef bool (*DeltaRead)(uint32_t offset, uint8_t *data, size_t length);
+typedef bool (*DeltaWrite)(const uint8_t *data, size_t length);
+//  called once the header is in, false refuses the patch
+typedef bool (*DeltaCheck)(const DeltaHeader &header);
+
+
+class DeltaPatch
+{
+public:
+  DeltaPatch();
+
+  //  starts a patch, read() gets bytes of the old image at an offset,
+  //  write() the new image in order
+  void     begin(DeltaRead read, DeltaWrite write, DeltaCheck check = NULL);
+  //  false once the patch failed, see error()
+  bool     feed(const uint8_t *data, size_t length);
+  //  the whole new image was written
+  bool     done() const        { return _state == STATE_DONE; };
+  uint8_t  error() const       { return _error; };
+  const DeltaHeader &header() const  { return _header; };
+  uint32_t written() const     { return _written; };
+
+  static void encodeHeader(const DeltaHeader &header, uint8_t *out);
+  static bool decodeHeader(const uint8_t *in, DeltaHeader &header);
+
+private:
+  enum State : uint8_t
+  {
+    STATE_HEADER = 0,
+    STATE_LITERAL_LENGTH,
+    STATE_ADD_LENGTH,
+    STATE_SEEK,
+    STATE_LITERAL,
+    STATE_SAME,
+    STATE_CHANGED_LENGTH,
+    STATE_CHANGED,
+    STATE_DONE,
+    STATE_FAILED
+  };
+
+  bool     _varint(uint8_t byte);
+  void     _entryDone();
+  bool     _emitOld(uint32_t length);
+  bool     _emit(const uint8_t *data, size_t length);
+  bool     _flush();
+  bool     _fail(uint8_t error);
+
+  DeltaRead   _read;
+  DeltaWrite  _write;
+  DeltaCheck  _check;
+  DeltaHeader _header;
+
+  uint8_t  _state;
+  uint8_t  _error;
+  uint8_t  _headerUsed;
+  uint8_t  _shift;               //  of the varint being read
+  uint32_t _value;
+  uint32_t _literal;             //  bytes left of the current run
+  uint32_t _add;
+  uint32_t _changed;
+  uint32_t _oldPos;
+  uint32_t _written;             //  new image bytes, flushed or not
+  uint16_t _used;
+  uint8_t  _buffer[DELTA_OUT_BUFFER > DELTA_HEADER_SIZE ? DELTA_OUT_BUFFER : DELTA_HEADER_SIZE];
+};
+
+
+//  -- END OF FILE --
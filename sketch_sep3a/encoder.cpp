@@ -0,0 +1,342 @@
+//
+//    FILE: encoder.cpp
+// PURPOSE: One writer for the JSON and the CBOR bodies of the pig pen
+//          controller API.
+//
+
+
+#include "encoder.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+
+//  CBOR major types
+#define CBOR_UNSIGNED   0
+#define CBOR_NEGATIVE   1
+#define CBOR_TEXT       3
+#define CBOR_ARRAY      4
+#define CBOR_MAP        5
+#define CBOR_SIMPLE     7
+
+#define CBOR_FALSE      0xF4
+#define CBOR_TRUE       0xF5
+#define CBOR_NULL       0xF6
+#define CBOR_FLOAT32    0xFA
+
+
+Encoder::Encoder(uint8_t format, uint8_t *buffer, size_t size, EncoderFlush flush)
+{
+  _format   = format;
+  _buffer   = buffer;
+  _size     = buffer ? size : 0;
+  _used     = 0;
+  _flushed  = 0;
+  _flush    = flush;
+  _overflow = false;
+  _depth    = 0;
+  _afterKey = false;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  CONTAINERS
+//
+void Encoder::beginMap(uint16_t count)
+{
+  _begin(CBOR_MAP, count, '{');
+}
+
+
+void Encoder::beginArray(uint16_t count)
+{
+  _begin(CBOR_ARRAY, count, '[');
+}
+
+
+void Encoder::end()
+{
+  if (_depth == 0) return;
+  _depth--;
+  if (_format == ENCODE_JSON) _byte(_close[_depth]);
+}
+
+
+void Encoder::_begin(uint8_t major, uint16_t count, char open)
+{
+  _separator();
+  if (_format == ENCODE_JSON) _byte(open);
+  else                        _head(major, count);
+  if (_depth >= ENCODER_MAX_DEPTH)
+  {
+    _overflow = true;
+    return;
+  }
+  _first[_depth] = true;
+  _close[_depth] = open == '{' ? '}' : ']';
+  _depth++;
+}
+
+
+//  JSON: ", " between the members, nothing between a key and its value
+void Encoder::_separator()
+{
+  if (_format != ENCODE_JSON) return;
+  if (_afterKey)
+  {
+    _afterKey = false;
+    return;
+  }
+  if (_depth == 0) return;
+  if (!_first[_depth - 1]) _put(", ", 2);
+  _first[_depth - 1] = false;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  VALUES
+//
+void Encoder::key(PGM_P name)
+{
+  _separator();
+  _text(name, strlen_P(name), true);
+  if (_format == ENCODE_JSON)
+  {
+    _put(": ", 2);
+    _afterKey = true;
+  }
+}
+
+
+void Encoder::string(const char *text)
+{
+  string(text, strlen(text));
+}
+
+
+void Encoder::string(const char *text, size_t length)
+{
+  _separator();
+  _text(text, length, false);
+}
+
+
+void Encoder::stringP(PGM_P text)
+{
+  _separator();
+  _text(text, strlen_P(text), true);
+}
+
+
+void Encoder::integer(int32_t value)
+{
+  if (value >= 0)
+  {
+    uinteger(value);
+    return;
+  }
+  _separator();
+  if (_format == ENCODE_JSON)
+  {
+    char text[12];
+    int n = snprintf(text, sizeof(text), "%ld", (long)value);
+    _put(text, n);
+  }
+  else
+  {
+    _head(CBOR_NEGATIVE, (uint32_t)(-1 - value));
+  }
+}
+
+
+void Encoder::uinteger(uint32_t value)
+{
+  _separator();
+  if (_format == ENCODE_JSON)
+  {
+    char text[11];
+    int n = snprintf(text, sizeof(text), "%lu", (unsigned long)value);
+    _put(text, n);
+  }
+  else
+  {
+    _head(CBOR_UNSIGNED, value);
+  }
+}
+
+
+void Encoder::number(float value, uint8_t decimals)
+{
+  if (_format == ENCODE_JSON)
+  {
+    if (isnan(value) || isinf(value))
+    {
+      null();
+      return;
+    }
+    _separator();
+    char text[24];
+    int n = snprintf(text, sizeof(text), "%.*f", decimals, value);
+    _put(text, n < (int)sizeof(text) ? n : sizeof(text) - 1);
+    return;
+  }
+  uint32_t bits;
+  memcpy(&bits, &value, 4);
+  uint8_t bytes[5] = { CBOR_FLOAT32, (uint8_t)(bits >> 24), (uint8_t)(bits >> 16), (uint8_t)(bits >> 8), (uint8_t)bits };
+  _put(bytes, 5);
+}
+
+
+void Encoder::boolean(bool value)
+{
+  _separator();
+  if (_format == ENCODE_JSON)
+  {
+    if (value) _put("true", 4);
+    else       _put("false", 5);
+  }
+  else
+  {
+    _byte(value ? CBOR_TRUE : CBOR_FALSE);
+  }
+}
+
+
+void Encoder::null()
+{
+  _separator();
+  if (_format == ENCODE_JSON) _put("null", 4);
+  else                        _byte(CBOR_NULL);
+}
+
+
+size_t Encoder::finish()
+{
+  if (_flush && _used)
+  {
+    _flush(_buffer, _used);
+    _flushed += _used;
+    _used = 0;
+  }
+  return length();
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  OUTPUT
+//
+void Encoder::_head(uint8_t major, uint32_t value)
+{
+  uint8_t bytes[5];
+  uint8_t n;
+  major <<= 5;
+  if (value < 24)
+  {
+    bytes[0] = major | value;
+    n = 1;
+  }
+  else if (value < 0x100)
+  {
+    bytes[0] = major | 24;
+    bytes[1] = value;
+    n = 2;
+  }
+  else if (value < 0x10000)
+  {
+    bytes[0] = major | 25;
+    bytes[1] = value >> 8;
+    bytes[2] = value;
+    n = 3;
+  }
+  else
+  {
+    bytes[0] = major | 26;
+    bytes[1] = value >> 24;
+    bytes[2] = value >> 16;
+    bytes[3] = value >> 8;
+    bytes[4] = value;
+    n = 5;
+  }
+  _put(bytes, n);
+}
+
+
+//  JSON escapes quotes, backslashes and control characters
+void Encoder::_text(const char *text, size_t length, bool flash)
+{
+  if (_format == ENCODE_CBOR)
+  {
+    _head(CBOR_TEXT, length);
+    if (flash) _putP(text, length);
+    else       _put(text, length);
+    return;
+  }
+  _byte('"');
+  size_t start = 0;
+  for (size_t i = 0; i < length; i++)
+  {
+    uint8_t c = flash ? pgm_read_byte(text + i) : (uint8_t)text[i];
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    if (flash) _putP(text + start, i - start);
+    else       _put(text + start, i - start);
+    char escape[7];
+    int n = c == '"' || c == '\\' ? snprintf(escape, sizeof(escape), "\\%c", c)
+                                  : snprintf(escape, sizeof(escape), "\\u%04x", c);
+    _put(escape, n);
+    start = i + 1;
+  }
+  if (flash) _putP(text + start, length - start);
+  else       _put(text + start, length - start);
+  _byte('"');
+}
+
+
+void Encoder::_put(const void *data, size_t length)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  if (_buffer == NULL)
+  {
+    _flushed += length;
+    return;
+  }
+  while (length)
+  {
+    if (_used == _size)
+    {
+      if (_flush == NULL)
+      {
+        _overflow = true;
+        return;
+      }
+      _flush(_buffer, _used);
+      _flushed += _used;
+      _used = 0;
+    }
+    size_t n = _size - _used < length ? _size - _used : length;
+    memcpy(_buffer + _used, p, n);
+    _used  += n;
+    p      += n;
+    length -= n;
+  }
+}
+
+
+void Encoder::_putP(PGM_P data, size_t length)
+{
+  uint8_t piece[32];
+  while (length)
+  {
+    size_t n = length < sizeof(piece) ? length : sizeof(piece);
+    memcpy_P(piece, data, n);
+    _put(piece, n);
+    data   += n;
+    length -= n;
+  }
+}
+
+
+//  -- END OF FILE --
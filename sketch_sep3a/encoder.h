@@ -0,0 +1,99 @@
+#pragma once
+//
+//    FILE: encoder.h
+// PURPOSE: One writer for the JSON and the CBOR bodies of the pig pen
+//          controller API.
+//
+//  NOTES
+//  A response is written once as a sequence of calls - maps, arrays,
+//  keys and values - and the encoder renders it as JSON or as CBOR
+//  (RFC 8949). Containers take their member count up front, CBOR heads
+//  carry it; JSON ignores it. Keys are flash strings (PSTR).
+//
+//  Output goes to a buffer. With a flush function the buffer is handed
+//  over whenever it is full, so a body of any length streams through a
+//  small buffer; without one, output past the end is dropped and
+//  overflow() is set. Without a buffer it only counts the bytes, for
+//  the Content-Length of a streamed body.
+//
+//  JSON numbers are printed with the decimals asked for, NaN and
+//  infinity as null. CBOR numbers are unsigned / negative integers or
+//  single precision floats.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "flash_strings.h"
+
+
+#define ENCODER_MAX_DEPTH   6
+
+
+enum EncoderFormat : uint8_t
+{
+  ENCODE_JSON = 0,
+  ENCODE_CBOR,
+  ENCODE_FORMATS
+};
+
+
+typedef void (*EncoderFlush)(const uint8_t *data, size_t length);
+
+
+class Encoder
+{
+public:
+  Encoder(uint8_t format, uint8_t *buffer, size_t size, EncoderFlush flush = NULL);
+
+  uint8_t  format() const    { return _format; };
+
+  //  CONTAINERS - count is the number of members, of pairs for a map
+  void     beginMap(uint16_t count);
+  void     beginArray(uint16_t count);
+  void     end();
+
+  //  VALUES - in a map each one follows a key
+  void     key(PGM_P name);
+  void     string(const char *text);
+  void     string(const char *text, size_t length);
+  void     stringP(PGM_P text);
+  void     integer(int32_t value);
+  void     uinteger(uint32_t value);
+  void     number(float value, uint8_t decimals);
+  void     boolean(bool value);
+  void     null();
+
+  //  flushes what is buffered; the length of the whole body
+  size_t   finish();
+  //  bytes written so far, flushed ones included
+  size_t   length() const    { return _flushed + _used; };
+  bool     overflow() const  { return _overflow; };
+
+private:
+  void     _begin(uint8_t major, uint16_t count, char open);
+  void     _separator();
+  void     _head(uint8_t major, uint32_t value);
+  void     _text(const char *text, size_t length, bool flash);
+  void     _put(const void *data, size_t length);
+  void     _putP(PGM_P data, size_t length);
+  void     _byte(uint8_t value)  { _put(&value, 1); };
+
+  uint8_t      _format;
+  uint8_t     *_buffer;
+  size_t       _size;
+  size_t       _used;
+  size_t       _flushed;
+  EncoderFlush _flush;
+  bool         _overflow;
+
+  uint8_t      _depth;
+  bool         _afterKey;
+  bool         _first[ENCODER_MAX_DEPTH];
+  char         _close[ENCODER_MAX_DEPTH];
+};
+
+
+//  -- END OF FILE --
@@ -0,0 +1,80 @@
+//
+//    FILE: feed_control.cpp
+// PURPOSE: Decisions of the feed gate while it is open and of the
+//          feed / wash schedules, apart from the hardware they drive.
+//
+
+
+#include "feed_control.h"
+
+
+FeedController::FeedController(GateFlowMap &flow, float dropAmount, float slowZone, float dribbleFlow)
+  : _flow(flow)
+{
+  _dropAmount   = dropAmount;
+  _slowZone     = slowZone;
+  _dribbleFlow  = dribbleFlow;
+  _weightAtOpen = 0;
+}
+
+
+FeedAction FeedController::update(float weight, float rate, uint16_t position, uint16_t target,
+                                  bool moving, uint16_t &newPosition)
+{
+  float weightDropped = dropped(weight);
+
+  if (!moving)
+  {
+    _flow.learn(position, -rate);
+  }
+
+  if (weightDropped >= _dropAmount)
+  {
+    return FEED_CLOSE;
+  }
+  if (_dropAmount - weightDropped <= _slowZone)
+  {
+    //  trade speed for accuracy on the last grams
+    uint16_t dribble = _flow.positionFor(_dribbleFlow);
+    if (target != dribble && _flow.flowAt(target) > _dribbleFlow)
+    {
+      newPosition = dribble;
+      return FEED_THROTTLE;
+    }
+  }
+  return FEED_HOLD;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  SCHEDULES
+//
+int16_t scheduleMinute(const char *text)
+{
+  if (text == 0) return -1;
+  for (uint8_t i = 0; i < 5; i++)
+  {
+    if (i == 2 ? text[i] != ':' : (text[i] < '0' || text[i] > '9')) return -1;
+  }
+  int16_t hours   = (text[0] - '0') * 10 + (text[1] - '0');
+  int16_t minutes = (text[3] - '0') * 10 + (text[4] - '0');
+  if (hours > 23 || minutes > 59) return -1;
+  return hours * 60 + minutes;
+}
+
+
+bool scheduleDue(uint16_t minuteOfDay, int16_t scheduleAt, bool &triggered)
+{
+  if (scheduleAt < 0 || minuteOfDay != (uint16_t)scheduleAt)
+  {
+    triggered = false;
+    return false;
+  }
+  if (triggered) return false;
+  triggered = true;
+  return true;
+}
+
+
+//  -- END OF FILE --
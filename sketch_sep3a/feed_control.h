@@ -0,0 +1,65 @@
+#pragma once
+//
+//    FILE: feed_control.h
+// PURPOSE: Decisions of the feed gate while it is open and of the
+//          feed / wash schedules, apart from the hardware they drive.
+//
+//  NOTES
+//  The sketch feeds one filtered weight sample per HX711 conversion
+//  into FeedController::update() and carries out the answer; the host
+//  replay tool does the same with the samples of a recorded trace, so
+//  both take the same decisions from the same data.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+
+#include "servo_motion.h"
+
+
+enum FeedAction : uint8_t
+{
+  FEED_HOLD = 0,                //  nothing to do
+  FEED_CLOSE,                   //  the drop amount is out
+  FEED_THROTTLE                 //  move the gate to newPosition
+};
+
+
+class FeedController
+{
+public:
+  FeedController(GateFlowMap &flow, float dropAmount, float slowZone, float dribbleFlow);
+
+  void     start(float weightAtOpen)  { _weightAtOpen = weightAtOpen; };
+  float    weightAtOpen() const       { return _weightAtOpen; };
+  float    dropped(float weight) const { return _weightAtOpen - weight; };
+
+  //  one sample while the gate is open: weight in grams, rate in g/s
+  //  (negative while feed runs out), the gate as the timer moves it.
+  //  Flow measured while the gate holds still teaches the flow map.
+  FeedAction update(float weight, float rate, uint16_t position, uint16_t target,
+                    bool moving, uint16_t &newPosition);
+
+  float    dropAmount() const   { return _dropAmount; };
+  float    slowZone() const     { return _slowZone; };
+  float    dribbleFlow() const  { return _dribbleFlow; };
+
+private:
+  GateFlowMap &_flow;
+  float    _dropAmount;
+  float    _slowZone;
+  float    _dribbleFlow;
+  float    _weightAtOpen;
+};
+
+
+//  "HH:MM" as minute of the day, -1 if it is not a time
+int16_t  scheduleMinute(const char *text);
+
+//  true once when the minute of the day reaches the schedule,
+//  triggered is re-armed as soon as the minute has passed.
+bool     scheduleDue(uint16_t minuteOfDay, int16_t scheduleAt, bool &triggered);
+
+
+//  -- END OF FILE --
@@ -0,0 +1,28 @@
+#pragma once
+//
+//    FILE: flash_strings.h
+// PURPOSE: Strings of the pig pen controller modules kept in flash.
+//
+//  NOTES
+//  On the ESP8266 a string literal is copied to RAM at boot; PSTR() keeps
+//  it in flash and the _P functions read it from there. On a host they
+//  are the plain ones, so the modules stay free of Arduino there.
+
+
+#ifdef ARDUINO
+#include <pgmspace.h>
+#else
+#include <stdio.h>
+#include <string.h>
+#define PROGMEM
+#define PGM_P               const char *
+#define PSTR(s)             (s)
+#define snprintf_P          snprintf
+#define strlen_P            strlen
+#define memcpy_P            memcpy
+#define pgm_read_byte(p)    (*(const uint8_t *)(p))
+#define pgm_read_ptr(p)     (*(const void *const *)(p))
+#endif
+
+
+//  -- END OF FILE --
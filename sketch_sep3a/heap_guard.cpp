@@ -0,0 +1,65 @@
+//
+//    FILE: heap_guard.cpp
+// PURPOSE: Watches the free heap and its largest block on the pig pen
+//          controller and decides when to shed non-essential requests.
+//
+
+
+#include "heap_guard.h"
+
+
+HeapGuard::HeapGuard(uint32_t shedBlock, uint32_t recoverBlock, uint8_t shedFragmentation, uint32_t trendPeriod)
+{
+  _shedBlock         = shedBlock;
+  _recoverBlock      = recoverBlock;
+  _shedFragmentation = shedFragmentation;
+  _trendPeriod       = trendPeriod;
+
+  _level         = HEAP_OK;
+  _fragmentation = 0;
+  _blockLow      = 0xFFFFFFFF;
+  _started       = false;
+  _trendAt       = 0;
+  _trendBlock    = 0;
+  _trend         = 0;
+  _sheds         = 0;
+}
+
+
+bool HeapGuard::update(uint32_t now, uint32_t freeHeap, uint32_t maxBlock)
+{
+  if (maxBlock > freeHeap) maxBlock = freeHeap;
+  _fragmentation = freeHeap ? 100 - (uint8_t)((uint64_t)maxBlock * 100 / freeHeap) : 100;
+  if (maxBlock < _blockLow) _blockLow = maxBlock;
+
+  if (!_started)
+  {
+    _started    = true;
+    _trendAt    = now;
+    _trendBlock = maxBlock;
+  }
+  else if (now - _trendAt >= _trendPeriod)
+  {
+    int64_t perHour = ((int64_t)maxBlock - _trendBlock) * 3600000 / (int64_t)(now - _trendAt);
+    _trend     += (int32_t)((perHour - _trend) / 4);
+    _trendAt    = now;
+    _trendBlock = maxBlock;
+  }
+
+  HeapLevel level = _level;
+  if (_level == HEAP_OK)
+  {
+    if (maxBlock < _shedBlock || _fragmentation >= _shedFragmentation) level = HEAP_SHED;
+  }
+  else if (maxBlock >= _recoverBlock && _fragmentation + 10 < _shedFragmentation)
+  {
+    level = HEAP_OK;
+  }
+  if (level == _level) return false;
+  _level = level;
+  if (level == HEAP_SHED && _sheds < 0xFFFF) _sheds++;
+  return true;
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,64 @@
+#pragma once
+//
+//    FILE: heap_guard.h
+// PURPOSE: Watches the free heap and its largest block on the pig pen
+//          controller and decides when to shed non-essential requests.
+//
+//  NOTES
+//  The sketch feeds it a sample between control passes, when no request
+//  holds memory. Fragmentation is the part of the free heap outside the
+//  largest block. Shedding starts when the largest block gets smaller
+//  than shedBlock or fragmentation reaches shedFragmentation, and stops
+//  only when the block is back at recoverBlock and fragmentation is 10
+//  points lower, so it does not flap.
+//
+//  The trend is the change of the largest block in bytes per hour,
+//  measured once per trendPeriod and smoothed over about four periods;
+//  a steady negative trend means something still fragments the heap.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+
+
+enum HeapLevel : uint8_t
+{
+  HEAP_OK = 0,
+  HEAP_SHED
+};
+
+
+class HeapGuard
+{
+public:
+  //  bytes, percent, ms
+  HeapGuard(uint32_t shedBlock, uint32_t recoverBlock, uint8_t shedFragmentation, uint32_t trendPeriod);
+
+  //  returns true when the level changed
+  bool      update(uint32_t now, uint32_t freeHeap, uint32_t maxBlock);
+
+  HeapLevel level() const          { return _level; };
+  uint8_t   fragmentation() const  { return _fragmentation; };  //  percent
+  uint32_t  blockLow() const       { return _blockLow; };
+  int32_t   blockTrend() const     { return _trend; };          //  bytes per hour
+  uint16_t  sheds() const          { return _sheds; };          //  times shedding started
+
+private:
+  uint32_t  _shedBlock;
+  uint32_t  _recoverBlock;
+  uint8_t   _shedFragmentation;
+  uint32_t  _trendPeriod;
+
+  HeapLevel _level;
+  uint8_t   _fragmentation;
+  uint32_t  _blockLow;
+  bool      _started;
+  uint32_t  _trendAt;
+  uint32_t  _trendBlock;
+  int32_t   _trend;
+  uint16_t  _sheds;
+};
+
+
+//  -- END OF FILE --
@@ -0,0 +1,789 @@
+//
+//    FILE: http_server.cpp
+// PURPOSE: Small HTTP/1.1 server for the pig pen controller.
+//
+
+
+#include "http_server.h"
+#include "request_body.h"
+
+
+static const char *statusText(int code)
+{
+  switch (code)
+  {
+    case 200: return "OK";
+    case 204: return "No Content";
+    case 400: return "Bad Request";
+    case 404: return "Not Found";
+    case 405: return "Method Not Allowed";
+    case 411: return "Length Required";
+    case 413: return "Payload Too Large";
+    case 500: return "Internal Server Error";
+    case 503: return "Service Unavailable";
+  }
+  return "";
+}
+
+
+static HTTPMethod parseMethod(const char *m)
+{
+  if (strcmp(m, "GET") == 0)     return HTTP_GET;
+  if (strcmp(m, "POST") == 0)    return HTTP_POST;
+  if (strcmp(m, "HEAD") == 0)    return HTTP_HEAD;
+  if (strcmp(m, "PUT") == 0)     return HTTP_PUT;
+  if (strcmp(m, "PATCH") == 0)   return HTTP_PATCH;
+  if (strcmp(m, "DELETE") == 0)  return HTTP_DELETE;
+  if (strcmp(m, "OPTIONS") == 0) return HTTP_OPTIONS;
+  return HTTP_ANY;
+}
+
+
+static const char *findBytes(const char *haystack, size_t length, const char *needle, size_t needleLength)
+{
+  if (needleLength == 0 || length < needleLength) return NULL;
+  for (size_t i = 0; i + needleLength <= length; i++)
+  {
+    if (haystack[i] == needle[0] && memcmp(haystack + i, needle, needleLength) == 0)
+    {
+      return haystack + i;
+    }
+  }
+  return NULL;
+}
+
+
+HttpServer::HttpServer(uint16_t port)
+  : _listener(port)
+{
+  _routeCount = 0;
+  _notFound   = NULL;
+  _requestHook = NULL;
+  _requests   = 0;
+  _current    = NULL;
+  _argCount   = 0;
+  _responded  = false;
+  _heapLow    = 0;
+  _arena      = NULL;
+  _shedding   = false;
+  _shed       = 0;
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++)
+  {
+    _connections[i].active = false;
+    _connections[i].stream = -1;
+  }
+}
+
+
+void HttpServer::on(const char *uri, HTTPMethod method, THandlerFunction handler, bool essential)
+{
+  on(uri, method, handler, NULL, essential);
+}
+
+
+void HttpServer::on(const char *uri, HTTPMethod method, THandlerFunction handler, TBodyFunction body, bool essential)
+{
+  if (_routeCount >= HTTP_MAX_ROUTES) return;
+  _routes[_routeCount].uri     = uri;
+  _routes[_routeCount].method  = method;
+  _routes[_routeCount].handler = handler;
+  _routes[_routeCount].body    = body;
+  _routes[_routeCount].heapPeak = 0;
+  _routes[_routeCount].essential = essential;
+  _routeCount++;
+}
+
+
+void HttpServer::onNotFound(THandlerFunction handler)
+{
+  _notFound = handler;
+}
+
+
+void HttpServer::onRequest(THandlerFunction hook)
+{
+  _requestHook = hook;
+}
+
+
+void HttpServer::begin()
+{
+  _listener.begin();
+  _listener.setNoDelay(true);
+}
+
+
+void HttpServer::handleClient()
+{
+  _accept();
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++)
+  {
+    if (_connections[i].active) _service(_connections[i]);
+  }
+}
+
+
+uint8_t HttpServer::activeClients() const
+{
+  uint8_t count = 0;
+  for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++)
+  {
+    if (_connections[i].active) count++;
+  }
+  return count;
+}
+
+
+const char *HttpServer::routeUri(uint8_t i) const
+{
+  return i < _routeCount ? _routes[i].uri : NULL;
+}
+
+
+HTTPMethod HttpServer::routeMethod(uint8_t i) const
+{
+  return i < _routeCount ? _routes[i].method : HTTP_ANY;
+}
+
+
+uint16_t HttpServer::routeHeapPeak(uint8_t i) const
+{
+  return i < _routeCount ? _routes[i].heapPeak : 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  CONNECTIONS
+//
+void HttpServer::_accept()
+{
+  while (_listener.hasClient())
+  {
+    WiFiClient client = _listener.accept();
+    Connection *slot = NULL;
+    for (uint8_t i = 0; i < HTTP_MAX_CLIENTS; i++)
+    {
+      if (!_connections[i].active)
+      {
+        slot = &_connections[i];
+        break;
+      }
+    }
+    if (slot == NULL)
+    {
+      _sendError(client, 503);
+      client.stop();
+      continue;
+    }
+    client.setNoDelay(true);
+    slot->client        = client;
+    slot->active        = true;
+    slot->length        = 0;
+    slot->headerEnd     = 0;
+    slot->stream        = -1;
+    slot->served        = 0;
+    slot->lastActivity  = millis();
+  }
+}
+
+
+void HttpServer::_service(Connection &c)
+{
+  int available = c.client.available();
+  if (available > 0)
+  {
+    if (c.length >= HTTP_BUFFER_SIZE)
+    {
+      _sendError(c.client, 413);
+      _close(c);
+      return;
+    }
+    size_t room = HTTP_BUFFER_SIZE - c.length;
+    int n = c.client.read((uint8_t *)c.buffer + c.length, min((size_t)available, room));
+    if (n > 0)
+    {
+      c.length += n;
+      c.lastActivity = millis();
+    }
+  }
+  else if (!c.client.connected())
+  {
+    _close(c);
+    return;
+  }
+
+  //  serve every complete (pipelined) request in the buffer
+  while (c.active)
+  {
+    if (c.headerEnd == 0 && !_parseHead(c)) break;
+    if (c.stream >= 0 && !_streamBody(c)) break;
+    if (c.length < c.headerEnd + c.contentLength) break;
+    _dispatch(c);
+  }
+
+  if (c.active && millis() - c.lastActivity > HTTP_KEEPALIVE_TIMEOUT)
+  {
+    _close(c);
+  }
+}
+
+
+//  Finds the end of the head, reads Content-Length and Connection.
+//  Returns false while the head is incomplete.
+bool HttpServer::_parseHead(Connection &c)
+{
+  c.buffer[c.length] = 0;
+  const char *end = findBytes(c.buffer, c.length, "\r\n\r\n", 4);
+  if (end == NULL)
+  {
+    if (c.length >= HTTP_BUFFER_SIZE)
+    {
+      _sendError(c.client, 413);
+      _close(c);
+    }
+    return false;
+  }
+  const char *line = findBytes(c.buffer, c.length, "\r\n", 2);
+  c.headerStart = line - c.buffer + 2;
+  c.headerEnd   = end - c.buffer + 4;
+
+  const char *value;
+  uint16_t    length;
+  bool  hasLength     = _findHeader(c, "Content-Length", &value, &length);
+  long  contentLength = hasLength ? atol(value) : 0;
+  int8_t stream       = _streamRoute(c);
+  c.contentLength = 0;
+  if (stream >= 0)
+  {
+    //  turned away before the body comes, which may be large
+    int code = 0;
+    if (!hasLength || contentLength < 0) code = 411;
+    else if (_shedding && !_routes[stream].essential) code = 503;
+    if (code)
+    {
+      if (code == 503) _shed++;
+      _sendError(c.client, code);
+      _close(c);
+      return false;
+    }
+    c.stream     = stream;
+    c.streamLeft = contentLength;
+    if (!_routes[stream].body(HTTP_BODY_START, NULL, contentLength)) c.stream = -1;
+  }
+  else if (hasLength)
+  {
+    if (contentLength < 0 || c.headerEnd + contentLength > HTTP_BUFFER_SIZE)
+    {
+      _sendError(c.client, 413);
+      _close(c);
+      return false;
+    }
+    c.contentLength = contentLength;
+  }
+
+  //  HTTP/1.1 defaults to keep-alive, HTTP/1.0 to close
+  const char *version = findBytes(c.buffer, c.headerStart, "HTTP/1.1", 8);
+  c.keepAlive = version != NULL;
+  if (_findHeader(c, "Connection", &value, &length))
+  {
+    if (length >= 5 && strncasecmp(value, "close", 5) == 0)       c.keepAlive = false;
+    if (length >= 10 && strncasecmp(value, "keep-alive", 10) == 0) c.keepAlive = true;
+  }
+  //  a body cut short leaves the rest unread
+  if (stream >= 0 && c.stream < 0) c.keepAlive = false;
+  return true;
+}
+
+
+//  The route with a body function the request line names, -1 if none.
+//  The line is still whole here, it is cut up when dispatched.
+int8_t HttpServer::_streamRoute(const Connection &c) const
+{
+  const char *space = (const char *)memchr(c.buffer, ' ', c.headerStart);
+  if (space == NULL || space - c.buffer > 7) return -1;
+  char method[8];
+  memcpy(method, c.buffer, space - c.buffer);
+  method[space - c.buffer] = 0;
+  HTTPMethod requested = parseMethod(method);
+
+  const char *target = space + 1;
+  const char *end    = target;
+  while (end < c.buffer + c.headerStart && *end != ' ' && *end != '?' && *end != '\r') end++;
+  size_t targetLength = end - target;
+  for (uint8_t i = 0; i < _routeCount; i++)
+  {
+    if (_routes[i].body == NULL) continue;
+    if (_routes[i].method != HTTP_ANY && _routes[i].method != requested) continue;
+    if (strlen(_routes[i].uri) == targetLength && memcmp(_routes[i].uri, target, targetLength) == 0) return i;
+  }
+  return -1;
+}
+
+
+//  Hands the body bytes in the buffer to the body function and drops
+//  them. True once the body is complete, the handler runs then.
+bool HttpServer::_streamBody(Connection &c)
+{
+  uint32_t n = c.length - c.headerEnd;
+  if (n > c.streamLeft) n = c.streamLeft;
+  if (n > 0)
+  {
+    uint8_t *data = (uint8_t *)c.buffer + c.headerEnd;
+    bool more = _routes[c.stream].body(HTTP_BODY_DATA, data, n);
+    memmove(data, data + n, c.length - c.headerEnd - n);
+    c.length     -= n;
+    c.streamLeft -= n;
+    if (!more)
+    {
+      c.stream    = -1;
+      c.keepAlive = false;
+      return true;
+    }
+  }
+  if (c.streamLeft > 0) return false;
+  c.stream = -1;
+  return true;
+}
+
+
+void HttpServer::_dispatch(Connection &c)
+{
+  //  the request line and the args are cut up in place; keep the
+  //  first byte of the next pipelined request out of reach.
+  uint16_t requestEnd = c.headerEnd + c.contentLength;
+  char     next       = c.buffer[requestEnd];
+  c.buffer[requestEnd] = 0;
+
+  _current   = &c;
+  _argCount  = 0;
+  _responded = false;
+  c.served++;
+  _requests++;
+  if (c.served >= HTTP_MAX_KEEPALIVE_REQUESTS) c.keepAlive = false;
+
+  //  "GET /path?query HTTP/1.1"
+  char *method = c.buffer;
+  char *target = strchr(method, ' ');
+  char *query  = NULL;
+  if (target == NULL || target > c.buffer + c.headerStart)
+  {
+    _sendError(c.client, 400);
+    _close(c);
+    _current = NULL;
+    return;
+  }
+  *target++ = 0;
+  char *space = strchr(target, ' ');
+  if (space) *space = 0;
+  char *mark = strchr(target, '?');
+  if (mark)
+  {
+    *mark = 0;
+    query = mark + 1;
+  }
+  _method = parseMethod(method);
+  _uri    = target;
+  _parseArgs(c, query, c.buffer + c.headerEnd);
+  if (_requestHook) _requestHook();
+
+  Route *route = NULL;
+  bool uriMatched = false;
+  for (uint8_t i = 0; i < _routeCount; i++)
+  {
+    if (strcmp(_routes[i].uri, _uri) != 0) continue;
+    uriMatched = true;
+    if (_routes[i].method == HTTP_ANY || _routes[i].method == _method)
+    {
+      route = &_routes[i];
+      break;
+    }
+  }
+  //  a streamed body was let in before, its handler has to finish it
+  if (route && _shedding && !route->essential && route->body == NULL)
+  {
+    _shed++;
+    send(503, "text/plain", "Busy, retry later");
+  }
+  else if (route)
+  {
+    //  the heap is sampled when the response goes out, where the
+    //  handler holds the most
+    uint32_t heapBefore = ESP.getFreeHeap();
+    _heapLow = heapBefore;
+    route->handler();
+    _sampleHeap();
+    uint32_t used = heapBefore > _heapLow ? heapBefore - _heapLow : 0;
+    if (used > route->heapPeak) route->heapPeak = used > 0xFFFF ? 0xFFFF : used;
+  }
+  else if (_notFound)
+  {
+    _notFound();
+  }
+  else
+  {
+    //  same text as ESP8266WebServer
+    char message[96];
+    int n = snprintf(message, sizeof(message), "%s%s", uriMatched ? "Method Not Allowed: " : "Not found: ", _uri);
+    send(uriMatched ? 405 : 404, "text/plain", message, n < (int)sizeof(message) ? n : sizeof(message) - 1);
+  }
+  if (!_responded) send(500, "text/plain", "No response");
+  if (_arena) _arena->reset();
+  _current = NULL;
+
+  if (!c.active) return;
+  if (!c.keepAlive)
+  {
+    _close(c);
+    return;
+  }
+  //  move a pipelined request to the front
+  c.buffer[requestEnd] = next;
+  memmove(c.buffer, c.buffer + requestEnd, c.length - requestEnd);
+  c.length   -= requestEnd;
+  c.headerEnd = 0;
+}
+
+
+void HttpServer::_parseArgs(Connection &c, char *query, char *body)
+{
+  if (query) _parseUrlEncoded(query);
+
+  if (c.contentLength == 0) return;
+  const char *type;
+  uint16_t    typeLength;
+  bool hasType = _findHeader(c, "Content-Type", &type, &typeLength);
+  if (hasType && typeLength >= 33 && strncasecmp(type, "application/x-www-form-urlencoded", 33) == 0)
+  {
+    _parseUrlEncoded(body);
+  }
+  else if (hasType && typeLength >= 19 && strncasecmp(type, "multipart/form-data", 19) == 0)
+  {
+    _parseMultipart(c, body);
+  }
+  else
+  {
+    //  a JSON object, whatever the type says, gives its members as args
+    BodyField fields[HTTP_MAX_ARGS];
+    int16_t count = tokenizeJson(body, c.contentLength, fields, HTTP_MAX_ARGS - _argCount);
+    if (count < 0)
+    {
+      _addArg("plain", body, c.contentLength);
+      return;
+    }
+    for (int16_t i = 0; i < count; i++) _addArg(fields[i].name, fields[i].value, fields[i].length);
+  }
+}
+
+
+//  "a=1&b=2" => args, decoded in place
+void HttpServer::_parseUrlEncoded(char *text)
+{
+  BodyField fields[HTTP_MAX_ARGS];
+  uint8_t count = tokenizeForm(text, fields, HTTP_MAX_ARGS - _argCount);
+  for (uint8_t i = 0; i < count; i++) _addArg(fields[i].name, fields[i].value, fields[i].length);
+}
+
+
+//  multipart/form-data as sent by a browser FormData, fields only.
+void HttpServer::_parseMultipart(Connection &c, char *body)
+{
+  const char *type;
+  uint16_t    typeLength;
+  _findHeader(c, "Content-Type", &type, &typeLength);
+  const char *b = findBytes(type, typeLength, "boundary=", 9);
+  if (b == NULL) return;
+  b += 9;
+  const char *boundaryEnd = type + typeLength;
+  const char *semicolon = (const char *)memchr(b, ';', boundaryEnd - b);
+  if (semicolon) boundaryEnd = semicolon;
+  if (b < boundaryEnd && *b == '"') b++;
+  if (boundaryEnd > b && boundaryEnd[-1] == '"') boundaryEnd--;
+  char delimiter[76] = "\r\n--";
+  size_t boundaryLength = boundaryEnd - b;
+  if (boundaryLength == 0 || boundaryLength > 70) return;
+  memcpy(delimiter + 4, b, boundaryLength);
+  size_t delimiterLength = boundaryLength + 4;
+
+  //  the first delimiter has no leading CRLF
+  char  *end = body + c.contentLength;
+  char  *p   = (char *)findBytes(body, end - body, delimiter + 2, delimiterLength - 2);
+  if (p == NULL) return;
+  p += delimiterLength - 2;
+  while (p + 2 <= end && !(p[0] == '-' && p[1] == '-'))
+  {
+    char *head = (char *)findBytes(p, end - p, "\r\n\r\n", 4);
+    if (head == NULL) return;
+    char *value = head + 4;
+    char *next  = (char *)findBytes(value, end - value, delimiter, delimiterLength);
+    if (next == NULL) return;
+
+    const char *name = findBytes(p, head - p, "name=\"", 6);
+    if (name)
+    {
+      name += 6;
+      char *quote = (char *)memchr(name, '"', head - name);
+      if (quote)
+      {
+        *quote = 0;
+        *next  = 0;
+        _addArg(name, value, next - value);
+      }
+    }
+    p = next + delimiterLength;
+  }
+}
+
+
+void HttpServer::_addArg(const char *name, const char *value, uint16_t length)
+{
+  if (_argCount >= HTTP_MAX_ARGS) return;
+  _args[_argCount].name   = name;
+  _args[_argCount].value  = value;
+  _args[_argCount].length = length;
+  _argCount++;
+}
+
+
+void HttpServer::_close(Connection &c)
+{
+  if (c.stream >= 0) _routes[c.stream].body(HTTP_BODY_ABORTED, NULL, 0);
+  c.stream    = -1;
+  c.client.stop();
+  c.active    = false;
+  c.length    = 0;
+  c.headerEnd = 0;
+}
+
+
+bool HttpServer::_findHeader(const Connection &c, const char *name, const char **value, uint16_t *length) const
+{
+  size_t nameLength = strlen(name);
+  const char *p   = c.buffer + c.headerStart;
+  const char *end = c.buffer + c.headerEnd - 2;
+  while (p < end)
+  {
+    const char *eol = findBytes(p, end - p + 2, "\r\n", 2);
+    if (eol == NULL) break;
+    if ((size_t)(eol - p) > nameLength && p[nameLength] == ':' && strncasecmp(p, name, nameLength) == 0)
+    {
+      const char *v = p + nameLength + 1;
+      while (v < eol && *v == ' ') v++;
+      *value  = v;
+      *length = eol - v;
+      return true;
+    }
+    p = eol + 2;
+  }
+  return false;
+}
+
+
+void HttpServer::_sendError(WiFiClient &client, int code)
+{
+  char head[128];
+  int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                   code, statusText(code));
+  client.write((const uint8_t *)head, n);
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  REQUEST
+//
+HTTPMethod HttpServer::method() const
+{
+  return _method;
+}
+
+
+String HttpServer::uri() const
+{
+  return String(_uri ? _uri : "");
+}
+
+
+void *HttpServer::alloc(size_t size)
+{
+  return _arena ? _arena->alloc(size) : NULL;
+}
+
+
+const char *HttpServer::argValue(const char *name, size_t *length) const
+{
+  for (uint8_t i = 0; i < _argCount; i++)
+  {
+    if (strcmp(_args[i].name, name) == 0)
+    {
+      if (length) *length = _args[i].length;
+      return _args[i].value;
+    }
+  }
+  return NULL;
+}
+
+
+const char *HttpServer::argName(uint8_t i) const
+{
+  if (i >= _argCount) return NULL;
+  return _args[i].name;
+}
+
+
+const char *HttpServer::argValueAt(uint8_t i, size_t *length) const
+{
+  if (i >= _argCount) return NULL;
+  if (length) *length = _args[i].length;
+  return _args[i].value;
+}
+
+
+bool HttpServer::hasArg(const char *name) const
+{
+  return argValue(name) != NULL;
+}
+
+
+String HttpServer::arg(const char *name) const
+{
+  size_t length;
+  const char *value = argValue(name, &length);
+  String s;
+  if (value)
+  {
+    s.reserve(length);
+    for (size_t i = 0; i < length; i++) s += value[i];
+  }
+  return s;
+}
+
+
+bool HttpServer::hasHeader(const char *name) const
+{
+  const char *value;
+  uint16_t    length;
+  return _current && _findHeader(*_current, name, &value, &length);
+}
+
+
+String HttpServer::header(const char *name) const
+{
+  const char *value;
+  uint16_t    length;
+  String s;
+  if (_current && _findHeader(*_current, name, &value, &length))
+  {
+    s.reserve(length);
+    for (uint16_t i = 0; i < length; i++) s += value[i];
+  }
+  return s;
+}
+
+
+const char *HttpServer::headerValue(const char *name, size_t *length) const
+{
+  const char *value;
+  uint16_t    n;
+  if (_current == NULL || !_findHeader(*_current, name, &value, &n)) return NULL;
+  *length = n;
+  return value;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  RESPONSE
+//
+void HttpServer::send(int code, const char *contentType, const char *content, size_t length)
+{
+  if (_current == NULL || _responded) return;
+  _responded = true;
+  _sampleHeap();
+  Connection &c = *_current;
+
+  char head[192];
+  int n = _head(head, sizeof(head), code, contentType, length);
+  if (_method == HTTP_HEAD) length = 0;
+
+  //  small responses go out in one segment
+  char packet[512];
+  if (n + length <= sizeof(packet))
+  {
+    memcpy(packet, head, n);
+    memcpy(packet + n, content, length);
+    c.client.write((const uint8_t *)packet, n + length);
+  }
+  else
+  {
+    c.client.write((const uint8_t *)head, n);
+    c.client.write((const uint8_t *)content, length);
+  }
+  c.lastActivity = millis();
+}
+
+
+void HttpServer::send(int code, const char *contentType, const char *content)
+{
+  send(code, contentType, content, strlen(content));
+}
+
+
+void HttpServer::send(int code, const char *contentType, const String &content)
+{
+  send(code, contentType, content.c_str(), content.length());
+}
+
+
+void HttpServer::send_P(int code, const char *contentType, PGM_P content)
+{
+  size_t length = strlen_P(content);
+  beginSend(code, contentType, length);
+  char buffer[256];
+  for (size_t sent = 0; sent < length; sent += sizeof(buffer))
+  {
+    size_t n = length - sent < sizeof(buffer) ? length - sent : sizeof(buffer);
+    memcpy_P(buffer, content + sent, n);
+    sendContent((const uint8_t *)buffer, n);
+  }
+}
+
+
+void HttpServer::beginSend(int code, const char *contentType, size_t length)
+{
+  if (_current == NULL || _responded) return;
+  _responded = true;
+  _sampleHeap();
+  char head[192];
+  int n = _head(head, sizeof(head), code, contentType, length);
+  _current->client.write((const uint8_t *)head, n);
+  _current->lastActivity = millis();
+}
+
+
+void HttpServer::sendContent(const uint8_t *content, size_t length)
+{
+  if (_current == NULL || _method == HTTP_HEAD) return;
+  _sampleHeap();
+  _current->client.write(content, length);
+  _current->lastActivity = millis();
+}
+
+
+void HttpServer::_sampleHeap()
+{
+  uint32_t heap = ESP.getFreeHeap();
+  if (heap < _heapLow) _heapLow = heap;
+}
+
+
+int HttpServer::_head(char *buffer, size_t size, int code, const char *contentType, size_t length)
+{
+  return snprintf(buffer, size,
+                  "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %u\r\nConnection: %s\r\n\r\n",
+                  code, statusText(code), contentType, (unsigned) length,
+                  _current->keepAlive ? "keep-alive" : "close");
+}
+
+
+//  -- END OF FILE --
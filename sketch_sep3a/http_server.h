@@ -0,0 +1,193 @@
+#pragma once
+//
+//    FILE: http_server.h
+// PURPOSE: Small HTTP/1.1 server for the pig pen controller.
+//
+//  NOTES
+//  Drop-in for the part of ESP8266WebServer the sketch uses: the same
+//  on() route table and the same arg() / hasArg() / send() handler API.
+//  Unlike ESP8266WebServer it keeps several connections open at once,
+//  honours HTTP/1.1 keep-alive (and pipelined requests), and every call
+//  of handleClient() serves all connections that have a complete request.
+//  The sketch calls it from loop() and while it waits between passes.
+//
+//  Each connection parses its request in place in a fixed buffer: no
+//  heap allocation happens until a handler asks for an arg() as String.
+//  argValue() hands out the decoded value where it lies, parse it with
+//  the field functions of request_body.h. Scratch memory of a handler
+//  comes from alloc(), an arena the server resets after every request.
+//
+//  A route with a body function gets its body as it arrives instead:
+//  in pieces, however long it is, and its handler runs once the last
+//  piece is in. That is for uploads larger than the buffer (firmware);
+//  args of such a request come from the query only.
+//
+//  While shedding (low or fragmented heap) only the routes registered
+//  as essential are served, the others get 503 right away.
+//  Handlers run in loop() context, so delay() and yield() stay legal.
+
+
+#include <ESP8266WiFi.h>
+#include "arena.h"
+
+
+#define HTTP_MAX_CLIENTS            4
+#define HTTP_MAX_ROUTES             32
+#define HTTP_MAX_ARGS               8
+#define HTTP_BUFFER_SIZE            1024     // request line + headers + body
+#define HTTP_KEEPALIVE_TIMEOUT      5000     // ms an idle connection stays open
+#define HTTP_MAX_KEEPALIVE_REQUESTS 100
+
+
+enum HTTPMethod { HTTP_ANY, HTTP_GET, HTTP_HEAD, HTTP_POST, HTTP_PUT, HTTP_PATCH, HTTP_DELETE, HTTP_OPTIONS };
+
+
+//  state of a streamed request body
+enum HttpBodyState : uint8_t
+{
+  HTTP_BODY_START = 0,        //  length is the Content-Length, data NULL
+  HTTP_BODY_DATA,
+  HTTP_BODY_ABORTED           //  the connection closed before the end
+};
+
+
+class HttpServer
+{
+public:
+  typedef void (*THandlerFunction)();
+  //  false stops the body, the handler runs right away and the
+  //  connection closes after its response
+  typedef bool (*TBodyFunction)(uint8_t state, const uint8_t *data, size_t length);
+
+  HttpServer(uint16_t port);
+
+  void       on(const char *uri, HTTPMethod method, THandlerFunction handler, bool essential = false);
+  void       on(const char *uri, HTTPMethod method, THandlerFunction handler, TBodyFunction body, bool essential = false);
+  void       onNotFound(THandlerFunction handler);
+  //  runs before the handler of every request, e.g. to log it
+  void       onRequest(THandlerFunction hook);
+  void       begin();
+
+  //  accepts new connections and dispatches every complete request.
+  void       handleClient();
+
+  //  scratch memory of the handlers, without it alloc() gives NULL
+  void       setArena(Arena *arena)  { _arena = arena; };
+  void       setShedding(bool shedding)  { _shedding = shedding; };
+  bool       shedding() const  { return _shedding; };
+  uint32_t   requestsShed() const  { return _shed; };
+
+  //  REQUEST - valid inside a handler
+  HTTPMethod method() const;
+  String     uri() const;
+  const char *uriValue() const  { return _uri ? _uri : ""; };
+  //  ARENA_ALIGN aligned, valid until the handler returns; NULL when
+  //  the arena is full
+  void      *alloc(size_t size);
+  bool       hasArg(const char *name) const;
+  String     arg(const char *name) const;
+  //  the members of a JSON object body are args too, any other body
+  //  is "plain" as in ESP8266WebServer
+  const char *argValue(const char *name, size_t *length = NULL) const;
+  uint8_t    args() const  { return _argCount; };
+  const char *argName(uint8_t i) const;
+  const char *argValueAt(uint8_t i, size_t *length = NULL) const;
+  bool       hasHeader(const char *name) const;
+  String     header(const char *name) const;
+  //  the header value where it lies, not NUL terminated; NULL if absent
+  const char *headerValue(const char *name, size_t *length) const;
+
+  //  RESPONSE - call once per request
+  void       send(int code, const char *contentType, const char *content, size_t length);
+  void       send(int code, const char *contentType, const char *content);
+  void       send(int code, const char *contentType, const String &content);
+  //  a body in flash, sent in pieces through a small buffer
+  void       send_P(int code, const char *contentType, PGM_P content);
+  //  larger bodies: the head with the total length, then the body
+  //  in pieces; the pieces must add up to length.
+  void       beginSend(int code, const char *contentType, size_t length);
+  void       sendContent(const uint8_t *content, size_t length);
+
+  uint8_t    activeClients() const;
+  uint32_t   requestsServed() const { return _requests; };
+
+  //  ROUTES - for the memory report: the most heap a handler took,
+  //  sampled when it starts, sends and returns
+  uint8_t    routes() const  { return _routeCount; };
+  const char *routeUri(uint8_t i) const;
+  HTTPMethod routeMethod(uint8_t i) const;
+  uint16_t   routeHeapPeak(uint8_t i) const;
+
+private:
+  struct Route
+  {
+    const char       *uri;
+    HTTPMethod        method;
+    THandlerFunction  handler;
+    TBodyFunction     body;           //  NULL: the body is buffered
+    uint16_t          heapPeak;       //  bytes
+    bool              essential;      //  served while shedding
+  };
+
+  struct Arg
+  {
+    const char *name;
+    const char *value;
+    uint16_t    length;
+  };
+
+  struct Connection
+  {
+    WiFiClient    client;
+    bool          active;
+    char          buffer[HTTP_BUFFER_SIZE + 1];
+    uint16_t      length;
+    uint16_t      headerStart;    //  first byte after the request line
+    uint16_t      headerEnd;      //  first byte of the body
+    uint16_t      contentLength;
+    int8_t        stream;         //  route taking the body, -1 none
+    uint32_t      streamLeft;     //  bytes of it still to come
+    bool          keepAlive;
+    uint8_t       served;
+    unsigned long lastActivity;
+  };
+
+  void       _accept();
+  void       _service(Connection &c);
+  bool       _parseHead(Connection &c);
+  int8_t     _streamRoute(const Connection &c) const;
+  bool       _streamBody(Connection &c);
+  void       _dispatch(Connection &c);
+  void       _parseArgs(Connection &c, char *query, char *body);
+  void       _parseUrlEncoded(char *text);
+  void       _parseMultipart(Connection &c, char *body);
+  void       _addArg(const char *name, const char *value, uint16_t length);
+  void       _close(Connection &c);
+  bool       _findHeader(const Connection &c, const char *name, const char **value, uint16_t *length) const;
+  void       _sendError(WiFiClient &client, int code);
+  void       _sampleHeap();
+  int        _head(char *buffer, size_t size, int code, const char *contentType, size_t length);
+
+  WiFiServer       _listener;
+  Route            _routes[HTTP_MAX_ROUTES];
+  uint8_t          _routeCount;
+  THandlerFunction _notFound;
+  THandlerFunction _requestHook;
+  Connection       _connections[HTTP_MAX_CLIENTS];
+  uint32_t         _requests;
+
+  //  current request
+  Connection      *_current;
+  HTTPMethod       _method;
+  const char      *_uri;
+  Arg              _args[HTTP_MAX_ARGS];
+  uint8_t          _argCount;
+  bool             _responded;
+  uint32_t         _heapLow;
+  Arena           *_arena;
+  bool             _shedding;
+  uint32_t         _shed;
+};
+
+
+//  -- END OF FILE --
@@ -0,0 +1,164 @@
+//
+//    FILE: journal.cpp
+// PURPOSE: Append-only journal of the events of the pig pen controller
+//          with sequence numbers, for clients that poll now and then.
+//
+
+
+#include "journal.h"
+#include "crc16.h"
+
+
+static const char nameUnknown[]      PROGMEM = "unknown";
+static const char nameBoot[]         PROGMEM = "boot";
+static const char nameFeedSchedule[] PROGMEM = "feed_schedule";
+static const char nameWashSchedule[] PROGMEM = "wash_schedule";
+static const char nameServoOpen[]    PROGMEM = "servo_open";
+static const char nameServoClose[]   PROGMEM = "servo_close";
+static const char nameWashStart[]    PROGMEM = "wash_start";
+static const char nameWashStop[]     PROGMEM = "wash_stop";
+static const char nameTare[]         PROGMEM = "tare";
+static const char nameConfig[]       PROGMEM = "config";
+static const char nameWifiDown[]     PROGMEM = "wifi_down";
+static const char nameWifiUp[]       PROGMEM = "wifi_up";
+static const char nameHeap[]         PROGMEM = "heap";
+static const char nameWashVolume[]   PROGMEM = "wash_volume";
+
+//  names and table in flash, by JournalType
+static PGM_P const typeNames[JOURNAL_TYPES] PROGMEM =
+{
+  nameUnknown, nameBoot, nameFeedSchedule, nameWashSchedule, nameServoOpen, nameServoClose,
+  nameWashStart, nameWashStop, nameTare, nameConfig, nameWifiDown, nameWifiUp, nameHeap,
+  nameWashVolume
+};
+
+
+static void put32(uint8_t *p, uint32_t value)
+{
+  p[0] = value;
+  p[1] = value >> 8;
+  p[2] = value >> 16;
+  p[3] = value >> 24;
+}
+
+
+static uint32_t get32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+Journal::Journal(JournalEvent *ring, uint16_t size)
+{
+  _ring  = ring;
+  _size  = size;
+  _head  = 0;
+  _count = 0;
+  _next  = 1;
+  _sink  = NULL;
+}
+
+
+uint32_t Journal::add(uint8_t type, uint8_t arg, int32_t value, uint32_t epoch, uint32_t uptime)
+{
+  JournalEvent event;
+  event.seq    = _next;
+  event.epoch  = epoch;
+  event.uptime = uptime;
+  event.value  = value;
+  event.type   = type;
+  event.arg    = arg;
+  restore(event);
+  if (_sink)
+  {
+    uint8_t record[JOURNAL_RECORD_SIZE];
+    encode(event, record);
+    _sink(record);
+  }
+  return event.seq;
+}
+
+
+void Journal::restore(const JournalEvent &event)
+{
+  _ring[_head] = event;
+  _head = (_head + 1) % _size;
+  if (_count < _size) _count++;
+  _next = event.seq + 1;
+}
+
+
+uint32_t Journal::oldest() const
+{
+  return _next - _count;
+}
+
+
+bool Journal::get(uint32_t seq, JournalEvent &event) const
+{
+  if (seq < oldest() || seq >= _next) return false;
+  //  the newest event is just before _head
+  uint16_t back = _next - seq;
+  event = _ring[(_head + _size - back) % _size];
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  RECORD
+//
+void Journal::encode(const JournalEvent &event, uint8_t *record)
+{
+  put32(record, event.seq);
+  put32(record + 4, event.epoch);
+  put32(record + 8, event.uptime);
+  put32(record + 12, (uint32_t)event.value);
+  record[16] = event.type;
+  record[17] = event.arg;
+  uint16_t crc = crc16(CRC16_INIT, record, 18);
+  record[18] = crc;
+  record[19] = crc >> 8;
+}
+
+
+bool Journal::decode(const uint8_t *record, JournalEvent &event)
+{
+  uint16_t crc = record[18] | (record[19] << 8);
+  if (crc != crc16(CRC16_INIT, record, 18)) return false;
+  event.seq    = get32(record);
+  event.epoch  = get32(record + 4);
+  event.uptime = get32(record + 8);
+  event.value  = (int32_t)get32(record + 12);
+  event.type   = record[16];
+  event.arg    = record[17];
+  return event.seq != 0;
+}
+
+
+PGM_P Journal::typeName(uint8_t type)
+{
+  return (PGM_P)pgm_read_ptr(&typeNames[type < JOURNAL_TYPES ? type : 0]);
+}
+
+
+void Journal::write(Encoder &encoder, const JournalEvent &event)
+{
+  encoder.beginMap(6);
+  encoder.key(PSTR("seq"));
+  encoder.uinteger(event.seq);
+  encoder.key(PSTR("time"));
+  encoder.uinteger(event.epoch);
+  encoder.key(PSTR("uptime"));
+  encoder.uinteger(event.uptime);
+  encoder.key(PSTR("type"));
+  encoder.stringP(typeName(event.type));
+  encoder.key(PSTR("arg"));
+  encoder.uinteger(event.arg);
+  encoder.key(PSTR("value"));
+  encoder.integer(event.value);
+  encoder.end();
+}
+
+
+//  -- END OF FILE --
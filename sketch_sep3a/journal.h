@@ -0,0 +1,146 @@
+#pragma once
+//
+//    FILE: journal.h
+// PURPOSE: Append-only journal of the events of the pig pen controller
+//          with sequence numbers, for clients that poll now and then.
+//
+//  NOTES
+//  Every event gets the next sequence number, numbers never repeat and
+//  continue across reboots (the sketch restores them from flash). A
+//  client asks for the events after the last number it saw and misses
+//  nothing as long as that one is still kept: the newest events are in
+//  a RAM ring, the sink appends each one to flash as well.
+//
+//  RECORD (JOURNAL_RECORD_SIZE bytes, little endian)
+//    0   4   sequence number, from 1
+//    4   4   epoch seconds, 0 = clock not set
+//    8   4   millis() since boot
+//   12   4   value, by type
+//   16   1   type
+//   17   1   arg, by type
+//   18   2   CRC-16/CCITT of bytes 0..17
+//
+//  TYPE            ARG                     VALUE
+//  boot            -                       -
+//  feed_schedule   schedule index          minute of the day
+//  wash_schedule   schedule index          minute of the day
+//  servo_open      -                       position, tenths of a degree
+//  servo_close     -                       centigrams dropped
+//  wash_start      -                       -
+//  wash_stop       JOURNAL_STOP_*          ms the wash ran
+//  tare            -                       HX711 offset
+//  config          JOURNAL_CONFIG_*        firmware: size of the new image
+//  wifi_down       -                       -
+//  wifi_up         -                       ms the outage lasted
+//  heap            HEAP_SHED or HEAP_OK    largest free block, bytes
+//  wash_volume     mean flow, L/min        millilitres the wash used
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "encoder.h"
+
+
+#define JOURNAL_RECORD_SIZE     20
+
+
+enum JournalType : uint8_t
+{
+  JOURNAL_BOOT = 1,
+  JOURNAL_FEED_SCHEDULE,
+  JOURNAL_WASH_SCHEDULE,
+  JOURNAL_SERVO_OPEN,
+  JOURNAL_SERVO_CLOSE,
+  JOURNAL_WASH_START,
+  JOURNAL_WASH_STOP,
+  JOURNAL_TARE,
+  JOURNAL_CONFIG,
+  JOURNAL_WIFI_DOWN,
+  JOURNAL_WIFI_UP,
+  JOURNAL_HEAP,
+  JOURNAL_WASH_VOLUME,
+  JOURNAL_TYPES
+};
+
+
+//  arg of JOURNAL_CONFIG
+enum JournalConfig : uint8_t
+{
+  JOURNAL_CONFIG_SCHEDULES = 0,
+  JOURNAL_CONFIG_WIFI,
+  JOURNAL_CONFIG_STATS,         //  rollups cleared
+  JOURNAL_CONFIG_FIRMWARE       //  a new image is in, value is its size
+};
+
+
+//  arg of JOURNAL_WASH_STOP, what ended the wash
+enum JournalWashStop : uint8_t
+{
+  JOURNAL_STOP_MANUAL = 0,
+  JOURNAL_STOP_TIMER,           //  the duration, or the time cap of a metered wash
+  JOURNAL_STOP_VOLUME,          //  the target volume ran
+  JOURNAL_STOP_NO_FLOW          //  the flow meter saw no water
+};
+
+
+struct JournalEvent
+{
+  uint32_t seq;
+  uint32_t epoch;
+  uint32_t uptime;
+  int32_t  value;
+  uint8_t  type;
+  uint8_t  arg;
+};
+
+
+//  called with every event added, the record is JOURNAL_RECORD_SIZE bytes
+typedef void (*JournalSink)(const uint8_t *record);
+
+
+class Journal
+{
+public:
+  //  ring holds the size newest events
+  Journal(JournalEvent *ring, uint16_t size);
+
+  //  the number the next event gets, e.g. after the last one in flash
+  void     setSequence(uint32_t next)  { _next = next; };
+  void     setSink(JournalSink sink)    { _sink = sink; };
+
+  //  returns the sequence number of the event
+  uint32_t add(uint8_t type, uint8_t arg, int32_t value, uint32_t epoch, uint32_t uptime);
+  //  puts an event read back from flash into the ring, not to the sink;
+  //  events must come in order
+  void     restore(const JournalEvent &event);
+
+  uint32_t next() const      { return _next; };
+  uint16_t count() const     { return _count; };
+  //  sequence number of the oldest event in RAM, next() if none
+  uint32_t oldest() const;
+  //  the event with sequence number seq, false if it is not in RAM
+  bool     get(uint32_t seq, JournalEvent &event) const;
+
+  //  RECORD - decode() false if the CRC does not match
+  static void        encode(const JournalEvent &event, uint8_t *record);
+  static bool        decode(const uint8_t *record, JournalEvent &event);
+
+  //  in flash
+  static PGM_P       typeName(uint8_t type);
+  //  {"seq": n, "time": e, "uptime": ms, "type": "name", "arg": a, "value": v}
+  static void        write(Encoder &encoder, const JournalEvent &event);
+
+private:
+  JournalEvent *_ring;
+  uint16_t     _size;
+  uint16_t     _head;           //  where the next event goes
+  uint16_t     _count;
+  uint32_t     _next;
+  JournalSink  _sink;
+};
+
+
+//  -- END OF FILE --
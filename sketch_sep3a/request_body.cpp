@@ -0,0 +1,417 @@
+//
+//    FILE: request_body.cpp
+// PURPOSE: In place tokenizers of request bodies and query strings,
+//          form-urlencoded and flat JSON objects, for the HTTP server.
+//
+
+
+#include "request_body.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+
+static int hexValue(char c)
+{
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  FORM
+//
+//  decodes %XX and '+' in place, returns the new length.
+static uint16_t urlDecode(char *s)
+{
+  char *out = s;
+  char *in  = s;
+  while (*in)
+  {
+    if (*in == '+')
+    {
+      *out++ = ' ';
+      in++;
+    }
+    else if (*in == '%' && hexValue(in[1]) >= 0 && hexValue(in[2]) >= 0)
+    {
+      *out++ = (char)(hexValue(in[1]) * 16 + hexValue(in[2]));
+      in += 3;
+    }
+    else
+    {
+      *out++ = *in++;
+    }
+  }
+  *out = 0;
+  return out - s;
+}
+
+
+uint8_t tokenizeForm(char *text, BodyField *fields, uint8_t max)
+{
+  uint8_t count = 0;
+  while (text && *text)
+  {
+    char *amp = strchr(text, '&');
+    if (amp) *amp = 0;
+    char *eq = strchr(text, '=');
+    const char *value = "";
+    uint16_t length = 0;
+    if (eq)
+    {
+      *eq = 0;
+      value  = eq + 1;
+      length = urlDecode(eq + 1);
+    }
+    urlDecode(text);
+    if (*text)
+    {
+      if (count < max)
+      {
+        fields[count].name   = text;
+        fields[count].value  = value;
+        fields[count].length = length;
+      }
+      if (count < 255) count++;
+    }
+    text = amp ? amp + 1 : NULL;
+  }
+  return count < max ? count : max;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  JSON
+//
+static char *skipSpace(char *p, char *end)
+{
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) p++;
+  return p;
+}
+
+
+static int32_t hex4(const char *p, const char *end)
+{
+  if (end - p < 4) return -1;
+  int32_t v = 0;
+  for (uint8_t i = 0; i < 4; i++)
+  {
+    int h = hexValue(p[i]);
+    if (h < 0) return -1;
+    v = v * 16 + h;
+  }
+  return v;
+}
+
+
+static char *putUtf8(char *out, uint32_t c)
+{
+  if (c < 0x80)
+  {
+    *out++ = c;
+  }
+  else if (c < 0x800)
+  {
+    *out++ = 0xC0 | (c >> 6);
+    *out++ = 0x80 | (c & 0x3F);
+  }
+  else if (c < 0x10000)
+  {
+    *out++ = 0xE0 | (c >> 12);
+    *out++ = 0x80 | ((c >> 6) & 0x3F);
+    *out++ = 0x80 | (c & 0x3F);
+  }
+  else
+  {
+    *out++ = 0xF0 | (c >> 18);
+    *out++ = 0x80 | ((c >> 12) & 0x3F);
+    *out++ = 0x80 | ((c >> 6) & 0x3F);
+    *out++ = 0x80 | (c & 0x3F);
+  }
+  return out;
+}
+
+
+//  p is the first byte after the opening quote. Returns the byte after
+//  the closing quote, NULL if the string is bad. With decode the string
+//  is unescaped in place and *decodedEnd is the end of the result.
+static char *scanString(char *p, char *end, bool decode, char **decodedEnd)
+{
+  char *out = p;
+  while (p < end)
+  {
+    char c = *p;
+    if (c == '"')
+    {
+      if (decodedEnd) *decodedEnd = out;
+      return p + 1;
+    }
+    if ((uint8_t)c < 0x20) return NULL;
+    if (c != '\\')
+    {
+      if (decode) *out = c;
+      out++;
+      p++;
+      continue;
+    }
+    if (end - p < 2) return NULL;
+    char e = p[1];
+    p += 2;
+    switch (e)
+    {
+      case '"':  c = '"';  break;
+      case '\\': c = '\\'; break;
+      case '/':  c = '/';  break;
+      case 'b':  c = '\b'; break;
+      case 'f':  c = '\f'; break;
+      case 'n':  c = '\n'; break;
+      case 'r':  c = '\r'; break;
+      case 't':  c = '\t'; break;
+      case 'u':
+      {
+        int32_t u = hex4(p, end);
+        if (u < 0) return NULL;
+        p += 4;
+        uint32_t code = u;
+        if (u >= 0xD800 && u <= 0xDBFF && end - p >= 6 && p[0] == '\\' && p[1] == 'u')
+        {
+          int32_t low = hex4(p + 2, end);
+          if (low >= 0xDC00 && low <= 0xDFFF)
+          {
+            code = 0x10000 + ((u - 0xD800) << 10) + (low - 0xDC00);
+            p += 6;
+          }
+        }
+        //  a lone surrogate is no character
+        if (code >= 0xD800 && code <= 0xDFFF) code = 0xFFFD;
+        if (decode) out = putUtf8(out, code);
+        continue;
+      }
+      default:
+        return NULL;
+    }
+    if (decode) *out = c;
+    out++;
+  }
+  return NULL;
+}
+
+
+//  -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?, true, false or null
+static char *scanScalar(char *p, char *end)
+{
+  static const char *const words[] = { "true", "false", "null" };
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    size_t n = strlen(words[i]);
+    if ((size_t)(end - p) >= n && memcmp(p, words[i], n) == 0) return p + n;
+  }
+  if (p < end && *p == '-') p++;
+  if (p >= end || *p < '0' || *p > '9') return NULL;
+  if (*p == '0') p++;
+  else while (p < end && *p >= '0' && *p <= '9') p++;
+  if (p < end && *p == '.')
+  {
+    p++;
+    if (p >= end || *p < '0' || *p > '9') return NULL;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+  }
+  if (p < end && (*p == 'e' || *p == 'E'))
+  {
+    p++;
+    if (p < end && (*p == '+' || *p == '-')) p++;
+    if (p >= end || *p < '0' || *p > '9') return NULL;
+    while (p < end && *p >= '0' && *p <= '9') p++;
+  }
+  return p;
+}
+
+
+//  p is at '{' or '[', returns the byte after the matching bracket
+static char *skipNested(char *p, char *end)
+{
+  uint32_t objects = 0;         //  bit per level, 1 = object
+  uint8_t  depth = 0;
+  while (p < end)
+  {
+    char c = *p;
+    if (c == '"')
+    {
+      p = scanString(p + 1, end, false, NULL);
+      if (p == NULL) return NULL;
+      continue;
+    }
+    if (c == '{' || c == '[')
+    {
+      if (depth == BODY_MAX_NESTING) return NULL;
+      objects = (objects << 1) | (c == '{');
+      depth++;
+    }
+    else if (c == '}' || c == ']')
+    {
+      if (depth == 0 || (objects & 1) != (uint32_t)(c == '}')) return NULL;
+      objects >>= 1;
+      if (--depth == 0) return p + 1;
+    }
+    p++;
+  }
+  return NULL;
+}
+
+
+//  one pass over the object, cutting it up only when fields is set
+static int16_t jsonObject(char *text, char *end, BodyField *fields, uint8_t max)
+{
+  bool    cut = fields != NULL;
+  int16_t count = 0;
+  char   *p = skipSpace(text, end);
+  if (p >= end || *p != '{') return -1;
+  p = skipSpace(p + 1, end);
+  if (p < end && *p == '}')
+  {
+    return skipSpace(p + 1, end) == end ? 0 : -1;
+  }
+  while (true)
+  {
+    if (p >= end || *p != '"') return -1;
+    char *name = p + 1;
+    char *nameEnd;
+    p = scanString(name, end, cut, &nameEnd);
+    if (p == NULL) return -1;
+    p = skipSpace(p, end);
+    if (p >= end || *p != ':') return -1;
+    p = skipSpace(p + 1, end);
+    if (p >= end) return -1;
+
+    char *value = p;
+    char *valueEnd;
+    if (*p == '"')
+    {
+      value = p + 1;
+      p = scanString(value, end, cut, &valueEnd);
+    }
+    else if (*p == '{' || *p == '[')
+    {
+      p = valueEnd = skipNested(p, end);
+    }
+    else
+    {
+      p = valueEnd = scanScalar(p, end);
+    }
+    if (p == NULL) return -1;
+
+    p = skipSpace(p, end);
+    char separator = p < end ? *p : 0;
+    if (separator != ',' && separator != '}') return -1;
+    if (cut)
+    {
+      //  the separator is read, its byte may take the NUL
+      *nameEnd  = 0;
+      *valueEnd = 0;
+      if (count < max)
+      {
+        fields[count].name   = name;
+        fields[count].value  = value;
+        fields[count].length = valueEnd - value;
+      }
+    }
+    if (count < INT16_MAX) count++;
+    p = skipSpace(p + 1, end);
+    if (separator == '}') break;
+  }
+  return p == end ? count : -1;
+}
+
+
+int16_t tokenizeJson(char *text, uint16_t length, BodyField *fields, uint8_t max)
+{
+  char *end = text + length;
+  //  validate first, nothing is written to a body that is no object
+  int16_t count = jsonObject(text, end, NULL, 0);
+  if (count < 0 || fields == NULL) return count;
+  count = jsonObject(text, end, fields, max);
+  return count < max ? count : max;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  VALUES
+//
+bool fieldIs(const char *value, uint16_t length, const char *text)
+{
+  if (value == NULL) return false;
+  return strlen(text) == length && memcmp(value, text, length) == 0;
+}
+
+
+bool fieldInt(const char *value, uint16_t length, int32_t &result)
+{
+  if (value == NULL || length == 0) return false;
+  uint16_t i = 0;
+  bool negative = value[0] == '-';
+  if (value[0] == '-' || value[0] == '+') i++;
+  if (i == length) return false;
+  int64_t v = 0;
+  for (; i < length; i++)
+  {
+    if (value[i] < '0' || value[i] > '9') return false;
+    v = v * 10 + (value[i] - '0');
+    if (v > (int64_t)INT32_MAX + 1) return false;
+  }
+  if (negative) v = -v;
+  if (v > INT32_MAX) return false;
+  result = (int32_t)v;
+  return true;
+}
+
+
+bool fieldFloat(const char *value, uint16_t length, float &result)
+{
+  if (value == NULL || length == 0) return false;
+  char number[32];
+  if (length >= sizeof(number)) return false;
+  memcpy(number, value, length);
+  number[length] = 0;
+  //  a sign, digits with at most one point, an exponent
+  char *p = number;
+  if (*p == '-' || *p == '+') p++;
+  bool digits = false;
+  bool point  = false;
+  for (; *p && *p != 'e' && *p != 'E'; p++)
+  {
+    if (*p >= '0' && *p <= '9') digits = true;
+    else if (*p == '.' && !point) point = true;
+    else return false;
+  }
+  if (!digits) return false;
+  if (*p)
+  {
+    p++;
+    if (*p == '-' || *p == '+') p++;
+    if (*p == 0) return false;
+    for (; *p; p++)
+    {
+      if (*p < '0' || *p > '9') return false;
+    }
+  }
+  result = strtod(number, NULL);
+  return true;
+}
+
+
+bool fieldCopy(const char *value, uint16_t length, char *out, size_t size)
+{
+  if (value == NULL || length >= size || memchr(value, 0, length)) return false;
+  memcpy(out, value, length);
+  out[length] = 0;
+  return true;
+}
+
+
+//  -- END OF FILE --
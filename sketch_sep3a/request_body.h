@@ -0,0 +1,57 @@
+#pragma once
+//
+//    FILE: request_body.h
+// PURPOSE: In place tokenizers of request bodies and query strings,
+//          form-urlencoded and flat JSON objects, for the HTTP server.
+//
+//  NOTES
+//  Both cut the text up where it lies and return fields pointing into
+//  it: names and values are decoded in place and NUL terminated, no
+//  copy and no heap. A decoded value is never longer than its source.
+//
+//  JSON: the body must be one object. String members are unescaped
+//  (\uXXXX as UTF-8), numbers, true, false and null are kept as they
+//  were written, nested objects and arrays as their whole text, only
+//  checked for balanced brackets. Anything else is rejected before a
+//  byte is written, so the caller can still use the body as it came.
+//
+//  tools/fuzz_body runs both on random and mutated input on a host.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define BODY_MAX_NESTING    32
+
+
+struct BodyField
+{
+  const char *name;
+  const char *value;
+  uint16_t    length;           //  of the value, it may hold a NUL from %00 or \u0000
+};
+
+
+//  "a=1&b=2" up to its NUL, %XX and '+' decoded. Empty names are
+//  skipped. Returns the number of fields kept, at most max.
+uint8_t  tokenizeForm(char *text, BodyField *fields, uint8_t max);
+
+//  {"a": 1, "b": "x"} of length bytes. Returns the number of members
+//  kept, at most max, or -1 if the text is not a JSON object. Without
+//  fields it only checks the text.
+int16_t  tokenizeJson(char *text, uint16_t length, BodyField *fields, uint8_t max);
+
+
+//  VALUES - false when the value is missing (NULL) or does not match
+//  as a whole, e.g. "12abc" is not a number.
+bool     fieldIs(const char *value, uint16_t length, const char *text);
+bool     fieldInt(const char *value, uint16_t length, int32_t &result);
+bool     fieldFloat(const char *value, uint16_t length, float &result);
+//  copies with a terminating NUL, false if it does not fit or holds a NUL
+bool     fieldCopy(const char *value, uint16_t length, char *out, size_t size);
+
+
+//  -- END OF FILE --
@@ -0,0 +1,99 @@
+//
+//    FILE: responses.cpp
+// PURPOSE: Bodies of the read-mostly endpoints of the pig pen
+//          controller, built from plain values through an Encoder.
+//
+
+
+#include "responses.h"
+
+
+void writeStatus(Encoder &e, const StatusView &s)
+{
+  e.beginMap(13);
+  e.key(PSTR("success"));
+  e.boolean(true);
+  e.key(PSTR("wifi"));
+  e.stringP(s.connected ? PSTR("Connected") : PSTR("Disconnected"));
+  e.key(PSTR("time"));
+  if (s.connected) e.string(s.time);
+  else             e.stringP(PSTR("No WiFi"));
+  e.key(PSTR("scale"));
+  e.stringP(s.scaleAvailable ? PSTR("Available") : PSTR("Disabled"));
+  e.key(PSTR("servo"));
+  e.stringP(s.servoAvailable ? (s.servoOpen ? PSTR("Open") : PSTR("Closed")) : PSTR("Disabled"));
+  e.key(PSTR("servoPosition"));
+  e.number(s.servoPosition / 10.0, 1);
+  e.key(PSTR("wash"));
+  e.stringP(s.washing ? PSTR("In Progress") : PSTR("Ready"));
+  e.key(PSTR("weight"));
+  e.number(s.weight, 2);
+  e.key(PSTR("lastFeedAmount"));
+  e.number(s.lastFeed, 2);
+  e.key(PSTR("weightStable"));
+  e.boolean(s.stable);
+  e.key(PSTR("flowRate"));
+  e.number(s.flowRate, 2);
+  e.key(PSTR("washVolume"));
+  e.number(s.washVolume, 2);
+  e.key(PSTR("washFlow"));
+  e.number(s.washFlow, 2);
+  e.end();
+}
+
+
+void writeSchedule(Encoder &e,
+                   const char *const *feed, uint8_t feedCount,
+                   const char *const *wash, uint8_t washCount)
+{
+  e.beginMap(3);
+  e.key(PSTR("success"));
+  e.boolean(true);
+  e.key(PSTR("feed_schedule"));
+  e.beginArray(feedCount);
+  for (uint8_t i = 0; i < feedCount; i++) e.string(feed[i]);
+  e.end();
+  e.key(PSTR("wash_schedule"));
+  e.beginArray(washCount);
+  for (uint8_t i = 0; i < washCount; i++) e.string(wash[i]);
+  e.end();
+  e.end();
+}
+
+
+void writeTime(Encoder &e, const char *time)
+{
+  e.beginMap(2);
+  e.key(PSTR("success"));
+  e.boolean(true);
+  e.key(PSTR("time"));
+  e.string(time);
+  e.end();
+}
+
+
+void writeMessage(Encoder &e, bool success, PGM_P message)
+{
+  e.beginMap(2);
+  e.key(PSTR("success"));
+  e.boolean(success);
+  e.key(PSTR("message"));
+  e.stringP(message);
+  e.end();
+}
+
+
+void formatClock(char *out, uint32_t epoch)
+{
+  uint32_t t = epoch % 86400UL;
+  uint8_t  part[3] = { (uint8_t)(t / 3600), (uint8_t)(t / 60 % 60), (uint8_t)(t % 60) };
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    out[i * 3]     = '0' + part[i] / 10;
+    out[i * 3 + 1] = '0' + part[i] % 10;
+    out[i * 3 + 2] = i < 2 ? ':' : 0;
+  }
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,51 @@
+#pragma once
+//
+//    FILE: responses.h
+// PURPOSE: Bodies of the read-mostly endpoints of the pig pen
+//          controller, built from plain values through an Encoder.
+//
+//  NOTES
+//  The sketch fills the views from its state and caches the bodies,
+//  one per format; the host benchmarks build the same bodies from
+//  fixed views. The keys are the same in JSON and in CBOR.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "encoder.h"
+
+
+struct StatusView
+{
+  bool        connected;
+  const char *time;             //  "HH:MM:SS", ignored when not connected
+  bool        scaleAvailable;
+  bool        servoAvailable;
+  bool        servoOpen;
+  uint16_t    servoPosition;    //  tenths of a degree
+  bool        washing;
+  float       weight;
+  float       lastFeed;         //  dropped since the gate opened
+  bool        stable;
+  float       flowRate;         //  g/s out of the hopper
+  float       washVolume;       //  litres of the running or the last wash
+  float       washFlow;         //  L/min through the flow meter
+};
+
+
+void   writeStatus(Encoder &encoder, const StatusView &status);
+void   writeSchedule(Encoder &encoder,
+                     const char *const *feed, uint8_t feedCount,
+                     const char *const *wash, uint8_t washCount);
+void   writeTime(Encoder &encoder, const char *time);
+//  {"success": s, "message": "text"}, text is a flash string
+void   writeMessage(Encoder &encoder, bool success, PGM_P message);
+
+//  epoch seconds as "HH:MM:SS", out holds at least 9 bytes
+void   formatClock(char *out, uint32_t epoch);
+
+
+//  -- END OF FILE --
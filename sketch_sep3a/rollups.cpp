@@ -0,0 +1,195 @@
+//
+//    FILE: rollups.cpp
+// PURPOSE: Running totals of the feedings and washes of the pig pen
+//          controller per hour, per day and per schedule slot.
+//
+
+
+#include "rollups.h"
+#include "crc16.h"
+
+#include <string.h>
+
+
+static const RollupCell emptyCell = { 0, 0, 0, 0, 0, 0 };
+
+
+static void addTo(RollupCell &cell, uint32_t stamp, float amount, uint32_t ms)
+{
+  if (cell.stamp != stamp || cell.count == 0)
+  {
+    cell.stamp = stamp;
+    cell.count = 0;
+    cell.sum   = 0;
+    cell.min   = amount;
+    cell.max   = amount;
+    cell.ms    = 0;
+  }
+  cell.count++;
+  cell.sum += amount;
+  if (amount < cell.min) cell.min = amount;
+  if (amount > cell.max) cell.max = amount;
+  cell.ms += ms;
+}
+
+
+Rollups::Rollups()
+{
+  clear();
+}
+
+
+void Rollups::clear()
+{
+  memset(&_image, 0, sizeof(_image));
+  _image.version = ROLLUP_VERSION;
+}
+
+
+void Rollups::add(uint8_t kind, uint8_t slot, uint32_t epoch, float amount, uint32_t ms)
+{
+  if (kind >= ROLLUP_KINDS) return;
+  if (slot >= ROLLUP_SLOTS) slot = ROLLUP_MANUAL;
+  if (epoch)
+  {
+    uint32_t hour = epoch / 3600;
+    uint32_t day  = epoch / 86400;
+    addTo(_image.hours[kind][hour % ROLLUP_HOURS], hour + 1, amount, ms);
+    addTo(_image.days[kind][day % ROLLUP_DAYS], day + 1, amount, ms);
+  }
+  addTo(_image.slots[kind][slot], 1, amount, ms);
+  addTo(_image.totals[kind], 1, amount, ms);
+}
+
+
+const RollupCell &Rollups::hour(uint8_t kind, uint32_t epoch) const
+{
+  uint32_t hour = epoch / 3600;
+  if (kind >= ROLLUP_KINDS || epoch == 0) return emptyCell;
+  const RollupCell &cell = _image.hours[kind][hour % ROLLUP_HOURS];
+  return cell.stamp == hour + 1 ? cell : emptyCell;
+}
+
+
+const RollupCell &Rollups::day(uint8_t kind, uint32_t epoch) const
+{
+  uint32_t day = epoch / 86400;
+  if (kind >= ROLLUP_KINDS || epoch == 0) return emptyCell;
+  const RollupCell &cell = _image.days[kind][day % ROLLUP_DAYS];
+  return cell.stamp == day + 1 ? cell : emptyCell;
+}
+
+
+const RollupCell &Rollups::slot(uint8_t kind, uint8_t slot) const
+{
+  if (kind >= ROLLUP_KINDS || slot >= ROLLUP_SLOTS) return emptyCell;
+  return _image.slots[kind][slot];
+}
+
+
+const RollupCell &Rollups::total(uint8_t kind) const
+{
+  if (kind >= ROLLUP_KINDS) return emptyCell;
+  return _image.totals[kind];
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  PERSISTENCE
+//
+//  the CRC covers everything after it
+const uint8_t *Rollups::image(size_t *size)
+{
+  const size_t skip = offsetof(Image, hours);
+  _image.crc = crc16(CRC16_INIT, (const uint8_t *)&_image + skip, sizeof(_image) - skip);
+  *size = sizeof(_image);
+  return (const uint8_t *)&_image;
+}
+
+
+bool Rollups::load(const uint8_t *data, size_t size)
+{
+  const size_t skip = offsetof(Image, hours);
+  if (size != sizeof(_image)) return false;
+  const Image *image = (const Image *)data;
+  if (image->version != ROLLUP_VERSION) return false;
+  if (image->crc != crc16(CRC16_INIT, data + skip, size - skip)) return false;
+  memcpy(&_image, data, size);
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  BODY
+//
+//  {"success": true, "time": E,
+//   "feed": {"total": {..}, "slots": [{..} x ROLLUP_SLOTS],
+//            "hours": [{"start": E, ..} x ROLLUP_HOURS],
+//            "days": [{"start": E, ..} x ROLLUP_DAYS]},
+//   "wash": {..}}
+//  hours and days are empty without a clock
+static void writeCell(Encoder &e, const RollupCell &cell, uint32_t start)
+{
+  e.beginMap(start ? 6 : 5);
+  if (start)
+  {
+    e.key(PSTR("start"));
+    e.uinteger(start);
+  }
+  e.key(PSTR("count"));
+  e.uinteger(cell.count);
+  e.key(PSTR("sum"));
+  e.number(cell.sum, 2);
+  e.key(PSTR("min"));
+  e.number(cell.min, 2);
+  e.key(PSTR("max"));
+  e.number(cell.max, 2);
+  e.key(PSTR("seconds"));
+  e.number(cell.ms / 1000.0, 1);
+  e.end();
+}
+
+
+void Rollups::write(Encoder &e, uint32_t epoch) const
+{
+  bool clock = epoch >= ROLLUP_DAYS * 86400UL;
+  e.beginMap(2 + ROLLUP_KINDS);
+  e.key(PSTR("success"));
+  e.boolean(true);
+  e.key(PSTR("time"));
+  e.uinteger(clock ? epoch : 0);
+  for (uint8_t kind = 0; kind < ROLLUP_KINDS; kind++)
+  {
+    e.key(kind == ROLLUP_FEED ? PSTR("feed") : PSTR("wash"));
+    e.beginMap(4);
+    e.key(PSTR("total"));
+    writeCell(e, _image.totals[kind], 0);
+    e.key(PSTR("slots"));
+    e.beginArray(ROLLUP_SLOTS);
+    for (uint8_t i = 0; i < ROLLUP_SLOTS; i++) writeCell(e, _image.slots[kind][i], 0);
+    e.end();
+    e.key(PSTR("hours"));
+    e.beginArray(clock ? ROLLUP_HOURS : 0);
+    for (uint8_t i = 0; clock && i < ROLLUP_HOURS; i++)
+    {
+      uint32_t start = (epoch / 3600 - (ROLLUP_HOURS - 1) + i) * 3600;
+      writeCell(e, hour(kind, start), start);
+    }
+    e.end();
+    e.key(PSTR("days"));
+    e.beginArray(clock ? ROLLUP_DAYS : 0);
+    for (uint8_t i = 0; clock && i < ROLLUP_DAYS; i++)
+    {
+      uint32_t start = (epoch / 86400 - (ROLLUP_DAYS - 1) + i) * 86400;
+      writeCell(e, day(kind, start), start);
+    }
+    e.end();
+    e.end();
+  }
+  e.end();
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,90 @@
+#pragma once
+//
+//    FILE: rollups.h
+// PURPOSE: Running totals of the feedings and washes of the pig pen
+//          controller per hour, per day and per schedule slot.
+//
+//  NOTES
+//  Every finished feeding or wash is added once: count, sum, min, max
+//  of the amount (grams of feed, litres of water when measured) and the
+//  time it took. An add touches four cells and a lookup reads one, both
+//  O(1); all cells live in one fixed image that is saved as it is.
+//
+//  Hours and days are rings indexed by the hour / day number of the
+//  epoch, a cell holds its number, so a stale cell reads as empty.
+//  Without a clock (epoch 0) only the slot and the total count it.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "encoder.h"
+
+
+#define ROLLUP_VERSION      1
+#define ROLLUP_HOURS        24
+#define ROLLUP_DAYS         14
+#define ROLLUP_SLOTS        8
+#define ROLLUP_MANUAL       (ROLLUP_SLOTS - 1)      //  slot of what no schedule started
+
+
+enum RollupKind : uint8_t
+{
+  ROLLUP_FEED = 0,
+  ROLLUP_WASH,
+  ROLLUP_KINDS
+};
+
+
+struct RollupCell
+{
+  uint32_t stamp;               //  hour or day number + 1, 0 = empty
+  uint32_t count;
+  float    sum;
+  float    min;
+  float    max;
+  uint32_t ms;                  //  total duration
+};
+
+
+class Rollups
+{
+public:
+  Rollups();
+
+  void     clear();
+  void     add(uint8_t kind, uint8_t slot, uint32_t epoch, float amount, uint32_t ms);
+
+  //  the cell of the hour / day of epoch, an empty one if nothing was added
+  const RollupCell &hour(uint8_t kind, uint32_t epoch) const;
+  const RollupCell &day(uint8_t kind, uint32_t epoch) const;
+  const RollupCell &slot(uint8_t kind, uint8_t slot) const;
+  const RollupCell &total(uint8_t kind) const;
+
+  //  PERSISTENCE - the image to save, load() false if it is damaged
+  //  or of another version and leaves the rollups as they were.
+  const uint8_t *image(size_t *size);
+  bool     load(const uint8_t *data, size_t size);
+
+  //  the body of /api/stats: the hours and days up to epoch, oldest
+  //  first. Streams through a small buffer with a flushing encoder.
+  void     write(Encoder &encoder, uint32_t epoch) const;
+
+private:
+  struct Image
+  {
+    uint16_t   version;
+    uint16_t   crc;
+    RollupCell hours[ROLLUP_KINDS][ROLLUP_HOURS];
+    RollupCell days[ROLLUP_KINDS][ROLLUP_DAYS];
+    RollupCell slots[ROLLUP_KINDS][ROLLUP_SLOTS];
+    RollupCell totals[ROLLUP_KINDS];
+  };
+
+  Image    _image;
+};
+
+
+//  -- END OF FILE --
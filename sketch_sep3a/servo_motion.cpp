@@ -0,0 +1,205 @@
+//
+//    FILE: servo_motion.cpp
+// PURPOSE: Motion profiles for the feed gate servo and the map from
+//          gate opening to feed flow used to pick partial openings.
+//
+
+
+#include "servo_motion.h"
+
+
+#define LEARN_RATE   0.25
+
+
+ServoMotion::ServoMotion(uint16_t minPulse, uint16_t maxPulse, uint32_t frameUs)
+{
+  _minPulse     = minPulse;
+  _maxPulse     = maxPulse;
+  _frameUs      = frameUs;
+  _position     = 0;
+  _target       = 0;
+  _velocity     = 0;
+  _maxVelocity  = 0;
+  _acceleration = 0;
+  _direction    = 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  TIMER SIDE
+//
+void SERVO_ISR ServoMotion::set(uint16_t position)
+{
+  if (position > SERVO_POSITION_MAX) position = SERVO_POSITION_MAX;
+  _position  = (int32_t)position * 100000;
+  _target    = _position;
+  _velocity  = 0;
+  _direction = 0;
+}
+
+
+void SERVO_ISR ServoMotion::moveTo(uint16_t position, const ServoProfile &profile)
+{
+  if (position > SERVO_POSITION_MAX) position = SERVO_POSITION_MAX;
+  _target = (int32_t)position * 100000;
+
+  //  deg/s * us = micro degrees per frame
+  _maxVelocity  = (int32_t)profile.speed * (int32_t)_frameUs;
+  _acceleration = (int32_t)(((uint64_t)profile.acceleration * _frameUs * _frameUs) / 1000000ULL);
+  if (profile.speed > 0 && profile.acceleration > 0 && _acceleration == 0) _acceleration = 1;
+
+  //  turning around starts again from standstill
+  int8_t direction = _target > _position ? 1 : (_target < _position ? -1 : 0);
+  if (direction != _direction) _velocity = 0;
+  _direction = direction;
+}
+
+
+uint16_t SERVO_ISR ServoMotion::frame()
+{
+  int32_t remaining = _target - _position;
+  if (remaining < 0) remaining = -remaining;
+
+  if (remaining == 0)
+  {
+    _velocity  = 0;
+    _direction = 0;
+  }
+  else if (_maxVelocity == 0)
+  {
+    _position = _target;
+    _velocity = 0;
+  }
+  else
+  {
+    int32_t v = _velocity;
+    if (_acceleration == 0)
+    {
+      v = _maxVelocity;
+    }
+    else
+    {
+      //  brake once the distance to stop covers what is left
+      int64_t stopping = ((int64_t)v * v) / (2 * (int64_t)_acceleration);
+      if (stopping >= remaining)
+      {
+        v -= _acceleration;
+        if (v < _acceleration) v = _acceleration;
+      }
+      else
+      {
+        v += _acceleration;
+        if (v > _maxVelocity) v = _maxVelocity;
+      }
+    }
+    if (v >= remaining)
+    {
+      _position = _target;
+      v = 0;
+    }
+    else
+    {
+      _position = _position + (_direction > 0 ? v : -v);
+    }
+    _velocity = v;
+  }
+  return pulseFor(position());
+}
+
+
+uint16_t SERVO_ISR ServoMotion::pulseFor(uint16_t position) const
+{
+  if (position > SERVO_POSITION_MAX) position = SERVO_POSITION_MAX;
+  return _minPulse + (uint32_t)(_maxPulse - _minPulse) * position / SERVO_POSITION_MAX;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  GATE FLOW MAP
+//
+GateFlowMap::GateFlowMap(uint16_t closedPosition, uint16_t openPosition, float openFlow)
+{
+  //  points spread evenly from closed to open, flow guessed linear
+  for (uint8_t i = 0; i < GATE_FLOW_POINTS; i++)
+  {
+    int32_t span = (int32_t)openPosition - (int32_t)closedPosition;
+    _position[i] = closedPosition + span * i / (GATE_FLOW_POINTS - 1);
+    _flow[i]     = openFlow * i / (GATE_FLOW_POINTS - 1);
+  }
+}
+
+
+//  segment i (between points i-1 and i) holding the position and the
+//  fraction along it, 0 when the position is at or before closed
+uint8_t GateFlowMap::_segment(uint16_t position, float &fraction) const
+{
+  bool opensUp = _position[GATE_FLOW_POINTS - 1] >= _position[0];
+  for (uint8_t i = 1; i < GATE_FLOW_POINTS; i++)
+  {
+    int32_t a = _position[i - 1];
+    int32_t b = _position[i];
+    int32_t p = position;
+    if (opensUp ? (p > b) : (p < b)) continue;
+    if (i == 1 && (opensUp ? (p <= a) : (p >= a))) return 0;
+    fraction = (a == b) ? 1.0 : (float)(p - a) / (float)(b - a);
+    return i;
+  }
+  //  past the open position
+  fraction = 1.0;
+  return GATE_FLOW_POINTS - 1;
+}
+
+
+//  blends the measurement into the two points around the position,
+//  each in proportion to how close it is; the closed point stays 0.
+void GateFlowMap::learn(uint16_t position, float gramsPerSecond)
+{
+  float f;
+  uint8_t i = _segment(position, f);
+  if (i == 0) return;
+
+  if (gramsPerSecond < 0) gramsPerSecond = 0;
+  float error = gramsPerSecond - (_flow[i - 1] + f * (_flow[i] - _flow[i - 1]));
+  if (i > 1) _flow[i - 1] += LEARN_RATE * error * (1.0 - f);
+  _flow[i] += LEARN_RATE * error * f;
+
+  //  a point pushed past a neighbour drags it along,
+  //  nothing drops below the closed point
+  for (uint8_t j = i - 1; j > 0; j--)
+  {
+    if (_flow[j] > _flow[j + 1]) _flow[j] = _flow[j + 1];
+  }
+  for (uint8_t j = 1; j < GATE_FLOW_POINTS; j++)
+  {
+    if (_flow[j] < _flow[j - 1]) _flow[j] = _flow[j - 1];
+  }
+}
+
+
+float GateFlowMap::flowAt(uint16_t position) const
+{
+  float f;
+  uint8_t i = _segment(position, f);
+  if (i == 0) return 0;
+  return _flow[i - 1] + f * (_flow[i] - _flow[i - 1]);
+}
+
+
+//  smallest opening that gives the flow, the open position if none does
+uint16_t GateFlowMap::positionFor(float gramsPerSecond) const
+{
+  if (gramsPerSecond <= 0) return _position[0];
+  for (uint8_t i = 1; i < GATE_FLOW_POINTS; i++)
+  {
+    if (_flow[i] < gramsPerSecond) continue;
+    float span = _flow[i] - _flow[i - 1];
+    float f = (span <= 0) ? 1.0 : (gramsPerSecond - _flow[i - 1]) / span;
+    return _position[i - 1] + (int32_t)(f * ((int32_t)_position[i] - (int32_t)_position[i - 1]));
+  }
+  return _position[GATE_FLOW_POINTS - 1];
+}
+
+
+//  -- END OF FILE --
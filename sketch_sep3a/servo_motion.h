@@ -0,0 +1,102 @@
+#pragma once
+//
+//    FILE: servo_motion.h
+// PURPOSE: Motion profiles for the feed gate servo and the map from
+//          gate opening to feed flow used to pick partial openings.
+//
+//  NOTES
+//  ServoMotion is advanced once per servo frame (20 ms) by the timer
+//  callback that generates the pulse, so a ramp never blocks loop().
+//  moveTo() and frame() belong to the timer side; position(), target()
+//  and moving() may be read from loop() at any time.
+//
+//  A profile with a speed ramps to the target with a trapezoidal
+//  velocity: accelerate, cruise, decelerate so the gate arrives without
+//  overshoot. A profile with speed 0 steps straight to the target and
+//  lets the servo move at its own (maximum) pace - used to close fast.
+//
+//  Positions are in tenths of a degree, 0 .. 1800.
+//  No Arduino dependency, host tools can drive it frame by frame.
+
+
+#include <stdint.h>
+
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#define SERVO_ISR  IRAM_ATTR
+#else
+#define SERVO_ISR
+#endif
+
+
+#define SERVO_MOTION_FRAME_US   20000
+#define SERVO_POSITION_MAX      1800     //  180.0 degrees
+#define GATE_FLOW_POINTS        5
+
+
+struct ServoProfile
+{
+  uint16_t speed;           //  degrees per second, 0 = step
+  uint16_t acceleration;    //  degrees per second^2, 0 = start at full speed
+};
+
+
+class ServoMotion
+{
+public:
+  ServoMotion(uint16_t minPulse = 544, uint16_t maxPulse = 2400, uint32_t frameUs = SERVO_MOTION_FRAME_US);
+
+  //  TIMER SIDE
+  void     set(uint16_t position);     //  no motion, e.g. at power up
+  void     moveTo(uint16_t position, const ServoProfile &profile);
+  //  advances one frame, returns the pulse width in us
+  uint16_t frame();
+
+  //  EITHER SIDE
+  uint16_t position() const  { return _position / 100000; };
+  uint16_t target() const    { return _target / 100000; };
+  bool     moving() const    { return _position != _target; };
+  uint16_t pulseFor(uint16_t position) const;
+
+private:
+  uint16_t          _minPulse;
+  uint16_t          _maxPulse;
+  uint32_t          _frameUs;
+
+  //  micro degrees, velocities per frame
+  volatile int32_t  _position;
+  volatile int32_t  _target;
+  int32_t           _velocity;
+  int32_t           _maxVelocity;
+  int32_t           _acceleration;
+  int8_t            _direction;
+};
+
+
+//  Flow through the gate in grams per second as a function of the
+//  opening, as a piecewise linear table. The points start as a guess
+//  and learn() moves them towards measured flows; the table is kept
+//  monotonic so positionFor() always has a single answer.
+//  Loop side only.
+class GateFlowMap
+{
+public:
+  GateFlowMap(uint16_t closedPosition, uint16_t openPosition, float openFlow);
+
+  void     learn(uint16_t position, float gramsPerSecond);
+  float    flowAt(uint16_t position) const;
+  uint16_t positionFor(float gramsPerSecond) const;
+
+  uint16_t pointPosition(uint8_t i) const  { return _position[i]; };
+  float    pointFlow(uint8_t i) const      { return _flow[i]; };
+
+private:
+  uint8_t  _segment(uint16_t position, float &fraction) const;
+
+  uint16_t _position[GATE_FLOW_POINTS];
+  float    _flow[GATE_FLOW_POINTS];
+};
+
+
+//  -- END OF FILE --
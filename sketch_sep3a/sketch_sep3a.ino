@@ -1,11 +1,28 @@
 #include <ESP8266WiFi.h>
-#include <ESP8266WebServer.h>
 #include <WiFiUdp.h>
 #include <NTPClient.h>
 #include <EEPROM.h>
-#include <Servo.h>
+#include <core_esp8266_waveform.h>
 #include <HX711.h>
 #include <DNSServer.h>
+#include <LittleFS.h>
+#include <Updater.h>
+#include "actuator_queue.h"
+#include "bench.h"
+#include "delta_patch.h"
+#include "encoder.h"
+#include "feed_control.h"
+#include "heap_guard.h"
+#include "http_server.h"
+#include "journal.h"
+#include "request_body.h"
+#include "responses.h"
+#include "rollups.h"
+#include "servo_motion.h"
+#include "telemetry.h"
+#include "trace.h"
+#include "wash_meter.h"
+#include "wifi_reconnect.h"
 
 // EEPROM Addresses
 #define EEPROM_SIZE 512
@@ -13,54 +30,247 @@
 #define PASS_ADDR 50
 #define FEED_SCHEDULE_ADDR 100
 #define WASH_SCHEDULE_ADDR 120
+#define WIFI_CACHE_ADDR 140
 
 char ssid[32];
 char password[32];
 
 // Web Server
-ESP8266WebServer server(80);
+HttpServer server(80);
+const unsigned long LOOP_PERIOD = 100; // ms between control passes, HTTP is served meanwhile
 
 // NTP Client
+// Every update asks all the servers at once and keeps the agreeing reply
+// with the shortest round trip, so one slow or wrong reply no longer sets
+// the clock and it stays close enough to sync every ten minutes.
+const unsigned long NTP_UPDATE_INTERVAL = 600000;
+const char *const ntpServers[] = {"0.pool.ntp.org", "1.pool.ntp.org", "2.pool.ntp.org", "3.pool.ntp.org"};
 WiFiUDP ntpUDP;
-NTPClient timeClient(ntpUDP, "pool.ntp.org", 0, 60000);
+NTPClient timeClient(ntpUDP, "pool.ntp.org", 0, NTP_UPDATE_INTERVAL);
 
 // DNS Server for Captive Portal
 DNSServer dnsServer;
 
-// HX711 Pins and Setup
+// Pin map
+// Boards wired for HSPI (build with -DHX711_WIRING_HSPI) have the HX711 on the
+// HSPI pins, where the SPI peripheral clocks the conversions out with the
+// interrupts on; that moves the servo and the relay as well. Other boards keep
+// the original wiring and read the HX711 by bit-bang.
+#ifdef HX711_WIRING_HSPI
+const int LOADCELL_DOUT_PIN = D6; // GPIO12, HSPI MISO
+const int LOADCELL_SCK_PIN = D5;  // GPIO14, HSPI SCK
+const int SERVO_PIN = D1;
+const int RELAY_PIN = D2;
+#else
 const int LOADCELL_DOUT_PIN = D3;
 const int LOADCELL_SCK_PIN = D2;
+const int SERVO_PIN = D6;
+const int RELAY_PIN = D5;
+#endif
+
+// HX711 Setup
 HX711 scale;
 const float scaleFactor = 1.0;
 const float dropAmount = 50.0;
+const float WEIGHT_NOISE_BOUND = 1.0; // g, standard error getWeight() aims for
+const uint8_t WEIGHT_MAX_SAMPLES = 10;
 bool hx711_available = false;
+float lastWeight = 0;
+unsigned long lastWeightTime = 0;
 
 // Servo Setup
-const int SERVO_PIN = D6;
-Servo servo;
+// The gate servo pulse is generated by the actuator timer, not the Servo library
 const int servoOpenPos = 90;
 const int servoClosedPos = 0;
+const uint32_t SERVO_FRAME_US = 20000;
+const uint16_t SERVO_MIN_PULSE = 544;  // us at 0 degrees, as in the Servo library
+const uint16_t SERVO_MAX_PULSE = 2400; // us at 180 degrees
+// Gate motion, positions in tenths of a degree; the timer moves the gate one step per frame
+ServoMotion gateMotion(SERVO_MIN_PULSE, SERVO_MAX_PULSE, SERVO_FRAME_US);
+const ServoProfile GATE_OPEN_PROFILE = {60, 240}; // deg/s, deg/s^2: ramp the flow up
+const ServoProfile GATE_CLOSE_PROFILE = {0, 0};   // step, the servo closes at full speed
+volatile uint16_t servoPulseUs = SERVO_MIN_PULSE + (SERVO_MAX_PULSE - SERVO_MIN_PULSE) * servoClosedPos / 180;
+uint32_t servoFrameStart = 0;
+bool servoPinHigh = false;
 bool isServoOpen = false;
 bool servo_available = false;
-float weightAtOpen = 0;
+
+// Dispensing
+// The gate opens fully, then throttles back to a slow flow for the last grams
+// so the auto close lands close to dropAmount. Flows are learned while feeding,
+// from the rate the scale's Kalman filter sees the weight go down.
+const float GATE_FLOW_AT_OPEN = 40.0; // g/s, first guess until learned
+const float FEED_SLOW_ZONE = 15.0;    // g before dropAmount where the flow is reduced
+const float FEED_DRIBBLE_FLOW = 5.0;  // g/s in the slow zone
+GateFlowMap gateFlow(servoClosedPos * 10, servoOpenPos * 10, GATE_FLOW_AT_OPEN);
+FeedController feeder(gateFlow, dropAmount, FEED_SLOW_ZONE, FEED_DRIBBLE_FLOW);
+uint16_t lastStatusPosition = 0;
 
 // Wash Relay Setup
-const int RELAY_PIN = D5;
 const int WASH_DURATION = 30000; // 30 seconds wash duration
 bool washInProgress = false;
 unsigned long washStartTime = 0;
 
+// Flow Meter
+// Hall effect meter on the wash line, its pulses are counted by interrupt.
+// With a target volume the relay goes off once that much water ran, or when
+// the meter sees no water; WASH_MAX_DURATION caps it either way. A target of
+// 0 runs every wash for WASH_DURATION, for pens without a meter.
+const int FLOW_METER_PIN = D7;
+const float FLOW_PULSES_PER_LITRE = 450.0;        // YF-S201
+const float WASH_TARGET_LITRES = 20.0;
+const unsigned long WASH_MAX_DURATION = 120000;   // ms, safety cap of a metered wash
+const unsigned long WASH_NO_FLOW_TIMEOUT = 5000;  // ms without a pulse that end a metered wash
+const unsigned long WASH_TRACE_INTERVAL = 1000;   // ms between the pulse counts in the trace
+volatile uint32_t flowPulses = 0;
+WashMeter washMeter(FLOW_PULSES_PER_LITRE, WASH_NO_FLOW_TIMEOUT);
+float washTarget = WASH_TARGET_LITRES; // of the wash being started
+uint8_t washStopReason = JOURNAL_STOP_MANUAL;
+unsigned long lastFlowTrace = 0;
+
+// Actuator Queue
+// Servo and relay commands are executed by the timer1 callback at their deadline
+ActuatorQueue actuators;
+const uint32_t ACTUATOR_TICK_MAX = 1000; // us, bounds the latency of immediate commands
+
+// UDP Telemetry Setup
+const bool TELEMETRY_ENABLED = true;
+const uint16_t TELEMETRY_PORT = TELEMETRY_DEFAULT_PORT;
+const unsigned long TELEMETRY_MIN_INTERVAL = 250;  // rate limit for change driven datagrams
+const unsigned long TELEMETRY_INTERVAL = 5000;     // heartbeat when nothing changes
+const float TELEMETRY_WEIGHT_DELTA = 1.0;          // grams that count as a change
+WiFiUDP telemetryUDP;
+uint32_t telemetrySequence = 0;
+unsigned long lastTelemetryTime = 0;
+uint8_t lastTelemetryFlags = 0;
+float lastTelemetryWeight = 0;
+
+// Trace Recording
+// Raw HX711 conversions, actuator events, schedule triggers and HTTP commands
+// are recorded into a RAM ring of blocks, exported by GET /api/trace and replayed
+// on a host by tools/trace_replay. With TRACE_FLASH_ENABLED completed blocks are
+// also appended to two LittleFS files; when one is full the older one is dropped.
+const bool TRACE_FLASH_ENABLED = false;
+const uint16_t TRACE_RAM_BLOCKS = 6;
+const uint32_t TRACE_FLASH_FILE_SIZE = 64UL * TRACE_BLOCK_SIZE;
+const char *TRACE_FILES[2] = {"/trace0.bin", "/trace1.bin"};
+uint8_t traceRam[TRACE_RAM_BLOCKS * TRACE_BLOCK_SIZE];
+TraceWriter trace(traceRam, TRACE_RAM_BLOCKS);
+bool traceFlashReady = false;
+uint8_t traceFile = 0; // file being appended to
+int lastTraceMinute = -1;
+
+// Rollups
+// Count, sum, min and max of the grams dropped and the litres washed per hour,
+// per day and per schedule slot, served by GET /api/stats. The image is saved
+// to LittleFS after every feed or wash, a few a day.
+const char *STATS_FILE = "/stats.bin";
+Rollups rollups;
+bool statsFlashReady = false;
+uint8_t feedSlot = ROLLUP_MANUAL; // schedule that opened the gate, ROLLUP_MANUAL otherwise
+uint8_t washSlot = ROLLUP_MANUAL;
+unsigned long feedOpenTime = 0;
+
+// Event Journal
+// Schedule triggers, gate and wash transitions, tare, config changes and WiFi
+// drops with sequence numbers. GET /api/events?since=<seq> returns the ones
+// after seq. The newest are in RAM, all are appended to two LittleFS files;
+// when one is full the older one is dropped, as for the trace.
+const uint16_t JOURNAL_RAM_EVENTS = 32;
+const uint32_t JOURNAL_FILE_SIZE = 128UL * JOURNAL_RECORD_SIZE;
+const uint8_t JOURNAL_PAGE = 16; // events per response
+const char *JOURNAL_FILES[2] = {"/events0.bin", "/events1.bin"};
+JournalEvent journalRam[JOURNAL_RAM_EVENTS];
+Journal journal(journalRam, JOURNAL_RAM_EVENTS);
+bool journalFlashReady = false;
+uint8_t journalFile = 0; // file being appended to
+
+// Health Counters
+uint16_t wifiDrops = 0;
+uint16_t scaleTimeouts = 0;
+
+// Memory Report
+// Static RAM comes from the linker sections of this build, the free heap is
+// sampled after every control pass and the heap each handler took by the
+// server. Shown by the serial "memory" command and GET /api/memory.
+extern "C" char _data_start[], _data_end[], _rodata_start[], _rodata_end[], _bss_start[], _bss_end[];
+const char *const HTTP_METHOD_NAMES[] = {"ANY", "GET", "HEAD", "POST", "PUT", "PATCH", "DELETE", "OPTIONS"};
+uint32_t idleHeap = 0;
+uint32_t idleHeapLow = 0xFFFFFFFF;
+
+// Request Arena and Heap Guard
+// Handler scratch memory comes from a fixed arena reset after every request.
+// When the largest free block gets small or the heap fragmented, only the
+// essential routes are served until it recovers.
+const size_t REQUEST_ARENA_SIZE = 2048;
+const uint32_t HEAP_SHED_BLOCK = 6144;       // bytes
+const uint32_t HEAP_RECOVER_BLOCK = 8192;
+const uint8_t HEAP_SHED_FRAGMENTATION = 60;  // percent
+const unsigned long HEAP_TREND_PERIOD = 600000UL;
+uint8_t requestArenaBuffer[REQUEST_ARENA_SIZE] __attribute__((aligned(ARENA_ALIGN)));
+Arena requestArena(requestArenaBuffer, REQUEST_ARENA_SIZE);
+HeapGuard heapGuard(HEAP_SHED_BLOCK, HEAP_RECOVER_BLOCK, HEAP_SHED_FRAGMENTATION, HEAP_TREND_PERIOD);
+
+// Response Cache
+// Pre-serialized bodies of the read-mostly endpoints. A body is rebuilt only
+// when marked dirty, when the second it was built for has passed or when it
+// is asked for in the other format (JSON or CBOR).
+const size_t RESPONSE_CACHE_SIZE = 320;
+const unsigned long STATUS_WEIGHT_MAX_AGE = 1000; // ms before /api/status takes a new sample
+struct CachedResponse {
+  uint8_t body[RESPONSE_CACHE_SIZE];
+  size_t length;
+  uint8_t format;
+  bool dirty;
+  unsigned long stamp;
+};
+CachedResponse statusCache = {{0}, 0, ENCODE_JSON, true, 0};
+CachedResponse scheduleCache = {{0}, 0, ENCODE_JSON, true, 0};
+CachedResponse timeCache = {{0}, 0, ENCODE_JSON, true, 0};
+
+// Response Format
+// JSON unless the client asks for CBOR with ?fmt=cbor or Accept: application/cbor
+const size_t RESPONSE_STREAM_BUFFER = 256; // bytes handed to sendContent at a time
+typedef void (*ResponseWriter)(Encoder &encoder, const void *context);
+
+// Delta OTA
+// POST /api/ota/delta takes a patch made by tools/delta_patch against the
+// running image and applies it as it arrives: old bytes are read from flash,
+// the new image goes to the update partition through Update, which checks its
+// MD5 before the reboot boots it. Only the patch crosses the WiFi.
+DeltaPatch otaPatch;
+bool otaRunning = false;  // a patch is being applied
+bool otaRefused = false;  // a second one came meanwhile
+
 // Schedules
+// "HH:MM" times, stored in the EEPROM as 5 bytes each without the NUL
 const int FEED_NUM_SCHEDULES = 3;
-String feedSchedules[FEED_NUM_SCHEDULES] = {"08:00", "12:00", "18:00"};
-bool feedTimeTriggered[FEED_NUM_SCHEDULES] = {false, false, false};
-
 const int WASH_NUM_SCHEDULES = 2;
-String washSchedules[WASH_NUM_SCHEDULES] = {"07:00", "17:00"};
+const int SCHEDULE_TIME_LENGTH = 5;
+struct ScheduleTable {
+  char feed[FEED_NUM_SCHEDULES][SCHEDULE_TIME_LENGTH + 1];
+  char wash[WASH_NUM_SCHEDULES][SCHEDULE_TIME_LENGTH + 1];
+};
+const ScheduleTable DEFAULT_SCHEDULES PROGMEM = {{"08:00", "12:00", "18:00"}, {"07:00", "17:00"}};
+ScheduleTable schedules;
+bool feedTimeTriggered[FEED_NUM_SCHEDULES] = {false, false, false};
 bool washTimeTriggered[WASH_NUM_SCHEDULES] = {false, false};
 
 // WiFi Status
-bool wifiDisconnectMessageShown = false;
+// Reconnects run in the background: first on the BSSID, channel and IP lease
+// of the last link, then with a scan, then backing off. The setup portal
+// comes up next to the station after WIFI_PORTAL_AFTER without a link.
+const unsigned long WIFI_CACHED_TIMEOUT = 1500;  // ms for an association without a scan
+const unsigned long WIFI_SCAN_TIMEOUT = 6000;    // scan, association and DHCP
+const unsigned long WIFI_BACKOFF_MIN = 2000;
+const unsigned long WIFI_BACKOFF_MAX = 60000;
+const unsigned long WIFI_PORTAL_AFTER = 30000;
+const uint8_t WIFI_CACHE_MAGIC = 0xA5;
+WifiReconnect wifiLink(WIFI_CACHED_TIMEOUT, WIFI_SCAN_TIMEOUT, WIFI_BACKOFF_MIN, WIFI_BACKOFF_MAX, WIFI_PORTAL_AFTER);
+uint8_t wifiBSSID[6];
+uint8_t wifiChannel = 0;
+bool wifiLeaseCached = false; // the lease is only reused within a boot
+IPAddress wifiLeaseIP, wifiLeaseGateway, wifiLeaseSubnet, wifiLeaseDNS;
 bool apMode = false;
 
 // AP Mode Static IP
@@ -81,107 +291,68 @@ void initializeEEPROM() {
   }
   
   if (needsInit) {
-    Serial.println("Initializing EEPROM with default schedules...");
-    String defaultFeedTimes[FEED_NUM_SCHEDULES] = {"08:00", "12:00", "18:00"};
-    String defaultWashTimes[WASH_NUM_SCHEDULES] = {"07:00", "17:00"};
-    
-    // Save feed schedules
-    for (int i = 0; i < FEED_NUM_SCHEDULES; i++) {
-      for (int j = 0; j < 5; j++) {
-        if (j < defaultFeedTimes[i].length()) {
-          EEPROM.write(FEED_SCHEDULE_ADDR + i * 5 + j, defaultFeedTimes[i][j]);
-        } else {
-          EEPROM.write(FEED_SCHEDULE_ADDR + i * 5 + j, 0);
-        }
-      }
-    }
-    
-    // Save wash schedules
-    for (int i = 0; i < WASH_NUM_SCHEDULES; i++) {
-      for (int j = 0; j < 5; j++) {
-        if (j < defaultWashTimes[i].length()) {
-          EEPROM.write(WASH_SCHEDULE_ADDR + i * 5 + j, defaultWashTimes[i][j]);
-        } else {
-          EEPROM.write(WASH_SCHEDULE_ADDR + i * 5 + j, 0);
-        }
-      }
-    }
-    
+    Serial.println(F("Initializing EEPROM with default schedules..."));
+    memcpy_P(&schedules, &DEFAULT_SCHEDULES, sizeof(schedules));
+    writeScheduleTimes();
     EEPROM.commit();
-    Serial.println("EEPROM initialized with default schedules");
+    Serial.println(F("EEPROM initialized with default schedules"));
   }
 }
 
-void loadSchedules() {
-  String defaultFeedTimes[FEED_NUM_SCHEDULES] = {"08:00", "12:00", "18:00"};
-  String defaultWashTimes[WASH_NUM_SCHEDULES] = {"07:00", "17:00"};
-  
-  // Load feed schedules
+// A time as the EEPROM holds it, NUL padded
+void readScheduleTime(int address, char *time, const char *fallback) {
+  for (int j = 0; j < SCHEDULE_TIME_LENGTH; j++) {
+    time[j] = EEPROM.read(address + j);
+  }
+  time[SCHEDULE_TIME_LENGTH] = 0;
+  if (scheduleMinute(time) < 0) {
+    memcpy_P(time, fallback, SCHEDULE_TIME_LENGTH + 1);
+  }
+}
+
+void writeScheduleTimes() {
   for (int i = 0; i < FEED_NUM_SCHEDULES; i++) {
-    String time = "";
-    for (int j = 0; j < 5; j++) {
-      char c = EEPROM.read(FEED_SCHEDULE_ADDR + i * 5 + j);
-      if (c == 0 || c == 255) break;
-      time += c;
-    }
-    if (time.length() == 5 && time.indexOf(':') != -1) {
-      feedSchedules[i] = time;
-    } else {
-      feedSchedules[i] = defaultFeedTimes[i];
+    for (int j = 0; j < SCHEDULE_TIME_LENGTH; j++) {
+      EEPROM.write(FEED_SCHEDULE_ADDR + i * SCHEDULE_TIME_LENGTH + j, schedules.feed[i][j]);
     }
   }
-  
-  // Load wash schedules
   for (int i = 0; i < WASH_NUM_SCHEDULES; i++) {
-    String time = "";
-    for (int j = 0; j < 5; j++) {
-      char c = EEPROM.read(WASH_SCHEDULE_ADDR + i * 5 + j);
-      if (c == 0 || c == 255) break;
-      time += c;
-    }
-    if (time.length() == 5 && time.indexOf(':') != -1) {
-      washSchedules[i] = time;
-    } else {
-      washSchedules[i] = defaultWashTimes[i];
+    for (int j = 0; j < SCHEDULE_TIME_LENGTH; j++) {
+      EEPROM.write(WASH_SCHEDULE_ADDR + i * SCHEDULE_TIME_LENGTH + j, schedules.wash[i][j]);
     }
   }
-  
-  Serial.println("Loaded schedules:");
+}
+
+void loadSchedules() {
   for (int i = 0; i < FEED_NUM_SCHEDULES; i++) {
-    Serial.print("Feed "); Serial.print(i); Serial.print(": "); Serial.println(feedSchedules[i]);
+    readScheduleTime(FEED_SCHEDULE_ADDR + i * SCHEDULE_TIME_LENGTH, schedules.feed[i], DEFAULT_SCHEDULES.feed[i]);
   }
   for (int i = 0; i < WASH_NUM_SCHEDULES; i++) {
-    Serial.print("Wash "); Serial.print(i); Serial.print(": "); Serial.println(washSchedules[i]);
+    readScheduleTime(WASH_SCHEDULE_ADDR + i * SCHEDULE_TIME_LENGTH, schedules.wash[i], DEFAULT_SCHEDULES.wash[i]);
   }
-}
+  
+  scheduleCache.dirty = true;
+  traceSchedules();
 
-void saveSchedules() {
-  // Save feed schedules
+  Serial.println(F("Loaded schedules:"));
   for (int i = 0; i < FEED_NUM_SCHEDULES; i++) {
-    for (int j = 0; j < 5; j++) {
-      if (j < feedSchedules[i].length()) {
-        EEPROM.write(FEED_SCHEDULE_ADDR + i * 5 + j, feedSchedules[i][j]);
-      } else {
-        EEPROM.write(FEED_SCHEDULE_ADDR + i * 5 + j, 0);
-      }
-    }
+    Serial.print(F("Feed ")); Serial.print(i); Serial.print(F(": ")); Serial.println(schedules.feed[i]);
   }
-  
-  // Save wash schedules
   for (int i = 0; i < WASH_NUM_SCHEDULES; i++) {
-    for (int j = 0; j < 5; j++) {
-      if (j < washSchedules[i].length()) {
-        EEPROM.write(WASH_SCHEDULE_ADDR + i * 5 + j, washSchedules[i][j]);
-      } else {
-        EEPROM.write(WASH_SCHEDULE_ADDR + i * 5 + j, 0);
-      }
-    }
+    Serial.print(F("Wash ")); Serial.print(i); Serial.print(F(": ")); Serial.println(schedules.wash[i]);
   }
-  
+}
+
+void saveSchedules() {
+  writeScheduleTimes();
+  scheduleCache.dirty = true;
+  traceSchedules();
+  journalEvent(JOURNAL_CONFIG, JOURNAL_CONFIG_SCHEDULES, 0);
+
   if (EEPROM.commit()) {
-    Serial.println("Schedules saved to EEPROM");
+    Serial.println(F("Schedules saved to EEPROM"));
   } else {
-    Serial.println("ERROR: Failed to save schedules to EEPROM");
+    Serial.println(F("ERROR: Failed to save schedules to EEPROM"));
   }
 }
 
@@ -200,7 +371,7 @@ void loadWiFiCredentials() {
   }
   password[31] = 0;
 
-  Serial.print("Loaded WiFi: ");
+  Serial.print(F("Loaded WiFi: "));
   Serial.println(ssid);
 }
 
@@ -216,194 +387,749 @@ void saveWiFiCredentials() {
     EEPROM.write(PASS_ADDR + i, password[i]);
     if (password[i] == 0) break;
   }
+  journalEvent(JOURNAL_CONFIG, JOURNAL_CONFIG_WIFI, 0);
 
   EEPROM.commit();
-  Serial.println("WiFi credentials saved to EEPROM");
+  Serial.println(F("WiFi credentials saved to EEPROM"));
 }
 
-void connectToWiFi() {
-  if (strlen(ssid) == 0) {
-    Serial.println("No WiFi credentials stored. Starting AP mode...");
-    startAPMode();
-    return;
+// EEPROM: magic, BSSID, channel, checksum; written only when the AP changes
+void loadWiFiCache() {
+  uint8_t sum = 0;
+  for (int i = 0; i < 6; i++) {
+    wifiBSSID[i] = EEPROM.read(WIFI_CACHE_ADDR + 1 + i);
+    sum += wifiBSSID[i];
   }
+  wifiChannel = EEPROM.read(WIFI_CACHE_ADDR + 7);
+  sum += wifiChannel;
+  bool valid = EEPROM.read(WIFI_CACHE_ADDR) == WIFI_CACHE_MAGIC && EEPROM.read(WIFI_CACHE_ADDR + 8) == sum &&
+               wifiChannel >= 1 && wifiChannel <= 14;
+  if (!valid) wifiChannel = 0;
+  wifiLink.setCached(valid);
+}
 
-  Serial.print("Connecting to WiFi: ");
-  Serial.println(ssid);
-  
-  // Use DHCP instead of static IP
-  WiFi.mode(WIFI_STA);
-  WiFi.begin(ssid, password);
-  
-  int attempts = 0;
-  while (WiFi.status() != WL_CONNECTED && attempts < 20) {
-    delay(500);
-    Serial.print(".");
-    attempts++;
+void saveWiFiCache() {
+  const uint8_t *bssid = WiFi.BSSID();
+  uint8_t channel = WiFi.channel();
+  if (bssid == NULL || channel == 0) return;
+  if (channel == wifiChannel && memcmp(bssid, wifiBSSID, 6) == 0) return;
+  memcpy(wifiBSSID, bssid, 6);
+  wifiChannel = channel;
+  uint8_t sum = channel;
+  EEPROM.write(WIFI_CACHE_ADDR, WIFI_CACHE_MAGIC);
+  for (int i = 0; i < 6; i++) {
+    EEPROM.write(WIFI_CACHE_ADDR + 1 + i, wifiBSSID[i]);
+    sum += wifiBSSID[i];
   }
+  EEPROM.write(WIFI_CACHE_ADDR + 7, wifiChannel);
+  EEPROM.write(WIFI_CACHE_ADDR + 8, sum);
+  EEPROM.commit();
+  wifiLink.setCached(true);
+}
 
-  if (WiFi.status() == WL_CONNECTED) {
-    Serial.println("\nWiFi connected!");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
-    wifiDisconnectMessageShown = false;
-    apMode = false;
+void initializeWiFi() {
+  // The SDK neither stores nor retries on its own, wifiLink decides
+  WiFi.persistent(false);
+  WiFi.setAutoReconnect(false);
+  WiFi.mode(WIFI_STA);
+  loadWiFiCache();
+  if (strlen(ssid) == 0) {
+    Serial.println(F("No WiFi credentials stored. Starting AP mode..."));
   } else {
-    Serial.println("\nFailed to connect to WiFi");
-    startAPMode();
+    Serial.print(F("Connecting to WiFi: "));
+    Serial.println(ssid);
   }
+  wifiLink.begin(millis(), strlen(ssid) > 0);
+  checkWiFiStatus();
 }
 
 void startAPMode() {
-  Serial.println("Starting AP mode...");
+  Serial.println(F("Starting AP mode..."));
   
-  // Configure AP with static IP
+  // Configure AP with static IP, the station keeps reconnecting
+  WiFi.mode(WIFI_AP_STA);
   WiFi.softAPConfig(apIP, apGateway, apSubnet);
   WiFi.softAP("PetFeeder_Setup", "");
   
-  Serial.print("AP IP address: ");
+  Serial.print(F("AP IP address: "));
   Serial.println(WiFi.softAPIP());
   
   // Setup DNS redirect for captive portal
   dnsServer.start(53, "*", WiFi.softAPIP());
   apMode = true;
   
-  Serial.println("Captive portal started. Connect to 'PetFeeder_Setup' network");
-  Serial.println("and go to http://192.168.4.1 to setup WiFi");
+  Serial.println(F("Captive portal started. Connect to 'PetFeeder_Setup' network"));
+  Serial.println(F("and go to http://192.168.4.1 to setup WiFi"));
+}
+
+void stopAPMode() {
+  dnsServer.stop();
+  WiFi.softAPdisconnect(true);
+  WiFi.mode(WIFI_STA);
+  apMode = false;
+  Serial.println(F("Captive portal stopped"));
 }
 
 void initializeHardware() {
-  // Initialize Servo
-  if (servo.attach(SERVO_PIN)) {
-    servo_available = true;
-    closeServo();
-    Serial.println("Servo initialized successfully");
-  } else {
-    Serial.println("Servo initialization failed");
-  }
+  // Initialize Servo, pulses come from the actuator timer
+  pinMode(SERVO_PIN, OUTPUT);
+  digitalWrite(SERVO_PIN, LOW);
+  pinMode(RELAY_PIN, OUTPUT);
+  digitalWrite(RELAY_PIN, LOW);
+  gateMotion.set(servoClosedPos * 10);
+  setTimer1Callback(onActuatorTimer);
+  servo_available = true;
+  closeServo();
+  Serial.println(F("Servo initialized successfully"));
 
   // Initialize HX711
   scale.begin(LOADCELL_DOUT_PIN, LOADCELL_SCK_PIN);
+#ifdef HX711_WIRING_HSPI
+  // before the flow meter pin is set up, HSPI leaves MOSI (D7) as INPUT
+  scale.use_hspi();
+#endif
   if (scale.wait_ready_timeout(1000)) {
     hx711_available = true;
     scale.set_scale(scaleFactor);
     scale.tare();
-    Serial.println("HX711 scale initialized successfully");
+    traceScaleConfig();
+    // get_units() takes one conversion per call and tracks the flow rate
+    scale.set_kalman_mode();
+    Serial.println(scale.get_transport() == HX711_HSPI ? F("HX711 scale initialized successfully (HSPI)")
+                                                       : F("HX711 scale initialized successfully (bit-bang)"));
   } else {
-    Serial.println("HX711 scale initialization failed");
+    Serial.println(F("HX711 scale initialization failed"));
   }
 
-  // Initialize Relay for Wash Cycle
-  pinMode(RELAY_PIN, OUTPUT);
-  digitalWrite(RELAY_PIN, LOW);
-  Serial.println("Wash relay initialized");
+  Serial.println(F("Wash relay initialized"));
+
+  pinMode(FLOW_METER_PIN, INPUT_PULLUP);
+  attachInterrupt(digitalPinToInterrupt(FLOW_METER_PIN), countFlowPulse, FALLING);
 }
 
-void openServo() {
-  if (servo_available) {
-    servo.write(servoOpenPos);
-    isServoOpen = true;
-    Serial.println("Servo opened");
+void IRAM_ATTR countFlowPulse() {
+  flowPulses++;
+}
+
+// Runs in the timer1 interrupt (an NMI): IRAM only, no Serial, no heap
+void IRAM_ATTR applyActuator(uint8_t command, uint16_t argument) {
+  switch (command) {
+    case ACTUATOR_SERVO_OPEN:
+    case ACTUATOR_SERVO_MOVE:
+      gateMotion.moveTo(argument, GATE_OPEN_PROFILE);
+      break;
+    case ACTUATOR_SERVO_CLOSE:
+      gateMotion.moveTo(servoClosedPos * 10, GATE_CLOSE_PROFILE);
+      break;
+    case ACTUATOR_WASH_START:
+      digitalWrite(RELAY_PIN, HIGH);
+      break;
+    case ACTUATOR_WASH_STOP:
+      digitalWrite(RELAY_PIN, LOW);
+      break;
   }
 }
 
-void closeServo() {
-  if (servo_available) {
-    servo.write(servoClosedPos);
-    isServoOpen = false;
-    Serial.println("Servo closed");
+// Timer1 callback, shared with the core waveform generator.
+// Executes due actuator commands and generates the servo pulse,
+// returns the us until it wants to run again.
+uint32_t IRAM_ATTR onActuatorTimer() {
+  uint32_t now = micros();
+  uint32_t next = actuators.run(now, applyActuator);
+
+  uint32_t inFrame = now - servoFrameStart;
+  if (inFrame >= SERVO_FRAME_US) {
+    servoFrameStart = now;
+    inFrame = 0;
+    servoPulseUs = gateMotion.frame();
+    digitalWrite(SERVO_PIN, HIGH);
+    servoPinHigh = true;
+  }
+  if (servoPinHigh && inFrame >= servoPulseUs) {
+    digitalWrite(SERVO_PIN, LOW);
+    servoPinHigh = false;
   }
+  uint32_t edge = servoPinHigh ? servoPulseUs - inFrame : SERVO_FRAME_US - inFrame;
+  if (edge < next) next = edge;
+  if (next > ACTUATOR_TICK_MAX) next = ACTUATOR_TICK_MAX;
+  return next;
 }
 
-void startWashCycle() {
-  digitalWrite(RELAY_PIN, HIGH);
-  washInProgress = true;
-  washStartTime = millis();
-  Serial.println("Wash cycle started");
+void sampleIdleHeap() {
+  idleHeap = ESP.getFreeHeap();
+  if (idleHeap < idleHeapLow) idleHeapLow = idleHeap;
+  uint32_t block = ESP.getMaxFreeBlockSize();
+  if (heapGuard.update(millis(), idleHeap, block)) {
+    bool shedding = heapGuard.level() == HEAP_SHED;
+    server.setShedding(shedding);
+    journalEvent(JOURNAL_HEAP, heapGuard.level(), block);
+    Serial.print(shedding ? F("Heap low, shedding requests: largest block ") : F("Heap recovered: largest block "));
+    Serial.print(block);
+    Serial.print(F(", fragmentation "));
+    Serial.print(heapGuard.fragmentation());
+    Serial.println(F("%"));
+  }
 }
 
-void stopWashCycle() {
-  digitalWrite(RELAY_PIN, LOW);
-  washInProgress = false;
-  Serial.println("Wash cycle stopped");
+// Stats survive reboots, a damaged or older file starts them over
+void initializeStats() {
+  if (!LittleFS.begin()) return;
+  statsFlashReady = true;
+  File file = LittleFS.open(STATS_FILE, "r");
+  if (!file) return;
+  size_t size;
+  rollups.image(&size);
+  if (file.size() == size) {
+    uint8_t *data = (uint8_t *)malloc(size);
+    if (data && file.read(data, size) == size && !rollups.load(data, size)) {
+      Serial.println(F("Stats file damaged, starting over"));
+    }
+    free(data);
+  }
+  file.close();
+}
+
+void saveStats() {
+  if (!statsFlashReady) return;
+  File file = LittleFS.open(STATS_FILE, "w");
+  if (!file) return;
+  size_t size;
+  const uint8_t *image = rollups.image(&size);
+  file.write(image, size);
+  file.close();
+}
+
+// A finished feed or wash, hours and days only count it once the clock is set
+void addRollup(uint8_t kind, uint8_t slot, float amount, unsigned long ms) {
+  rollups.add(kind, slot, timeClient.isTimeSet() ? timeClient.getEpochTime() : 0, amount, ms);
+  saveStats();
+}
+
+void journalEvent(uint8_t type, uint8_t arg, int32_t value) {
+  journal.add(type, arg, value, timeClient.isTimeSet() ? timeClient.getEpochTime() : 0, millis());
+}
+
+void journalToFlash(const uint8_t *record) {
+  File file = LittleFS.open(JOURNAL_FILES[journalFile], "a");
+  if (!file) return;
+  file.write(record, JOURNAL_RECORD_SIZE);
+  size_t size = file.size();
+  file.close();
+  if (size >= JOURNAL_FILE_SIZE) {
+    journalFile ^= 1;
+    LittleFS.remove(JOURNAL_FILES[journalFile]);
+  }
+}
+
+// The intact events of a journal file after seq and before end, at most max
+uint8_t journalFileRead(const char *path, uint32_t seq, uint32_t end, JournalEvent *events, uint8_t max) {
+  File file = LittleFS.open(path, "r");
+  if (!file) return 0;
+  uint8_t count = 0;
+  uint8_t record[JOURNAL_RECORD_SIZE];
+  JournalEvent event;
+  while (count < max && file.read(record, JOURNAL_RECORD_SIZE) == JOURNAL_RECORD_SIZE) {
+    if (!Journal::decode(record, event) || event.seq <= seq || event.seq >= end) continue;
+    events[count++] = event;
+    seq = event.seq;
+  }
+  file.close();
+  return count;
+}
+
+// Sequence numbers continue those kept in flash
+void initializeJournal() {
+  if (LittleFS.begin()) {
+    journalFlashReady = true;
+    // The file that starts with the newer events is appended to
+    JournalEvent event;
+    uint32_t first[2];
+    for (int i = 0; i < 2; i++) {
+      first[i] = journalFileRead(JOURNAL_FILES[i], 0, 0xFFFFFFFF, &event, 1) ? event.seq : 0;
+    }
+    journalFile = first[1] > first[0] ? 1 : 0;
+    uint8_t record[JOURNAL_RECORD_SIZE];
+    for (int i = 0; i < 2; i++) {
+      File file = LittleFS.open(JOURNAL_FILES[journalFile ^ 1 ^ i], "r");
+      if (!file) continue;
+      while (file.read(record, JOURNAL_RECORD_SIZE) == JOURNAL_RECORD_SIZE) {
+        if (Journal::decode(record, event) && event.seq >= journal.next()) journal.restore(event);
+      }
+      file.close();
+    }
+    File file = LittleFS.open(JOURNAL_FILES[journalFile], "r");
+    if (file && file.size() >= JOURNAL_FILE_SIZE) {
+      journalFile ^= 1;
+      LittleFS.remove(JOURNAL_FILES[journalFile]);
+    }
+    if (file) file.close();
+    journal.setSink(journalToFlash);
+  }
+  journalEvent(JOURNAL_BOOT, 0, 0);
+}
+
+// Up to max events after seq, oldest first: from flash what RAM no longer has
+uint8_t journalRead(uint32_t seq, JournalEvent *events, uint8_t max) {
+  uint8_t count = 0;
+  if (journalFlashReady && seq + 1 < journal.oldest()) {
+    for (int i = 0; i < 2 && count < max; i++) {
+      count += journalFileRead(JOURNAL_FILES[journalFile ^ 1 ^ i], seq, journal.oldest(), events + count, max - count);
+      if (count) seq = events[count - 1].seq;
+    }
+  }
+  if (seq + 1 < journal.oldest()) seq = journal.oldest() - 1;
+  while (count < max && journal.get(seq + 1, events[count])) {
+    seq++;
+    count++;
+  }
+  return count;
+}
+
+// Sequence number of the oldest event still kept
+uint32_t journalFirst() {
+  JournalEvent event;
+  if (journalFlashReady) {
+    for (int i = 0; i < 2; i++) {
+      if (journalFileRead(JOURNAL_FILES[journalFile ^ 1 ^ i], 0, journal.oldest(), &event, 1)) return event.seq;
+    }
+  }
+  return journal.oldest();
+}
+
+// Mirrors what the timer executed into the sketch state
+void processActuatorEvents() {
+  ActuatorEvent event;
+  while (actuators.nextEvent(event)) {
+    trace.actuator(event.timeUs, event.command, event.result, event.argument);
+    if (event.result == ACTUATOR_INTERLOCK) {
+      Serial.println(event.command == ACTUATOR_SERVO_OPEN ? F("Servo open refused: wash in progress")
+                                                           : F("Wash refused: feed gate is open"));
+      continue;
+    }
+    if (event.result != ACTUATOR_DONE) continue;
+
+    switch (event.command) {
+      case ACTUATOR_SERVO_OPEN:
+        isServoOpen = true;
+        feedOpenTime = millis();
+        journalEvent(JOURNAL_SERVO_OPEN, 0, event.argument);
+        Serial.print(F("Servo opening to "));
+        Serial.println(event.argument / 10.0);
+        break;
+      case ACTUATOR_SERVO_MOVE:
+        Serial.print(F("Servo moving to "));
+        Serial.println(event.argument / 10.0);
+        break;
+      case ACTUATOR_SERVO_CLOSE:
+        Serial.println(F("Servo closed"));
+        // Only a gate that was open ends a feed, not the close at boot
+        if (isServoOpen) {
+          journalEvent(JOURNAL_SERVO_CLOSE, 0, hx711_available ? telemetryCentigrams(feeder.dropped(lastWeight)) : 0);
+          addRollup(ROLLUP_FEED, feedSlot, hx711_available ? feeder.dropped(lastWeight) : 0, millis() - feedOpenTime);
+        }
+        isServoOpen = false;
+        feedSlot = ROLLUP_MANUAL;
+        break;
+      case ACTUATOR_WASH_START:
+        washInProgress = true;
+        washStartTime = millis();
+        washStopReason = JOURNAL_STOP_MANUAL;
+        washMeter.start(flowPulses, washStartTime, washTarget);
+        lastFlowTrace = washStartTime;
+        Serial.println(F("Wash cycle started"));
+        journalEvent(JOURNAL_WASH_START, 0, 0);
+        break;
+      case ACTUATOR_WASH_STOP:
+        washMeter.stop(flowPulses, millis());
+        trace.flow(micros(), washMeter.pulses());
+        if (event.timed) washStopReason = JOURNAL_STOP_TIMER;
+        Serial.print(event.timed ? F("Wash cycle completed automatically") : F("Wash cycle stopped"));
+        Serial.print(F(", "));
+        Serial.print(washMeter.litres());
+        Serial.print(F(" L at "));
+        Serial.print(washMeter.meanFlow());
+        Serial.println(F(" L/min"));
+        // Only a wash that ran is counted, not a stop with none running
+        if (washInProgress) {
+          journalEvent(JOURNAL_WASH_STOP, washStopReason, washMeter.duration());
+          journalEvent(JOURNAL_WASH_VOLUME, (uint8_t)min(washMeter.meanFlow(), 255.0f), lroundf(washMeter.litres() * 1000));
+          addRollup(ROLLUP_WASH, washSlot, washMeter.litres(), washMeter.duration());
+        }
+        washInProgress = false;
+        washSlot = ROLLUP_MANUAL;
+        break;
+    }
+    statusCache.dirty = true;
+  }
+}
+
+// Opens the gate with a ramp to position (tenths of a degree),
+// or moves it there if it is already open. Returns the submit() result,
+// ACTUATOR_NOT_ACTIVE without a servo; servoOpened() tells success.
+uint8_t openServoTo(uint16_t position) {
+  if (!servo_available) return ACTUATOR_NOT_ACTIVE;
+  uint8_t command = isServoOpen || actuators.servoOpen() ? ACTUATOR_SERVO_MOVE : ACTUATOR_SERVO_OPEN;
+  uint8_t result = actuators.submit(command, micros(), 0, position);
+  if (result == ACTUATOR_INTERLOCK) {
+    Serial.println(F("Servo open refused: wash in progress"));
+  }
+  return result;
+}
+
+bool servoOpened(uint8_t result) {
+  return result == ACTUATOR_QUEUED || result == ACTUATOR_ALREADY;
+}
+
+uint8_t openServo() {
+  return openServoTo(servoOpenPos * 10);
+}
+
+// Partial opening expected to give the flow, in g/s
+uint8_t openServoForFlow(float gramsPerSecond) {
+  return openServoTo(gateFlow.positionFor(gramsPerSecond));
+}
+
+bool closeServo() {
+  if (!servo_available) return false;
+  return actuators.submit(ACTUATOR_SERVO_CLOSE, micros()) == ACTUATOR_QUEUED;
+}
+
+// Commanded gate position in degrees, follows the ramp while it moves
+float servoPosition() {
+  return gateMotion.position() / 10.0;
+}
+
+// The relay is switched off by the timer exactly WASH_DURATION after it went
+// on, or WASH_MAX_DURATION when checkWashVolume() ends it at litres
+bool startWashCycle(float litres) {
+  unsigned long duration = litres > 0 ? WASH_MAX_DURATION : WASH_DURATION;
+  uint8_t result = actuators.submit(ACTUATOR_WASH_START, micros(), duration * 1000UL);
+  if (result == ACTUATOR_INTERLOCK) {
+    Serial.println(F("Wash refused: feed gate is open"));
+  }
+  if (result == ACTUATOR_QUEUED) {
+    // Ahead of the start in the trace, the replay meters the wash with it
+    washTarget = litres;
+    trace.configFloat(micros(), TRACE_KEY_WASH_LITRES, litres);
+  }
+  return result == ACTUATOR_QUEUED;
+}
+
+bool stopWashCycle() {
+  return actuators.submit(ACTUATOR_WASH_STOP, micros()) == ACTUATOR_QUEUED;
+}
+
+void setWeightSample(float weight) {
+  lastWeight = weight;
+  lastWeightTime = millis();
+  statusCache.dirty = true;
 }
 
 float getWeight() {
   if (hx711_available && scale.wait_ready_timeout(1000)) {
-    return scale.get_units(10);
+    // A quiet scale answers in one or two conversions, a noisy one takes up to WEIGHT_MAX_SAMPLES
+    setWeightSample(scale.get_units_adaptive(WEIGHT_NOISE_BOUND, WEIGHT_MAX_SAMPLES));
+    return lastWeight;
   }
+  if (hx711_available && scaleTimeouts < 0xFFFF) scaleTimeouts++;
   return 0.0;
 }
 
+// The weight the drop amount is counted from
+void beginFeed() {
+  if (hx711_available) {
+    feeder.start(getWeight());
+    trace.feed(micros(), feeder.weightAtOpen());
+  }
+}
+
+// Schedules match on the minute of the day, each fires once in its minute
 void checkSchedules() {
   if (WiFi.status() != WL_CONNECTED) return;
   
   timeClient.update();
-  String currentTime = timeClient.getFormattedTime();
+  if (!timeClient.isTimeSet()) return;
+  int minuteOfDay = timeClient.getHours() * 60 + timeClient.getMinutes();
+  if (minuteOfDay != lastTraceMinute) {
+    // The replay reruns the schedules on these
+    trace.time(micros(), timeClient.getEpochTime());
+    lastTraceMinute = minuteOfDay;
+  }
   
   // Check feed schedules
   for (int i = 0; i < FEED_NUM_SCHEDULES; i++) {
-    if (currentTime == feedSchedules[i] && !feedTimeTriggered[i]) {
-      Serial.print("Feed schedule triggered: ");
-      Serial.println(feedSchedules[i]);
+    if (scheduleDue(minuteOfDay, scheduleMinute(schedules.feed[i]), feedTimeTriggered[i])) {
+      Serial.print(F("Feed schedule triggered: "));
+      Serial.println(schedules.feed[i]);
+      trace.schedule(micros(), TRACE_FEED_SCHEDULE, i, minuteOfDay);
+      journalEvent(JOURNAL_FEED_SCHEDULE, i, minuteOfDay);
+      if (!isServoOpen) feedSlot = i;
       openServo();
-      if (hx711_available) {
-        weightAtOpen = getWeight();
-      }
-      feedTimeTriggered[i] = true;
-    }
-    
-    // Reset trigger after 1 minute
-    if (currentTime != feedSchedules[i]) {
-      feedTimeTriggered[i] = false;
+      beginFeed();
     }
   }
   
   // Check wash schedules
   for (int i = 0; i < WASH_NUM_SCHEDULES; i++) {
-    if (currentTime == washSchedules[i] && !washTimeTriggered[i]) {
-      Serial.print("Wash schedule triggered: ");
-      Serial.println(washSchedules[i]);
-      startWashCycle();
-      washTimeTriggered[i] = true;
-    }
-    
-    // Reset trigger after 1 minute
-    if (currentTime != washSchedules[i]) {
-      washTimeTriggered[i] = false;
+    if (scheduleDue(minuteOfDay, scheduleMinute(schedules.wash[i]), washTimeTriggered[i])) {
+      Serial.print(F("Wash schedule triggered: "));
+      Serial.println(schedules.wash[i]);
+      trace.schedule(micros(), TRACE_WASH_SCHEDULE, i, minuteOfDay);
+      journalEvent(JOURNAL_WASH_SCHEDULE, i, minuteOfDay);
+      if (!washInProgress) washSlot = i;
+      startWashCycle(WASH_TARGET_LITRES);
     }
   }
 }
 
+// Once per pass while the water runs; the trace gets the pulse count every
+// WASH_TRACE_INTERVAL and at the decision, the replay decides on the same counts
+void checkWashVolume() {
+  if (!washInProgress || !washMeter.running()) return;
+  unsigned long now = millis();
+  WashAction action = washMeter.update(flowPulses, now);
+  if (action != WASH_HOLD || now - lastFlowTrace >= WASH_TRACE_INTERVAL) {
+    trace.flow(micros(), washMeter.pulses());
+    lastFlowTrace = now;
+    statusCache.dirty = true;
+  }
+  if (action == WASH_HOLD) return;
+  washStopReason = action == WASH_VOLUME_REACHED ? JOURNAL_STOP_VOLUME : JOURNAL_STOP_NO_FLOW;
+  Serial.println(action == WASH_VOLUME_REACHED ? F("Wash target volume reached") : F("Wash stopped: no water flow"));
+  stopWashCycle();
+}
+
 void checkAutoClose() {
-  if (isServoOpen && hx711_available) {
-    float currentWeight = getWeight();
-    float weightDropped = weightAtOpen - currentWeight;
-    
-    if (weightDropped >= dropAmount) {
-      closeServo();
-      Serial.print("Auto-closed after dropping ");
-      Serial.print(weightDropped);
-      Serial.println("g");
+  // One filtered conversion per pass, only when the ADC has one ready
+  if (isServoOpen && hx711_available && scale.is_ready()) {
+    setWeightSample(scale.get_units(1));
+    uint16_t position;
+    switch (feeder.update(lastWeight, scale.get_rate(), gateMotion.position(), gateMotion.target(),
+                          gateMotion.moving(), position)) {
+      case FEED_CLOSE:
+        closeServo();
+        Serial.print(F("Auto-closed after dropping "));
+        Serial.print(feeder.dropped(lastWeight));
+        Serial.println(F("g"));
+        break;
+      case FEED_THROTTLE:
+        openServoTo(position);
+        break;
+      case FEED_HOLD:
+        break;
     }
   }
 }
 
-void checkWashTimeout() {
-  if (washInProgress && (millis() - washStartTime >= WASH_DURATION)) {
-    stopWashCycle();
-    Serial.println("Wash cycle completed automatically");
+// One pass of the reconnect state machine, it never waits
+void checkWiFiStatus() {
+  bool connected = WiFi.status() == WL_CONNECTED;
+  WifiAction action;
+  while ((action = wifiLink.update(millis(), connected)) != WIFI_NONE) {
+    switch (action) {
+      case WIFI_LINK_UP:
+        Serial.print(F("WiFi connected after "));
+        Serial.print(wifiLink.lastOutage());
+        Serial.print(F(" ms, IP address: "));
+        Serial.println(WiFi.localIP());
+        saveWiFiCache();
+        journalEvent(JOURNAL_WIFI_UP, 0, wifiLink.lastOutage());
+        if (!wifiLeaseCached) {
+          wifiLeaseIP = WiFi.localIP();
+          wifiLeaseGateway = WiFi.gatewayIP();
+          wifiLeaseSubnet = WiFi.subnetMask();
+          wifiLeaseDNS = WiFi.dnsIP();
+          wifiLeaseCached = true;
+        }
+        break;
+      case WIFI_LINK_DOWN:
+        Serial.println(F("WiFi disconnected! Attempting to reconnect..."));
+        if (wifiDrops < 0xFFFF) wifiDrops++;
+        journalEvent(JOURNAL_WIFI_DOWN, 0, 0);
+        break;
+      case WIFI_CONNECT_CACHED:
+        if (wifiLeaseCached) {
+          WiFi.config(wifiLeaseIP, wifiLeaseGateway, wifiLeaseSubnet, wifiLeaseDNS);
+        }
+        WiFi.begin(ssid, password, wifiChannel, wifiBSSID, true);
+        break;
+      case WIFI_CONNECT_SCAN:
+        // The AP may have moved: scan, and take a fresh lease
+        WiFi.config(IPAddress(), IPAddress(), IPAddress());
+        wifiLeaseCached = false;
+        WiFi.begin(ssid, password);
+        break;
+      case WIFI_START_PORTAL:
+        startAPMode();
+        break;
+      case WIFI_STOP_PORTAL:
+        stopAPMode();
+        break;
+      case WIFI_NONE:
+        break;
+    }
   }
 }
 
-void checkWiFiStatus() {
-  if (WiFi.status() != WL_CONNECTED && !apMode && !wifiDisconnectMessageShown) {
-    Serial.println("WiFi disconnected! Attempting to reconnect...");
-    wifiDisconnectMessageShown = true;
-    connectToWiFi();
-  } else if (WiFi.status() == WL_CONNECTED) {
-    wifiDisconnectMessageShown = false;
+uint8_t telemetryFlags() {
+  uint8_t flags = 0;
+  if (isServoOpen) flags |= TELEMETRY_FLAG_SERVO_OPEN;
+  if (servo_available) flags |= TELEMETRY_FLAG_SERVO_OK;
+  if (hx711_available) flags |= TELEMETRY_FLAG_SCALE_OK;
+  if (washInProgress) flags |= TELEMETRY_FLAG_WASHING;
+  if (WiFi.status() == WL_CONNECTED) flags |= TELEMETRY_FLAG_WIFI_OK;
+  if (timeClient.isTimeSet()) flags |= TELEMETRY_FLAG_TIME_SET;
+  return flags;
+}
+
+void sendTelemetry(uint8_t flags) {
+  TelemetrySample sample;
+  sample.flags = flags;
+  sample.sequence = telemetrySequence++;
+  sample.epoch = timeClient.isTimeSet() ? timeClient.getEpochTime() : 0;
+  sample.uptime = millis();
+  sample.weight = telemetryCentigrams(lastWeight);
+  sample.lastFeed = telemetryCentigrams(isServoOpen ? feeder.dropped(lastWeight) : 0);
+  sample.wifiDrops = wifiDrops;
+  sample.scaleTimeouts = scaleTimeouts;
+  uint32_t freeHeap = ESP.getFreeHeap();
+  sample.freeHeap = freeHeap > 0xFFFF ? 0xFFFF : freeHeap;
+
+  uint8_t packet[TELEMETRY_PACKET_SIZE];
+  telemetryEncode(sample, packet);
+  telemetryUDP.beginPacket(WiFi.broadcastIP(), TELEMETRY_PORT);
+  telemetryUDP.write(packet, sizeof(packet));
+  telemetryUDP.endPacket();
+
+  lastTelemetryTime = millis();
+  lastTelemetryFlags = flags;
+  lastTelemetryWeight = lastWeight;
+}
+
+void checkTelemetry() {
+  if (!TELEMETRY_ENABLED || WiFi.status() != WL_CONNECTED) return;
+
+  unsigned long sinceLast = millis() - lastTelemetryTime;
+  if (sinceLast < TELEMETRY_MIN_INTERVAL) return;
+
+  // Refresh an idle weight with a single conversion, never wait for the ADC
+  if (hx711_available && millis() - lastWeightTime >= TELEMETRY_INTERVAL && scale.is_ready()) {
+    setWeightSample(scale.get_units(1));
   }
+
+  uint8_t flags = telemetryFlags();
+  bool changed = flags != lastTelemetryFlags ||
+                 fabs(lastWeight - lastTelemetryWeight) >= TELEMETRY_WEIGHT_DELTA;
+  if (changed || sinceLast >= TELEMETRY_INTERVAL) {
+    sendTelemetry(flags);
+  }
+}
+
+// Every conversion clocked out of the HX711, whatever read it belongs to
+void traceConversion(int32_t raw) {
+  trace.raw(micros(), raw);
+}
+
+// Completed trace blocks go to flash. Runs inside the read that filled the
+// block, a few ms every few hundred conversions.
+void traceToFlash(const uint8_t *block, uint16_t length) {
+  File file = LittleFS.open(TRACE_FILES[traceFile], "a");
+  if (!file) return;
+  file.write(block, length);
+  size_t size = file.size();
+  file.close();
+  if (size >= TRACE_FLASH_FILE_SIZE) {
+    traceFile ^= 1;
+    LittleFS.remove(TRACE_FILES[traceFile]);
+  }
+}
+
+// Block number after the last block kept in a trace file, 0 when there is none
+uint32_t traceFileSequence(const char *path) {
+  uint32_t next = 0;
+  File file = LittleFS.open(path, "r");
+  if (!file) return next;
+  uint8_t header[TRACE_HEADER_SIZE];
+  while (file.read(header, TRACE_HEADER_SIZE) == TRACE_HEADER_SIZE) {
+    uint16_t used = header[4] | (header[5] << 8);
+    if (header[0] != 'P' || header[1] != 'T' || used < TRACE_HEADER_SIZE) break;
+    next = ((uint32_t)header[8] | ((uint32_t)header[9] << 8) | ((uint32_t)header[10] << 16) | ((uint32_t)header[11] << 24)) + 1;
+    file.seek(file.position() + used - TRACE_HEADER_SIZE);
+  }
+  file.close();
+  return next;
+}
+
+// Before anything is recorded: block numbers continue those kept in flash
+void initializeTrace() {
+  if (TRACE_FLASH_ENABLED && LittleFS.begin()) {
+    traceFlashReady = true;
+    File file = LittleFS.open(TRACE_FILES[0], "r");
+    traceFile = (file && file.size() >= TRACE_FLASH_FILE_SIZE) ? 1 : 0;
+    if (file) file.close();
+    trace.setSequence(max(traceFileSequence(TRACE_FILES[0]), traceFileSequence(TRACE_FILES[1])));
+    trace.setSink(traceToFlash);
+  }
+  scale.set_read_callback(traceConversion);
+
+  uint32_t now = micros();
+  trace.configFloat(now, TRACE_KEY_DROP_AMOUNT, dropAmount);
+  trace.configFloat(now, TRACE_KEY_SLOW_ZONE, FEED_SLOW_ZONE);
+  trace.configFloat(now, TRACE_KEY_DRIBBLE_FLOW, FEED_DRIBBLE_FLOW);
+  trace.config(now, TRACE_KEY_GATE_OPEN, servoOpenPos * 10);
+  trace.configFloat(now, TRACE_KEY_WASH_LITRES, WASH_TARGET_LITRES);
+  trace.configFloat(now, TRACE_KEY_FLOW_PULSES, FLOW_PULSES_PER_LITRE);
+}
+
+// After every tare, the replay converts raw values with these
+void traceScaleConfig() {
+  trace.configFloat(micros(), TRACE_KEY_SCALE, scale.get_scale());
+  trace.config(micros(), TRACE_KEY_OFFSET, (uint32_t)scale.get_offset());
+}
+
+void traceSchedules() {
+  uint8_t kinds[FEED_NUM_SCHEDULES + WASH_NUM_SCHEDULES];
+  uint16_t minutes[FEED_NUM_SCHEDULES + WASH_NUM_SCHEDULES];
+  uint8_t count = 0;
+  for (int i = 0; i < FEED_NUM_SCHEDULES; i++) {
+    kinds[count] = TRACE_FEED_SCHEDULE;
+    minutes[count++] = max(scheduleMinute(schedules.feed[i]), (int16_t)0);
+  }
+  for (int i = 0; i < WASH_NUM_SCHEDULES; i++) {
+    kinds[count] = TRACE_WASH_SCHEDULE;
+    minutes[count++] = max(scheduleMinute(schedules.wash[i]), (int16_t)0);
+  }
+  trace.schedules(micros(), count, kinds, minutes);
+}
+
+// Commands only: method and uri with the args of everything but GET
+void traceRequest() {
+  HTTPMethod method = server.method();
+  if (method == HTTP_GET || method == HTTP_HEAD) return;
+  char text[TRACE_HTTP_MAX];
+  const char *uri = server.uriValue();
+  size_t n = min(strlen(uri), sizeof(text));
+  memcpy(text, uri, n);
+  // WiFi credentials stay out of the trace
+  uint8_t args = strcmp(uri, "/api/wifi/set") == 0 ? 0 : server.args();
+  for (uint8_t i = 0; i < args && n < sizeof(text); i++) {
+    size_t length;
+    const char *name = server.argName(i);
+    const char *value = server.argValueAt(i, &length);
+    text[n++] = i == 0 ? '?' : '&';
+    size_t nameLength = min(strlen(name), sizeof(text) - n);
+    memcpy(text + n, name, nameLength);
+    n += nameLength;
+    if (n < sizeof(text)) text[n++] = '=';
+    length = min(length, sizeof(text) - n);
+    memcpy(text + n, value, length);
+    n += length;
+  }
+  trace.http(micros(), method, text, n);
+}
+
+void benchPrint(const char *line) {
+  Serial.println(line);
 }
 
 void handleSerialCommands() {
@@ -412,98 +1138,218 @@ void handleSerialCommands() {
     command.trim();
     
     if (command == "help") {
-      Serial.println("Available commands:");
-      Serial.println("  help - Show this help");
-      Serial.println("  status - Show system status");
-      Serial.println("  feed - Start feeding");
-      Serial.println("  wash - Start wash cycle");
-      Serial.println("  washstop - Stop wash cycle");
-      Serial.println("  open - Open servo");
-      Serial.println("  close - Close servo");
-      Serial.println("  weight - Get current weight");
-      Serial.println("  tare - Tare the scale");
-      Serial.println("  time - Get current time");
-      Serial.println("  reboot - Reboot system");
-      Serial.println("  wifi - Show WiFi status");
-      Serial.println("  resetschedules - Reset to default schedules");
+      Serial.println(F("Available commands:"));
+      Serial.println(F("  help - Show this help"));
+      Serial.println(F("  status - Show system status"));
+      Serial.println(F("  feed - Start feeding"));
+      Serial.println(F("  wash - Start wash cycle"));
+      Serial.println(F("  washstop - Stop wash cycle"));
+      Serial.println(F("  open - Open servo"));
+      Serial.println(F("  close - Close servo"));
+      Serial.println(F("  gate - Show gate position and learned flows"));
+      Serial.println(F("  trace - Show trace recording state"));
+      Serial.println(F("  stats - Show feed and wash totals"));
+      Serial.println(F("  events - Show the newest events"));
+      Serial.println(F("  memory - Show static RAM, free heap and the heap each handler took"));
+      Serial.println(F("  bench [name] - Time the sample math and responses, in CPU cycles"));
+      Serial.println(F("  weight - Get current weight"));
+      Serial.println(F("  tare - Tare the scale"));
+      Serial.println(F("  time - Get current time"));
+      Serial.println(F("  reboot - Reboot system"));
+      Serial.println(F("  wifi - Show WiFi status"));
+      Serial.println(F("  resetschedules - Reset to default schedules"));
     }
     else if (command == "status") {
-      Serial.print("WiFi: ");
-      Serial.println(WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected");
-      Serial.print("Time: ");
+      Serial.print(F("WiFi: "));
+      Serial.println(WiFi.status() == WL_CONNECTED ? F("Connected") : F("Disconnected"));
+      Serial.print(F("Time: "));
       Serial.println(timeClient.getFormattedTime());
-      Serial.print("Scale: ");
-      Serial.println(hx711_available ? "Available" : "Disabled");
-      Serial.print("Servo: ");
-      Serial.println(servo_available ? (isServoOpen ? "Open" : "Closed") : "Disabled");
-      Serial.print("Wash: ");
-      Serial.println(washInProgress ? "In Progress" : "Ready");
-      Serial.print("Weight: ");
+      Serial.print(F("Scale: "));
+      Serial.println(hx711_available ? F("Available") : F("Disabled"));
+      Serial.print(F("Servo: "));
+      Serial.print(servo_available ? (isServoOpen ? F("Open") : F("Closed")) : F("Disabled"));
+      Serial.print(F(" at "));
+      Serial.println(servoPosition());
+      Serial.print(F("Wash: "));
+      Serial.println(washInProgress ? F("In Progress") : F("Ready"));
+      Serial.print(F("Wash water: "));
+      Serial.print(washMeter.litres());
+      Serial.print(F(" L, "));
+      Serial.print(washMeter.flowRate());
+      Serial.println(F(" L/min"));
+      Serial.print(F("Weight: "));
       Serial.print(getWeight());
-      Serial.println("g");
+      Serial.println(F("g"));
       
-      Serial.println("Feed Schedules:");
+      Serial.println(F("Feed Schedules:"));
       for (int i = 0; i < FEED_NUM_SCHEDULES; i++) {
-        Serial.print("  "); Serial.print(i); Serial.print(": "); Serial.println(feedSchedules[i]);
+        Serial.print(F("  ")); Serial.print(i); Serial.print(F(": ")); Serial.println(schedules.feed[i]);
       }
-      Serial.println("Wash Schedules:");
+      Serial.println(F("Wash Schedules:"));
       for (int i = 0; i < WASH_NUM_SCHEDULES; i++) {
-        Serial.print("  "); Serial.print(i); Serial.print(": "); Serial.println(washSchedules[i]);
+        Serial.print(F("  ")); Serial.print(i); Serial.print(F(": ")); Serial.println(schedules.wash[i]);
       }
     }
     else if (command == "feed") {
       openServo();
-      if (hx711_available) {
-        weightAtOpen = getWeight();
-      }
-      Serial.println("Feeding started");
+      beginFeed();
+      Serial.println(F("Feeding started"));
     }
     else if (command == "wash") {
-      startWashCycle();
-      Serial.println("Wash cycle started");
+      startWashCycle(WASH_TARGET_LITRES);
+      Serial.println(F("Wash cycle started"));
     }
     else if (command == "washstop") {
       stopWashCycle();
-      Serial.println("Wash cycle stopped");
+      Serial.println(F("Wash cycle stopped"));
     }
     else if (command == "open") {
       openServo();
-      Serial.println("Servo opened");
+      Serial.println(F("Servo opened"));
     }
     else if (command == "close") {
       closeServo();
-      Serial.println("Servo closed");
+      Serial.println(F("Servo closed"));
+    }
+    else if (command == "gate") {
+      Serial.print(F("Gate: "));
+      Serial.print(servoPosition());
+      Serial.print(F(" -> "));
+      Serial.println(gateMotion.target() / 10.0);
+      for (int i = 0; i < GATE_FLOW_POINTS; i++) {
+        Serial.print(F("  ")); Serial.print(gateFlow.pointPosition(i) / 10.0);
+        Serial.print(F(": ")); Serial.print(gateFlow.pointFlow(i)); Serial.println(F(" g/s"));
+      }
+    }
+    else if (command == "trace") {
+      Serial.print(F("Trace: "));
+      Serial.print(trace.records());
+      Serial.print(F(" records, "));
+      Serial.print(trace.blockCount());
+      Serial.print(F(" blocks in RAM, next block "));
+      Serial.print(trace.sequence());
+      Serial.println(traceFlashReady ? F(", flash on") : F(", flash off"));
+    }
+    else if (command == "stats") {
+      for (uint8_t kind = 0; kind < ROLLUP_KINDS; kind++) {
+        const RollupCell &total = rollups.total(kind);
+        Serial.print(kind == ROLLUP_FEED ? F("Feeds: ") : F("Washes: "));
+        Serial.print(total.count);
+        if (kind == ROLLUP_FEED) {
+          Serial.print(F(", "));
+          Serial.print(total.sum);
+          Serial.print(F("g"));
+        }
+        Serial.print(F(", "));
+        Serial.print(total.ms / 1000.0);
+        Serial.println(F(" s"));
+      }
+    }
+    else if (command == "memory") {
+      Serial.print(F("Static RAM: data "));
+      Serial.print((unsigned)(_data_end - _data_start));
+      Serial.print(F(", rodata "));
+      Serial.print((unsigned)(_rodata_end - _rodata_start));
+      Serial.print(F(", bss "));
+      Serial.println((unsigned)(_bss_end - _bss_start));
+      Serial.print(F("Heap: free "));
+      Serial.print(ESP.getFreeHeap());
+      Serial.print(F(", idle "));
+      Serial.print(idleHeap);
+      Serial.print(F(", idle low "));
+      Serial.print(idleHeapLow);
+      Serial.print(F(", largest block "));
+      Serial.print(ESP.getMaxFreeBlockSize());
+      Serial.print(F(", low "));
+      Serial.print(heapGuard.blockLow());
+      Serial.print(F(", trend "));
+      Serial.print(heapGuard.blockTrend());
+      Serial.println(F(" bytes/h"));
+      Serial.print(F("Shedding: "));
+      Serial.print(server.shedding() ? F("on") : F("off"));
+      Serial.print(F(", "));
+      Serial.print(server.requestsShed());
+      Serial.println(F(" requests shed"));
+      Serial.print(F("Request arena: "));
+      Serial.print(requestArena.peak());
+      Serial.print(F(" of "));
+      Serial.print(requestArena.size());
+      Serial.print(F(" bytes at most, "));
+      Serial.print(requestArena.failures());
+      Serial.println(F(" refused"));
+      Serial.println(F("Peak heap per handler:"));
+      for (uint8_t i = 0; i < server.routes(); i++) {
+        Serial.print(F("  ")); Serial.print(HTTP_METHOD_NAMES[server.routeMethod(i)]);
+        Serial.print(F(" ")); Serial.print(server.routeUri(i));
+        Serial.print(F(": ")); Serial.println(server.routeHeapPeak(i));
+      }
+    }
+    else if (command == "events") {
+      JournalEvent event;
+      char line[160];
+      for (uint32_t seq = journal.next() - min((uint32_t)10, (uint32_t)journal.count()); journal.get(seq, event); seq++) {
+        Encoder encoder(ENCODE_JSON, (uint8_t *)line, sizeof(line) - 1);
+        Journal::write(encoder, event);
+        line[encoder.finish()] = 0;
+        Serial.println(line);
+      }
+    }
+    else if (command == "bench" || command.startsWith("bench ")) {
+      // Runs for a second or two, the web server waits meanwhile
+      String filter = command.substring(5);
+      filter.trim();
+      benchRun(NULL, 0, filter.length() ? filter.c_str() : NULL, benchPrint);
     }
     else if (command == "weight") {
-      Serial.print("Weight: ");
+      Serial.print(F("Weight: "));
       Serial.print(getWeight());
-      Serial.println("g");
+      Serial.println(F("g"));
     }
     else if (command == "tare") {
       if (hx711_available) {
         scale.tare();
-        Serial.println("Scale tared");
+        traceScaleConfig();
+        journalEvent(JOURNAL_TARE, 0, scale.get_offset());
+        Serial.println(F("Scale tared"));
       } else {
-        Serial.println("Scale not available");
+        Serial.println(F("Scale not available"));
       }
     }
     else if (command == "time") {
-      Serial.print("Time: ");
+      Serial.print(F("Time: "));
       Serial.println(timeClient.getFormattedTime());
+      if (timeClient.getLastServer() >= 0) {
+        Serial.printf_P(PSTR("From %s, round trip %lu us, %u replies\n"), ntpServers[timeClient.getLastServer()],
+                        timeClient.getLastDelay(), timeClient.getLastReplies());
+      }
     }
     else if (command == "reboot") {
-      Serial.println("Rebooting...");
+      Serial.println(F("Rebooting..."));
       ESP.restart();
     }
     else if (command == "wifi") {
-      Serial.print("SSID: ");
+      Serial.print(F("SSID: "));
       Serial.println(ssid);
-      Serial.print("Status: ");
-      Serial.println(WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected");
+      Serial.print(F("Status: "));
+      Serial.println(WiFi.status() == WL_CONNECTED ? F("Connected") : F("Disconnected"));
       if (WiFi.status() == WL_CONNECTED) {
-        Serial.print("IP: ");
+        Serial.print(F("IP: "));
         Serial.println(WiFi.localIP());
+      } else {
+        Serial.print(F("Reconnect attempts: "));
+        Serial.print(wifiLink.attempts());
+        Serial.print(F(", next in "));
+        Serial.print(wifiLink.retryIn(millis()));
+        Serial.println(F(" ms"));
       }
+      Serial.print(F("Cached channel: "));
+      Serial.print(wifiChannel);
+      Serial.print(F(", cache misses: "));
+      Serial.println(wifiLink.cacheMisses());
+      Serial.print(F("Last outage: "));
+      Serial.print(wifiLink.lastOutage());
+      Serial.print(F(" ms, portal "));
+      Serial.println(apMode ? F("up") : F("down"));
     }
     else if (command == "resetschedules") {
       for (int i = FEED_SCHEDULE_ADDR; i < WASH_SCHEDULE_ADDR + 10; i++) {
@@ -511,201 +1357,590 @@ void handleSerialCommands() {
       }
       EEPROM.commit();
       loadSchedules();
-      Serial.println("Schedules reset to defaults");
+      journalEvent(JOURNAL_CONFIG, JOURNAL_CONFIG_SCHEDULES, 0);
+      Serial.println(F("Schedules reset to defaults"));
     }
     else {
-      Serial.println("Unknown command. Type 'help' for available commands.");
+      Serial.println(F("Unknown command. Type 'help' for available commands."));
     }
   }
 }
 
-void handleStatus() {
-  String json = "{";
-  json += "\"success\": true,";
-  json += "\"wifi\": \"";
-  json += (WiFi.status() == WL_CONNECTED ? "Connected" : "Disconnected");
-  json += "\",";
-  json += "\"time\": \"";
-  json += (WiFi.status() == WL_CONNECTED ? timeClient.getFormattedTime() : "No WiFi");
-  json += "\",";
-  json += "\"scale\": \"";
-  json += (hx711_available ? "Available" : "Disabled");
-  json += "\",";
-  json += "\"servo\": \"";
-  json += (servo_available ? (isServoOpen ? "Open" : "Closed") : "Disabled");
-  json += "\",";
-  json += "\"wash\": \"";
-  json += (washInProgress ? "In Progress" : "Ready");
-  json += "\",";
-  json += "\"weight\": ";
-  json += String(getWeight());
-  json += ",";
-  json += "\"lastFeedAmount\": ";
-  json += String(isServoOpen ? weightAtOpen - getWeight() : 0);
-  json += "}";
-
-  server.send(200, "application/json", json);
+// ?fmt= wins over the Accept header
+uint8_t responseFormat() {
+  size_t length;
+  const char *value = server.argValue("fmt", &length);
+  if (value) {
+    return length == 4 && strncasecmp(value, "cbor", 4) == 0 ? ENCODE_CBOR : ENCODE_JSON;
+  }
+  value = server.headerValue("Accept", &length);
+  for (size_t i = 0; value && i + 16 <= length; i++) {
+    if (strncasecmp(value + i, "application/cbor", 16) == 0) return ENCODE_CBOR;
+  }
+  return ENCODE_JSON;
 }
 
-void handleFeed() {
-  String response = "{\"success\": true, \"message\": \"";
+const char *contentType(uint8_t format) {
+  return format == ENCODE_CBOR ? "application/cbor" : "application/json";
+}
 
-  if (servo_available) {
-    openServo();
-    if (hx711_available) {
-      weightAtOpen = getWeight();
-    }
-    response += "Feeding started successfully\"}";
+void sendCached(const CachedResponse &cache) {
+  server.send(200, contentType(cache.format), (const char *)cache.body, cache.length);
+}
+
+void sendContentPiece(const uint8_t *data, size_t length) {
+  server.sendContent(data, length);
+}
+
+// Bodies of any length through a small buffer: one pass of the writer for
+// the length, one to send. The writer must give the same body both times.
+void sendEncoded(int code, ResponseWriter writer, const void *context) {
+  uint8_t format = responseFormat();
+  Encoder counter(format, NULL, 0);
+  writer(counter, context);
+  server.beginSend(code, contentType(format), counter.finish());
+  uint8_t buffer[RESPONSE_STREAM_BUFFER];
+  Encoder encoder(format, buffer, sizeof(buffer), sendContentPiece);
+  writer(encoder, context);
+  encoder.finish();
+}
+
+// Bodies are valid until the state they show changes; the stamp is the epoch
+// second they were built for, 0 while there is no WiFi time.
+const CachedResponse &statusResponse(uint8_t format) {
+  bool connected = WiFi.status() == WL_CONNECTED;
+  if (hx711_available && millis() - lastWeightTime >= STATUS_WEIGHT_MAX_AGE) {
+    getWeight();
+  }
+  unsigned long stamp = connected ? timeClient.getEpochTime() : 0;
+  if (gateMotion.position() != lastStatusPosition) {
+    lastStatusPosition = gateMotion.position();
+    statusCache.dirty = true;
+  }
+  if (statusCache.dirty || statusCache.stamp != stamp || statusCache.format != format) {
+    char clock[9];
+    formatClock(clock, stamp);
+    StatusView view = {
+      connected, clock, hx711_available, servo_available, isServoOpen, lastStatusPosition,
+      washInProgress, lastWeight, isServoOpen ? feeder.dropped(lastWeight) : 0.0f,
+      hx711_available && scale.is_stable(), hx711_available ? -scale.get_rate() : 0.0f,
+      washMeter.litres(), washMeter.flowRate()
+    };
+    Encoder encoder(format, statusCache.body, RESPONSE_CACHE_SIZE);
+    writeStatus(encoder, view);
+    statusCache.length = encoder.finish();
+    statusCache.format = format;
+    statusCache.stamp = stamp;
+    statusCache.dirty = false;
+  }
+  return statusCache;
+}
+
+const CachedResponse &scheduleResponse(uint8_t format) {
+  if (scheduleCache.dirty || scheduleCache.format != format) {
+    const char *feed[FEED_NUM_SCHEDULES];
+    const char *wash[WASH_NUM_SCHEDULES];
+    for (int i = 0; i < FEED_NUM_SCHEDULES; i++) feed[i] = schedules.feed[i];
+    for (int i = 0; i < WASH_NUM_SCHEDULES; i++) wash[i] = schedules.wash[i];
+    Encoder encoder(format, scheduleCache.body, RESPONSE_CACHE_SIZE);
+    writeSchedule(encoder, feed, FEED_NUM_SCHEDULES, wash, WASH_NUM_SCHEDULES);
+    scheduleCache.length = encoder.finish();
+    scheduleCache.format = format;
+    scheduleCache.dirty = false;
+  }
+  return scheduleCache;
+}
+
+const CachedResponse &timeResponse(uint8_t format) {
+  unsigned long stamp = timeClient.getEpochTime();
+  if (timeCache.dirty || timeCache.stamp != stamp || timeCache.format != format) {
+    char clock[9];
+    formatClock(clock, stamp);
+    Encoder encoder(format, timeCache.body, RESPONSE_CACHE_SIZE);
+    writeTime(encoder, clock);
+    timeCache.length = encoder.finish();
+    timeCache.format = format;
+    timeCache.stamp = stamp;
+    timeCache.dirty = false;
+  }
+  return timeCache;
+}
+
+// {"success": .., "message": ".."} with the message kept in flash
+void sendMessage(int code, bool success, PGM_P message) {
+  uint8_t format = responseFormat();
+  uint8_t body[128];
+  Encoder encoder(format, body, sizeof(body));
+  writeMessage(encoder, success, message);
+  server.send(code, contentType(format), (const char *)body, encoder.finish());
+}
+
+void handleStatus() {
+  sendCached(statusResponse(responseFormat()));
+}
+
+// Why the gate did not open: the inbox to the actuator ISR is full for
+// a moment, or a wash holds the interlock
+void sendServoRefused(uint8_t result) {
+  if (result == ACTUATOR_QUEUE_FULL) {
+    sendMessage(503, false, PSTR("Actuators busy, retry"));
+  } else if (result == ACTUATOR_INTERLOCK) {
+    sendMessage(200, false, PSTR("Feeder locked: wash in progress"));
   } else {
-    response = "{\"success\": false, \"message\": \"Servo not available\"}";
+    sendMessage(200, false, PSTR("Servo open refused"));
   }
+}
 
-  server.send(200, "application/json", response);
+void handleFeed() {
+  if (!servo_available) {
+    sendMessage(200, false, PSTR("Servo not available"));
+    return;
+  }
+  uint8_t result = openServo();
+  if (servoOpened(result)) {
+    beginFeed();
+    sendMessage(200, true, PSTR("Feeding started successfully"));
+  } else {
+    sendServoRefused(result);
+  }
 }
 
+// Optional litres arg overrides WASH_TARGET_LITRES, 0 runs WASH_DURATION
 void handleWash() {
-  if (!washInProgress) {
-    startWashCycle();
-    String response = "{\"success\": true, \"message\": \"Wash cycle started for 30 seconds\"}";
-    server.send(200, "application/json", response);
+  float litres = WASH_TARGET_LITRES;
+  size_t length;
+  const char *value = server.argValue("litres", &length);
+  if (value && (!fieldFloat(value, length, litres) || litres < 0)) {
+    sendMessage(400, false, PSTR("Invalid litres"));
+    return;
+  }
+  if (!washInProgress && startWashCycle(litres)) {
+    sendMessage(200, true, litres > 0 ? PSTR("Wash cycle started until the target volume")
+                                      : PSTR("Wash cycle started for 30 seconds"));
+  } else if (!washInProgress) {
+    sendMessage(200, false, PSTR("Wash locked: feed gate is open"));
   } else {
-    String response = "{\"success\": false, \"message\": \"Wash cycle already in progress\"}";
-    server.send(200, "application/json", response);
+    sendMessage(200, false, PSTR("Wash cycle already in progress"));
   }
 }
 
 void handleWashStop() {
   if (washInProgress) {
     stopWashCycle();
-    String response = "{\"success\": true, \"message\": \"Wash cycle stopped\"}";
-    server.send(200, "application/json", response);
+    sendMessage(200, true, PSTR("Wash cycle stopped"));
   } else {
-    String response = "{\"success\": false, \"message\": \"No wash cycle in progress\"}";
-    server.send(200, "application/json", response);
+    sendMessage(200, false, PSTR("No wash cycle in progress"));
   }
 }
 
+// Optional position (degrees) or flow (g/s) args give a partial opening
 void handleServoOpen() {
-  String response = "{\"success\": true, \"message\": \"";
-
-  if (servo_available) {
-    openServo();
-    response += "Servo opened successfully\"}";
+  uint8_t result;
+  size_t length;
+  const char *value;
+  float number;
+  if ((value = server.argValue("position", &length))) {
+    if (!fieldFloat(value, length, number)) {
+      sendMessage(400, false, PSTR("Invalid position"));
+      return;
+    }
+    result = openServoTo(constrain(number, 0.0, 180.0) * 10);
+  } else if ((value = server.argValue("flow", &length))) {
+    if (!fieldFloat(value, length, number)) {
+      sendMessage(400, false, PSTR("Invalid flow"));
+      return;
+    }
+    result = openServoForFlow(number);
   } else {
-    response = "{\"success\": false, \"message\": \"Servo not available\"}";
+    result = openServo();
   }
 
-  server.send(200, "application/json", response);
+  if (servoOpened(result)) {
+    sendMessage(200, true, PSTR("Servo opened successfully"));
+  } else if (servo_available) {
+    sendServoRefused(result);
+  } else {
+    sendMessage(200, false, PSTR("Servo not available"));
+  }
 }
 
 void handleServoClose() {
-  String response = "{\"success\": true, \"message\": \"";
-
   if (servo_available) {
     closeServo();
-    response += "Servo closed successfully\"}";
+    sendMessage(200, true, PSTR("Servo closed successfully"));
   } else {
-    response = "{\"success\": false, \"message\": \"Servo not available\"}";
+    sendMessage(200, false, PSTR("Servo not available"));
   }
-
-  server.send(200, "application/json", response);
 }
 
 void handleWeight() {
-  String json = "{\"success\": true, \"weight\": " + String(getWeight()) + "}";
-  server.send(200, "application/json", json);
+  uint8_t *body = (uint8_t *)server.alloc(48);
+  if (body == NULL) {
+    sendMessage(503, false, PSTR("Out of memory"));
+    return;
+  }
+  uint8_t format = responseFormat();
+  Encoder encoder(format, body, 48);
+  encoder.beginMap(2);
+  encoder.key(PSTR("success"));
+  encoder.boolean(true);
+  encoder.key(PSTR("weight"));
+  encoder.number(getWeight(), 2);
+  encoder.end();
+  server.send(200, contentType(format), (const char *)body, encoder.finish());
 }
 
 void handleTare() {
   if (hx711_available) {
     scale.tare();
-    String response = "{\"success\": true, \"message\": \"Scale tared successfully\"}";
-    server.send(200, "application/json", response);
+    traceScaleConfig();
+    journalEvent(JOURNAL_TARE, 0, scale.get_offset());
+    sendMessage(200, true, PSTR("Scale tared successfully"));
   } else {
-    String response = "{\"success\": false, \"message\": \"Scale not available\"}";
-    server.send(200, "application/json", response);
+    sendMessage(200, false, PSTR("Scale not available"));
   }
 }
 
 void handleTime() {
-  String json = "{\"success\": true, \"time\": \"" + timeClient.getFormattedTime() + "\"}";
-  server.send(200, "application/json", json);
+  sendCached(timeResponse(responseFormat()));
 }
 
 void handleReboot() {
-  String json = "{\"success\": true, \"message\": \"Rebooting system...\"}";
-  server.send(200, "application/json", json);
+  sendMessage(200, true, PSTR("Rebooting system..."));
   delay(1000);
   ESP.restart();
 }
 
+// The old image starts at flash address 0; flash reads are whole words
+bool otaReadImage(uint32_t offset, uint8_t *data, size_t length) {
+  uint32_t words[16];
+  while (length > 0) {
+    uint32_t skip = offset & 3;
+    size_t n = min(length, sizeof(words) - skip);
+    if (!ESP.flashRead(offset - skip, words, (skip + n + 3) & ~3)) return false;
+    memcpy(data, (uint8_t *)words + skip, n);
+    offset += n;
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+bool otaWriteImage(const uint8_t *data, size_t length) {
+  return Update.write((uint8_t *)data, length) == length;
+}
+
+void formatMd5(char *hex, const uint8_t *md5) {
+  for (uint8_t i = 0; i < 16; i++) snprintf_P(hex + 2 * i, 3, PSTR("%02x"), md5[i]);
+}
+
+// The patch must be made against this very image; the new one gets the space
+// of the update partition and its MD5 is checked when Update ends
+bool otaCheckImage(const DeltaHeader &header) {
+  char md5[33];
+  formatMd5(md5, header.oldMd5);
+  if (header.oldSize != ESP.getSketchSize() || ESP.getSketchMD5() != md5) return false;
+  formatMd5(md5, header.newMd5);
+  return Update.begin(header.newSize) && Update.setMD5(md5);
+}
+
+bool otaBody(uint8_t state, const uint8_t *data, size_t length) {
+  if (state == HTTP_BODY_START) {
+    if (otaRunning) {
+      otaRefused = true;
+      return false;
+    }
+    otaRunning = true;
+    otaPatch.begin(otaReadImage, otaWriteImage, otaCheckImage);
+    Serial.printf_P(PSTR("OTA: patch of %u bytes\n"), (unsigned)length);
+    return true;
+  }
+  if (state == HTTP_BODY_DATA) return otaPatch.feed(data, length);
+  // the connection dropped, the partial image is dropped too
+  Update.end();
+  otaRunning = false;
+  Serial.println(F("OTA: aborted"));
+  return false;
+}
+
+void handleOtaDelta() {
+  if (otaRefused) {
+    otaRefused = false;
+    sendMessage(503, false, PSTR("Update already in progress"));
+    return;
+  }
+  otaRunning = false;
+  if (!otaPatch.done()) {
+    Update.end();
+    uint8_t error = otaPatch.error();
+    Serial.printf_P(PSTR("OTA: failed, error %u after %u bytes\n"), error, (unsigned)otaPatch.written());
+    if (error == DELTA_READ_FAILED || error == DELTA_WRITE_FAILED) {
+      sendMessage(500, false, PSTR("Flash error"));
+    } else if (error == DELTA_BAD_HEADER) {
+      sendMessage(400, false, PSTR("Not a delta patch"));
+    } else if (error == DELTA_WRONG_SOURCE) {
+      sendMessage(400, false, PSTR("Patch is not for this firmware"));
+    } else if (error == DELTA_OK) {
+      sendMessage(400, false, PSTR("Patch incomplete"));
+    } else {
+      sendMessage(400, false, PSTR("Corrupt patch"));
+    }
+    return;
+  }
+  if (!Update.end()) {
+    sendMessage(500, false, PSTR("New image failed its check"));
+    return;
+  }
+  journalEvent(JOURNAL_CONFIG, JOURNAL_CONFIG_FIRMWARE, otaPatch.header().newSize);
+  Serial.printf_P(PSTR("OTA: new image of %u bytes\n"), (unsigned)otaPatch.header().newSize);
+  sendMessage(200, true, PSTR("Update applied. Rebooting..."));
+  delay(1000);
+  ESP.restart();
+}
+
+// The recorded trace, oldest first: the flash files, then the blocks in RAM.
+// Blocks in both are sent twice, readers skip the repeats.
+void handleTrace() {
+  File files[2];
+  size_t length = 0;
+  if (traceFlashReady) {
+    for (int i = 0; i < 2; i++) {
+      files[i] = LittleFS.open(TRACE_FILES[traceFile ^ 1 ^ i], "r");
+      if (files[i]) length += files[i].size();
+    }
+  }
+  for (uint16_t i = 0; i < trace.blockCount(); i++) {
+    uint16_t used;
+    trace.block(i, &used);
+    length += used;
+  }
+
+  server.beginSend(200, "application/octet-stream", length);
+  uint8_t buffer[256];
+  for (int i = 0; i < 2; i++) {
+    if (!files[i]) continue;
+    size_t n;
+    while ((n = files[i].read(buffer, sizeof(buffer))) > 0) {
+      server.sendContent(buffer, n);
+    }
+    files[i].close();
+  }
+  for (uint16_t i = 0; i < trace.blockCount(); i++) {
+    uint16_t used;
+    const uint8_t *block = trace.block(i, &used);
+    server.sendContent(block, used);
+  }
+}
+
+void handleTraceClear() {
+  trace.clear();
+  if (traceFlashReady) {
+    LittleFS.remove(TRACE_FILES[0]);
+    LittleFS.remove(TRACE_FILES[1]);
+    traceFile = 0;
+  }
+  sendMessage(200, true, PSTR("Trace cleared"));
+}
+
 void handleGetSchedule() {
-  String json = "{\"success\": true, \"feed_schedule\": [";
-  for (int i = 0; i < FEED_NUM_SCHEDULES; i++) {
-    json += "\"" + feedSchedules[i] + "\"";
-    if (i < FEED_NUM_SCHEDULES - 1) json += ",";
+  sendCached(scheduleResponse(responseFormat()));
+}
+
+struct EventsPage {
+  const JournalEvent *events;
+  uint8_t count;
+  uint32_t first;
+  uint32_t last;
+  bool more;
+  bool missed;
+};
+
+void writeEvents(Encoder &encoder, const void *context) {
+  const EventsPage &page = *(const EventsPage *)context;
+  encoder.beginMap(6);
+  encoder.key(PSTR("success"));
+  encoder.boolean(true);
+  encoder.key(PSTR("first"));
+  encoder.uinteger(page.first);
+  encoder.key(PSTR("last"));
+  encoder.uinteger(page.last);
+  encoder.key(PSTR("more"));
+  encoder.boolean(page.more);
+  encoder.key(PSTR("missed"));
+  encoder.boolean(page.missed);
+  encoder.key(PSTR("events"));
+  encoder.beginArray(page.count);
+  for (uint8_t i = 0; i < page.count; i++) {
+    Journal::write(encoder, page.events[i]);
   }
-  json += "], \"wash_schedule\": [";
-  for (int i = 0; i < WASH_NUM_SCHEDULES; i++) {
-    json += "\"" + washSchedules[i] + "\"";
-    if (i < WASH_NUM_SCHEDULES - 1) json += ",";
+  encoder.end();
+  encoder.end();
+}
+
+// Events after since, at most JOURNAL_PAGE; poll again from "last" while
+// "more". "missed" when events after since were dropped before this poll,
+// or since is from a journal that was wiped.
+void handleEvents() {
+  int32_t since = 0;
+  size_t length;
+  const char *value = server.argValue("since", &length);
+  if (value && (!fieldInt(value, length, since) || since < 0)) {
+    sendMessage(400, false, PSTR("Invalid since"));
+    return;
   }
-  json += "]}";
-  
-  server.send(200, "application/json", json);
+  JournalEvent *events = (JournalEvent *)server.alloc(JOURNAL_PAGE * sizeof(JournalEvent));
+  if (events == NULL) {
+    sendMessage(503, false, PSTR("Out of memory"));
+    return;
+  }
+  EventsPage page;
+  page.events = events;
+  page.count = journalRead(since, events, JOURNAL_PAGE);
+  page.first = journalFirst();
+  page.last = page.count ? events[page.count - 1].seq : journal.next() - 1;
+  page.more = page.last + 1 < journal.next();
+  page.missed = (uint32_t)since + 1 < page.first || (uint32_t)since >= journal.next();
+  sendEncoded(200, writeEvents, &page);
+}
+
+// Taken once, the two passes of sendEncoded() must see the same numbers
+struct MemoryReport {
+  uint32_t heapFree;
+  uint32_t heapMaxBlock;
+  uint8_t heapFragmentation;
+  uint8_t routes;
+  uint16_t *heapPeaks;
+};
+
+void writeMemory(Encoder &encoder, const void *context) {
+  const MemoryReport &report = *(const MemoryReport *)context;
+  encoder.beginMap(18);
+  encoder.key(PSTR("success"));
+  encoder.boolean(true);
+  encoder.key(PSTR("data"));
+  encoder.uinteger(_data_end - _data_start);
+  encoder.key(PSTR("rodata"));
+  encoder.uinteger(_rodata_end - _rodata_start);
+  encoder.key(PSTR("bss"));
+  encoder.uinteger(_bss_end - _bss_start);
+  encoder.key(PSTR("heapFree"));
+  encoder.uinteger(report.heapFree);
+  encoder.key(PSTR("heapIdle"));
+  encoder.uinteger(idleHeap);
+  encoder.key(PSTR("heapIdleLow"));
+  encoder.uinteger(idleHeapLow);
+  encoder.key(PSTR("heapMaxBlock"));
+  encoder.uinteger(report.heapMaxBlock);
+  encoder.key(PSTR("heapFragmentation"));
+  encoder.uinteger(report.heapFragmentation);
+  encoder.key(PSTR("heapBlockLow"));
+  encoder.uinteger(heapGuard.blockLow());
+  encoder.key(PSTR("heapBlockTrend"));
+  encoder.integer(heapGuard.blockTrend());
+  encoder.key(PSTR("shedding"));
+  encoder.boolean(server.shedding());
+  encoder.key(PSTR("sheds"));
+  encoder.uinteger(heapGuard.sheds());
+  encoder.key(PSTR("requestsShed"));
+  encoder.uinteger(server.requestsShed());
+  encoder.key(PSTR("arenaSize"));
+  encoder.uinteger(requestArena.size());
+  encoder.key(PSTR("arenaPeak"));
+  encoder.uinteger(requestArena.peak());
+  encoder.key(PSTR("arenaFailures"));
+  encoder.uinteger(requestArena.failures());
+  encoder.key(PSTR("routes"));
+  encoder.beginArray(report.routes);
+  for (uint8_t i = 0; i < report.routes; i++) {
+    encoder.beginMap(3);
+    encoder.key(PSTR("uri"));
+    encoder.string(server.routeUri(i));
+    encoder.key(PSTR("method"));
+    encoder.string(HTTP_METHOD_NAMES[server.routeMethod(i)]);
+    encoder.key(PSTR("heapPeak"));
+    encoder.uinteger(report.heapPeaks ? report.heapPeaks[i] : 0);
+    encoder.end();
+  }
+  encoder.end();
+  encoder.end();
+}
+
+void handleMemory() {
+  MemoryReport report;
+  report.heapFree = ESP.getFreeHeap();
+  report.heapMaxBlock = ESP.getMaxFreeBlockSize();
+  report.heapFragmentation = ESP.getHeapFragmentation();
+  report.routes = server.routes();
+  report.heapPeaks = (uint16_t *)server.alloc(report.routes * sizeof(uint16_t));
+  for (uint8_t i = 0; report.heapPeaks && i < report.routes; i++) {
+    report.heapPeaks[i] = server.routeHeapPeak(i);
+  }
+  sendEncoded(200, writeMemory, &report);
+}
+
+void writeStats(Encoder &encoder, const void *context) {
+  rollups.write(encoder, *(const uint32_t *)context);
+}
+
+void handleStats() {
+  uint32_t epoch = timeClient.isTimeSet() ? timeClient.getEpochTime() : 0;
+  sendEncoded(200, writeStats, &epoch);
+}
+
+void handleStatsClear() {
+  rollups.clear();
+  saveStats();
+  journalEvent(JOURNAL_CONFIG, JOURNAL_CONFIG_STATS, 0);
+  sendMessage(200, true, PSTR("Stats cleared"));
 }
 
 void handleSetSchedule() {
-  if (server.hasArg("type") && server.hasArg("index") && server.hasArg("time")) {
-    String typeStr = server.arg("type");
-    int index = server.arg("index").toInt();
-    String timeStr = server.arg("time");
-    
-    Serial.print("Schedule update: type=");
-    Serial.print(typeStr);
-    Serial.print(", index=");
+  size_t typeLength, indexLength, timeLength;
+  const char *type = server.argValue("type", &typeLength);
+  const char *indexText = server.argValue("index", &indexLength);
+  const char *time = server.argValue("time", &timeLength);
+  int32_t index;
+  if (type && fieldInt(indexText, indexLength, index) && time) {
+    Serial.print(F("Schedule update: type="));
+    Serial.print(type);
+    Serial.print(F(", index="));
     Serial.print(index);
-    Serial.print(", time=");
-    Serial.println(timeStr);
+    Serial.print(F(", time="));
+    Serial.println(time);
     
     // Validate time format
-    if (timeStr.length() == 5 && timeStr.indexOf(':') == 2 && 
-        timeStr.substring(0, 2).toInt() < 24 && 
-        timeStr.substring(3, 5).toInt() < 60) {
+    if (timeLength == 5 && scheduleMinute(time) >= 0) {
       
-      if (typeStr == "feed" && index >= 0 && index < FEED_NUM_SCHEDULES) {
-        feedSchedules[index] = timeStr;
-        Serial.print("Updated feed schedule ");
+      if (fieldIs(type, typeLength, "feed") && index >= 0 && index < FEED_NUM_SCHEDULES) {
+        memcpy(schedules.feed[index], time, SCHEDULE_TIME_LENGTH);
+        Serial.print(F("Updated feed schedule "));
         Serial.print(index);
-        Serial.print(" to ");
-        Serial.println(timeStr);
+        Serial.print(F(" to "));
+        Serial.println(time);
       } 
-      else if (typeStr == "wash" && index >= 0 && index < WASH_NUM_SCHEDULES) {
-        washSchedules[index] = timeStr;
-        Serial.print("Updated wash schedule ");
+      else if (fieldIs(type, typeLength, "wash") && index >= 0 && index < WASH_NUM_SCHEDULES) {
+        memcpy(schedules.wash[index], time, SCHEDULE_TIME_LENGTH);
+        Serial.print(F("Updated wash schedule "));
         Serial.print(index);
-        Serial.print(" to ");
-        Serial.println(timeStr);
+        Serial.print(F(" to "));
+        Serial.println(time);
       }
       else {
-        String response = "{\"success\": false, \"message\": \"Invalid schedule type or index\"}";
-        server.send(400, "application/json", response);
+        sendMessage(400, false, PSTR("Invalid schedule type or index"));
         return;
       }
       
       saveSchedules();
-      String response = "{\"success\": true, \"message\": \"Schedule updated successfully\"}";
-      server.send(200, "application/json", response);
+      sendMessage(200, true, PSTR("Schedule updated successfully"));
       return;
     }
   }
   
-  String response = "{\"success\": false, \"message\": \"Invalid request format\"}";
-  server.send(400, "application/json", response);
+  sendMessage(400, false, PSTR("Invalid request format"));
 }
 
 void handleWiFiConfigPage() {
-  String html = R"=====(
+  static const char html[] PROGMEM = R"=====(
 <!DOCTYPE html>
 <html>
 <head>
@@ -769,63 +2004,61 @@ void handleWiFiConfigPage() {
 </body>
 </html>
 )=====";
-  server.send(200, "text/html", html);
+  server.send_P(200, "text/html", html);
 }
 
+// JSON from the setup page, a form post works as well
 void handleWiFiSet() {
-  if (server.hasArg("plain")) {
-    String body = server.arg("plain");
-    int ssidIndex = body.indexOf("\"ssid\":");
-    int passIndex = body.indexOf("\"password\":");
+  size_t ssidLength, passLength;
+  const char *newSSID = server.argValue("ssid", &ssidLength);
+  const char *newPassword = server.argValue("password", &passLength);
+  char checked[sizeof(ssid)];
+  if (newSSID && ssidLength > 0 && fieldCopy(newSSID, ssidLength, checked, sizeof(ssid)) &&
+      fieldCopy(newPassword, passLength, password, sizeof(password))) {
+    memcpy(ssid, checked, sizeof(ssid));
+    saveWiFiCredentials();
     
-    if (ssidIndex != -1 && passIndex != -1) {
-      String newSSID = body.substring(ssidIndex + 8, body.indexOf(',', ssidIndex));
-      newSSID.replace("\"", "");
-      newSSID.trim();
-      
-      String newPassword = body.substring(passIndex + 12, body.indexOf('}', passIndex));
-      newPassword.replace("\"", "");
-      newPassword.trim();
-      
-      newSSID.toCharArray(ssid, 32);
-      newPassword.toCharArray(password, 32);
-      saveWiFiCredentials();
-      
-      String response = "{\"success\": true, \"message\": \"WiFi credentials saved. Rebooting...\"}";
-      server.send(200, "application/json", response);
-      
-      delay(2000);
-      ESP.restart();
-      return;
-    }
+    sendMessage(200, true, PSTR("WiFi credentials saved. Rebooting..."));
+    
+    delay(2000);
+    ESP.restart();
+    return;
   }
   
-  String response = "{\"success\": false, \"message\": \"Invalid data\"}";
-  server.send(400, "application/json", response);
+  sendMessage(400, false, PSTR("Invalid data"));
 }
 
 void setupWebServer() {
   // Main page and captive portal
+  server.setArena(&requestArena);
   server.on("/", HTTP_GET, handleRoot);
-  server.on("/wifi", HTTP_GET, handleWiFiConfigPage);
-
-  // API endpoints
-  server.on("/api/status", HTTP_GET, handleStatus);
-  server.on("/api/feed", HTTP_POST, handleFeed);
-  server.on("/api/wash", HTTP_POST, handleWash);
-  server.on("/api/wash/stop", HTTP_POST, handleWashStop);
-  server.on("/api/servo/open", HTTP_POST, handleServoOpen);
-  server.on("/api/servo/close", HTTP_POST, handleServoClose);
-  server.on("/api/weight", HTTP_GET, handleWeight);
-  server.on("/api/tare", HTTP_POST, handleTare);
-  server.on("/api/time", HTTP_GET, handleTime);
-  server.on("/api/reboot", HTTP_POST, handleReboot);
-  server.on("/api/schedule", HTTP_GET, handleGetSchedule);
-  server.on("/api/schedule", HTTP_POST, handleSetSchedule);
-  server.on("/api/wifi/set", HTTP_POST, handleWiFiSet);
+  server.on("/wifi", HTTP_GET, handleWiFiConfigPage, true);
+
+  // API endpoints, the essential ones (true) are served while shedding
+  server.on("/api/status", HTTP_GET, handleStatus, true);
+  server.on("/api/feed", HTTP_POST, handleFeed, true);
+  server.on("/api/wash", HTTP_POST, handleWash, true);
+  server.on("/api/wash/stop", HTTP_POST, handleWashStop, true);
+  server.on("/api/servo/open", HTTP_POST, handleServoOpen, true);
+  server.on("/api/servo/close", HTTP_POST, handleServoClose, true);
+  server.on("/api/weight", HTTP_GET, handleWeight, true);
+  server.on("/api/tare", HTTP_POST, handleTare, true);
+  server.on("/api/time", HTTP_GET, handleTime, true);
+  server.on("/api/reboot", HTTP_POST, handleReboot, true);
+  server.on("/api/schedule", HTTP_GET, handleGetSchedule, true);
+  server.on("/api/schedule", HTTP_POST, handleSetSchedule, true);
+  server.on("/api/wifi/set", HTTP_POST, handleWiFiSet, true);
+  server.on("/api/trace", HTTP_GET, handleTrace);
+  server.on("/api/trace/clear", HTTP_POST, handleTraceClear);
+  server.on("/api/stats", HTTP_GET, handleStats);
+  server.on("/api/stats/clear", HTTP_POST, handleStatsClear);
+  server.on("/api/events", HTTP_GET, handleEvents, true);
+  server.on("/api/memory", HTTP_GET, handleMemory, true);
+  server.on("/api/ota/delta", HTTP_POST, handleOtaDelta, otaBody);
+  server.onRequest(traceRequest);
 
   server.begin();
-  Serial.println("Web server started");
+  Serial.println(F("Web server started"));
 }
 
 void handleRoot() {
@@ -835,7 +2068,7 @@ void handleRoot() {
     return;
   }
 
-  String html = R"=====(
+  static const char html[] PROGMEM = R"=====(
 <!DOCTYPE html>
 <html>
 <head>
@@ -1038,6 +2271,10 @@ void handleRoot() {
                     <span>Wash Status:</span>
                     <span class="status-value" id="washStatus">-</span>
                 </div>
+                <div class="status-item">
+                    <span>Wash Water:</span>
+                    <span class="status-value" id="washWater">-</span>
+                </div>
                 <div id="washMessage"></div>
             </div>
 
@@ -1133,11 +2370,12 @@ void handleRoot() {
                 document.getElementById('wifiStatus').textContent = status.wifi;
                 document.getElementById('currentTime').textContent = status.time;
                 document.getElementById('scaleStatus').textContent = status.scale;
-                document.getElementById('servoStatus').textContent = status.servo;
+                document.getElementById('servoStatus').textContent = status.servo + (status.servo === 'Disabled' ? '' : ' (' + status.servoPosition + '°)');
                 document.getElementById('washStatus').textContent = status.wash;
                 document.getElementById('currentWeight').textContent = status.weight + 'g';
                 document.getElementById('liveWeight').textContent = status.weight + 'g';
                 document.getElementById('lastFeedAmount').textContent = status.lastFeedAmount + 'g';
+                document.getElementById('washWater').textContent = status.washVolume + ' L (' + status.washFlow + ' L/min)';
             }
         }
 
@@ -1263,20 +2501,29 @@ void handleRoot() {
 </html>
 )=====";
 
-  server.send(200, "text/html", html);
+  server.send_P(200, "text/html", html);
 }
 
 void setup() {
   Serial.begin(115200);
   delay(1000);
 
-  Serial.println("\n=== Pet Feeder System Starting ===");
-  Serial.print("MAC Address: ");
+  Serial.println(F("\n=== Pet Feeder System Starting ==="));
+  Serial.print(F("MAC Address: "));
   Serial.println(WiFi.macAddress());
 
   // Initialize EEPROM
   initializeEEPROM();
 
+  // Start recording before the first conversion
+  initializeTrace();
+
+  // Feed and wash totals of earlier boots
+  initializeStats();
+
+  // Events continue the numbers of earlier boots
+  initializeJournal();
+
   // Initialize hardware
   initializeHardware();
 
@@ -1284,65 +2531,38 @@ void setup() {
   loadWiFiCredentials();
   loadSchedules();
   
-  // Connect to WiFi
-  WiFi.mode(WIFI_STA);
-  Serial.print("Connecting to WiFi: ");
-  Serial.println(ssid);
-  
-  if (strlen(ssid) == 0) {
-    Serial.println("No WiFi credentials stored. Starting AP mode...");
-    startAPMode();
-  } else {
-    WiFi.begin(ssid, password);
-    
-    int attempts = 0;
-    while (WiFi.status() != WL_CONNECTED && attempts < 30) {
-      delay(500);
-      Serial.print(".");
-      attempts++;
-      if (attempts % 10 == 0) Serial.println(); // New line every 10 attempts
-    }
-
-    if (WiFi.status() == WL_CONNECTED) {
-      Serial.println("\nWiFi connected successfully!");
-      Serial.print("IP address: ");
-      Serial.println(WiFi.localIP());
-      Serial.print("Gateway: ");
-      Serial.println(WiFi.gatewayIP());
-      Serial.print("Subnet: ");
-      Serial.println(WiFi.subnetMask());
-      
-      wifiDisconnectMessageShown = false;
-      apMode = false;
-    } else {
-      Serial.println("\nFailed to connect to WiFi. Starting AP mode...");
-      startAPMode();
-    }
-  }
+  // Connect to WiFi in the background
+  initializeWiFi();
 
   // Initialize NTP
+  for (const char *name : ntpServers) {
+    timeClient.addServer(name);
+  }
   timeClient.begin();
 
   // Setup web server routes
   setupWebServer();
 
-  Serial.println("=== System Ready ===");
-  Serial.println("Type 'help' for available commands");
+  Serial.println(F("=== System Ready ==="));
+  Serial.println(F("Type 'help' for available commands"));
   
   if (WiFi.status() == WL_CONNECTED) {
-    Serial.print("Web interface: http://");
+    Serial.print(F("Web interface: http://"));
     Serial.println(WiFi.localIP());
   } else if (apMode) {
-    Serial.print("AP Mode: http://");
+    Serial.print(F("AP Mode: http://"));
     Serial.println(WiFi.softAPIP());
-    Serial.println("Connect to WiFi: PetFeeder_Setup");
-    Serial.println("No password required");
+    Serial.println(F("Connect to WiFi: PetFeeder_Setup"));
+    Serial.println(F("No password required"));
   }
   
-  Serial.println("========================");
+  Serial.println(F("========================"));
 }
 
 void loop() {
+  // Pick up what the actuator timer executed
+  processActuatorEvents();
+
   // Handle DNS requests in AP mode
   if (apMode) {
     dnsServer.processNextRequest();
@@ -1361,15 +2581,32 @@ void loop() {
   
   // Check auto-close condition
   checkAutoClose();
-  
-  // Check wash cycle timeout
-  checkWashTimeout();
+
+  // End a metered wash
+  checkWashVolume();
   
   // Check WiFi status
   checkWiFiStatus();
+
+  // Broadcast binary telemetry
+  checkTelemetry();
   
   // Handle serial commands
   handleSerialCommands();
+
+  // Nothing is being served between passes
+  sampleIdleHeap();
   
-  delay(100);
+  // Keep serving HTTP until the next control pass. delay(1), not yield(),
+  // between polls: a request still waits at most a millisecond, and the
+  // core idles in between so the modem can sleep.
+  unsigned long idleStart = millis();
+  do {
+    processActuatorEvents();
+    if (apMode) {
+      dnsServer.processNextRequest();
+    }
+    server.handleClient();
+    delay(1);
+  } while (millis() - idleStart < LOOP_PERIOD);
 }
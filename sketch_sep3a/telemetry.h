@@ -0,0 +1,139 @@
+#pragma once
+//
+//    FILE: telemetry.h
+// PURPOSE: Fixed layout binary telemetry datagram of the pig pen controller.
+//          Shared by the firmware (encoder) and host tools (decoder), so it
+//          only depends on <stdint.h> and <string.h>.
+//
+//  LAYOUT  (version 1, 32 bytes, all fields little endian)
+//
+//  OFFSET  SIZE  FIELD
+//  ------------------------------------------------------------
+//     0      2   magic            'P' 'F'
+//     2      1   version          TELEMETRY_VERSION
+//     3      1   flags            TELEMETRY_FLAG_*
+//     4      4   sequence         +1 per datagram, restarts at boot
+//     8      4   epoch            seconds since 1970, 0 = time not set
+//    12      4   uptime           ms since boot
+//    16      4   weight           int32, 0.01 g
+//    20      4   lastFeed         int32, 0.01 g, dropped since gate opened
+//    24      2   wifiDrops        health counters, saturate at 65535
+//    26      2   scaleTimeouts
+//    28      2   freeHeap         bytes, saturates at 65535
+//    30      2   reserved         0
+//
+//  Decoders must accept datagrams longer than TELEMETRY_PACKET_SIZE for
+//  their version: later versions only append fields.
+
+
+#include <stdint.h>
+#include <string.h>
+
+
+#define TELEMETRY_VERSION        1
+#define TELEMETRY_PACKET_SIZE    32
+#define TELEMETRY_DEFAULT_PORT   4210
+
+
+const uint8_t TELEMETRY_FLAG_SERVO_OPEN  = 0x01;
+const uint8_t TELEMETRY_FLAG_SERVO_OK    = 0x02;
+const uint8_t TELEMETRY_FLAG_SCALE_OK    = 0x04;
+const uint8_t TELEMETRY_FLAG_WASHING     = 0x08;
+const uint8_t TELEMETRY_FLAG_WIFI_OK     = 0x10;
+const uint8_t TELEMETRY_FLAG_TIME_SET    = 0x20;
+
+
+struct TelemetrySample
+{
+  uint8_t  version;
+  uint8_t  flags;
+  uint32_t sequence;
+  uint32_t epoch;
+  uint32_t uptime;
+  int32_t  weight;          //  0.01 g
+  int32_t  lastFeed;        //  0.01 g
+  uint16_t wifiDrops;
+  uint16_t scaleTimeouts;
+  uint16_t freeHeap;
+};
+
+
+inline void telemetryPut16(uint8_t *p, uint16_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+}
+
+
+inline void telemetryPut32(uint8_t *p, uint32_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = (v >> 8) & 0xFF;
+  p[2] = (v >> 16) & 0xFF;
+  p[3] = v >> 24;
+}
+
+
+inline uint16_t telemetryGet16(const uint8_t *p)
+{
+  return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+
+inline uint32_t telemetryGet32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+//  grams => int32 in 0.01 g, rounded and clamped
+inline int32_t telemetryCentigrams(float grams)
+{
+  float cg = grams * 100.0f;
+  if (cg >  2147483000.0f) return  2147483000;
+  if (cg < -2147483000.0f) return -2147483000;
+  return (int32_t)(cg < 0 ? cg - 0.5f : cg + 0.5f);
+}
+
+
+//  writes TELEMETRY_PACKET_SIZE bytes into buf.
+inline uint8_t telemetryEncode(const TelemetrySample &s, uint8_t *buf)
+{
+  memset(buf, 0, TELEMETRY_PACKET_SIZE);
+  buf[0] = 'P';
+  buf[1] = 'F';
+  buf[2] = TELEMETRY_VERSION;
+  buf[3] = s.flags;
+  telemetryPut32(buf + 4,  s.sequence);
+  telemetryPut32(buf + 8,  s.epoch);
+  telemetryPut32(buf + 12, s.uptime);
+  telemetryPut32(buf + 16, (uint32_t)s.weight);
+  telemetryPut32(buf + 20, (uint32_t)s.lastFeed);
+  telemetryPut16(buf + 24, s.wifiDrops);
+  telemetryPut16(buf + 26, s.scaleTimeouts);
+  telemetryPut16(buf + 28, s.freeHeap);
+  return TELEMETRY_PACKET_SIZE;
+}
+
+
+//  returns false if buf is not a telemetry datagram this decoder understands.
+inline bool telemetryDecode(const uint8_t *buf, uint16_t length, TelemetrySample &s)
+{
+  if (length < TELEMETRY_PACKET_SIZE) return false;
+  if (buf[0] != 'P' || buf[1] != 'F') return false;
+  if (buf[2] < 1) return false;
+  s.version       = buf[2];
+  s.flags         = buf[3];
+  s.sequence      = telemetryGet32(buf + 4);
+  s.epoch         = telemetryGet32(buf + 8);
+  s.uptime        = telemetryGet32(buf + 12);
+  s.weight        = (int32_t)telemetryGet32(buf + 16);
+  s.lastFeed      = (int32_t)telemetryGet32(buf + 20);
+  s.wifiDrops     = telemetryGet16(buf + 24);
+  s.scaleTimeouts = telemetryGet16(buf + 26);
+  s.freeHeap      = telemetryGet16(buf + 28);
+  return true;
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,568 @@
+//
+//    FILE: trace.cpp
+// PURPOSE: Compact binary trace of what the pig pen controller saw and
+//          did, for replay of field problems on a host.
+//
+
+
+#include "trace.h"
+#include "crc16.h"
+
+#include <string.h>
+
+
+float traceFloat(uint32_t bits)
+{
+  float value;
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
+
+uint32_t traceBits(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, 4);
+  return bits;
+}
+
+
+//  the header part the CRC covers, the rest of the block is added
+//  record by record
+static uint16_t headerCrc(const uint8_t *b)
+{
+  return crc16(crc16(CRC16_INIT, b, 4), b + 8, TRACE_HEADER_SIZE - 8);
+}
+
+
+static uint8_t *putVarint(uint8_t *p, uint32_t v)
+{
+  while (v >= 0x80)
+  {
+    *p++ = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  *p++ = v;
+  return p;
+}
+
+
+static uint8_t *putSigned(uint8_t *p, int32_t v)
+{
+  return putVarint(p, ((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+
+static uint8_t *put32(uint8_t *p, uint32_t v)
+{
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+  return p + 4;
+}
+
+
+static uint32_t get32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+
+static uint16_t get16(const uint8_t *p)
+{
+  return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  WRITER
+//
+TraceWriter::TraceWriter(uint8_t *ram, uint16_t blocks)
+{
+  _ram    = ram;
+  _blocks = blocks;
+  _sink   = NULL;
+  _configSet     = 0;
+  _scheduleCount = 0;
+  _sequence      = 0;
+  _boot          = true;
+  clear();
+}
+
+
+void TraceWriter::clear()
+{
+  _first      = 0;
+  _current    = 0;
+  _used       = 0;
+  _wrapped    = false;
+  _records    = 0;
+  _inPreamble = false;
+  _lastUs     = 0;
+  _lastRaw    = 0;
+  _epoch      = 0;
+  _epochUs    = 0;
+}
+
+
+void TraceWriter::raw(uint32_t us, int32_t value)
+{
+  uint8_t *p = _begin(us, TRACE_RAW, 5);
+  p = putSigned(p, value - _lastRaw);
+  _lastRaw = value;
+  _end(p);
+}
+
+
+void TraceWriter::actuator(uint32_t us, uint8_t command, uint8_t result, uint16_t argument)
+{
+  uint8_t *p = _begin(us, TRACE_ACTUATOR, 2 + 3);
+  *p++ = command;
+  *p++ = result;
+  p = putVarint(p, argument);
+  _end(p);
+}
+
+
+void TraceWriter::schedule(uint32_t us, uint8_t kind, uint8_t index, uint16_t minute)
+{
+  uint8_t *p = _begin(us, TRACE_SCHEDULE, 2 + 3);
+  *p++ = kind;
+  *p++ = index;
+  p = putVarint(p, minute);
+  _end(p);
+}
+
+
+void TraceWriter::http(uint32_t us, uint8_t method, const char *text, uint16_t length)
+{
+  if (length > TRACE_HTTP_MAX) length = TRACE_HTTP_MAX;
+  uint8_t *p = _begin(us, TRACE_HTTP, 2 + length);
+  *p++ = method;
+  *p++ = length;
+  memcpy(p, text, length);
+  _end(p + length);
+}
+
+
+void TraceWriter::time(uint32_t us, uint32_t epoch)
+{
+  _epoch   = epoch;
+  _epochUs = us;
+  uint8_t *p = _begin(us, TRACE_TIME, 4);
+  _end(put32(p, epoch));
+}
+
+
+void TraceWriter::config(uint32_t us, uint8_t key, uint32_t bits)
+{
+  if (key >= TRACE_CONFIG_KEYS) return;
+  //  a block opened for this record repeats the value before it
+  uint8_t *p = _begin(us, TRACE_CONFIG, 5);
+  _config[key] = bits;
+  _configSet |= 1 << key;
+  *p++ = key;
+  _end(put32(p, bits));
+}
+
+
+void TraceWriter::schedules(uint32_t us, uint8_t count, const uint8_t *kinds, const uint16_t *minutes)
+{
+  if (count > TRACE_MAX_SCHEDULES) count = TRACE_MAX_SCHEDULES;
+  uint8_t *p = _begin(us, TRACE_SCHEDULES, 1 + count * 4);
+  *p++ = count;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    *p++ = kinds[i];
+    p = putVarint(p, minutes[i]);
+  }
+  _end(p);
+  if (kinds != _scheduleKinds)
+  {
+    _scheduleCount = count;
+    memcpy(_scheduleKinds, kinds, count);
+    memcpy(_scheduleMinutes, minutes, count * sizeof(uint16_t));
+  }
+}
+
+
+void TraceWriter::feed(uint32_t us, float weight)
+{
+  uint8_t *p = _begin(us, TRACE_FEED, 4);
+  _end(put32(p, traceBits(weight)));
+}
+
+
+void TraceWriter::flow(uint32_t us, uint32_t pulses)
+{
+  uint8_t *p = _begin(us, TRACE_FLOW, 5);
+  _end(putVarint(p, pulses));
+}
+
+
+uint16_t TraceWriter::blockCount() const
+{
+  if (_used == 0 && _current == _first) return 0;
+  return (uint16_t)((_current + _blocks - _first) % _blocks) + 1;
+}
+
+
+const uint8_t *TraceWriter::block(uint16_t i, uint16_t *length) const
+{
+  if (i >= blockCount()) return NULL;
+  uint16_t index = (_first + i) % _blocks;
+  const uint8_t *b = _ram + (uint32_t)index * TRACE_BLOCK_SIZE;
+  if (length) *length = get16(b + 4);
+  return b;
+}
+
+
+//  starts a record, opening a new block if it might not fit
+uint8_t *TraceWriter::_begin(uint32_t us, uint8_t type, uint8_t payload)
+{
+  if (_used == 0 || (!_inPreamble && _used + 1 + 5 + payload > TRACE_BLOCK_SIZE))
+  {
+    _newBlock(us);
+  }
+  uint8_t *p = _ram + (uint32_t)_current * TRACE_BLOCK_SIZE + _used;
+  *p++ = type;
+  //  events may be logged a little after later conversions
+  p = putSigned(p, (int32_t)(us - _lastUs));
+  _lastUs = us;
+  return p;
+}
+
+
+void TraceWriter::_end(uint8_t *p)
+{
+  uint8_t *b = _ram + (uint32_t)_current * TRACE_BLOCK_SIZE;
+  uint16_t used = p - b;
+  _crc  = crc16(_crc, b + _used, used - _used);
+  _used = used;
+  b[4] = _used;
+  b[5] = _used >> 8;
+  b[6] = _crc;
+  b[7] = _crc >> 8;
+  _records++;
+}
+
+
+void TraceWriter::_newBlock(uint32_t us)
+{
+  if (_used > 0)
+  {
+    if (_sink) _sink(_ram + (uint32_t)_current * TRACE_BLOCK_SIZE, _used);
+    _current = (_current + 1) % _blocks;
+    if (_current == _first)
+    {
+      _first   = (_first + 1) % _blocks;
+      _wrapped = true;
+    }
+  }
+
+  uint8_t *b = _ram + (uint32_t)_current * TRACE_BLOCK_SIZE;
+  memset(b, 0, TRACE_HEADER_SIZE);
+  b[0] = 'P';
+  b[1] = 'T';
+  b[2] = TRACE_VERSION;
+  b[3] = _boot ? TRACE_FLAG_BOOT : 0;
+  _boot = false;
+  put32(b + 8, _sequence++);
+  put32(b + 12, us);
+  put32(b + 16, _epoch ? _epoch + (us - _epochUs) / 1000000UL : 0);
+  put32(b + 20, (uint32_t)_lastRaw);
+  _used   = TRACE_HEADER_SIZE;
+  b[4]    = _used;
+  b[5]    = _used >> 8;
+  _crc    = headerCrc(b);
+  b[6]    = _crc;
+  b[7]    = _crc >> 8;
+  _lastUs = us;
+  _preamble();
+}
+
+
+//  the configuration at the start of every block
+void TraceWriter::_preamble()
+{
+  _inPreamble = true;
+  for (uint8_t key = 0; key < TRACE_CONFIG_KEYS; key++)
+  {
+    if (_configSet & (1 << key)) config(_lastUs, key, _config[key]);
+  }
+  if (_scheduleCount > 0)
+  {
+    schedules(_lastUs, _scheduleCount, _scheduleKinds, _scheduleMinutes);
+  }
+  _inPreamble = false;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  READER
+//
+TraceReader::TraceReader(const uint8_t *data, uint32_t length)
+{
+  _data       = data;
+  _length     = length;
+  _offset     = 0;
+  _pos        = 0;
+  _used       = 0;
+  _open       = false;
+  _started    = false;
+  _time       = 0;
+  _blockTime  = 0;
+  _blockEpoch = 0;
+  _lastUs     = 0;
+  _sequence   = 0;
+  _raw        = 0;
+  _blockCount = 0;
+  _damaged    = 0;
+  _missing    = 0;
+  _boots      = 0;
+}
+
+
+static bool readVarint(const uint8_t *p, uint16_t end, uint16_t &pos, uint32_t &v)
+{
+  v = 0;
+  for (uint8_t shift = 0; shift < 35; shift += 7)
+  {
+    if (pos >= end) return false;
+    uint8_t b = p[pos++];
+    v |= (uint32_t)(b & 0x7F) << shift;
+    if ((b & 0x80) == 0) return true;
+  }
+  return false;
+}
+
+
+static bool readSigned(const uint8_t *p, uint16_t end, uint16_t &pos, int32_t &v)
+{
+  uint32_t u;
+  if (!readVarint(p, end, pos, u)) return false;
+  v = (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+  return true;
+}
+
+
+//  finds the next valid block header at or after _offset
+bool TraceReader::_openBlock()
+{
+  bool skipped = false;
+  while (_offset + TRACE_HEADER_SIZE <= _length)
+  {
+    const uint8_t *b = _data + _offset;
+    uint16_t used = get16(b + 4);
+    if (b[0] == 'P' && b[1] == 'T' && b[2] >= 1 && b[2] <= TRACE_VERSION &&
+        used >= TRACE_HEADER_SIZE && used <= TRACE_BLOCK_SIZE &&
+        _offset + used <= _length &&
+        crc16(headerCrc(b), b + TRACE_HEADER_SIZE, used - TRACE_HEADER_SIZE) == get16(b + 6))
+    {
+      if (skipped) _damaged++;
+      skipped = false;
+      uint32_t sequence = get32(b + 8);
+      uint32_t us       = get32(b + 12);
+      uint32_t epoch    = get32(b + 16);
+      //  a block exported twice, from flash and from RAM
+      if (_started && sequence <= _sequence)
+      {
+        _offset += used;
+        continue;
+      }
+      if (_started)
+      {
+        if (sequence > _sequence + 1) _missing += sequence - _sequence - 1;
+        if (b[3] & TRACE_FLAG_BOOT)
+        {
+          //  micros() restarted, the wall clock tells the time between
+          _boots++;
+          if (epoch != 0 && _blockEpoch != 0 && epoch > _blockEpoch)
+          {
+            _time = _blockTime + (int64_t)(epoch - _blockEpoch) * 1000000;
+          }
+          else
+          {
+            _time += 1000000;
+          }
+        }
+        else
+        {
+          _time += (int32_t)(us - _lastUs);
+        }
+      }
+      _blockTime  = _time;
+      _blockEpoch = epoch;
+      _started  = true;
+      _sequence = sequence;
+      _lastUs   = us;
+      _raw      = (int32_t)get32(b + 20);
+      _used     = used;
+      _pos      = TRACE_HEADER_SIZE;
+      _open     = true;
+      _blockCount++;
+      return true;
+    }
+    skipped = true;
+    _offset++;
+  }
+  if (skipped) _damaged++;
+  return false;
+}
+
+
+bool TraceReader::next(TraceRecord &r)
+{
+  while (true)
+  {
+    if (!_open)
+    {
+      if (!_openBlock()) return false;
+      //  the header epoch reads as a time record
+      uint32_t epoch = get32(_data + _offset + 16);
+      if (epoch != 0)
+      {
+        memset(&r, 0, sizeof(r));
+        r.type     = TRACE_TIME;
+        r.timeUs   = _time;
+        r.sequence = _sequence;
+        r.epoch    = epoch;
+        return true;
+      }
+    }
+    if (_pos >= _used)
+    {
+      _offset += _used;
+      _open = false;
+      continue;
+    }
+
+    const uint8_t *b = _data + _offset;
+    uint16_t pos = _pos;
+    int32_t  delta;
+    uint32_t v;
+    memset(&r, 0, sizeof(r));
+    r.type = b[pos++];
+    bool ok = readSigned(b, _used, pos, delta);
+    if (ok)
+    {
+      switch (r.type)
+      {
+        case TRACE_RAW:
+        {
+          int32_t diff;
+          ok = readSigned(b, _used, pos, diff);
+          if (ok)
+          {
+            _raw += diff;
+            r.raw = _raw;
+          }
+          break;
+        }
+        case TRACE_ACTUATOR:
+          ok = pos + 2 <= _used;
+          if (ok)
+          {
+            r.command = b[pos++];
+            r.result  = b[pos++];
+            ok = readVarint(b, _used, pos, v);
+            r.argument = v;
+          }
+          break;
+        case TRACE_SCHEDULE:
+          ok = pos + 2 <= _used;
+          if (ok)
+          {
+            r.kind  = b[pos++];
+            r.index = b[pos++];
+            ok = readVarint(b, _used, pos, v);
+            r.minute = v;
+          }
+          break;
+        case TRACE_HTTP:
+          ok = pos + 2 <= _used;
+          if (ok)
+          {
+            r.method = b[pos++];
+            r.length = b[pos++];
+            ok = r.length <= TRACE_HTTP_MAX && pos + r.length <= _used;
+            if (ok)
+            {
+              memcpy(r.text, b + pos, r.length);
+              r.text[r.length] = 0;
+              pos += r.length;
+            }
+          }
+          break;
+        case TRACE_TIME:
+          ok = pos + 4 <= _used;
+          if (ok)
+          {
+            r.epoch = get32(b + pos);
+            pos += 4;
+          }
+          break;
+        case TRACE_CONFIG:
+          ok = pos + 5 <= _used;
+          if (ok)
+          {
+            r.key  = b[pos++];
+            r.bits = get32(b + pos);
+            pos += 4;
+          }
+          break;
+        case TRACE_SCHEDULES:
+          ok = pos + 1 <= _used;
+          if (ok)
+          {
+            r.count = b[pos++];
+            ok = r.count <= TRACE_MAX_SCHEDULES;
+            for (uint8_t i = 0; ok && i < r.count; i++)
+            {
+              ok = pos + 1 <= _used;
+              if (!ok) break;
+              r.kinds[i] = b[pos++];
+              ok = readVarint(b, _used, pos, v);
+              r.minutes[i] = v;
+            }
+          }
+          break;
+        case TRACE_FEED:
+          ok = pos + 4 <= _used;
+          if (ok)
+          {
+            r.weight = traceFloat(get32(b + pos));
+            pos += 4;
+          }
+          break;
+        case TRACE_FLOW:
+          ok = readVarint(b, _used, pos, v);
+          r.pulses = v;
+          break;
+        default:
+          ok = false;
+          break;
+      }
+    }
+    if (!ok)
+    {
+      //  the rest of the block cannot be trusted
+      _damaged++;
+      _offset += _used;
+      _open = false;
+      continue;
+    }
+    _pos      = pos;
+    _time    += delta;
+    _lastUs  += delta;
+    r.timeUs   = _time;
+    r.sequence = _sequence;
+    return true;
+  }
+}
+
+
+//  -- END OF FILE --
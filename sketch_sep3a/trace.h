@@ -0,0 +1,229 @@
+#pragma once
+//
+//    FILE: trace.h
+// PURPOSE: Compact binary trace of what the pig pen controller saw and
+//          did, for replay of field problems on a host.
+//
+//  NOTES
+//  A trace is a sequence of blocks of at most TRACE_BLOCK_SIZE bytes.
+//  Every block starts with a header holding absolute values (time,
+//  epoch, last raw conversion) and repeats the configuration, so a
+//  reader can start at any block - the RAM ring overwrites the oldest
+//  block and the flash ring drops whole files.
+//  Records never span blocks. All values are little endian.
+//
+//  BLOCK HEADER (TRACE_HEADER_SIZE bytes)
+//    0   2   magic 'P' 'T'
+//    2   1   TRACE_VERSION
+//    3   1   flags, TRACE_FLAG_BOOT on the first block after power up
+//    4   2   bytes used in the block, header included
+//    6   2   CRC-16/CCITT of bytes 0..3, 8..23 and the records
+//    8   4   block sequence number
+//   12   4   micros() of the block start
+//   16   4   epoch seconds at the block start, 0 = unknown
+//   20   4   raw HX711 conversion the first TRACE_RAW delta is based on
+//
+//  RECORD
+//    1 byte type, zigzag varint us since the previous record (or the
+//    block start) - negative for events logged after later conversions -
+//    then the payload of the type:
+//    TRACE_RAW        zigzag varint difference to the previous conversion
+//    TRACE_ACTUATOR   command, result, varint argument
+//    TRACE_SCHEDULE   kind, index, varint minute of the day
+//    TRACE_HTTP       method, length, length bytes "uri?name=value&..."
+//    TRACE_TIME       4 bytes epoch seconds
+//    TRACE_CONFIG     key, 4 bytes value (float or int32 by key)
+//    TRACE_SCHEDULES  count, count x (kind, varint minute of the day)
+//    TRACE_FEED       4 bytes float, weight when a feeding started
+//    TRACE_FLOW       varint flow meter pulses since the wash started
+//
+//  Version 2 added TRACE_FLOW and the wash keys; version 1 blocks are
+//  read as well, they hold none of them.
+//
+//  No Arduino dependency, the host replay tool reads traces with it.
+
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define TRACE_VERSION           2
+#define TRACE_BLOCK_SIZE        512
+#define TRACE_HEADER_SIZE       24
+#define TRACE_HTTP_MAX          64
+#define TRACE_MAX_SCHEDULES     8
+#define TRACE_CONFIG_KEYS       8      //  at most 8, one bit each
+
+#define TRACE_FLAG_BOOT         0x01
+
+
+enum TraceType : uint8_t
+{
+  TRACE_RAW = 1,
+  TRACE_ACTUATOR,
+  TRACE_SCHEDULE,
+  TRACE_HTTP,
+  TRACE_TIME,
+  TRACE_CONFIG,
+  TRACE_SCHEDULES,
+  TRACE_FEED,
+  TRACE_FLOW
+};
+
+
+//  TRACE_CONFIG keys
+enum TraceKey : uint8_t
+{
+  TRACE_KEY_SCALE = 0,          //  float, HX711 set_scale()
+  TRACE_KEY_OFFSET,             //  int32, HX711 offset
+  TRACE_KEY_DROP_AMOUNT,        //  float, grams per feeding
+  TRACE_KEY_SLOW_ZONE,          //  float, grams
+  TRACE_KEY_DRIBBLE_FLOW,       //  float, g/s
+  TRACE_KEY_GATE_OPEN,          //  int32, open position, tenths of a degree
+  TRACE_KEY_WASH_LITRES,        //  float, target of the wash, 0 = timed
+  TRACE_KEY_FLOW_PULSES         //  float, flow meter pulses per litre
+};
+
+
+//  TRACE_SCHEDULE / TRACE_SCHEDULES kinds
+#define TRACE_FEED_SCHEDULE     0
+#define TRACE_WASH_SCHEDULE     1
+
+
+//  a decoded record; only the fields of its type are valid
+struct TraceRecord
+{
+  uint8_t  type;
+  int64_t  timeUs;              //  since the start of the trace
+  uint32_t sequence;            //  block it came from
+  int32_t  raw;
+  uint8_t  command;
+  uint8_t  result;
+  uint16_t argument;
+  uint8_t  kind;
+  uint8_t  index;
+  uint16_t minute;
+  uint8_t  method;
+  uint8_t  length;
+  char     text[TRACE_HTTP_MAX + 1];
+  uint32_t epoch;
+  uint8_t  key;
+  uint32_t bits;                //  TRACE_CONFIG value, see traceFloat()
+  float    weight;
+  uint32_t pulses;
+  uint8_t  count;
+  uint8_t  kinds[TRACE_MAX_SCHEDULES];
+  uint16_t minutes[TRACE_MAX_SCHEDULES];
+};
+
+
+float    traceFloat(uint32_t bits);
+uint32_t traceBits(float value);
+
+
+//  called with every completed block, e.g. to keep it in flash
+typedef void (*TraceSink)(const uint8_t *block, uint16_t length);
+
+
+class TraceWriter
+{
+public:
+  //  ram holds blocks x TRACE_BLOCK_SIZE bytes
+  TraceWriter(uint8_t *ram, uint16_t blocks);
+
+  void     setSink(TraceSink sink)  { _sink = sink; };
+  //  continues the block numbers of a trace kept from before a reboot
+  void     setSequence(uint32_t next)  { _sequence = next; };
+  //  drops the recorded blocks, keeps configuration and numbering
+  void     clear();
+
+  void     raw(uint32_t us, int32_t value);
+  void     actuator(uint32_t us, uint8_t command, uint8_t result, uint16_t argument);
+  void     schedule(uint32_t us, uint8_t kind, uint8_t index, uint16_t minute);
+  void     http(uint32_t us, uint8_t method, const char *text, uint16_t length);
+  void     time(uint32_t us, uint32_t epoch);
+  void     config(uint32_t us, uint8_t key, uint32_t bits);
+  void     configFloat(uint32_t us, uint8_t key, float value)  { config(us, key, traceBits(value)); };
+  void     schedules(uint32_t us, uint8_t count, const uint8_t *kinds, const uint16_t *minutes);
+  void     feed(uint32_t us, float weight);
+  void     flow(uint32_t us, uint32_t pulses);
+
+  //  EXPORT - the blocks in RAM, oldest first, the last one is the
+  //  block being filled. block() returns NULL past the end.
+  uint16_t blockCount() const;
+  const uint8_t *block(uint16_t i, uint16_t *length) const;
+  uint32_t records() const  { return _records; };
+  uint32_t sequence() const { return _sequence; };
+
+private:
+  uint8_t *_begin(uint32_t us, uint8_t type, uint8_t payload);
+  void     _end(uint8_t *p);
+  void     _newBlock(uint32_t us);
+  void     _preamble();
+
+  uint8_t  *_ram;
+  uint16_t  _blocks;
+  uint16_t  _first;             //  oldest block in the ring
+  uint16_t  _current;
+  uint16_t  _used;              //  bytes used in the current block
+  bool      _wrapped;
+  TraceSink _sink;
+  uint32_t  _sequence;
+  uint32_t  _records;
+  bool      _inPreamble;
+  bool      _boot;
+  uint16_t  _crc;
+
+  //  state the deltas and the next block header need
+  uint32_t  _lastUs;
+  int32_t   _lastRaw;
+  uint32_t  _epoch;
+  uint32_t  _epochUs;
+
+  //  configuration repeated at the start of every block
+  uint32_t  _config[TRACE_CONFIG_KEYS];
+  uint8_t   _configSet;         //  bit per key
+  uint8_t   _scheduleCount;
+  uint8_t   _scheduleKinds[TRACE_MAX_SCHEDULES];
+  uint16_t  _scheduleMinutes[TRACE_MAX_SCHEDULES];
+};
+
+
+class TraceReader
+{
+public:
+  TraceReader(const uint8_t *data, uint32_t length);
+
+  //  next record in recording order, false at the end.
+  //  damaged blocks are skipped and counted, repeated ones skipped.
+  bool     next(TraceRecord &record);
+
+  uint32_t blocks() const   { return _blockCount; };
+  uint32_t damaged() const  { return _damaged; };
+  uint32_t missing() const  { return _missing; };   //  sequence gaps, damaged included
+  uint32_t boots() const    { return _boots; };     //  reboots inside the trace
+
+private:
+  bool     _openBlock();
+
+  const uint8_t *_data;
+  uint32_t  _length;
+  uint32_t  _offset;            //  start of the current block
+  uint16_t  _pos;               //  within the current block
+  uint16_t  _used;
+  bool      _open;
+  bool      _started;
+  int64_t   _time;
+  int64_t   _blockTime;         //  _time at the start of the block
+  uint32_t  _blockEpoch;
+  uint32_t  _lastUs;
+  uint32_t  _sequence;
+  int32_t   _raw;
+  uint32_t  _blockCount;
+  uint32_t  _damaged;
+  uint32_t  _missing;
+  uint32_t  _boots;
+};
+
+
+//  -- END OF FILE --
@@ -0,0 +1,100 @@
+//
+//    FILE: wash_meter.cpp
+// PURPOSE: Volume of a wash cycle from a pulse output flow meter and
+//          the decision to end the cycle, apart from the hardware.
+//
+
+
+#include "wash_meter.h"
+
+
+WashMeter::WashMeter(float pulsesPerLitre, uint32_t noFlowMs)
+{
+  _pulsesPerLitre = pulsesPerLitre;
+  _noFlowMs       = noFlowMs;
+  _running        = false;
+  _decided        = false;
+  _target         = 0;
+  _startPulses    = 0;
+  _startMs        = 0;
+  _pulses         = 0;
+  _duration       = 0;
+  _lastPulseMs    = 0;
+  _windowPulses   = 0;
+  _windowMs       = 0;
+  _rate           = 0;
+}
+
+
+void WashMeter::start(uint32_t pulses, uint32_t ms, float targetLitres)
+{
+  _running        = true;
+  _decided        = false;
+  _target         = targetLitres > 0 ? targetLitres : 0;
+  _startPulses    = pulses;
+  _startMs        = ms;
+  _pulses         = 0;
+  _duration       = 0;
+  _lastPulseMs    = ms;
+  _windowPulses   = pulses;
+  _windowMs       = ms;
+  _rate           = 0;
+}
+
+
+WashAction WashMeter::update(uint32_t pulses, uint32_t ms)
+{
+  if (!_running) return WASH_HOLD;
+  _count(pulses, ms);
+  if (_decided || _target == 0) return WASH_HOLD;
+  if (_pulses >= _target * _pulsesPerLitre)
+  {
+    _decided = true;
+    return WASH_VOLUME_REACHED;
+  }
+  if (ms - _lastPulseMs >= _noFlowMs)
+  {
+    _decided = true;
+    return WASH_NO_FLOW;
+  }
+  return WASH_HOLD;
+}
+
+
+void WashMeter::stop(uint32_t pulses, uint32_t ms)
+{
+  if (!_running) return;
+  _count(pulses, ms);
+  _running = false;
+}
+
+
+float WashMeter::litres() const
+{
+  return _pulses / _pulsesPerLitre;
+}
+
+
+float WashMeter::meanFlow() const
+{
+  if (_duration == 0) return 0;
+  return litres() * 60000.0 / _duration;
+}
+
+
+void WashMeter::_count(uint32_t pulses, uint32_t ms)
+{
+  uint32_t counted = pulses - _startPulses;
+  if (counted != _pulses) _lastPulseMs = ms;
+  _pulses   = counted;
+  _duration = ms - _startMs;
+  if (ms - _windowMs >= WASH_RATE_WINDOW)
+  {
+    _rate = (pulses - _windowPulses) / _pulsesPerLitre * 60000.0 / (ms - _windowMs);
+    _windowPulses = pulses;
+    _windowMs     = ms;
+  }
+}
+
+
+//  -- END OF FILE --
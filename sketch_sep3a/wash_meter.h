@@ -0,0 +1,82 @@
+#pragma once
+//
+//    FILE: wash_meter.h
+// PURPOSE: Volume of a wash cycle from a pulse output flow meter and
+//          the decision to end the cycle, apart from the hardware.
+//
+//  NOTES
+//  The sketch counts the meter pulses in an interrupt and hands the
+//  running count to update() once per pass; the host replay tool does
+//  the same with the counts of a recorded trace, so both end a wash at
+//  the same pass. Counts are differences of a free running uint32_t,
+//  they may wrap.
+//
+//  A cycle with a target volume ends when that much water has run, or
+//  when the meter gives no pulse for the no flow time - a dry supply
+//  or a broken meter - so it is never left to the time cap alone.
+//  Without a target the meter only measures, the caller's timer ends
+//  the cycle.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+
+
+#define WASH_RATE_WINDOW        1000    //  ms the flow rate is measured over
+
+
+enum WashAction : uint8_t
+{
+  WASH_HOLD = 0,                //  keep the water running
+  WASH_VOLUME_REACHED,          //  the target volume has run
+  WASH_NO_FLOW                  //  no pulse for the no flow time
+};
+
+
+class WashMeter
+{
+public:
+  WashMeter(float pulsesPerLitre, uint32_t noFlowMs);
+
+  //  relay on: pulses is the running count; targetLitres 0 = measure only
+  void     start(uint32_t pulses, uint32_t ms, float targetLitres);
+  //  one pass while the water runs, an action other than WASH_HOLD
+  //  comes once per cycle
+  WashAction update(uint32_t pulses, uint32_t ms);
+  //  relay off, fixes the volume and the duration of the cycle
+  void     stop(uint32_t pulses, uint32_t ms);
+
+  bool     running() const      { return _running; };
+  float    target() const       { return _target; };
+  uint32_t pulses() const       { return _pulses; };
+  //  of the running cycle, or of the last one once stopped
+  float    litres() const;
+  uint32_t duration() const     { return _duration; };
+  //  L/min over the last WASH_RATE_WINDOW, 0 once stopped
+  float    flowRate() const     { return _running ? _rate : 0; };
+  //  L/min over the whole cycle
+  float    meanFlow() const;
+
+  float    pulsesPerLitre() const  { return _pulsesPerLitre; };
+
+private:
+  void     _count(uint32_t pulses, uint32_t ms);
+
+  float    _pulsesPerLitre;
+  uint32_t _noFlowMs;
+  bool     _running;
+  bool     _decided;
+  float    _target;
+  uint32_t _startPulses;
+  uint32_t _startMs;
+  uint32_t _pulses;             //  since start
+  uint32_t _duration;           //  ms since start
+  uint32_t _lastPulseMs;        //  when the count last went up
+  uint32_t _windowPulses;
+  uint32_t _windowMs;
+  float    _rate;
+};
+
+
+//  -- END OF FILE --
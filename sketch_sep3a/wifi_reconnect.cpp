@@ -0,0 +1,148 @@
+//
+//    FILE: wifi_reconnect.cpp
+// PURPOSE: Decisions of the WiFi station link of the pig pen controller:
+//          when to reconnect, how, and when to bring up the setup portal.
+//
+
+
+#include "wifi_reconnect.h"
+
+
+WifiReconnect::WifiReconnect(uint32_t cachedTimeout, uint32_t scanTimeout,
+                             uint32_t backoffMin, uint32_t backoffMax, uint32_t portalAfter)
+{
+  _cachedTimeout = cachedTimeout;
+  _scanTimeout   = scanTimeout;
+  _backoffMin    = backoffMin;
+  _backoffMax    = backoffMax;
+  _portalAfter   = portalAfter;
+
+  _state        = WIFI_STATE_NO_CREDENTIALS;
+  _cached       = false;
+  _portal       = false;
+  _downSince    = 0;
+  _attemptStart = 0;
+  _scanAt       = 0;
+  _backoff      = backoffMin;
+  _attempts     = 0;
+  _cacheMisses  = 0;
+  _lastOutage   = 0;
+}
+
+
+void WifiReconnect::begin(uint32_t now, bool credentials)
+{
+  _downSince    = now;
+  _attemptStart = now;
+  _scanAt       = now;
+  _backoff      = 0;
+  _attempts     = 0;
+  //  the first pass of update() starts the first attempt
+  _state = credentials ? WIFI_STATE_BACKOFF : WIFI_STATE_NO_CREDENTIALS;
+}
+
+
+WifiAction WifiReconnect::update(uint32_t now, bool connected)
+{
+  if (_state == WIFI_STATE_NO_CREDENTIALS)
+  {
+    if (_portal) return WIFI_NONE;
+    _portal = true;
+    return WIFI_START_PORTAL;
+  }
+
+  if (connected)
+  {
+    if (_state != WIFI_STATE_UP)
+    {
+      _state      = WIFI_STATE_UP;
+      _lastOutage = now - _downSince;
+      _backoff    = _backoffMin;
+      return WIFI_LINK_UP;
+    }
+    if (_portal)
+    {
+      _portal = false;
+      return WIFI_STOP_PORTAL;
+    }
+    return WIFI_NONE;
+  }
+
+  if (_state == WIFI_STATE_UP)
+  {
+    //  lost: report it, then reconnect right away
+    _state     = WIFI_STATE_BACKOFF;
+    _downSince = now;
+    _attemptStart = now;
+    _scanAt    = now;
+    _backoff   = 0;
+    _attempts  = 0;
+    return WIFI_LINK_DOWN;
+  }
+
+  if (!_portal && now - _downSince >= _portalAfter)
+  {
+    _portal = true;
+    return WIFI_START_PORTAL;
+  }
+
+  switch (_state)
+  {
+    case WIFI_STATE_CACHED:
+      if (now - _attemptStart < _cachedTimeout) return WIFI_NONE;
+      //  the access point is still down or moved: keep knocking where
+      //  it was, look for it elsewhere once per backoff
+      if (_cacheMisses < 0xFFFF) _cacheMisses++;
+      if (now - _scanAt >= _backoff) return _scan(now);
+      return _attempt(now);
+
+    case WIFI_STATE_SCAN:
+      if (now - _attemptStart < _scanTimeout) return WIFI_NONE;
+      _scanAt  = now;
+      _backoff = _backoff == 0 ? _backoffMin : _backoff * 2;
+      if (_backoff > _backoffMax) _backoff = _backoffMax;
+      if (_cached) return _attempt(now);
+      _state = WIFI_STATE_BACKOFF;
+      _attemptStart = now;
+      return WIFI_NONE;
+
+    case WIFI_STATE_BACKOFF:
+      if (now - _attemptStart < _backoff) return WIFI_NONE;
+      return _attempt(now);
+
+    default:
+      return WIFI_NONE;
+  }
+}
+
+
+uint32_t WifiReconnect::retryIn(uint32_t now) const
+{
+  if (_state != WIFI_STATE_BACKOFF) return 0;
+  uint32_t waited = now - _attemptStart;
+  return waited < _backoff ? _backoff - waited : 0;
+}
+
+
+WifiAction WifiReconnect::_attempt(uint32_t now)
+{
+  if (_attempts < 0xFFFF) _attempts++;
+  _attemptStart = now;
+  if (_cached)
+  {
+    _state = WIFI_STATE_CACHED;
+    return WIFI_CONNECT_CACHED;
+  }
+  return _scan(now);
+}
+
+
+WifiAction WifiReconnect::_scan(uint32_t now)
+{
+  _state = WIFI_STATE_SCAN;
+  _attemptStart = now;
+  return WIFI_CONNECT_SCAN;
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,98 @@
+#pragma once
+//
+//    FILE: wifi_reconnect.h
+// PURPOSE: Decisions of the WiFi station link of the pig pen controller:
+//          when to reconnect, how, and when to bring up the setup portal.
+//
+//  NOTES
+//  The sketch calls update() every control pass with the link state
+//  and carries out the actions until it returns WIFI_NONE; nothing in
+//  here waits, an association runs in the background of the SDK.
+//
+//  A reconnect goes to the BSSID and channel of the last link, with its
+//  IP lease, which skips the scan and DHCP - an access point that
+//  rebooted comes back where it was. These attempts repeat back to back
+//  while the link is down, so the link is back within one cached timeout
+//  of the access point. In between it scans, in case the access point
+//  moved: first after one cached attempt, then at a doubling backoff.
+//  Without a cache it only scans, waiting the backoff in between.
+//
+//  The setup portal (soft AP + captive DNS) comes up next to the station
+//  when the link is down for longer than portalAfter, or there are no
+//  credentials; reconnects go on meanwhile and it goes down on connect.
+//
+//  No Arduino dependency.
+
+
+#include <stdint.h>
+
+
+enum WifiAction : uint8_t
+{
+  WIFI_NONE = 0,
+  WIFI_LINK_UP,                 //  connected: remember BSSID, channel and lease
+  WIFI_LINK_DOWN,               //  the link was lost
+  WIFI_CONNECT_CACHED,          //  associate on the cached BSSID / channel
+  WIFI_CONNECT_SCAN,            //  associate after a full scan, DHCP
+  WIFI_START_PORTAL,
+  WIFI_STOP_PORTAL
+};
+
+
+enum WifiState : uint8_t
+{
+  WIFI_STATE_UP = 0,
+  WIFI_STATE_CACHED,            //  association on the cache in progress
+  WIFI_STATE_SCAN,              //  association after a scan in progress
+  WIFI_STATE_BACKOFF,
+  WIFI_STATE_NO_CREDENTIALS
+};
+
+
+class WifiReconnect
+{
+public:
+  //  times in ms
+  WifiReconnect(uint32_t cachedTimeout, uint32_t scanTimeout,
+                uint32_t backoffMin, uint32_t backoffMax, uint32_t portalAfter);
+
+  //  at boot, the link is down
+  void       begin(uint32_t now, bool credentials);
+  //  whether a BSSID / channel is known to connect to
+  void       setCached(bool cached)  { _cached = cached; };
+
+  //  the next thing to do, WIFI_NONE when there is nothing more now
+  WifiAction update(uint32_t now, bool connected);
+
+  WifiState  state() const        { return _state; };
+  bool       portal() const       { return _portal; };
+  uint16_t   attempts() const     { return _attempts; };   //  since the link went down
+  uint16_t   cacheMisses() const  { return _cacheMisses; };
+  uint32_t   lastOutage() const   { return _lastOutage; }; //  ms the last outage lasted
+  //  ms until the next attempt while backing off without a cache
+  uint32_t   retryIn(uint32_t now) const;
+
+private:
+  WifiAction _attempt(uint32_t now);
+  WifiAction _scan(uint32_t now);
+
+  uint32_t  _cachedTimeout;
+  uint32_t  _scanTimeout;
+  uint32_t  _backoffMin;
+  uint32_t  _backoffMax;
+  uint32_t  _portalAfter;
+
+  WifiState _state;
+  bool      _cached;
+  bool      _portal;
+  uint32_t  _downSince;
+  uint32_t  _attemptStart;
+  uint32_t  _scanAt;            //  end of the last scan, or the link loss
+  uint32_t  _backoff;
+  uint16_t  _attempts;
+  uint16_t  _cacheMisses;
+  uint32_t  _lastOutage;
+};
+
+
+//  -- END OF FILE --
@@ -0,0 +1,239 @@
+//
+//    FILE: bench.cpp
+// PURPOSE: Runs the micro-benchmarks of the pig pen controller (bench.h)
+//          on a Linux host, on the fixed sample set or on the raw HX711
+//          conversions of a recorded trace, and compares with a baseline.
+//
+//  BUILD
+//    g++ -std=c++17 -O2 -I../host_arduino -I../../libraries/HX711 -I../../sketch_sep3a
+//        -o bench bench.cpp ../host_arduino/host_arduino.cpp
+//        ../../libraries/HX711/HX711.cpp ../../sketch_sep3a/bench.cpp
+//        ../../sketch_sep3a/responses.cpp ../../sketch_sep3a/feed_control.cpp
+//        ../../sketch_sep3a/servo_motion.cpp ../../sketch_sep3a/trace.cpp
+//        ../../sketch_sep3a/encoder.cpp ../../sketch_sep3a/crc16.cpp
+//
+//  USAGE
+//    bench [--trace trace.bin] [--filter name] [--baseline old.jsonl] [--threshold %]
+//
+//  Prints one JSON line per benchmark, times in ns. Save a run as the
+//  baseline, a later run with --baseline flags every benchmark that got
+//  slower by more than the threshold (default 10%) and exits with 1.
+//  Lines of the serial "bench" command of the controller (CPU cycles)
+//  compare with each other the same way. Cycle counts repeat closely,
+//  host times only on an otherwise idle machine at a fixed clock.
+//
+//  Besides the shared suite the host times reads through the HX711
+//  library from the emulated HX711 of host_arduino - the bit banging
+//  is emulated, so these only compare host runs.
+//
+
+
+#include "Arduino.h"
+#include "HX711.h"
+#include "bench.h"
+#include "trace.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+const uint8_t HX_DATA_PIN  = 0;
+const uint8_t HX_CLOCK_PIN = 4;
+
+
+static bool loadFile(const char *path, std::vector<uint8_t> &data)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return false;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) data.insert(data.end(), buffer, buffer + n);
+  fclose(f);
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  READS THROUGH THE LIBRARY
+//
+static HX711 scale;
+static std::vector<int32_t> conversions;
+static size_t nextConversion = 0;
+
+static bool conversionSource(int32_t &raw)
+{
+  raw = conversions[nextConversion];
+  if (++nextConversion == conversions.size()) nextConversion = 0;
+  return true;
+}
+
+
+static float benchGetUnits(const float *, uint8_t)
+{
+  return scale.get_units(1);
+}
+
+
+static float benchReadMedian(const float *, uint8_t window)
+{
+  return scale.read_median(window);
+}
+
+
+static float benchReadKalman(const float *, uint8_t)
+{
+  return scale.read_kalman();
+}
+
+
+static const BenchCase hostCases[] =
+{
+  { "get_units_1",     1, benchGetUnits },
+  { "read_median_7",   7, benchReadMedian },
+  { "read_kalman",     1, benchReadKalman }
+};
+
+
+///////////////////////////////////////////////////////////////
+//
+//  OUTPUT AND BASELINE
+//
+static std::vector<std::string> lines;
+
+static void printLine(const char *line)
+{
+  puts(line);
+  fflush(stdout);
+  lines.push_back(line);
+}
+
+
+static bool field(const std::string &line, const char *name, std::string &value)
+{
+  std::string key = std::string("\"") + name + "\":";
+  size_t p = line.find(key);
+  if (p == std::string::npos) return false;
+  p += key.size();
+  if (line[p] == '"')
+  {
+    size_t end = line.find('"', p + 1);
+    if (end == std::string::npos) return false;
+    value = line.substr(p + 1, end - p - 1);
+    return true;
+  }
+  size_t end = line.find_first_of(",}", p);
+  value = line.substr(p, end - p);
+  return true;
+}
+
+
+//  returns the number of benchmarks slower than the baseline
+static int compare(const char *path, double threshold)
+{
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+  int  slower = 0;
+  char buffer[512];
+  while (fgets(buffer, sizeof(buffer), f))
+  {
+    std::string old(buffer), name, unit, perOp;
+    if (!field(old, "bench", name) || !field(old, "unit", unit) || !field(old, "per_op", perOp)) continue;
+    for (const std::string &line : lines)
+    {
+      std::string newName, newUnit, newPerOp;
+      if (!field(line, "bench", newName) || newName != name) continue;
+      if (!field(line, "unit", newUnit) || newUnit != unit) continue;
+      field(line, "per_op", newPerOp);
+      double before = atof(perOp.c_str());
+      double after  = atof(newPerOp.c_str());
+      double change = before > 0 ? (after - before) * 100 / before : 0;
+      bool   flag   = change > threshold;
+      fprintf(stderr, "%-16s %10.1f -> %10.1f %s %+6.1f%%%s\n", name.c_str(), before, after,
+              unit.c_str(), change, flag ? "  SLOWER" : "");
+      if (flag) slower++;
+    }
+  }
+  fclose(f);
+  return slower;
+}
+
+
+static void usage()
+{
+  fprintf(stderr, "usage: bench [--trace trace.bin] [--filter name] [--baseline old.jsonl] [--threshold %%]\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *tracePath = NULL;
+  const char *filter = NULL;
+  const char *baseline = NULL;
+  double threshold = 10;
+  for (int i = 1; i < argc; i++)
+  {
+    bool more = i + 1 < argc;
+    if      (strcmp(argv[i], "--trace") == 0 && more) tracePath = argv[++i];
+    else if (strcmp(argv[i], "--filter") == 0 && more) filter = argv[++i];
+    else if (strcmp(argv[i], "--baseline") == 0 && more) baseline = argv[++i];
+    else if (strcmp(argv[i], "--threshold") == 0 && more) threshold = atof(argv[++i]);
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  std::vector<float> samples(BENCH_DEFAULT_SAMPLES);
+  benchSamples(samples.data(), samples.size());
+  if (tracePath)
+  {
+    std::vector<uint8_t> data;
+    if (!loadFile(tracePath, data))
+    {
+      perror(tracePath);
+      return 2;
+    }
+    TraceReader reader(data.data(), data.size());
+    TraceRecord record;
+    samples.clear();
+    while (reader.next(record) && samples.size() < 65535)
+    {
+      if (record.type == TRACE_RAW) samples.push_back(record.raw);
+    }
+    if (samples.size() < 15)
+    {
+      fprintf(stderr, "%s: %zu conversions, too few to benchmark\n", tracePath, samples.size());
+      return 2;
+    }
+  }
+
+  for (float s : samples) conversions.push_back((int32_t)s);
+  hostHX711(HX_DATA_PIN, HX_CLOCK_PIN);
+  hostSetConversionSource(conversionSource);
+  scale.begin(HX_DATA_PIN, HX_CLOCK_PIN);
+  scale.set_scale(1.0);
+
+  benchRun(samples.data(), samples.size(), filter, printLine);
+  for (const BenchCase &bench : hostCases)
+  {
+    if (filter && !strstr(bench.name, filter)) continue;
+    benchMeasure(bench, samples.data(), samples.size(), printLine);
+  }
+
+  if (baseline == NULL) return 0;
+  int slower = compare(baseline, threshold);
+  if (slower < 0) return 2;
+  return slower > 0 ? 1 : 0;
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,642 @@
+//
+//    FILE: delta_patch.cpp
+// PURPOSE: Makes the delta patches POST /api/ota/delta of the pig pen
+//          controller takes, and applies them on a Linux host through
+//          the same streaming code the firmware runs.
+//
+//  BUILD
+//    g++ -std=c++17 -O2 -I../../sketch_sep3a -o delta_patch delta_patch.cpp
+//        ../../sketch_sep3a/delta_patch.cpp
+//
+//  USAGE
+//    delta_patch diff old.bin new.bin patch.bin
+//    delta_patch apply old.bin patch.bin new.bin [--chunk n]
+//    delta_patch --selftest [--runs n] [--seed n]
+//
+//  diff matches the new image against the old one bsdiff style: where
+//  code only moved, a run of the old image with a few changed bytes
+//  (the addresses that moved with it) is much cheaper than the bytes.
+//  The images are the .bin files the Arduino build writes, old.bin has
+//  to be what the controller runs now.
+//
+//  apply feeds the patch in pieces of n bytes (default 1460, a TCP
+//  segment) and checks the result against the MD5 in the patch.
+//
+//  --selftest builds firmware-like images, rebuilds them with code
+//  inserted (every address after it moves), patches one into the other
+//  with random piece sizes and checks the result; then feeds patches
+//  that are cut short, damaged, made for another image or followed by
+//  junk, which must fail without touching memory outside the images.
+//  Exit code 1 on the first failure.
+//
+//  curl --data-binary @patch.bin -H "Content-Type: application/octet-stream"
+//       http://<controller>/api/ota/delta
+//
+
+
+#include "delta_patch.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+
+#define MATCH_HASH      8       //  bytes a match has to start with
+#define MATCH_CANDIDATES 16     //  old positions tried per hash
+#define MATCH_MIN_SCORE 24      //  2 * equal - length of a worthwhile match
+#define MATCH_LOOKAHEAD 64      //  bytes scanned past the best end so far
+#define CHANGED_GAP     2       //  equal bytes kept inside a changed run
+
+
+typedef std::vector<uint8_t> Bytes;
+
+
+///////////////////////////////////////////////////////////////
+//
+//  MD5 (RFC 1321)
+//
+static const uint32_t md5K[64] =
+{
+  0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+  0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+  0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+  0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+  0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+  0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+  0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+  0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const uint8_t md5R[64] =
+{
+  7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+  5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+  4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+  6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+
+static void md5Block(uint32_t *h, const uint8_t *block)
+{
+  uint32_t w[16];
+  for (int i = 0; i < 16; i++)
+  {
+    w[i] = block[4 * i] | (block[4 * i + 1] << 8) | (block[4 * i + 2] << 16) | ((uint32_t)block[4 * i + 3] << 24);
+  }
+  uint32_t a = h[0], b = h[1], c = h[2], d = h[3];
+  for (int i = 0; i < 64; i++)
+  {
+    uint32_t f;
+    int      g;
+    if      (i < 16) { f = (b & c) | (~b & d); g = i; }
+    else if (i < 32) { f = (d & b) | (~d & c); g = (5 * i + 1) & 15; }
+    else if (i < 48) { f = b ^ c ^ d;          g = (3 * i + 5) & 15; }
+    else             { f = c ^ (b | ~d);       g = (7 * i) & 15; }
+    uint32_t t = a + f + md5K[i] + w[g];
+    a = d;
+    d = c;
+    c = b;
+    b = b + ((t << md5R[i]) | (t >> (32 - md5R[i])));
+  }
+  h[0] += a;
+  h[1] += b;
+  h[2] += c;
+  h[3] += d;
+}
+
+
+static void md5(const Bytes &data, uint8_t *digest)
+{
+  uint32_t h[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  size_t full = data.size() & ~(size_t)63;
+  for (size_t i = 0; i < full; i += 64) md5Block(h, data.data() + i);
+
+  uint8_t tail[128] = {0};
+  size_t  rest = data.size() - full;
+  if (rest) memcpy(tail, data.data() + full, rest);
+  tail[rest] = 0x80;
+  size_t   tailLength = rest < 56 ? 64 : 128;
+  uint64_t bits = (uint64_t)data.size() * 8;
+  for (int i = 0; i < 8; i++) tail[tailLength - 8 + i] = bits >> (8 * i);
+  md5Block(h, tail);
+  if (tailLength == 128) md5Block(h, tail + 64);
+
+  for (int i = 0; i < 16; i++) digest[i] = h[i / 4] >> (8 * (i % 4));
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  DIFF
+//
+static void putVarint(Bytes &out, uint32_t value)
+{
+  while (value >= 0x80)
+  {
+    out.push_back((value & 0x7F) | 0x80);
+    value >>= 7;
+  }
+  out.push_back(value);
+}
+
+
+static uint64_t hashAt(const Bytes &data, size_t pos)
+{
+  uint64_t h = 0;
+  memcpy(&h, data.data() + pos, MATCH_HASH);
+  return h * 0x9E3779B97F4A7C15ULL;
+}
+
+
+//  Extends a match of new at n with old at o forward, as long as the
+//  equal bytes outweigh the others; returns the length, score gets
+//  2 * equal - length at that length.
+static size_t extend(const Bytes &oldImage, size_t o, const Bytes &newImage, size_t n, int64_t &score)
+{
+  size_t  best  = 0;
+  int64_t s     = 0;
+  score = 0;
+  for (size_t i = 0; o + i < oldImage.size() && n + i < newImage.size(); i++)
+  {
+    s += oldImage[o + i] == newImage[n + i] ? 1 : -1;
+    if (s > score)
+    {
+      score = s;
+      best  = i + 1;
+    }
+    else if (i - best > MATCH_LOOKAHEAD) break;
+  }
+  return best;
+}
+
+
+//  One add run: (same, changed, differences) pairs; short equal gaps
+//  stay inside a changed run, a pair costs more than them.
+static void putAdd(Bytes &out, const Bytes &oldImage, size_t o, const Bytes &newImage, size_t n, size_t length)
+{
+  size_t i = 0;
+  while (i < length)
+  {
+    size_t same = 0;
+    while (i + same < length && newImage[n + i + same] == oldImage[o + i + same]) same++;
+    i += same;
+    size_t changed = 0;
+    while (i + changed < length)
+    {
+      if (newImage[n + i + changed] != oldImage[o + i + changed])
+      {
+        changed++;
+        continue;
+      }
+      size_t gap = 0;
+      while (i + changed + gap < length && gap <= CHANGED_GAP
+             && newImage[n + i + changed + gap] == oldImage[o + i + changed + gap]) gap++;
+      if (gap > CHANGED_GAP || i + changed + gap == length) break;
+      changed += gap;
+    }
+    putVarint(out, same);
+    putVarint(out, changed);
+    for (size_t k = 0; k < changed; k++) out.push_back(newImage[n + i + k] - oldImage[o + i + k]);
+    i += changed;
+  }
+}
+
+
+static void putEntry(Bytes &out, const Bytes &oldImage, const Bytes &newImage,
+                     size_t literalStart, size_t matchNew, size_t matchOld, size_t length, size_t &oldPos)
+{
+  int64_t  seek   = (int64_t)matchOld - (int64_t)oldPos;
+  uint32_t zigzag = seek < 0 ? ((uint32_t)(-seek) << 1) - 1 : (uint32_t)seek << 1;
+  putVarint(out, matchNew - literalStart);
+  putVarint(out, length);
+  putVarint(out, length ? zigzag : 0);
+  out.insert(out.end(), newImage.begin() + literalStart, newImage.begin() + matchNew);
+  if (length == 0) return;
+  putAdd(out, oldImage, matchOld, newImage, matchNew, length);
+  oldPos = matchOld + length;
+}
+
+
+static Bytes diff(const Bytes &oldImage, const Bytes &newImage)
+{
+  Bytes patch(DELTA_HEADER_SIZE);
+  DeltaHeader header;
+  header.oldSize = oldImage.size();
+  header.newSize = newImage.size();
+  md5(oldImage, header.oldMd5);
+  md5(newImage, header.newMd5);
+  DeltaPatch::encodeHeader(header, patch.data());
+
+  //  the newest positions of every hash of the old image
+  std::unordered_map<uint64_t, std::vector<uint32_t>> index;
+  for (size_t i = 0; i + MATCH_HASH <= oldImage.size(); i++)
+  {
+    std::vector<uint32_t> &positions = index[hashAt(oldImage, i)];
+    if (positions.size() == MATCH_CANDIDATES) positions.erase(positions.begin());
+    positions.push_back(i);
+  }
+
+  size_t  literalStart = 0;
+  size_t  oldPos       = 0;
+  int64_t shift        = 0;             //  old - new of the last match
+  size_t  n            = 0;
+  while (n < newImage.size())
+  {
+    //  the last match going on after a changed stretch, or a new one
+    size_t  bestOld    = 0;
+    size_t  bestLength = 0;
+    int64_t bestScore  = 0;
+    int64_t score;
+    int64_t next = (int64_t)n + shift;
+    if (next >= 0 && (size_t)next < oldImage.size())
+    {
+      size_t length = extend(oldImage, next, newImage, n, score);
+      if (score > bestScore)
+      {
+        bestOld    = next;
+        bestLength = length;
+        bestScore  = score;
+      }
+    }
+    if (n + MATCH_HASH <= newImage.size())
+    {
+      auto found = index.find(hashAt(newImage, n));
+      if (found != index.end())
+      {
+        for (uint32_t o : found->second)
+        {
+          size_t length = extend(oldImage, o, newImage, n, score);
+          if (score > bestScore)
+          {
+            bestOld    = o;
+            bestLength = length;
+            bestScore  = score;
+          }
+        }
+      }
+    }
+    if (bestScore < MATCH_MIN_SCORE)
+    {
+      n++;
+      continue;
+    }
+
+    //  take back what the match covers of the literal before it
+    size_t  back  = 0;
+    int64_t s     = 0;
+    int64_t sBest = 0;
+    for (size_t i = 1; i <= n - literalStart && i <= bestOld; i++)
+    {
+      s += oldImage[bestOld - i] == newImage[n - i] ? 1 : -1;
+      if (s > sBest)
+      {
+        sBest = s;
+        back  = i;
+      }
+    }
+    putEntry(patch, oldImage, newImage, literalStart, n - back, bestOld - back, bestLength + back, oldPos);
+    shift        = (int64_t)bestOld - (int64_t)n;
+    n           += bestLength;
+    literalStart = n;
+  }
+  if (literalStart < newImage.size())
+  {
+    putEntry(patch, oldImage, newImage, literalStart, newImage.size(), 0, 0, oldPos);
+  }
+  return patch;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  APPLY
+//
+static const Bytes *applyOld;
+static Bytes       *applyNew;
+
+
+static bool readOld(uint32_t offset, uint8_t *data, size_t length)
+{
+  if ((uint64_t)offset + length > applyOld->size()) return false;
+  memcpy(data, applyOld->data() + offset, length);
+  return true;
+}
+
+
+static bool writeNew(const uint8_t *data, size_t length)
+{
+  if (length == 0 || length > DELTA_OUT_BUFFER) return false;
+  applyNew->insert(applyNew->end(), data, data + length);
+  return true;
+}
+
+
+//  as the sketch: the patch has to name the image it goes on
+static bool checkOld(const DeltaHeader &header)
+{
+  uint8_t digest[16];
+  md5(*applyOld, digest);
+  return header.oldSize == applyOld->size() && memcmp(header.oldMd5, digest, 16) == 0;
+}
+
+
+//  pieces of chunk bytes, or of random sizes up to 2 KB with rng
+static uint8_t apply(const Bytes &oldImage, const Bytes &patch, Bytes &newImage, size_t chunk, std::mt19937 *rng)
+{
+  applyOld = &oldImage;
+  applyNew = &newImage;
+  newImage.clear();
+  DeltaPatch delta;
+  delta.begin(readOld, writeNew, checkOld);
+  size_t pos = 0;
+  while (pos < patch.size())
+  {
+    size_t n = rng ? 1 + (*rng)() % 2048 : chunk;
+    if (n > patch.size() - pos) n = patch.size() - pos;
+    if (!delta.feed(patch.data() + pos, n)) return delta.error();
+    pos += n;
+  }
+  if (!delta.done()) return 0xFF;
+  if (newImage.size() != delta.header().newSize) return 0xFE;
+  uint8_t digest[16];
+  md5(newImage, digest);
+  if (memcmp(digest, delta.header().newMd5, 16) != 0) return 0xFD;
+  return DELTA_OK;
+}
+
+
+static const char *applyError(uint8_t error)
+{
+  switch (error)
+  {
+    case DELTA_OK:           return "ok";
+    case DELTA_BAD_HEADER:   return "not a patch";
+    case DELTA_WRONG_SOURCE: return "made for another image";
+    case DELTA_BAD_PATCH:    return "corrupt";
+    case DELTA_READ_FAILED:  return "old image read failed";
+    case DELTA_WRITE_FAILED: return "write failed";
+    case DELTA_TRAILING:     return "junk after the image";
+    case 0xFF:               return "cut short";
+    case 0xFE:               return "wrong size";
+    case 0xFD:               return "MD5 mismatch";
+  }
+  return "?";
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  SELFTEST
+//
+//  Code-like words with absolute addresses into the image, and strings.
+//  rebuild() inserts code at a few places and moves every address
+//  after them, as a recompile with a small change does.
+struct Image
+{
+  Bytes                 bytes;
+  std::vector<uint32_t> pointers;       //  offsets of the addresses
+};
+
+
+#define IMAGE_BASE  0x40200000
+
+
+static Image synthImage(std::mt19937 &rng, size_t size)
+{
+  Image image;
+  while (image.bytes.size() < size)
+  {
+    uint32_t kind = rng() % 10;
+    if (kind < 6)
+    {
+      //  an instruction from a small vocabulary
+      static const uint32_t ops[] = {0x0020F0, 0x00A002, 0x221B00, 0x61C1F0, 0x0D0C12, 0x47B6D1};
+      uint32_t op = ops[rng() % 6] ^ (rng() % 4 << 8);
+      for (int i = 0; i < 3; i++) image.bytes.push_back(op >> (8 * i));
+    }
+    else if (kind < 9)
+    {
+      //  a literal pool address
+      image.pointers.push_back(image.bytes.size());
+      for (int i = 0; i < 4; i++) image.bytes.push_back(0);
+    }
+    else
+    {
+      const char *text = "Feeding started successfully\0Wash cycle stopped\0pool.ntp.org\0";
+      size_t length = 20 + rng() % 40;
+      image.bytes.insert(image.bytes.end(), text, text + length);
+    }
+  }
+  for (uint32_t p : image.pointers)
+  {
+    uint32_t target = IMAGE_BASE + rng() % image.bytes.size();
+    memcpy(image.bytes.data() + p, &target, 4);
+  }
+  return image;
+}
+
+
+static Image rebuild(const Image &old, std::mt19937 &rng, uint8_t inserts)
+{
+  Image image = old;
+  for (uint8_t k = 0; k < inserts; k++)
+  {
+    size_t at     = rng() % image.bytes.size();
+    size_t length = 4 * (1 + rng() % 64);
+    Bytes  code(length);
+    for (uint8_t &b : code) b = rng();
+    image.bytes.insert(image.bytes.begin() + at, code.begin(), code.end());
+    for (uint32_t &p : image.pointers)
+    {
+      if (p >= at) p += length;
+      uint32_t target;
+      memcpy(&target, image.bytes.data() + p, 4);
+      if (target >= IMAGE_BASE + at)
+      {
+        target += length;
+        memcpy(image.bytes.data() + p, &target, 4);
+      }
+    }
+  }
+  //  and a few edits in place, a changed constant
+  for (uint8_t k = 0; k < inserts; k++) image.bytes[rng() % image.bytes.size()] ^= 1 + rng() % 255;
+  return image;
+}
+
+
+static int selftest(uint32_t runs, uint32_t seed)
+{
+  std::mt19937 rng(seed);
+  uint64_t oldTotal = 0, newTotal = 0, patchTotal = 0;
+  for (uint32_t run = 0; run < runs; run++)
+  {
+    size_t size    = 4096 + rng() % (run == 0 ? 400000 : 60000);
+    Image  oldImg  = synthImage(rng, size);
+    Image  newImg  = rebuild(oldImg, rng, 1 + rng() % 8);
+    Bytes  patch   = diff(oldImg.bytes, newImg.bytes);
+    Bytes  out;
+    uint8_t error = apply(oldImg.bytes, patch, out, 0, &rng);
+    if (error != DELTA_OK || out != newImg.bytes)
+    {
+      printf("run %u: patch of %zu bytes %s\n", run, patch.size(), applyError(error));
+      return 1;
+    }
+    oldTotal   += oldImg.bytes.size();
+    newTotal   += newImg.bytes.size();
+    patchTotal += patch.size();
+
+    //  an unrelated new image and an empty one still make valid patches
+    Image other = synthImage(rng, 1 + rng() % 4096);
+    Bytes empty;
+    for (const Bytes *target : {&other.bytes, &empty})
+    {
+      Bytes p = diff(oldImg.bytes, *target);
+      if (apply(oldImg.bytes, p, out, 1 + rng() % 64, NULL) != DELTA_OK || out != *target)
+      {
+        printf("run %u: patch to a %zu byte image fails\n", run, target->size());
+        return 1;
+      }
+    }
+
+    //  what must fail, and fail without reading or writing outside
+    Bytes wrongOld = oldImg.bytes;
+    wrongOld[rng() % wrongOld.size()] ^= 0x40;
+    if (apply(wrongOld, patch, out, 512, NULL) != DELTA_WRONG_SOURCE)
+    {
+      printf("run %u: patch accepted on another image\n", run);
+      return 1;
+    }
+    Bytes cut(patch.begin(), patch.begin() + rng() % patch.size());
+    if (apply(oldImg.bytes, cut, out, 512, NULL) == DELTA_OK)
+    {
+      printf("run %u: patch cut to %zu bytes accepted\n", run, cut.size());
+      return 1;
+    }
+    Bytes junk = patch;
+    junk.push_back(0);
+    if (apply(oldImg.bytes, junk, out, 512, NULL) != DELTA_TRAILING)
+    {
+      printf("run %u: junk after the patch accepted\n", run);
+      return 1;
+    }
+    for (int k = 0; k < 16; k++)
+    {
+      Bytes damaged = patch;
+      size_t at = DELTA_HEADER_SIZE + rng() % (patch.size() - DELTA_HEADER_SIZE);
+      damaged[at] ^= 1 << (rng() % 8);
+      if (apply(oldImg.bytes, damaged, out, 0, &rng) == DELTA_OK)
+      {
+        printf("run %u: damaged patch accepted\n", run);
+        return 1;
+      }
+    }
+  }
+  printf("%u runs OK, %llu bytes of new images in %llu bytes of patches (%.1f%%), old images %llu bytes\n",
+         runs, (unsigned long long)newTotal, (unsigned long long)patchTotal,
+         newTotal ? 100.0 * patchTotal / newTotal : 0.0, (unsigned long long)oldTotal);
+  return 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  MAIN
+//
+static bool loadFile(const char *path, Bytes &data)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return false;
+  uint8_t buffer[4096];
+  size_t  n;
+  data.clear();
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) data.insert(data.end(), buffer, buffer + n);
+  fclose(f);
+  return true;
+}
+
+
+static bool saveFile(const char *path, const Bytes &data)
+{
+  FILE *f = fopen(path, "wb");
+  if (f == NULL) return false;
+  bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+  return fclose(f) == 0 && ok;
+}
+
+
+static int usage()
+{
+  fprintf(stderr, "usage: delta_patch diff old.bin new.bin patch.bin\n"
+                  "       delta_patch apply old.bin patch.bin new.bin [--chunk n]\n"
+                  "       delta_patch --selftest [--runs n] [--seed n]\n");
+  return 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+  if (argc >= 2 && strcmp(argv[1], "--selftest") == 0)
+  {
+    uint32_t runs = 20;
+    uint32_t seed = 1;
+    for (int i = 2; i < argc; i++)
+    {
+      bool more = i + 1 < argc;
+      if      (strcmp(argv[i], "--runs") == 0 && more) runs = strtoul(argv[++i], NULL, 10);
+      else if (strcmp(argv[i], "--seed") == 0 && more) seed = strtoul(argv[++i], NULL, 10);
+      else return usage();
+    }
+    return selftest(runs, seed);
+  }
+  if (argc != 5 && !(argc == 7 && strcmp(argv[5], "--chunk") == 0)) return usage();
+
+  Bytes a, b;
+  if (!loadFile(argv[2], a))
+  {
+    perror(argv[2]);
+    return 2;
+  }
+  if (!loadFile(argv[3], b))
+  {
+    perror(argv[3]);
+    return 2;
+  }
+  if (strcmp(argv[1], "diff") == 0 && argc == 5)
+  {
+    Bytes patch = diff(a, b);
+    if (!saveFile(argv[4], patch))
+    {
+      perror(argv[4]);
+      return 2;
+    }
+    printf("%zu -> %zu bytes, patch %zu bytes (%.1f%% of the image)\n",
+           a.size(), b.size(), patch.size(), b.empty() ? 0.0 : 100.0 * patch.size() / b.size());
+    return 0;
+  }
+  if (strcmp(argv[1], "apply") == 0)
+  {
+    size_t chunk = argc == 7 ? strtoul(argv[6], NULL, 10) : 1460;
+    if (chunk == 0) return usage();
+    Bytes   out;
+    uint8_t error = apply(a, b, out, chunk, NULL);
+    if (error != DELTA_OK)
+    {
+      printf("patch failed: %s\n", applyError(error));
+      return 1;
+    }
+    if (!saveFile(argv[4], out))
+    {
+      perror(argv[4]);
+      return 2;
+    }
+    printf("%zu bytes written, MD5 matches\n", out.size());
+    return 0;
+  }
+  return usage();
+}
+
+
+//  -- END OF FILE --
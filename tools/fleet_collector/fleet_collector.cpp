@@ -0,0 +1,1232 @@
+//
+//    FILE: fleet_collector.cpp
+// PURPOSE: Linux companion that watches a fleet of pig pen controllers.
+//          Polls /api/status, /api/weight and /api/schedule of many
+//          controllers concurrently, appends the results to a columnar
+//          on-disk store and answers aggregate queries across pens.
+//
+//  BUILD
+//    g++ -std=c++17 -O2 -pthread -o fleet_collector fleet_collector.cpp
+//
+//  USAGE
+//    fleet_collector collect  --targets pens.txt --out data [options]
+//    fleet_collector collect  --simulate 2000 --out data --duration 30
+//    fleet_collector simulate --count 2000 [--base-port 20000]
+//    fleet_collector query    data [--pen 12] [--since <epoch ms>]
+//
+//  collect options
+//    --interval ms          /api/status poll period per pen     (1000)
+//    --weight-interval ms   extra /api/weight polls, 0 = off    (0)
+//    --schedule-interval ms /api/schedule poll period           (60000)
+//    --timeout ms           per request timeout                 (3000)
+//    --max-inflight n       concurrent connections              (256)
+//    --per-pen n            concurrent connections per pen      (2)
+//    --workers n            parser / writer threads             (4)
+//    --duration s           stop after s seconds, 0 = run       (0)
+//    --simulate n           start n fake controllers in-process
+//    --base-port p          first port of the fake controllers  (20000)
+//
+//  The targets file has one controller per line: "host[:port] [pen]".
+//  Lines starting with # are ignored. Pen ids default to the line index.
+//
+//  NOTES
+//  One epoll thread drives all sockets non-blocking, finished responses
+//  are handed to a worker pool that parses them and appends rows.
+//  A controller serves HTTP_MAX_CLIENTS (4) connections at once, see
+//  sketch_sep3a/http_server.h. The endpoints of a pen are polled on
+//  their own, one request per endpoint in flight, so a slow schedule
+//  does not hold up the status; --per-pen caps the connections to one
+//  pen and leaves the rest to the web page and other clients.
+//
+//  STORE LAYOUT
+//    <out>/samples/<column>.col    one fixed width file per column
+//    <out>/schedules/<column>.col
+//  Files are only appended to. A table has as many rows as its shortest
+//  column, so a torn write after a crash loses at most the last row.
+//
+
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+static std::atomic<bool> stopRequested(false);
+
+
+static uint64_t monotonicUs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+
+static uint64_t wallMs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+
+static void raiseFileLimit()
+{
+  rlimit rl;
+  if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max)
+  {
+    rl.rlim_cur = rl.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &rl);
+  }
+}
+
+
+static bool setNonBlocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  JSON FIELDS
+//
+//  The controller emits flat, hand built JSON, a key lookup is enough.
+//
+static size_t jsonValueStart(const std::string &s, const char *key)
+{
+  std::string k = std::string("\"") + key + "\"";
+  size_t p = s.find(k);
+  if (p == std::string::npos) return p;
+  p = s.find(':', p + k.size());
+  if (p == std::string::npos) return p;
+  p++;
+  while (p < s.size() && (s[p] == ' ' || s[p] == '\t')) p++;
+  return p;
+}
+
+
+static bool jsonNumber(const std::string &s, const char *key, float &out)
+{
+  size_t p = jsonValueStart(s, key);
+  if (p == std::string::npos) return false;
+  const char *start = s.c_str() + p;
+  char *end = nullptr;
+  out = strtof(start, &end);
+  return end != start;
+}
+
+
+static bool jsonString(const std::string &s, const char *key, std::string &out)
+{
+  size_t p = jsonValueStart(s, key);
+  if (p == std::string::npos || s[p] != '"') return false;
+  size_t e = s.find('"', p + 1);
+  if (e == std::string::npos) return false;
+  out = s.substr(p + 1, e - p - 1);
+  return true;
+}
+
+
+static void jsonStringArray(const std::string &s, const char *key, std::vector<std::string> &out)
+{
+  out.clear();
+  size_t p = jsonValueStart(s, key);
+  if (p == std::string::npos || s[p] != '[') return;
+  size_t end = s.find(']', p);
+  if (end == std::string::npos) return;
+  while (true)
+  {
+    size_t q = s.find('"', p);
+    if (q == std::string::npos || q > end) break;
+    size_t e = s.find('"', q + 1);
+    if (e == std::string::npos || e > end) break;
+    out.push_back(s.substr(q + 1, e - q - 1));
+    p = e + 1;
+  }
+}
+
+
+//  "HH:MM" => minutes since midnight, 0xFFFF when invalid.
+static uint16_t scheduleMinutes(const std::string &t)
+{
+  if (t.size() != 5 || t[2] != ':') return 0xFFFF;
+  int h = atoi(t.substr(0, 2).c_str());
+  int m = atoi(t.substr(3, 2).c_str());
+  if (h < 0 || h > 23 || m < 0 || m > 59) return 0xFFFF;
+  return (uint16_t)(h * 60 + m);
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  COLUMNAR STORE
+//
+struct ColumnSpec
+{
+  const char *name;
+  size_t      width;
+};
+
+
+//  sample flags
+const uint8_t FLAG_SERVO_OPEN  = 0x01;
+const uint8_t FLAG_SERVO_OK    = 0x02;
+const uint8_t FLAG_SCALE_OK    = 0x04;
+const uint8_t FLAG_WASHING     = 0x08;
+const uint8_t FLAG_WIFI_OK     = 0x10;
+const uint8_t FLAG_WEIGHT_ONLY = 0x80;   //  row from /api/weight
+
+
+static const ColumnSpec SAMPLE_COLUMNS[] =
+{
+  { "ts_ms",      8 },
+  { "pen",        4 },
+  { "weight",     4 },
+  { "last_feed",  4 },
+  { "flags",      1 },
+  { "latency_us", 4 },
+};
+static const size_t SAMPLE_COLUMN_COUNT = sizeof(SAMPLE_COLUMNS) / sizeof(SAMPLE_COLUMNS[0]);
+
+
+static const ColumnSpec SCHEDULE_COLUMNS[] =
+{
+  { "ts_ms",  8 },
+  { "pen",    4 },
+  { "feed0",  2 },
+  { "feed1",  2 },
+  { "feed2",  2 },
+  { "wash0",  2 },
+  { "wash1",  2 },
+};
+static const size_t SCHEDULE_COLUMN_COUNT = sizeof(SCHEDULE_COLUMNS) / sizeof(SCHEDULE_COLUMNS[0]);
+
+
+class ColumnTable
+{
+public:
+  ColumnTable(const std::string &dir, const ColumnSpec *spec, size_t count, size_t batchRows = 4096)
+  : _dir(dir), _spec(spec), _count(count), _batchRows(batchRows), _pending(0)
+  {
+    _buffers.resize(count);
+  }
+
+  ~ColumnTable()
+  {
+    flush();
+    for (FILE *f : _files) if (f) fclose(f);
+  }
+
+  bool open()
+  {
+    mkdir(_dir.c_str(), 0755);
+    for (size_t i = 0; i < _count; i++)
+    {
+      std::string path = _dir + "/" + _spec[i].name + ".col";
+      FILE *f = fopen(path.c_str(), "ab");
+      if (f == nullptr) return false;
+      _files.push_back(f);
+    }
+    return true;
+  }
+
+  //  values[i] points to _spec[i].width bytes
+  void append(const void * const *values)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (size_t i = 0; i < _count; i++)
+    {
+      const uint8_t *v = (const uint8_t *)values[i];
+      _buffers[i].insert(_buffers[i].end(), v, v + _spec[i].width);
+    }
+    if (++_pending >= _batchRows) _flushLocked();
+  }
+
+  void flush()
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _flushLocked();
+  }
+
+private:
+  void _flushLocked()
+  {
+    if (_pending == 0) return;
+    for (size_t i = 0; i < _files.size(); i++)
+    {
+      fwrite(_buffers[i].data(), 1, _buffers[i].size(), _files[i]);
+      fflush(_files[i]);
+      _buffers[i].clear();
+    }
+    _pending = 0;
+  }
+
+  std::string                       _dir;
+  const ColumnSpec                 *_spec;
+  size_t                            _count;
+  size_t                            _batchRows;
+  size_t                            _pending;
+  std::vector<FILE *>               _files;
+  std::vector<std::vector<uint8_t>> _buffers;
+  std::mutex                        _mutex;
+};
+
+
+//  Reads all columns of a table, returns the number of complete rows.
+static size_t readTable(const std::string &dir, const ColumnSpec *spec, size_t count,
+                        std::vector<std::vector<uint8_t>> &columns)
+{
+  columns.assign(count, std::vector<uint8_t>());
+  size_t rows = SIZE_MAX;
+  for (size_t i = 0; i < count; i++)
+  {
+    std::string path = dir + "/" + spec[i].name + ".col";
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == nullptr) return 0;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    columns[i].resize(size > 0 ? size : 0);
+    if (size > 0 && fread(columns[i].data(), 1, size, f) != (size_t)size) size = 0;
+    fclose(f);
+    size_t n = (size_t)size / spec[i].width;
+    if (n < rows) rows = n;
+  }
+  return rows == SIZE_MAX ? 0 : rows;
+}
+
+
+template <typename T>
+static T columnValue(const std::vector<uint8_t> &column, size_t row)
+{
+  T value;
+  memcpy(&value, column.data() + row * sizeof(T), sizeof(T));
+  return value;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  SIMULATED CONTROLLERS
+//
+//  Stand-in for real hardware: every fake controller listens on its own
+//  loopback port and answers the same routes with the same JSON layout
+//  as the sketch. State is derived from time so no locking is needed.
+//
+class FakeFleet
+{
+public:
+  FakeFleet(uint32_t count, uint16_t basePort, uint32_t threads)
+  : _count(count), _basePort(basePort), _threads(threads ? threads : 1) {}
+
+  ~FakeFleet() { stop(); }
+
+  bool start()
+  {
+    _epoll.resize(_threads, -1);
+    for (uint32_t t = 0; t < _threads; t++)
+    {
+      _epoll[t] = epoll_create1(0);
+      if (_epoll[t] < 0) return false;
+    }
+    for (uint32_t i = 0; i < _count; i++)
+    {
+      int fd = socket(AF_INET, SOCK_STREAM, 0);
+      if (fd < 0) return false;
+      int one = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+      sockaddr_in addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sin_family      = AF_INET;
+      addr.sin_port        = htons(_basePort + i);
+      addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0)
+      {
+        fprintf(stderr, "simulate: cannot listen on port %u: %s\n", _basePort + i, strerror(errno));
+        close(fd);
+        return false;
+      }
+      setNonBlocking(fd);
+      _listeners.push_back(fd);
+      epoll_event ev;
+      ev.events   = EPOLLIN;
+      ev.data.u64 = ((uint64_t)i << 32) | (uint32_t)fd;
+      epoll_ctl(_epoll[i % _threads], EPOLL_CTL_ADD, fd, &ev);
+    }
+    _running = true;
+    for (uint32_t t = 0; t < _threads; t++)
+    {
+      _workers.emplace_back(&FakeFleet::_serve, this, t);
+    }
+    return true;
+  }
+
+  void stop()
+  {
+    if (!_running) return;
+    _running = false;
+    for (std::thread &t : _workers) t.join();
+    _workers.clear();
+    for (int fd : _listeners) close(fd);
+    for (int fd : _epoll) close(fd);
+    _listeners.clear();
+    _epoll.clear();
+  }
+
+  uint64_t served() const { return _served; }
+
+private:
+  struct Client
+  {
+    uint32_t    pen;
+    std::string request;
+  };
+
+  void _serve(uint32_t t)
+  {
+    std::map<int, Client> clients;
+    epoll_event events[64];
+    while (_running)
+    {
+      int n = epoll_wait(_epoll[t], events, 64, 50);
+      for (int e = 0; e < n; e++)
+      {
+        int      fd  = (int)(uint32_t)events[e].data.u64;
+        uint32_t pen = (uint32_t)(events[e].data.u64 >> 32);
+        if (pen < _count && fd == _listeners[pen])
+        {
+          int c;
+          while ((c = accept(fd, nullptr, nullptr)) >= 0)
+          {
+            setNonBlocking(c);
+            clients[c].pen = pen;
+            epoll_event ev;
+            ev.events   = EPOLLIN;
+            ev.data.u64 = ((uint64_t)0xFFFFFFFF << 32) | (uint32_t)c;
+            epoll_ctl(_epoll[t], EPOLL_CTL_ADD, c, &ev);
+          }
+          continue;
+        }
+        auto it = clients.find(fd);
+        if (it == clients.end()) continue;
+        char buf[1024];
+        ssize_t r;
+        bool closed = false;
+        while ((r = read(fd, buf, sizeof(buf))) > 0) it->second.request.append(buf, r);
+        if (r == 0 || (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) closed = true;
+        if (!closed && it->second.request.find("\r\n\r\n") == std::string::npos) continue;
+        if (!closed)
+        {
+          std::string response = _respond(it->second.pen, it->second.request);
+          //  responses are small, a loopback socket buffer takes them at once
+          ssize_t w = write(fd, response.data(), response.size());
+          (void) w;
+          _served++;
+        }
+        epoll_ctl(_epoll[t], EPOLL_CTL_DEL, fd, nullptr);
+        close(fd);
+        clients.erase(it);
+      }
+    }
+    for (auto &c : clients) close(c.first);
+  }
+
+  //  Deterministic pen behaviour: a 10 minute cycle with a feed at the
+  //  start (gate open 20 s, 15 g/s drop) and a wash in the middle (30 s).
+  std::string _respond(uint32_t pen, const std::string &request)
+  {
+    uint64_t nowMs  = wallMs();
+    uint64_t cycle  = 600000;
+    uint64_t phase  = (nowMs + (uint64_t)pen * 7919) % cycle;
+    bool servoOpen  = phase < 20000;
+    bool washing    = phase >= 300000 && phase < 330000;
+    float capacity  = 2000.0f + (pen % 17) * 50.0f;
+    float dropped   = servoOpen ? phase * 0.015f : 300.0f;
+    float noise     = (float)((nowMs / 100 + pen) % 7) * 0.1f - 0.3f;
+    float weight    = capacity - dropped + noise;
+
+    char body[256];
+    if (request.compare(0, 15, "GET /api/weight") == 0)
+    {
+      snprintf(body, sizeof(body), "{\"success\": true, \"weight\": %.2f}", weight);
+    }
+    else if (request.compare(0, 17, "GET /api/schedule") == 0)
+    {
+      int shift = pen % 4;
+      snprintf(body, sizeof(body),
+               "{\"success\": true, \"feed_schedule\": [\"%02d:00\",\"12:00\",\"18:00\"], "
+               "\"wash_schedule\": [\"07:00\",\"17:00\"]}", 6 + shift);
+    }
+    else if (request.compare(0, 15, "GET /api/status") == 0)
+    {
+      uint64_t secs = (nowMs / 1000) % 86400;
+      snprintf(body, sizeof(body),
+               "{\"success\": true,\"wifi\": \"Connected\",\"time\": \"%02u:%02u:%02u\","
+               "\"scale\": \"Available\",\"servo\": \"%s\",\"wash\": \"%s\","
+               "\"weight\": %.2f,\"lastFeedAmount\": %.2f}",
+               (unsigned)(secs / 3600), (unsigned)(secs / 60 % 60), (unsigned)(secs % 60),
+               servoOpen ? "Open" : "Closed", washing ? "In Progress" : "Ready",
+               weight, servoOpen ? dropped : 0.0f);
+    }
+    else
+    {
+      return "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    }
+    char head[128];
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\n"
+             "Content-Length: %zu\r\nConnection: close\r\n\r\n", strlen(body));
+    return std::string(head) + body;
+  }
+
+  uint32_t                 _count;
+  uint16_t                 _basePort;
+  uint32_t                 _threads;
+  std::vector<int>         _listeners;
+  std::vector<int>         _epoll;
+  std::vector<std::thread> _workers;
+  std::atomic<bool>        _running{false};
+  std::atomic<uint64_t>    _served{0};
+};
+
+
+///////////////////////////////////////////////////////////////
+//
+//  COLLECTOR
+//
+enum Endpoint : uint8_t
+{
+  EP_STATUS = 0,
+  EP_WEIGHT,
+  EP_SCHEDULE,
+  EP_COUNT
+};
+
+static const char *ENDPOINT_PATH[EP_COUNT] = { "/api/status", "/api/weight", "/api/schedule" };
+
+
+struct Target
+{
+  sockaddr_in addr;
+  std::string host;
+  uint32_t    pen;
+  uint64_t    nextDueUs[EP_COUNT];
+  bool        busy[EP_COUNT];
+  uint8_t     inflight;
+};
+
+
+struct Response
+{
+  uint32_t    pen;
+  uint8_t     endpoint;
+  bool        ok;
+  uint64_t    tsMs;
+  uint32_t    latencyUs;
+  std::string raw;
+};
+
+
+struct CollectorConfig
+{
+  uint32_t intervalMs         = 1000;
+  uint32_t weightIntervalMs   = 0;
+  uint32_t scheduleIntervalMs = 60000;
+  uint32_t timeoutMs          = 3000;
+  uint32_t maxInflight        = 256;
+  uint32_t perPen             = 2;
+  uint32_t workers            = 4;
+  uint32_t durationS          = 0;
+};
+
+
+class ResponseQueue
+{
+public:
+  void push(Response &&r)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _queue.push_back(std::move(r));
+    }
+    _cv.notify_one();
+  }
+
+  //  returns false when closed and drained
+  bool pop(Response &r)
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [this] { return !_queue.empty() || _closed; });
+    if (_queue.empty()) return false;
+    r = std::move(_queue.front());
+    _queue.pop_front();
+    return true;
+  }
+
+  void close()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _closed = true;
+    }
+    _cv.notify_all();
+  }
+
+private:
+  std::deque<Response>    _queue;
+  std::mutex              _mutex;
+  std::condition_variable _cv;
+  bool                    _closed = false;
+};
+
+
+class Collector
+{
+public:
+  Collector(std::vector<Target> &targets, const CollectorConfig &config, const std::string &out)
+  : _targets(targets), _config(config),
+    _samples(out + "/samples", SAMPLE_COLUMNS, SAMPLE_COLUMN_COUNT),
+    _schedules(out + "/schedules", SCHEDULE_COLUMNS, SCHEDULE_COLUMN_COUNT)
+  {
+    mkdir(out.c_str(), 0755);
+  }
+
+  int run()
+  {
+    if (!_samples.open() || !_schedules.open())
+    {
+      fprintf(stderr, "collect: cannot open store: %s\n", strerror(errno));
+      return 1;
+    }
+    _epoll = epoll_create1(0);
+    if (_epoll < 0) return 1;
+
+    //  spread the first polls over one interval to avoid a thundering herd
+    uint64_t now = monotonicUs();
+    for (size_t i = 0; i < _targets.size(); i++)
+    {
+      uint64_t spread = (uint64_t)_config.intervalMs * 1000 * i / _targets.size();
+      _targets[i].inflight = 0;
+      for (uint8_t ep = 0; ep < EP_COUNT; ep++) _targets[i].busy[ep] = false;
+      _targets[i].nextDueUs[EP_STATUS]   = now + spread;
+      _targets[i].nextDueUs[EP_WEIGHT]   = _config.weightIntervalMs ? now + spread : UINT64_MAX;
+      _targets[i].nextDueUs[EP_SCHEDULE] = now + spread;
+    }
+
+    std::vector<std::thread> workers;
+    for (uint32_t w = 0; w < _config.workers; w++)
+    {
+      workers.emplace_back(&Collector::_work, this);
+    }
+
+    uint64_t start      = now;
+    uint64_t lastReport = now;
+    size_t   cursor     = 0;
+    epoll_event events[256];
+    while (!stopRequested)
+    {
+      now = monotonicUs();
+      if (_config.durationS && now - start >= (uint64_t)_config.durationS * 1000000) break;
+
+      _startDue(now, cursor);
+
+      int n = epoll_wait(_epoll, events, 256, 5);
+      for (int e = 0; e < n; e++)
+      {
+        _onEvent(events[e]);
+      }
+      _expire(monotonicUs());
+
+      if (now - lastReport >= 5000000)
+      {
+        _report((now - lastReport) / 1e6);
+        lastReport = now;
+      }
+    }
+
+    for (auto &c : _conns) close(c.first);
+    _conns.clear();
+    close(_epoll);
+    _queue.close();
+    for (std::thread &t : workers) t.join();
+    _samples.flush();
+    _schedules.flush();
+    _report((monotonicUs() - lastReport) / 1e6);
+    return 0;
+  }
+
+private:
+  struct Conn
+  {
+    uint32_t    target;
+    uint8_t     endpoint;
+    uint64_t    startUs;
+    std::string request;
+    size_t      sent;
+    bool        connected;
+    std::string raw;
+  };
+
+  //  Round robin over the targets so a large fleet is not starved
+  //  by the in-flight limit always favouring the first pens.
+  void _startDue(uint64_t now, size_t &cursor)
+  {
+    size_t count = _targets.size();
+    for (size_t k = 0; k < count && _conns.size() < _config.maxInflight; k++)
+    {
+      size_t i = (cursor + k) % count;
+      Target &t = _targets[i];
+      for (uint8_t ep = 0; ep < EP_COUNT; ep++)
+      {
+        if (t.inflight >= _config.perPen || _conns.size() >= _config.maxInflight) break;
+        if (t.busy[ep] || t.nextDueUs[ep] > now) continue;
+        uint32_t period = ep == EP_STATUS ? _config.intervalMs
+                        : ep == EP_WEIGHT ? _config.weightIntervalMs
+                        : _config.scheduleIntervalMs;
+        //  keep the phase, but never queue up missed polls
+        t.nextDueUs[ep] += (uint64_t)period * 1000;
+        if (t.nextDueUs[ep] <= now) t.nextDueUs[ep] = now + (uint64_t)period * 1000;
+        if (_connect(i, ep, now)) cursor = (i + 1) % count;
+      }
+    }
+  }
+
+  bool _connect(uint32_t target, uint8_t endpoint, uint64_t now)
+  {
+    Target &t = _targets[target];
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0)
+    {
+      _fail(target, endpoint, now);
+      return false;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    int rc = ::connect(fd, (sockaddr *)&t.addr, sizeof(t.addr));
+    if (rc < 0 && errno != EINPROGRESS)
+    {
+      close(fd);
+      _fail(target, endpoint, now);
+      return false;
+    }
+    Conn &c     = _conns[fd];
+    c.target    = target;
+    c.endpoint  = endpoint;
+    c.startUs   = now;
+    c.sent      = 0;
+    c.connected = false;
+    c.request   = std::string("GET ") + ENDPOINT_PATH[endpoint] + " HTTP/1.1\r\nHost: " + t.host
+                + "\r\nConnection: close\r\n\r\n";
+    epoll_event ev;
+    ev.events  = EPOLLOUT | EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = fd;
+    epoll_ctl(_epoll, EPOLL_CTL_ADD, fd, &ev);
+    t.busy[endpoint] = true;
+    t.inflight++;
+    return true;
+  }
+
+  void _onEvent(const epoll_event &ev)
+  {
+    int fd = ev.data.fd;
+    auto it = _conns.find(fd);
+    if (it == _conns.end()) return;
+    Conn &c = it->second;
+
+    if (!c.connected && (ev.events & (EPOLLOUT | EPOLLERR | EPOLLHUP)))
+    {
+      int err = 0;
+      socklen_t len = sizeof(err);
+      getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len);
+      if (err != 0)
+      {
+        _finish(fd, false);
+        return;
+      }
+      c.connected = true;
+    }
+    if (c.connected && c.sent < c.request.size())
+    {
+      ssize_t w = send(fd, c.request.data() + c.sent, c.request.size() - c.sent, MSG_NOSIGNAL);
+      if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        _finish(fd, false);
+        return;
+      }
+      if (w > 0) c.sent += w;
+      if (c.sent == c.request.size())
+      {
+        epoll_event mod;
+        mod.events  = EPOLLIN | EPOLLRDHUP;
+        mod.data.fd = fd;
+        epoll_ctl(_epoll, EPOLL_CTL_MOD, fd, &mod);
+      }
+    }
+    if (ev.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))
+    {
+      char buf[2048];
+      ssize_t r;
+      while ((r = recv(fd, buf, sizeof(buf), 0)) > 0) c.raw.append(buf, r);
+      if (r == 0)
+      {
+        _finish(fd, true);
+      }
+      else if (errno != EAGAIN && errno != EWOULDBLOCK)
+      {
+        _finish(fd, false);
+      }
+    }
+  }
+
+  void _expire(uint64_t now)
+  {
+    uint64_t limit = (uint64_t)_config.timeoutMs * 1000;
+    std::vector<int> expired;
+    for (auto &c : _conns)
+    {
+      if (now - c.second.startUs > limit) expired.push_back(c.first);
+    }
+    for (int fd : expired)
+    {
+      _timeouts++;
+      _finish(fd, false);
+    }
+  }
+
+  void _finish(int fd, bool ok)
+  {
+    auto it = _conns.find(fd);
+    Conn &c = it->second;
+    Response r;
+    r.pen       = _targets[c.target].pen;
+    r.endpoint  = c.endpoint;
+    r.ok        = ok;
+    r.tsMs      = wallMs();
+    r.latencyUs = (uint32_t)(monotonicUs() - c.startUs);
+    r.raw       = std::move(c.raw);
+    _targets[c.target].busy[c.endpoint] = false;
+    _targets[c.target].inflight--;
+    epoll_ctl(_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    _conns.erase(it);
+    _queue.push(std::move(r));
+  }
+
+  void _fail(uint32_t target, uint8_t endpoint, uint64_t now)
+  {
+    Response r;
+    r.pen       = _targets[target].pen;
+    r.endpoint  = endpoint;
+    r.ok        = false;
+    r.tsMs      = wallMs();
+    r.latencyUs = (uint32_t)(monotonicUs() - now);
+    _queue.push(std::move(r));
+  }
+
+  void _work()
+  {
+    Response r;
+    while (_queue.pop(r))
+    {
+      if (!r.ok || r.raw.compare(0, 12, "HTTP/1.1 200") != 0)
+      {
+        _errors++;
+        continue;
+      }
+      size_t bodyAt = r.raw.find("\r\n\r\n");
+      if (bodyAt == std::string::npos)
+      {
+        _errors++;
+        continue;
+      }
+      std::string body = r.raw.substr(bodyAt + 4);
+      if (_store(r, body))
+      {
+        _ok++;
+        _latencySumUs += r.latencyUs;
+      }
+      else
+      {
+        _errors++;
+      }
+    }
+  }
+
+  bool _store(const Response &r, const std::string &body)
+  {
+    if (r.endpoint == EP_SCHEDULE)
+    {
+      std::vector<std::string> feed, wash;
+      jsonStringArray(body, "feed_schedule", feed);
+      jsonStringArray(body, "wash_schedule", wash);
+      if (feed.empty() && wash.empty()) return false;
+      uint16_t slots[5];
+      for (int i = 0; i < 3; i++) slots[i]     = i < (int)feed.size() ? scheduleMinutes(feed[i]) : 0xFFFF;
+      for (int i = 0; i < 2; i++) slots[3 + i] = i < (int)wash.size() ? scheduleMinutes(wash[i]) : 0xFFFF;
+      const void *values[] = { &r.tsMs, &r.pen, &slots[0], &slots[1], &slots[2], &slots[3], &slots[4] };
+      _schedules.append(values);
+      return true;
+    }
+
+    float   weight   = 0;
+    float   lastFeed = 0;
+    uint8_t flags    = 0;
+    if (!jsonNumber(body, "weight", weight)) return false;
+    if (r.endpoint == EP_WEIGHT)
+    {
+      flags = FLAG_WEIGHT_ONLY;
+    }
+    else
+    {
+      std::string servo, wash, scale, wifi;
+      jsonNumber(body, "lastFeedAmount", lastFeed);
+      jsonString(body, "servo", servo);
+      jsonString(body, "wash",  wash);
+      jsonString(body, "scale", scale);
+      jsonString(body, "wifi",  wifi);
+      if (servo == "Open")                    flags |= FLAG_SERVO_OPEN | FLAG_SERVO_OK;
+      if (servo == "Closed")                  flags |= FLAG_SERVO_OK;
+      if (scale == "Available")               flags |= FLAG_SCALE_OK;
+      if (wash == "In Progress")              flags |= FLAG_WASHING;
+      if (wifi == "Connected")                flags |= FLAG_WIFI_OK;
+    }
+    const void *values[] = { &r.tsMs, &r.pen, &weight, &lastFeed, &flags, &r.latencyUs };
+    _samples.append(values);
+    return true;
+  }
+
+  void _report(double seconds)
+  {
+    uint64_t ok  = _ok.exchange(0);
+    uint64_t err = _errors.exchange(0);
+    uint64_t lat = _latencySumUs.exchange(0);
+    uint64_t to  = _timeouts.exchange(0);
+    if (seconds <= 0) seconds = 1;
+    fprintf(stderr, "collect: %.0f ok/s  %llu errors (%llu timeouts)  mean latency %.2f ms  inflight %zu\n",
+            ok / seconds, (unsigned long long)err, (unsigned long long)to,
+            ok ? lat / 1000.0 / ok : 0.0, _conns.size());
+  }
+
+  std::vector<Target>  &_targets;
+  CollectorConfig       _config;
+  ColumnTable           _samples;
+  ColumnTable           _schedules;
+  ResponseQueue         _queue;
+  std::map<int, Conn>   _conns;
+  int                   _epoll = -1;
+  std::atomic<uint64_t> _ok{0};
+  std::atomic<uint64_t> _errors{0};
+  std::atomic<uint64_t> _timeouts{0};
+  std::atomic<uint64_t> _latencySumUs{0};
+};
+
+
+///////////////////////////////////////////////////////////////
+//
+//  QUERY
+//
+struct PenStats
+{
+  uint64_t samples   = 0;
+  uint64_t servoOpen = 0;
+  uint64_t washing   = 0;
+  uint64_t feeds     = 0;   //  closed -> open transitions
+  uint64_t washes    = 0;   //  ready -> in progress transitions
+  float    minWeight = INFINITY;
+  float    maxWeight = -INFINITY;
+  double   sumWeight = 0;
+  float    lastWeight = 0;
+  uint64_t firstMs   = 0;
+  uint64_t lastMs    = 0;
+  uint8_t  lastFlags = 0;
+  uint16_t schedule[5] = { 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF, 0xFFFF };
+};
+
+
+static void printMinutes(uint16_t m)
+{
+  if (m == 0xFFFF) printf(" --:--");
+  else             printf(" %02u:%02u", m / 60, m % 60);
+}
+
+
+static int query(const std::string &dir, long pen, uint64_t sinceMs)
+{
+  std::vector<std::vector<uint8_t>> s;
+  size_t rows = readTable(dir + "/samples", SAMPLE_COLUMNS, SAMPLE_COLUMN_COUNT, s);
+
+  //  several workers append concurrently, so rows are not in time order;
+  //  sort them before counting open / wash transitions.
+  std::vector<size_t> order;
+  order.reserve(rows);
+  for (size_t i = 0; i < rows; i++)
+  {
+    if (columnValue<uint64_t>(s[0], i) < sinceMs) continue;
+    if (pen >= 0 && columnValue<uint32_t>(s[1], i) != (uint32_t)pen) continue;
+    order.push_back(i);
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+  {
+    return columnValue<uint64_t>(s[0], a) < columnValue<uint64_t>(s[0], b);
+  });
+
+  std::map<uint32_t, PenStats> stats;
+  for (size_t i : order)
+  {
+    uint64_t ts     = columnValue<uint64_t>(s[0], i);
+    uint32_t id     = columnValue<uint32_t>(s[1], i);
+    float    weight = columnValue<float>(s[2], i);
+    uint8_t  flags  = columnValue<uint8_t>(s[4], i);
+    PenStats &p = stats[id];
+    if (p.samples == 0) p.firstMs = ts;
+    p.samples++;
+    p.lastMs     = ts;
+    p.lastWeight = weight;
+    p.sumWeight += weight;
+    if (weight < p.minWeight) p.minWeight = weight;
+    if (weight > p.maxWeight) p.maxWeight = weight;
+    if (flags & FLAG_WEIGHT_ONLY) continue;
+    if (flags & FLAG_SERVO_OPEN) p.servoOpen++;
+    if (flags & FLAG_WASHING)    p.washing++;
+    if ((flags & FLAG_SERVO_OPEN) && !(p.lastFlags & FLAG_SERVO_OPEN)) p.feeds++;
+    if ((flags & FLAG_WASHING)    && !(p.lastFlags & FLAG_WASHING))    p.washes++;
+    p.lastFlags = flags;
+  }
+
+  std::vector<std::vector<uint8_t>> c;
+  size_t srows = readTable(dir + "/schedules", SCHEDULE_COLUMNS, SCHEDULE_COLUMN_COUNT, c);
+  std::map<uint32_t, uint64_t> scheduleTs;
+  for (size_t i = 0; i < srows; i++)
+  {
+    uint64_t ts = columnValue<uint64_t>(c[0], i);
+    uint32_t id = columnValue<uint32_t>(c[1], i);
+    auto it = stats.find(id);
+    if (it == stats.end() || ts < scheduleTs[id]) continue;
+    scheduleTs[id] = ts;
+    for (int k = 0; k < 5; k++) it->second.schedule[k] = columnValue<uint16_t>(c[2 + k], i);
+  }
+
+  printf("%6s %8s %9s %9s %9s %9s %6s %6s %6s %6s  %s\n",
+         "pen", "samples", "min", "max", "mean", "last", "feeds", "washes", "open%", "wash%",
+         "feed / wash schedule");
+  PenStats fleet;
+  for (auto &e : stats)
+  {
+    PenStats &p = e.second;
+    uint64_t full = p.samples ? p.samples : 1;
+    printf("%6u %8llu %9.2f %9.2f %9.2f %9.2f %6llu %6llu %5.1f%% %5.1f%% ",
+           e.first, (unsigned long long)p.samples, p.minWeight, p.maxWeight,
+           p.sumWeight / full, p.lastWeight,
+           (unsigned long long)p.feeds, (unsigned long long)p.washes,
+           100.0 * p.servoOpen / full, 100.0 * p.washing / full);
+    for (int k = 0; k < 5; k++) printMinutes(p.schedule[k]);
+    printf("\n");
+    fleet.samples   += p.samples;
+    fleet.feeds     += p.feeds;
+    fleet.washes    += p.washes;
+    fleet.sumWeight += p.lastWeight;
+  }
+  printf("\nfleet: %zu pens, %llu samples, %llu feeds, %llu washes, %.2f total weight on scales\n",
+         stats.size(), (unsigned long long)fleet.samples, (unsigned long long)fleet.feeds,
+         (unsigned long long)fleet.washes, fleet.sumWeight);
+  return 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  MAIN
+//
+static bool resolveTarget(const std::string &spec, uint32_t pen, Target &t)
+{
+  std::string host = spec;
+  std::string port = "80";
+  size_t colon = spec.rfind(':');
+  if (colon != std::string::npos)
+  {
+    host = spec.substr(0, colon);
+    port = spec.substr(colon + 1);
+  }
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family   = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  addrinfo *res = nullptr;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || res == nullptr) return false;
+  memcpy(&t.addr, res->ai_addr, sizeof(t.addr));
+  freeaddrinfo(res);
+  t.host = host;
+  t.pen  = pen;
+  t.inflight = 0;
+  for (uint8_t ep = 0; ep < EP_COUNT; ep++) t.busy[ep] = false;
+  return true;
+}
+
+
+static bool loadTargets(const char *path, std::vector<Target> &targets)
+{
+  FILE *f = fopen(path, "r");
+  if (f == nullptr) return false;
+  char line[256];
+  uint32_t index = 0;
+  while (fgets(line, sizeof(line), f))
+  {
+    char spec[200];
+    unsigned pen;
+    int fields = sscanf(line, "%199s %u", spec, &pen);
+    if (fields < 1 || spec[0] == '#') continue;
+    Target t;
+    if (!resolveTarget(spec, fields == 2 ? pen : index, t))
+    {
+      fprintf(stderr, "targets: cannot resolve %s\n", spec);
+      continue;
+    }
+    targets.push_back(t);
+    index++;
+  }
+  fclose(f);
+  return true;
+}
+
+
+static void onSignal(int)
+{
+  stopRequested = true;
+}
+
+
+static void usage()
+{
+  fprintf(stderr,
+          "usage: fleet_collector collect  (--targets file | --simulate n) --out dir [options]\n"
+          "       fleet_collector simulate --count n [--base-port p] [--threads t]\n"
+          "       fleet_collector query    dir [--pen n] [--since epoch_ms]\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    usage();
+    return 2;
+  }
+  signal(SIGINT,  onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+  raiseFileLimit();
+
+  std::string command = argv[1];
+  std::map<std::string, std::string> opt;
+  std::string positional;
+  for (int i = 2; i < argc; i++)
+  {
+    if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc) { opt[argv[i] + 2] = argv[i + 1]; i++; }
+    else positional = argv[i];
+  }
+  auto num = [&](const char *key, uint32_t def) -> uint32_t
+  {
+    auto it = opt.find(key);
+    return it == opt.end() ? def : (uint32_t)strtoul(it->second.c_str(), nullptr, 10);
+  };
+
+  if (command == "query")
+  {
+    if (positional.empty()) { usage(); return 2; }
+    long pen = opt.count("pen") ? atol(opt["pen"].c_str()) : -1;
+    uint64_t since = opt.count("since") ? strtoull(opt["since"].c_str(), nullptr, 10) : 0;
+    return query(positional, pen, since);
+  }
+
+  if (command == "simulate")
+  {
+    FakeFleet fleet(num("count", 100), (uint16_t)num("base-port", 20000), num("threads", 2));
+    if (!fleet.start()) return 1;
+    fprintf(stderr, "simulate: %u controllers on 127.0.0.1:%u..%u\n", num("count", 100),
+            num("base-port", 20000), num("base-port", 20000) + num("count", 100) - 1);
+    while (!stopRequested) usleep(100000);
+    fleet.stop();
+    fprintf(stderr, "simulate: served %llu requests\n", (unsigned long long)fleet.served());
+    return 0;
+  }
+
+  if (command == "collect")
+  {
+    if (!opt.count("out")) { usage(); return 2; }
+    CollectorConfig config;
+    config.intervalMs         = num("interval", config.intervalMs);
+    config.weightIntervalMs   = num("weight-interval", config.weightIntervalMs);
+    config.scheduleIntervalMs = num("schedule-interval", config.scheduleIntervalMs);
+    config.timeoutMs          = num("timeout", config.timeoutMs);
+    config.maxInflight        = num("max-inflight", config.maxInflight);
+    config.perPen             = std::max(1u, num("per-pen", config.perPen));
+    config.workers            = num("workers", config.workers);
+    config.durationS          = num("duration", config.durationS);
+    if (config.workers == 0)     config.workers = 1;
+    if (config.maxInflight == 0) config.maxInflight = 1;
+    if (config.intervalMs == 0)  config.intervalMs = 1;
+    if (config.scheduleIntervalMs == 0) config.scheduleIntervalMs = config.intervalMs;
+
+    std::vector<Target> targets;
+    std::unique_ptr<FakeFleet> fleet;
+    if (opt.count("simulate"))
+    {
+      uint32_t count    = num("simulate", 0);
+      uint16_t basePort = (uint16_t)num("base-port", 20000);
+      fleet.reset(new FakeFleet(count, basePort, num("threads", 2)));
+      if (!fleet->start()) return 1;
+      for (uint32_t i = 0; i < count; i++)
+      {
+        Target t;
+        resolveTarget("127.0.0.1:" + std::to_string(basePort + i), i, t);
+        targets.push_back(t);
+      }
+    }
+    else if (!opt.count("targets") || !loadTargets(opt["targets"].c_str(), targets))
+    {
+      fprintf(stderr, "collect: no targets\n");
+      return 2;
+    }
+    if (targets.empty()) return 2;
+
+    fprintf(stderr, "collect: %zu pens, status every %u ms, %u workers, %u in flight\n",
+            targets.size(), config.intervalMs, config.workers, config.maxInflight);
+    Collector collector(targets, config, opt["out"]);
+    int rc = collector.run();
+    if (fleet) fleet->stop();
+    return rc;
+  }
+
+  usage();
+  return 2;
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,388 @@
+//
+//    FILE: fuzz_body.cpp
+// PURPOSE: Fuzzes the in place request body tokenizers of the pig pen
+//          controller (request_body.h) on a Linux host.
+//
+//  BUILD
+//    g++ -std=c++17 -O1 -g -fsanitize=address,undefined -I../../sketch_sep3a
+//        -o fuzz_body fuzz_body.cpp ../../sketch_sep3a/request_body.cpp
+//  or, as a libFuzzer target
+//    clang++ -std=c++17 -O1 -g -fsanitize=fuzzer,address,undefined -DFUZZ_LIBFUZZER
+//        -I../../sketch_sep3a -o fuzz_body fuzz_body.cpp ../../sketch_sep3a/request_body.cpp
+//
+//  USAGE
+//    fuzz_body [--runs n] [--seed n] [file ...]
+//
+//  Without files it generates JSON objects and form bodies with known
+//  fields, encoded with random escapes and whitespace, and checks they
+//  come back as they went in; then it mutates them at random. With
+//  files it checks just those, e.g. a crash libFuzzer wrote.
+//
+//  On every input: nothing is read or written outside the buffer (the
+//  sanitizers watch), a rejected JSON body is left as it was, and every
+//  field lies in the buffer with a NUL after its value.
+//  Exit code 1 on the first failure, its input is printed in hex.
+//
+
+
+#include "request_body.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+
+#define MAX_FIELDS  8
+
+
+static void fail(const char *what, const uint8_t *data, size_t size)
+{
+  fprintf(stderr, "FAIL: %s\ninput (%zu bytes):", what, size);
+  for (size_t i = 0; i < size; i++) fprintf(stderr, "%s%02x", i % 32 ? " " : "\n  ", data[i]);
+  fprintf(stderr, "\n");
+  exit(1);
+}
+
+
+static bool inside(const char *p, const char *buffer, size_t size)
+{
+  return p >= buffer && p < buffer + size;
+}
+
+
+static void checkFields(const BodyField *fields, int count, const char *buffer, size_t size,
+                        const uint8_t *data, size_t dataSize)
+{
+  for (int i = 0; i < count; i++)
+  {
+    const BodyField &f = fields[i];
+    if (!inside(f.name, buffer, size) || !memchr(f.name, 0, buffer + size - f.name))
+    {
+      fail("field name outside the buffer", data, dataSize);
+    }
+    if (f.length > 0 && !inside(f.value, buffer, size)) fail("value outside the buffer", data, dataSize);
+    if (f.length > 0 && !inside(f.value + f.length, buffer, size)) fail("value runs past the buffer", data, dataSize);
+    if (f.length > 0 && f.value[f.length] != 0) fail("value not NUL terminated", data, dataSize);
+
+    //  the value parsers read length bytes only
+    int32_t n;
+    float   x;
+    char    copy[33];
+    fieldInt(f.value, f.length, n);
+    fieldFloat(f.value, f.length, x);
+    fieldCopy(f.value, f.length, copy, sizeof(copy));
+    fieldIs(f.value, f.length, "feed");
+  }
+}
+
+
+//  the checks every input gets, both tokenizers
+static void checkInput(const uint8_t *data, size_t size)
+{
+  //  exactly size bytes, the sanitizer sees any byte past them
+  char *json = (char *)malloc(size ? size : 1);
+  memcpy(json, data, size);
+  BodyField fields[MAX_FIELDS];
+  int16_t count = tokenizeJson(json, size, fields, MAX_FIELDS);
+  if (count < 0 && memcmp(json, data, size) != 0) fail("rejected JSON was written to", data, size);
+  if (count > MAX_FIELDS) fail("more JSON fields than room", data, size);
+  if (count > 0) checkFields(fields, count, json, size, data, size);
+  free(json);
+
+  //  forms end at a NUL, as the HTTP server hands them over
+  char *form = (char *)malloc(size + 1);
+  memcpy(form, data, size);
+  form[size] = 0;
+  uint8_t formCount = tokenizeForm(form, fields, MAX_FIELDS);
+  if (formCount > MAX_FIELDS) fail("more form fields than room", data, size);
+  checkFields(fields, formCount, form, size + 1, data, size);
+  free(form);
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  ROUND TRIP
+//
+static std::mt19937 rng;
+
+static uint32_t pick(uint32_t n)  { return rng() % n; }
+
+
+//  random text, mostly printable, some UTF-8 and control bytes
+static std::string randomText(size_t maxLength)
+{
+  static const char *const utf8[] = { "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x90\x96" };
+  std::string s;
+  size_t n = pick(maxLength + 1);
+  while (s.size() < n)
+  {
+    uint32_t r = pick(20);
+    if      (r == 0) s += utf8[pick(3)];
+    else if (r == 1) s += (char)(1 + pick(31));
+    else if (r == 2) s += "\"\\/&=+%";
+    else             s += (char)(' ' + pick(95));
+  }
+  return s;
+}
+
+
+static void appendUtf16(std::string &out, uint32_t u)
+{
+  char hex[8];
+  snprintf(hex, sizeof(hex), pick(2) ? "\\u%04x" : "\\u%04X", u);
+  out += hex;
+}
+
+
+//  JSON string body of text, escaped at random where it may be
+static std::string jsonEscape(const std::string &text)
+{
+  std::string out;
+  for (size_t i = 0; i < text.size(); i++)
+  {
+    uint8_t c = text[i];
+    if (c == '"' || c == '\\')        { out += '\\'; out += (char)c; }
+    else if (c == '\n' && pick(2))     out += "\\n";
+    else if (c == '\t' && pick(2))     out += "\\t";
+    else if (c < 0x20)                 appendUtf16(out, c);
+    else if (c == '/' && pick(2))      out += "\\/";
+    else if (c >= 0xC0)
+    {
+      //  a whole UTF-8 sequence, as is or as \u escapes
+      size_t n = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : 2;
+      if (pick(2))
+      {
+        out += text.substr(i, n);
+      }
+      else
+      {
+        uint32_t code = c & (0x7F >> n);
+        for (size_t k = 1; k < n; k++) code = (code << 6) | (text[i + k] & 0x3F);
+        if (code >= 0x10000)
+        {
+          code -= 0x10000;
+          appendUtf16(out, 0xD800 + (code >> 10));
+          appendUtf16(out, 0xDC00 + (code & 0x3FF));
+        }
+        else appendUtf16(out, code);
+      }
+      i += n - 1;
+    }
+    else if (pick(16) == 0)            appendUtf16(out, c);
+    else                               out += (char)c;
+  }
+  return out;
+}
+
+
+static std::string space()
+{
+  static const char *const blanks[] = { "", "", " ", "\n", "\t", "  \r\n" };
+  return blanks[pick(6)];
+}
+
+
+struct Field
+{
+  std::string name;
+  std::string value;            //  as it must come back
+  std::string json;             //  as written in the body
+};
+
+
+static Field randomJsonField()
+{
+  static const char *const scalars[] = { "0", "-12", "3.25", "1e3", "-0.5E-2", "true", "false", "null" };
+  static const char *const nested[]  = { "[]", "{}", "[1, \"]\", {\"a\": [2]}]", "{\"x\": {\"y\": \"}\"}}" };
+  Field f;
+  f.name = randomText(12);
+  uint32_t kind = pick(4);
+  if (kind == 0)
+  {
+    f.value = f.json = scalars[pick(8)];
+  }
+  else if (kind == 1)
+  {
+    f.value = f.json = nested[pick(4)];
+  }
+  else
+  {
+    f.value = randomText(24);
+    f.json  = "\"" + jsonEscape(f.value) + "\"";
+  }
+  return f;
+}
+
+
+static std::string formEscape(const std::string &text)
+{
+  std::string out;
+  char hex[4];
+  for (uint8_t c : text)
+  {
+    if (c == ' ' && pick(2))                                   out += '+';
+    else if (c == '&' || c == '=' || c == '%' || c == '+' || c == 0 || pick(8) == 0)
+    {
+      snprintf(hex, sizeof(hex), "%%%02X", c);
+      out += hex;
+    }
+    else                                                       out += (char)c;
+  }
+  return out;
+}
+
+
+static void roundTripJson(std::vector<uint8_t> &body)
+{
+  std::vector<Field> fields(pick(MAX_FIELDS + 1));
+  std::string text = space() + "{" + space();
+  for (size_t i = 0; i < fields.size(); i++)
+  {
+    fields[i] = randomJsonField();
+    if (i) text += "," + space();
+    text += "\"" + jsonEscape(fields[i].name) + "\"" + space() + ":" + space() + fields[i].json + space();
+  }
+  text += "}" + space();
+  body.assign(text.begin(), text.end());
+
+  std::vector<char> buffer(text.begin(), text.end());
+  BodyField out[MAX_FIELDS];
+  int16_t count = tokenizeJson(buffer.data(), buffer.size(), out, MAX_FIELDS);
+  if (count != (int16_t)fields.size()) fail("JSON field count", body.data(), body.size());
+  for (int16_t i = 0; i < count; i++)
+  {
+    if (fields[i].name != out[i].name) fail("JSON name", body.data(), body.size());
+    if (fields[i].value != std::string(out[i].value, out[i].length)) fail("JSON value", body.data(), body.size());
+  }
+}
+
+
+static void roundTripForm(std::vector<uint8_t> &body)
+{
+  std::vector<Field> fields(pick(MAX_FIELDS + 1));
+  std::string text;
+  for (size_t i = 0; i < fields.size(); i++)
+  {
+    do fields[i].name = randomText(12); while (fields[i].name.empty());
+    fields[i].value = randomText(24);
+    if (i) text += "&";
+    text += formEscape(fields[i].name) + "=" + formEscape(fields[i].value);
+  }
+  body.assign(text.begin(), text.end());
+
+  std::vector<char> buffer(text.begin(), text.end());
+  buffer.push_back(0);
+  BodyField out[MAX_FIELDS];
+  uint8_t count = tokenizeForm(buffer.data(), out, MAX_FIELDS);
+  if (count != fields.size()) fail("form field count", body.data(), body.size());
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (fields[i].name != out[i].name) fail("form name", body.data(), body.size());
+    if (fields[i].value != std::string(out[i].value, out[i].length)) fail("form value", body.data(), body.size());
+  }
+}
+
+
+static void mutate(std::vector<uint8_t> &body)
+{
+  static const char special[] = "{}[]\":,\\u%&=+ \n0-eE";
+  uint32_t edits = 1 + pick(4);
+  for (uint32_t i = 0; i < edits; i++)
+  {
+    size_t   at = body.empty() ? 0 : pick(body.size());
+    uint8_t  c  = pick(2) ? special[pick(sizeof(special) - 1)] : pick(256);
+    switch (pick(3))
+    {
+      case 0:  if (!body.empty()) body[at] = c; break;
+      case 1:  body.insert(body.begin() + at, c); break;
+      default: if (!body.empty()) body.erase(body.begin() + at); break;
+    }
+  }
+}
+
+
+#ifdef FUZZ_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  checkInput(data, size);
+  return 0;
+}
+
+#else
+
+static bool loadFile(const char *path, std::vector<uint8_t> &data)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return false;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) data.insert(data.end(), buffer, buffer + n);
+  fclose(f);
+  return true;
+}
+
+
+int main(int argc, char *argv[])
+{
+  uint32_t runs = 100000;
+  uint32_t seed = 1;
+  std::vector<const char *> files;
+  for (int i = 1; i < argc; i++)
+  {
+    bool more = i + 1 < argc;
+    if      (strcmp(argv[i], "--runs") == 0 && more) runs = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--seed") == 0 && more) seed = strtoul(argv[++i], NULL, 10);
+    else if (argv[i][0] != '-') files.push_back(argv[i]);
+    else
+    {
+      fprintf(stderr, "usage: fuzz_body [--runs n] [--seed n] [file ...]\n");
+      return 2;
+    }
+  }
+
+  if (!files.empty())
+  {
+    for (const char *path : files)
+    {
+      std::vector<uint8_t> data;
+      if (!loadFile(path, data))
+      {
+        perror(path);
+        return 2;
+      }
+      checkInput(data.data(), data.size());
+    }
+    printf("%zu files OK\n", files.size());
+    return 0;
+  }
+
+  rng.seed(seed);
+  uint32_t accepted = 0;
+  std::vector<uint8_t> body;
+  for (uint32_t run = 0; run < runs; run++)
+  {
+    if (run & 1) roundTripForm(body);
+    else         roundTripJson(body);
+    checkInput(body.data(), body.size());
+    //  a few generations of damage on top
+    for (uint8_t g = 0; g < 4; g++)
+    {
+      mutate(body);
+      checkInput(body.data(), body.size());
+      std::vector<char> copy(body.begin(), body.end());
+      if (tokenizeJson(copy.data(), copy.size(), NULL, 0) >= 0) accepted++;
+    }
+  }
+  printf("%u runs OK, %u mutated bodies still JSON objects\n", runs, accepted);
+  return 0;
+}
+
+#endif
+
+
+//  -- END OF FILE --
@@ -0,0 +1,124 @@
+#pragma once
+//
+//    FILE: Arduino.h
+// PURPOSE: Just enough of the Arduino core to run the HX711 library
+//          and the pure sketch modules on a Linux host, on a virtual
+//          clock, with an emulated HX711 on the data / clock pins.
+//
+//  NOTES
+//  Time only moves when told to: hostSetMicros(), hostAdvanceMicros(),
+//  delay() and delayMicroseconds(). A run is deterministic and takes
+//  as long as the host needs, not as long as the recorded time.
+//
+//  The emulated HX711 hands out the conversions queued with
+//  hostPushConversion() in order, then the values of the source set
+//  with hostSetConversionSource(). DOUT reads HIGH (not ready) when
+//  there is neither, a blocking read then calls the idle hook from
+//  yield() - without one it stops the program instead of hanging.
+//
+//  An input with an interrupt attached runs its handler once per edge
+//  given to hostPulse(), in the caller's thread - the way a pulse
+//  counter in the sketch sees a flow meter.
+//
+//  Udp.h next to it has the UDP interface the NTP client talks to, a
+//  tool brings its own network behind it.
+//
+//  Used by tools/trace_replay, tools/bench and tools/ntp_server, add
+//  its directory to the include path ahead of anything else called
+//  Arduino.h.
+
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+#define RISING          1
+#define FALLING         2
+#define CHANGE          3
+
+#define IRAM_ATTR
+#define PROGMEM
+#define F(x)            (x)
+#define digitalPinToInterrupt(pin)  (pin)
+#define word(high, low) ((uint16_t)(((high) << 8) | (low)))
+
+
+typedef uint8_t byte;
+
+
+uint32_t millis();
+uint32_t micros();
+void     delay(uint32_t ms);
+void     delayMicroseconds(uint32_t us);
+void     yield();
+
+void     pinMode(uint8_t pin, uint8_t mode);
+void     digitalWrite(uint8_t pin, uint8_t value);
+int      digitalRead(uint8_t pin);
+
+void     noInterrupts();
+void     interrupts();
+void     attachInterrupt(uint8_t interrupt, void (*handler)(), int mode);
+void     detachInterrupt(uint8_t interrupt);
+
+int      analogRead(uint8_t pin);
+void     randomSeed(unsigned long seed);
+long     random(long min, long max);
+
+
+//  as much of String as NTPClient::getFormattedTime() takes
+class String
+{
+public:
+  String(const char *text = "")  { snprintf(_text, sizeof(_text), "%s", text); };
+  String(unsigned long value)    { snprintf(_text, sizeof(_text), "%lu", value); };
+
+  const char *c_str() const      { return _text; };
+  size_t      length() const     { return strlen(_text); };
+  String      operator+(const String &other) const
+  {
+    String s(*this);
+    snprintf(s._text + length(), sizeof(s._text) - length(), "%s", other._text);
+    return s;
+  };
+  friend String operator+(const char *text, const String &other)  { return String(text) + other; };
+
+private:
+  char _text[48];
+};
+
+
+///////////////////////////////////////////////////////////////
+//
+//  HOST CONTROL
+//
+void     hostSetMicros(uint64_t us);
+void     hostAdvanceMicros(uint64_t us);
+uint64_t hostMicros();
+
+//  pins the emulated HX711 is wired to
+void     hostHX711(uint8_t dataPin, uint8_t clockPin);
+void     hostPushConversion(int32_t raw);
+uint32_t hostPendingConversions();
+void     hostDropConversions();
+//  returns false when it has no more values
+void     hostSetConversionSource(bool (*source)(int32_t &raw));
+//  extra clock pulses after the last conversion: 1 = A/128, 2 = B/32, 3 = A/64
+uint8_t  hostSelectedGain();
+uint32_t hostConversions();
+//  called by yield(), e.g. to advance the clock to the next conversion
+void     hostSetIdleHook(void (*hook)());
+//  count edges on pin, nothing when no interrupt is attached to it
+void     hostPulse(uint8_t pin, uint32_t count);
+
+
+//  -- END OF FILE --
@@ -0,0 +1,51 @@
+#pragma once
+//
+//    FILE: Udp.h
+// PURPOSE: The UDP interface of the Arduino core for the host build,
+//          implemented by the tool that links it, e.g. with a
+//          simulated network on the virtual clock.
+//
+
+
+#include "Arduino.h"
+
+
+class IPAddress
+{
+public:
+  IPAddress()                                         { _address = 0; };
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+  {
+    _address = (uint32_t)a << 24 | (uint32_t)b << 16 | (uint32_t)c << 8 | d;
+  };
+
+  uint8_t operator[](int i) const  { return _address >> (24 - 8 * i); };
+  bool    operator==(const IPAddress &other) const  { return _address == other._address; };
+
+private:
+  uint32_t _address;
+};
+
+
+class UDP
+{
+public:
+  virtual ~UDP() {};
+
+  virtual uint8_t  begin(uint16_t port) = 0;
+  virtual void     stop() = 0;
+
+  virtual int      beginPacket(IPAddress ip, uint16_t port) = 0;
+  virtual int      beginPacket(const char *host, uint16_t port) = 0;
+  virtual size_t   write(const uint8_t *buffer, size_t size) = 0;
+  virtual int      endPacket() = 0;
+
+  //  the size of the next packet, 0 if none
+  virtual int      parsePacket() = 0;
+  virtual int      read(uint8_t *buffer, size_t length) = 0;
+  //  drops the rest of the packet
+  virtual void     flush() = 0;
+};
+
+
+//  -- END OF FILE --
@@ -0,0 +1,183 @@
+//
+//    FILE: host_arduino.cpp
+// PURPOSE: Just enough of the Arduino core to run the HX711 library
+//          and the pure sketch modules on a Linux host, on a virtual
+//          clock, with an emulated HX711 on the data / clock pins.
+//
+
+
+#include "Arduino.h"
+
+#include <cstdio>
+#include <deque>
+
+
+static uint64_t clockUs = 0;
+
+static uint8_t  hxData  = 0xFF;
+static uint8_t  hxClock = 0xFF;
+static bool     hxClockHigh = false;
+static uint64_t hxHighSince = 0;
+static uint8_t  hxPulses    = 0;         //  rising edges since the last conversion
+static int32_t  hxValue     = 0;         //  conversion being shifted out
+static bool     hxLatched   = false;
+static uint8_t  hxGain      = 1;
+static uint32_t hxCount     = 0;
+static std::deque<int32_t> hxQueue;
+static bool   (*hxSource)(int32_t &raw) = NULL;
+static void   (*idleHook)() = NULL;
+static uint32_t idleSpins = 0;
+static bool     hxWaiting = false;       //  the last DOUT read said not ready
+static void   (*pinHandlers[64])() = { NULL };
+
+
+uint32_t millis()                     { return (uint32_t)(clockUs / 1000); }
+uint32_t micros()                     { return (uint32_t)clockUs; }
+void     delay(uint32_t ms)           { clockUs += (uint64_t)ms * 1000; yield(); }
+void     delayMicroseconds(uint32_t us) { clockUs += us; }
+void     pinMode(uint8_t, uint8_t)    {}
+void     noInterrupts()               {}
+void     interrupts()                 {}
+
+
+int  analogRead(uint8_t)               { return 0; }
+void randomSeed(unsigned long seed)   { srandom(seed); }
+long random(long min, long max)       { return max > min ? min + ::random() % (max - min) : min; }
+
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int)
+{
+  if (interrupt < 64) pinHandlers[interrupt] = handler;
+}
+
+
+void detachInterrupt(uint8_t interrupt)
+{
+  if (interrupt < 64) pinHandlers[interrupt] = NULL;
+}
+
+
+void yield()
+{
+  if (idleHook)
+  {
+    idleHook();
+    return;
+  }
+  //  a read waiting for a conversion that never comes
+  if (hxWaiting && ++idleSpins > 1000000)
+  {
+    fprintf(stderr, "host_arduino: HX711 read with no conversion left\n");
+    exit(3);
+  }
+}
+
+
+//  a conversion is ready when one is queued or the source has one
+static bool hxReady()
+{
+  if (!hxQueue.empty()) return true;
+  int32_t raw;
+  if (hxSource && hxSource(raw))
+  {
+    hxQueue.push_back(raw);
+    return true;
+  }
+  return false;
+}
+
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+  if (pin != hxClock) return;
+  if (!value && hxClockHigh && clockUs - hxHighSince >= 60)
+  {
+    //  clock held high: powered down, a conversion in progress is lost
+    hxPulses  = 0;
+    hxLatched = false;
+  }
+  if (value && !hxClockHigh)
+  {
+    hxHighSince = clockUs;
+    hxPulses++;
+    if (hxPulses == 1 && hxReady())
+    {
+      hxValue   = hxQueue.front();
+      hxLatched = true;
+    }
+    //  the 25th pulse ends the conversion, 25..27 select the next one
+    if (hxPulses == 25 && hxLatched)
+    {
+      hxQueue.pop_front();
+      hxCount++;
+    }
+    if (hxPulses >= 25) hxGain = hxPulses - 24;
+  }
+  hxClockHigh = value;
+}
+
+
+int digitalRead(uint8_t pin)
+{
+  if (pin != hxData) return LOW;
+  if (!hxClockHigh)
+  {
+    if (hxPulses >= 25 || !hxLatched)
+    {
+      hxPulses  = 0;
+      hxLatched = false;
+    }
+    if (hxPulses == 0)
+    {
+      hxWaiting = !hxReady();
+      if (!hxWaiting)
+      {
+        idleSpins = 0;
+        return LOW;
+      }
+      return HIGH;
+    }
+    return LOW;
+  }
+  //  data is valid while the clock is high, MSB first
+  if (hxLatched && hxPulses >= 1 && hxPulses <= 24)
+  {
+    return (hxValue >> (24 - hxPulses)) & 1;
+  }
+  return LOW;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  HOST CONTROL
+//
+void     hostSetMicros(uint64_t us)       { clockUs = us; }
+void     hostAdvanceMicros(uint64_t us)   { clockUs += us; }
+uint64_t hostMicros()                     { return clockUs; }
+
+
+void hostHX711(uint8_t dataPin, uint8_t clockPin)
+{
+  hxData  = dataPin;
+  hxClock = clockPin;
+}
+
+
+void     hostPushConversion(int32_t raw)  { hxQueue.push_back(raw); }
+uint32_t hostPendingConversions()         { return hxQueue.size(); }
+void     hostDropConversions()            { hxQueue.clear(); }
+void     hostSetConversionSource(bool (*source)(int32_t &raw)) { hxSource = source; }
+uint8_t  hostSelectedGain()               { return hxGain; }
+uint32_t hostConversions()                { return hxCount; }
+void     hostSetIdleHook(void (*hook)())  { idleHook = hook; }
+
+
+void hostPulse(uint8_t pin, uint32_t count)
+{
+  if (pin >= 64 || pinHandlers[pin] == NULL) return;
+  while (count--) pinHandlers[pin]();
+}
+
+
+//  -- END OF FILE --
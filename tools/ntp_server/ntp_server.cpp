@@ -0,0 +1,524 @@
+//
+//    FILE: ntp_server.cpp
+// PURPOSE: Stand-in NTP server for testing the NTP client of the pig pen
+//          controller: answers with a chosen offset, delay, loss or
+//          stratum. --selftest runs the NTPClient library against a
+//          set of them on a simulated network.
+//
+//  BUILD
+//    g++ -std=c++17 -O2 -I../host_arduino -I../../libraries/NTPClient
+//        -o ntp_server ntp_server.cpp ../host_arduino/host_arduino.cpp
+//        ../../libraries/NTPClient/NTPClient.cpp
+//
+//  USAGE
+//    ntp_server [--port n] [--offset ms] [--delay ms] [--jitter ms] [--drop %] [--stratum n]
+//    ntp_server --selftest [--rounds n] [--seed n]
+//
+//  As a server it answers on the port (default 12300, 123 needs root)
+//  with the host clock moved by the offset, after the delay plus up to
+//  the jitter, and ignores the drop percentage of the requests; stratum
+//  0 sends kiss-o'-death replies. Run a few with different settings
+//  and point the controller at them with timeClient.addServer(ip, port).
+//
+//  --selftest queries simulated servers on the virtual clock of
+//  host_arduino: some slow one way, some lossy, some seconds off, some
+//  answering with the wrong origin, some slow to look up. The client must pick the good
+//  sample with the shortest round trip, fail rather than follow a
+//  minority; then it compares the clock error of a random server per
+//  update (one pool name, as before) with all of them in parallel.
+//  Exit code 1 on the first failure.
+//
+
+
+#include "Arduino.h"
+#include "Udp.h"
+#include "NTPClient.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+
+#define NTP_UNIX_OFFSET   2208988800ULL     //  1900 to 1970
+#define SERVER_HOLD_US    50                //  request to reply, in a server
+
+
+struct Behaviour
+{
+  int32_t  offsetMs;          //  server clock minus the true time
+  uint32_t outMs;             //  one way delays
+  uint32_t backMs;
+  uint32_t jitterMs;          //  added to either, 0..jitter
+  uint8_t  dropPercent;
+  uint8_t  stratum;           //  0 = kiss-o'-death
+  bool     wrongOrigin;
+};
+
+
+static std::mt19937 rng;
+
+
+///////////////////////////////////////////////////////////////
+//
+//  REPLY
+//
+static void putTimestamp(uint8_t *p, uint64_t t)
+{
+  for (int i = 7; i >= 0; i--)
+  {
+    p[i] = t & 0xFF;
+    t >>= 8;
+  }
+}
+
+
+static uint64_t microsToTimestamp(uint64_t unixUs)
+{
+  uint64_t seconds = unixUs / 1000000 + NTP_UNIX_OFFSET;
+  uint64_t fraction = ((unixUs % 1000000) << 32) / 1000000;
+  return seconds << 32 | fraction;
+}
+
+
+//  a server reply to a client request, false if it is none
+static bool buildReply(const uint8_t *request, size_t length, uint64_t receive, uint64_t transmit,
+                       const Behaviour &behaviour, uint8_t *reply)
+{
+  if (length < NTP_PACKET_SIZE || (request[0] & 0x07) != 3) return false;
+  memset(reply, 0, NTP_PACKET_SIZE);
+  uint8_t version = (request[0] >> 3) & 0x07;
+  reply[0] = version << 3 | 4;                  //  no leap warning, server
+  reply[1] = behaviour.stratum;
+  reply[2] = request[2];
+  reply[3] = 0xEC;                              //  precision 2^-20
+  reply[5] = 0x01;                              //  root delay, dispersion
+  reply[9] = 0x01;
+  memcpy(reply + 12, behaviour.stratum ? "LOCL" : "RATE", 4);
+  putTimestamp(reply + 16, receive - (16ULL << 32));
+  memcpy(reply + 24, request + 40, 8);          //  origin = their transmit
+  if (behaviour.wrongOrigin) reply[31] ^= 0x5A;
+  putTimestamp(reply + 32, receive);
+  putTimestamp(reply + 40, transmit);
+  return true;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  SERVE
+//
+static uint64_t realMicros()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+
+static int serve(uint16_t port, const Behaviour &behaviour)
+{
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  struct sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family      = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port        = htons(port);
+  if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+  {
+    perror("ntp_server");
+    return 2;
+  }
+  printf("serving on port %u, offset %d ms, delay %u ms, jitter %u ms, drop %u%%, stratum %u\n",
+         port, behaviour.offsetMs, behaviour.outMs, behaviour.jitterMs, behaviour.dropPercent, behaviour.stratum);
+
+  while (true)
+  {
+    uint8_t request[512];
+    struct sockaddr_in client;
+    socklen_t clientLength = sizeof(client);
+    ssize_t n = recvfrom(fd, request, sizeof(request), 0, (struct sockaddr *)&client, &clientLength);
+    if (n < 0) continue;
+    int64_t  offsetUs = (int64_t)behaviour.offsetMs * 1000;
+    uint64_t receive  = microsToTimestamp(realMicros() + offsetUs);
+    bool     drop     = rng() % 100 < behaviour.dropPercent;
+    printf("%s:%u %zd bytes%s\n", inet_ntoa(client.sin_addr), ntohs(client.sin_port), n, drop ? ", dropped" : "");
+    fflush(stdout);
+    if (drop) continue;
+    uint32_t wait = behaviour.outMs + (behaviour.jitterMs ? rng() % (behaviour.jitterMs + 1) : 0);
+    if (wait) usleep(wait * 1000);
+    uint8_t reply[NTP_PACKET_SIZE];
+    uint64_t transmit = microsToTimestamp(realMicros() + offsetUs);
+    if (!buildReply(request, n, receive, transmit, behaviour, reply)) continue;
+    sendto(fd, reply, sizeof(reply), 0, (struct sockaddr *)&client, clientLength);
+  }
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  SIMULATED NETWORK
+//
+//  true time is the virtual clock of host_arduino after SIM_EPOCH
+#define SIM_EPOCH_US      (1792281600ULL * 1000000)
+
+
+struct SimServer
+{
+  std::string name;
+  Behaviour   behaviour;
+  bool        pool;           //  one of the servers "pool.ntp.org" gives
+  uint32_t    dnsMs;          //  a lookup of the name takes that long
+};
+
+
+//  servers[i] is at 10.0.0.i+1
+static IPAddress simAddress(size_t i)
+{
+  return IPAddress(10, 0, 0, i + 1);
+}
+
+
+struct SimPacket
+{
+  uint64_t deliverAt;
+  uint8_t  data[NTP_PACKET_SIZE];
+};
+
+
+class SimUDP : public UDP
+{
+public:
+  std::vector<SimServer> servers;
+
+  uint8_t begin(uint16_t)  { return 1; };
+  void    stop()           { _queue.clear(); };
+
+  int beginPacket(IPAddress ip, uint16_t)
+  {
+    _to = -1;
+    for (size_t i = 0; i < servers.size(); i++) if (simAddress(i) == ip) _to = i;
+    return 1;
+  };
+  //  as WiFiUDP: looks the name up first
+  int beginPacket(const char *host, uint16_t)
+  {
+    _to = lookup(host);
+    return 1;
+  };
+
+  //  index of the server, -1 if none; takes the time of the lookup
+  int lookup(const char *host)
+  {
+    int found = -1;
+    if (strcmp(host, "pool.ntp.org") == 0)
+    {
+      std::vector<int> pool;
+      for (size_t i = 0; i < servers.size(); i++) if (servers[i].pool) pool.push_back(i);
+      if (!pool.empty()) found = pool[rng() % pool.size()];
+    }
+    for (size_t i = 0; i < servers.size(); i++) if (servers[i].name == host) found = i;
+    if (found >= 0) hostAdvanceMicros(1000ULL * servers[found].dnsMs);
+    return found;
+  };
+  size_t write(const uint8_t *buffer, size_t size)
+  {
+    _request.assign(buffer, buffer + size);
+    return size;
+  };
+  int endPacket()
+  {
+    if (_to < 0) return 1;
+    const Behaviour &b = servers[_to].behaviour;
+    if (rng() % 100 < b.dropPercent) return 1;
+    uint64_t arrive  = hostMicros() + 1000ULL * (b.outMs + (b.jitterMs ? rng() % (b.jitterMs + 1) : 0));
+    int64_t  offset  = (int64_t)b.offsetMs * 1000;
+    uint64_t receive = microsToTimestamp(SIM_EPOCH_US + arrive + offset);
+    uint64_t send    = arrive + SERVER_HOLD_US;
+    SimPacket packet;
+    if (!buildReply(_request.data(), _request.size(), receive,
+                    microsToTimestamp(SIM_EPOCH_US + send + offset), b, packet.data)) return 1;
+    packet.deliverAt = send + 1000ULL * (b.backMs + (b.jitterMs ? rng() % (b.jitterMs + 1) : 0));
+    _queue.push_back(packet);
+    return 1;
+  };
+
+  int parsePacket()
+  {
+    _current = -1;
+    for (size_t i = 0; i < _queue.size(); i++)
+    {
+      if (_queue[i].deliverAt > hostMicros()) continue;
+      if (_current < 0 || _queue[i].deliverAt < _queue[_current].deliverAt) _current = i;
+    }
+    return _current < 0 ? 0 : NTP_PACKET_SIZE;
+  };
+  int read(uint8_t *buffer, size_t length)
+  {
+    if (_current < 0) return 0;
+    size_t n = length < NTP_PACKET_SIZE ? length : NTP_PACKET_SIZE;
+    memcpy(buffer, _queue[_current].data, n);
+    flush();
+    return n;
+  };
+  void flush()
+  {
+    if (_current >= 0) _queue.erase(_queue.begin() + _current);
+    _current = -1;
+  };
+
+private:
+  int                    _to = -1;
+  int                    _current = -1;
+  std::vector<uint8_t>   _request;
+  std::vector<SimPacket> _queue;
+};
+
+
+static SimUDP *network = NULL;
+
+
+static bool simResolver(const char *name, IPAddress &ip)
+{
+  int i = network->lookup(name);
+  if (i < 0) return false;
+  ip = simAddress(i);
+  return true;
+}
+
+
+//  ms the client clock is ahead of the true time: the instant its
+//  seconds roll over, to the ms
+static int64_t clockError(const NTPClient &client)
+{
+  uint64_t now = hostMicros();
+  unsigned long second = client.getEpochTime();
+  uint32_t waited = 0;
+  while (client.getEpochTime() == second && waited++ < 2000) hostAdvanceMicros(1000);
+  int64_t trueMs = (int64_t)((SIM_EPOCH_US + hostMicros()) / 1000);
+  int64_t error  = (int64_t)client.getEpochTime() * 1000 - trueMs;
+  hostSetMicros(now);
+  return error;
+}
+
+
+static Behaviour behave(int32_t offsetMs, uint32_t outMs, uint32_t backMs)
+{
+  Behaviour b = {offsetMs, outMs, backMs, 0, 0, 1, false};
+  return b;
+}
+
+
+static int64_t median(std::vector<int64_t> values)
+{
+  if (values.empty()) return 0;
+  std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+  return values[values.size() / 2];
+}
+
+
+static bool expect(bool condition, const char *what)
+{
+  if (!condition) printf("FAILED: %s\n", what);
+  return condition;
+}
+
+
+static int selftest(uint32_t rounds, uint32_t seed)
+{
+  rng.seed(seed);
+  hostSetMicros(3600ULL * 1000000);
+  SimUDP udp;
+  network = &udp;
+
+  //  the fastest server is 2.5 s off, the slow one one way only
+  {
+    udp.servers = {{"a.test", behave(0, 20, 20), false, 0},
+                   {"b.test", behave(0, 80, 15), false, 0},
+                   {"c.test", behave(2500, 5, 5), false, 0}};
+    NTPClient client(udp);
+    client.setResolver(simResolver);
+    client.addServer("a.test");
+    client.addServer("b.test");
+    client.addServer("c.test");
+    client.begin();
+    bool ok = client.forceUpdate();
+    int64_t error = ok ? clockError(client) : 0;
+    printf("falseticker: server %d, round trip %lu us, %u replies, error %lld ms\n",
+           client.getLastServer(), client.getLastDelay(), client.getLastReplies(), (long long)error);
+    if (!expect(ok && client.getLastServer() == 0 && client.getLastReplies() == 3, "good sample with the shortest round trip")) return 1;
+    if (!expect(error >= -2 && error <= 2, "clock within 2 ms")) return 1;
+  }
+
+  //  forged origin and kiss-o'-death replies do not count
+  {
+    Behaviour forged = behave(-5000, 1, 1);
+    forged.wrongOrigin = true;
+    Behaviour kod = behave(7000, 1, 1);
+    kod.stratum = 0;
+    udp.servers = {{"a.test", behave(0, 30, 30), false, 0},
+                   {"forged.test", forged, false, 0},
+                   {"kod.test", kod, false, 0}};
+    NTPClient client(udp);
+    client.setResolver(simResolver);
+    client.addServer("forged.test");
+    client.addServer("kod.test");
+    client.addServer("a.test");
+    bool ok = client.forceUpdate();
+    if (!expect(ok && client.getLastServer() == 2 && client.getLastReplies() == 1, "only the genuine reply")) return 1;
+    if (!expect(labs(clockError(client)) <= 2, "clock within 2 ms")) return 1;
+  }
+
+  //  two servers seconds apart: no majority, no time
+  {
+    udp.servers = {{"a.test", behave(0, 10, 10), false, 0},
+                   {"b.test", behave(-3000, 10, 10), false, 0}};
+    NTPClient client(udp);
+    client.setResolver(simResolver);
+    client.addServer("a.test");
+    client.addServer("b.test");
+    if (!expect(!client.forceUpdate() && !client.isTimeSet(), "disagreeing pair refused")) return 1;
+  }
+
+  //  slow lookups: all names are looked up before the first request,
+  //  the lookups do not count into the round trips
+  {
+    udp.servers = {{"a.test", behave(0, 20, 20), false, 300},
+                   {"b.test", behave(0, 80, 15), false, 300},
+                   {"c.test", behave(0, 40, 40), false, 300}};
+    NTPClient client(udp);
+    client.setResolver(simResolver);
+    client.addServer("a.test");
+    client.addServer("b.test");
+    client.addServer("c.test");
+    bool ok = client.forceUpdate();
+    int64_t error = ok ? clockError(client) : 0;
+    printf("slow lookups: server %d, round trip %lu us, error %lld ms\n",
+           client.getLastServer(), client.getLastDelay(), (long long)error);
+    if (!expect(ok && client.getLastServer() == 0 && client.getLastDelay() < 42000, "lookups outside the round trip")) return 1;
+    if (!expect(error >= -2 && error <= 2, "clock within 2 ms")) return 1;
+  }
+
+  //  nobody answers: the update gives up after NTP_TIMEOUT
+  {
+    Behaviour lost = behave(0, 10, 10);
+    lost.dropPercent = 100;
+    udp.servers = {{"a.test", lost, false, 0}};
+    NTPClient client(udp);
+    client.setResolver(simResolver);
+    client.addServer("a.test");
+    uint64_t start = hostMicros();
+    bool ok = client.forceUpdate();
+    uint64_t waited = (hostMicros() - start) / 1000;
+    if (!expect(!ok && waited >= NTP_TIMEOUT && waited < NTP_TIMEOUT + 50, "timeout")) return 1;
+  }
+
+  //  a lossy uplink to four servers, now and then one of them wrong
+  uint32_t poolFailed = 0, multiFailed = 0, poolBad = 0, multiBad = 0;
+  double   poolSum = 0, multiSum = 0;
+  int64_t  poolMax = 0, multiMax = 0;
+  uint32_t poolCount = 0, multiCount = 0;
+  std::vector<int64_t> poolErrors, multiErrors;
+  for (uint32_t round = 0; round < rounds; round++)
+  {
+    udp.servers.clear();
+    for (int i = 0; i < 4; i++)
+    {
+      Behaviour b = behave(0, 10 + rng() % 150, 10 + rng() % 150);
+      b.jitterMs    = rng() % 100;
+      b.dropPercent = 20;
+      if (rng() % 10 == 0) b.offsetMs = (rng() % 2 ? 1 : -1) * (1000 + rng() % 60000);
+      char name[16];
+      snprintf(name, sizeof(name), "%c.pool.test", 'a' + i);
+      udp.servers.push_back({name, b, true, (uint32_t)(rng() % 200)});
+    }
+
+    NTPClient pool(udp, "pool.ntp.org");
+    if (pool.forceUpdate())
+    {
+      int64_t error = llabs(clockError(pool));
+      poolSum += error;
+      poolErrors.push_back(error);
+      if (error > poolMax) poolMax = error;
+      if (error > 1000) poolBad++;
+      poolCount++;
+    }
+    else poolFailed++;
+    udp.stop();
+
+    NTPClient multi(udp);
+    multi.setResolver(simResolver);
+    for (const SimServer &server : udp.servers) multi.addServer(server.name.c_str());
+    if (multi.forceUpdate())
+    {
+      int64_t error = llabs(clockError(multi));
+      multiSum += error;
+      multiErrors.push_back(error);
+      if (error > multiMax) multiMax = error;
+      if (error > 1000) multiBad++;
+      multiCount++;
+    }
+    else multiFailed++;
+    udp.stop();
+  }
+  printf("%u rounds, 4 servers, lookups up to 200 ms, 20%% loss, 1 in 10 wrong\n", rounds);
+  printf("  one pool server:  %u failed, error median %lld ms, mean %.1f ms, max %lld ms, %u over 1 s\n",
+         poolFailed, (long long)median(poolErrors), poolCount ? poolSum / poolCount : 0.0, (long long)poolMax, poolBad);
+  printf("  all in parallel:  %u failed, error median %lld ms, mean %.1f ms, max %lld ms, %u over 1 s\n",
+         multiFailed, (long long)median(multiErrors), multiCount ? multiSum / multiCount : 0.0, (long long)multiMax, multiBad);
+  if (!expect(multiFailed <= poolFailed && multiBad <= poolBad && multiSum / multiCount < poolSum / poolCount,
+              "parallel servers at least as good")) return 1;
+  printf("OK\n");
+  return 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  MAIN
+//
+static int usage()
+{
+  fprintf(stderr, "usage: ntp_server [--port n] [--offset ms] [--delay ms] [--jitter ms] [--drop %%] [--stratum n]\n"
+                  "       ntp_server --selftest [--rounds n] [--seed n]\n");
+  return 2;
+}
+
+
+int main(int argc, char *argv[])
+{
+  uint16_t  port = 12300;
+  Behaviour behaviour = behave(0, 0, 0);
+  bool      test = false;
+  uint32_t  rounds = 1000;
+  uint32_t  seed = 1;
+  for (int i = 1; i < argc; i++)
+  {
+    bool more = i + 1 < argc;
+    if      (strcmp(argv[i], "--selftest") == 0)         test = true;
+    else if (strcmp(argv[i], "--port") == 0 && more)     port = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--offset") == 0 && more)   behaviour.offsetMs = strtol(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--delay") == 0 && more)    behaviour.outMs = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--jitter") == 0 && more)   behaviour.jitterMs = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--drop") == 0 && more)     behaviour.dropPercent = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--stratum") == 0 && more)  behaviour.stratum = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--rounds") == 0 && more)   rounds = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--seed") == 0 && more)     seed = strtoul(argv[++i], NULL, 10);
+    else return usage();
+  }
+  if (test) return selftest(rounds, seed);
+  rng.seed(seed);
+  return serve(port, behaviour);
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,128 @@
+//
+//    FILE: telemetry_listen.cpp
+// PURPOSE: Host side receiver for the binary UDP telemetry of the
+//          pig pen controllers. Decodes with the same telemetry.h the
+//          firmware encodes with, tracks sequence gaps per controller.
+//
+//  BUILD
+//    g++ -std=c++17 -O2 -I../../sketch_sep3a -o telemetry_listen telemetry_listen.cpp
+//
+//  USAGE
+//    telemetry_listen [port] [--csv]
+//
+
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+
+#include "telemetry.h"
+
+
+struct SenderState
+{
+  uint32_t nextSequence;
+  uint32_t received;
+  uint32_t lost;
+};
+
+
+int main(int argc, char *argv[])
+{
+  uint16_t port = TELEMETRY_DEFAULT_PORT;
+  bool csv = false;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--csv") == 0) csv = true;
+    else port = (uint16_t)atoi(argv[i]);
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (fd < 0)
+  {
+    perror("socket");
+    return 1;
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family      = AF_INET;
+  addr.sin_port        = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    perror("bind");
+    return 1;
+  }
+
+  if (csv)
+  {
+    printf("sender,version,sequence,epoch,uptime_ms,weight_g,last_feed_g,"
+           "servo_open,servo_ok,scale_ok,washing,wifi_ok,time_set,"
+           "wifi_drops,scale_timeouts,free_heap,lost\n");
+  }
+
+  std::map<uint32_t, SenderState> senders;
+  uint8_t buf[512];
+  while (true)
+  {
+    sockaddr_in from;
+    socklen_t fromLen = sizeof(from);
+    ssize_t n = recvfrom(fd, buf, sizeof(buf), 0, (sockaddr *)&from, &fromLen);
+    if (n < 0) continue;
+
+    TelemetrySample s;
+    if (!telemetryDecode(buf, (uint16_t)n, s)) continue;
+
+    //  a sequence that goes backwards means the controller rebooted
+    uint32_t key = from.sin_addr.s_addr;
+    auto it = senders.find(key);
+    uint32_t lost = 0;
+    if (it == senders.end())
+    {
+      it = senders.insert(std::make_pair(key, SenderState{ 0, 0, 0 })).first;
+    }
+    else if (s.sequence > it->second.nextSequence)
+    {
+      lost = s.sequence - it->second.nextSequence;
+    }
+    it->second.nextSequence = s.sequence + 1;
+    it->second.received++;
+    it->second.lost += lost;
+
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &from.sin_addr, ip, sizeof(ip));
+    if (csv)
+    {
+      printf("%s,%u,%u,%u,%u,%.2f,%.2f,%d,%d,%d,%d,%d,%d,%u,%u,%u,%u\n",
+             ip, s.version, s.sequence, s.epoch, s.uptime,
+             s.weight / 100.0, s.lastFeed / 100.0,
+             !!(s.flags & TELEMETRY_FLAG_SERVO_OPEN), !!(s.flags & TELEMETRY_FLAG_SERVO_OK),
+             !!(s.flags & TELEMETRY_FLAG_SCALE_OK),   !!(s.flags & TELEMETRY_FLAG_WASHING),
+             !!(s.flags & TELEMETRY_FLAG_WIFI_OK),    !!(s.flags & TELEMETRY_FLAG_TIME_SET),
+             s.wifiDrops, s.scaleTimeouts, s.freeHeap, lost);
+    }
+    else
+    {
+      printf("%-15s #%-8u %10.2f g  feed %8.2f g  servo %-6s wash %-5s  heap %5u  drops %u  timeouts %u%s\n",
+             ip, s.sequence, s.weight / 100.0, s.lastFeed / 100.0,
+             (s.flags & TELEMETRY_FLAG_SERVO_OK) ? ((s.flags & TELEMETRY_FLAG_SERVO_OPEN) ? "open" : "closed") : "n/a",
+             (s.flags & TELEMETRY_FLAG_WASHING) ? "on" : "off",
+             s.freeHeap, s.wifiDrops, s.scaleTimeouts,
+             lost ? "  (gap)" : "");
+    }
+    fflush(stdout);
+  }
+  return 0;
+}
+
+
+//  -- END OF FILE --
@@ -0,0 +1,724 @@
+//
+//    FILE: trace_replay.cpp
+// PURPOSE: Replays a trace recorded by a pig pen controller (GET /api/trace)
+//          on a Linux host. The raw HX711 conversions go through the real
+//          HX711 library in Kalman mode and the feed controller of the
+//          sketch, the schedules are rerun on the recorded clock, metered
+//          washes on the recorded flow meter counts, and the decisions
+//          are compared with what the controller did.
+//
+//  BUILD
+//    g++ -std=c++17 -O2 -I../host_arduino -I../../libraries/HX711 -I../../sketch_sep3a
+//        -o trace_replay trace_replay.cpp ../host_arduino/host_arduino.cpp
+//        ../../libraries/HX711/HX711.cpp ../../sketch_sep3a/trace.cpp
+//        ../../sketch_sep3a/feed_control.cpp ../../sketch_sep3a/servo_motion.cpp
+//        ../../sketch_sep3a/wash_meter.cpp ../../sketch_sep3a/crc16.cpp
+//
+//  USAGE
+//    trace_replay trace.bin [--dump] [--tolerance ms] [--open-flow g/s]
+//    trace_replay --synth out.bin [--feeds n] [--sps n] [--seed n] [--wash-flow L/min]
+//
+//  The replay runs on a virtual clock, as fast as the host goes; the same
+//  trace gives the same result on every run. The gate follows the recorded
+//  actuator events, the replayed decisions do not move it, so a changed
+//  filter or controller shows as decisions that moved in time.
+//  Exit code 1 when a decision differs by more than the tolerance.
+//
+//  --synth writes a trace of a simulated controller feeding from a hopper,
+//  then washing through a flow meter at the given water pressure (L/min
+//  fully open), recorded the way the firmware records, for testing the
+//  replay itself.
+//
+
+
+#include "Arduino.h"
+#include "HX711.h"
+#include "feed_control.h"
+#include "servo_motion.h"
+#include "trace.h"
+#include "wash_meter.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+
+//  as in the sketch
+const uint8_t      HX_DATA_PIN = 0;             //  D3
+const uint8_t      HX_CLOCK_PIN = 4;            //  D2
+const uint16_t     GATE_CLOSED = 0;
+const ServoProfile GATE_OPEN_PROFILE  = {60, 240};
+const ServoProfile GATE_CLOSE_PROFILE = {0, 0};
+const float        GATE_FLOW_AT_OPEN = 40.0;
+const uint32_t     SERVO_FRAME_US = 20000;
+const uint8_t      FLOW_METER_PIN = 13;         //  D7
+const uint32_t     WASH_MAX_DURATION = 120000;
+const uint32_t     WASH_NO_FLOW_TIMEOUT = 5000;
+const uint32_t     WASH_TRACE_INTERVAL = 1000;
+
+//  actuator commands and results of actuator_queue.h
+const uint8_t      SERVO_OPEN  = 0;
+const uint8_t      SERVO_CLOSE = 1;
+const uint8_t      WASH_START  = 2;
+const uint8_t      WASH_STOP   = 3;
+const uint8_t      SERVO_MOVE  = 4;
+const uint8_t      DONE = 0;
+
+
+static const char *typeName(uint8_t type)
+{
+  static const char *names[] = { "?", "raw", "actuator", "schedule", "http", "time", "config", "schedules", "feed", "flow" };
+  return type <= TRACE_FLOW ? names[type] : "?";
+}
+
+
+static bool loadFile(const char *path, std::vector<uint8_t> &data)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == NULL) return false;
+  uint8_t buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) data.insert(data.end(), buffer, buffer + n);
+  fclose(f);
+  return true;
+}
+
+
+static void dumpRecord(const TraceRecord &r)
+{
+  printf("%12.6f  %-9s ", r.timeUs / 1e6, typeName(r.type));
+  switch (r.type)
+  {
+    case TRACE_RAW:       printf("%d", r.raw); break;
+    case TRACE_ACTUATOR:  printf("command %u result %u argument %u", r.command, r.result, r.argument); break;
+    case TRACE_SCHEDULE:  printf("%s %u at %02u:%02u", r.kind == TRACE_FEED_SCHEDULE ? "feed" : "wash",
+                                 r.index, r.minute / 60, r.minute % 60); break;
+    case TRACE_HTTP:      printf("method %u %s", r.method, r.text); break;
+    case TRACE_TIME:      printf("epoch %u  %02u:%02u:%02u", r.epoch, (r.epoch % 86400) / 3600,
+                                 (r.epoch % 3600) / 60, r.epoch % 60); break;
+    case TRACE_CONFIG:
+      if (r.key == TRACE_KEY_OFFSET || r.key == TRACE_KEY_GATE_OPEN) printf("key %u = %d", r.key, (int32_t) r.bits);
+      else printf("key %u = %g", r.key, traceFloat(r.bits));
+      break;
+    case TRACE_SCHEDULES:
+      for (uint8_t i = 0; i < r.count; i++)
+      {
+        printf("%s%02u:%02u ", r.kinds[i] == TRACE_FEED_SCHEDULE ? "F" : "W", r.minutes[i] / 60, r.minutes[i] % 60);
+      }
+      break;
+    case TRACE_FEED:      printf("weight at open %.2f", r.weight); break;
+    case TRACE_FLOW:      printf("pulses %u", r.pulses); break;
+  }
+  printf("  [block %u]\n", r.sequence);
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  REPLAY
+//
+struct Feed
+{
+  int64_t startUs;
+  float   weightAtOpen;
+  int64_t recordedThrottle = -1;     //  first gate move, us after the start
+  int64_t recordedClose = -1;
+  int64_t replayedThrottle = -1;
+  int64_t replayedClose = -1;
+  float   replayedDropped = 0;
+};
+
+
+struct Wash
+{
+  int64_t  startUs;
+  float    target;                 //  litres, 0 = timed
+  uint32_t pulses = 0;
+  int64_t  recordedStop = -1;
+  int64_t  replayedStop = -1;
+  uint8_t  replayedAction = WASH_HOLD;
+  bool     capped = false;         //  the time cap ended it in the replay
+};
+
+
+struct Trigger
+{
+  uint8_t  kind;
+  uint8_t  index;
+  uint16_t minute;
+  bool operator==(const Trigger &o) const { return kind == o.kind && index == o.index && minute == o.minute; }
+};
+
+
+static int replay(const std::vector<uint8_t> &data, bool dump, double toleranceMs, float openFlow)
+{
+  hostHX711(HX_DATA_PIN, HX_CLOCK_PIN);
+  HX711 scale;
+  scale.begin(HX_DATA_PIN, HX_CLOCK_PIN);
+  scale.set_kalman_mode();
+
+  float    config[TRACE_CONFIG_KEYS] = { 1, 0, 50, 15, 5, 900, 0, 450 };
+  uint32_t configBits[TRACE_CONFIG_KEYS] = { 0 };
+  bool     flowReady = false;
+  GateFlowMap *flow = NULL;
+  FeedController *feeder = NULL;
+
+  ServoMotion gate;
+  gate.set(GATE_CLOSED);
+  bool     gateOpen = false;
+  int64_t  nextFrame = 0;
+
+  std::vector<Feed> feeds;
+  std::vector<Wash> washes;
+  WashMeter *meter = NULL;
+  std::vector<Trigger> recordedTriggers;
+  std::vector<Trigger> replayedTriggers;
+  uint8_t  scheduleCount = 0;
+  uint8_t  scheduleKinds[TRACE_MAX_SCHEDULES];
+  int16_t  scheduleAt[TRACE_MAX_SCHEDULES];
+  bool     triggered[TRACE_MAX_SCHEDULES] = { false };
+
+  uint32_t counts[TRACE_FLOW + 1] = { 0 };
+  int64_t  firstUs = 0;
+  int64_t  lastUs = 0;
+  bool     first = true;
+
+  auto start = std::chrono::steady_clock::now();
+  TraceReader reader(data.data(), data.size());
+  TraceRecord r;
+  while (reader.next(r))
+  {
+    if (dump) dumpRecord(r);
+    if (r.type <= TRACE_FLOW) counts[r.type]++;
+    if (first) firstUs = r.timeUs;
+    first = false;
+    if (r.timeUs > lastUs) lastUs = r.timeUs;
+
+    //  the gate moves one step per servo frame
+    while (nextFrame <= r.timeUs)
+    {
+      gate.frame();
+      nextFrame += SERVO_FRAME_US;
+    }
+    if (r.timeUs >= 0) hostSetMicros(r.timeUs);
+    Feed *feed = feeds.empty() ? NULL : &feeds.back();
+    Wash *wash = washes.empty() ? NULL : &washes.back();
+
+    switch (r.type)
+    {
+      case TRACE_CONFIG:
+        if (r.key >= TRACE_CONFIG_KEYS || configBits[r.key] == r.bits) break;
+        configBits[r.key] = r.bits;
+        config[r.key] = (r.key == TRACE_KEY_OFFSET || r.key == TRACE_KEY_GATE_OPEN) ? (float)(int32_t) r.bits : traceFloat(r.bits);
+        if (r.key == TRACE_KEY_SCALE) scale.set_scale(config[r.key]);
+        if (r.key == TRACE_KEY_OFFSET) scale.set_offset((int32_t) r.bits);
+        break;
+
+      case TRACE_SCHEDULES:
+        scheduleCount = r.count;
+        for (uint8_t i = 0; i < r.count; i++)
+        {
+          scheduleKinds[i] = r.kinds[i];
+          scheduleAt[i] = r.minutes[i];
+        }
+        break;
+
+      case TRACE_TIME:
+      {
+        uint16_t minute = (r.epoch % 86400) / 60;
+        uint8_t index[2] = { 0, 0 };
+        for (uint8_t i = 0; i < scheduleCount; i++)
+        {
+          uint8_t kind = scheduleKinds[i];
+          if (scheduleDue(minute, scheduleAt[i], triggered[i]))
+          {
+            replayedTriggers.push_back({ kind, index[kind & 1], minute });
+          }
+          index[kind & 1]++;
+        }
+        break;
+      }
+
+      case TRACE_SCHEDULE:
+        recordedTriggers.push_back({ r.kind, r.index, r.minute });
+        break;
+
+      case TRACE_FEED:
+      {
+        if (!flowReady)
+        {
+          flow = new GateFlowMap(GATE_CLOSED, (uint16_t) config[TRACE_KEY_GATE_OPEN], openFlow);
+          flowReady = true;
+        }
+        delete feeder;
+        feeder = new FeedController(*flow, config[TRACE_KEY_DROP_AMOUNT],
+                                    config[TRACE_KEY_SLOW_ZONE], config[TRACE_KEY_DRIBBLE_FLOW]);
+        feeder->start(r.weight);
+        Feed f;
+        f.startUs = r.timeUs;
+        f.weightAtOpen = r.weight;
+        feeds.push_back(f);
+        break;
+      }
+
+      case TRACE_ACTUATOR:
+        if (r.result != DONE) break;
+        if (r.command == SERVO_OPEN || r.command == SERVO_MOVE)
+        {
+          gate.moveTo(r.argument, GATE_OPEN_PROFILE);
+          if (r.command == SERVO_OPEN) gateOpen = true;
+          if (r.command == SERVO_MOVE && feed && feed->recordedThrottle < 0) feed->recordedThrottle = r.timeUs - feed->startUs;
+        }
+        else if (r.command == SERVO_CLOSE)
+        {
+          gate.moveTo(GATE_CLOSED, GATE_CLOSE_PROFILE);
+          gateOpen = false;
+          if (feed && feed->recordedClose < 0) feed->recordedClose = r.timeUs - feed->startUs;
+        }
+        else if (r.command == WASH_START)
+        {
+          delete meter;
+          meter = new WashMeter(config[TRACE_KEY_FLOW_PULSES], WASH_NO_FLOW_TIMEOUT);
+          meter->start(0, r.timeUs / 1000, config[TRACE_KEY_WASH_LITRES]);
+          Wash w;
+          w.startUs = r.timeUs;
+          w.target = meter->target();
+          washes.push_back(w);
+        }
+        else if (r.command == WASH_STOP && wash && wash->recordedStop < 0)
+        {
+          wash->recordedStop = r.timeUs - wash->startUs;
+          //  the timer of a metered wash, undecided up to the cap
+          if (wash->target > 0 && wash->replayedStop < 0 && wash->recordedStop >= WASH_MAX_DURATION * 1000LL)
+          {
+            wash->replayedStop = WASH_MAX_DURATION * 1000LL;
+            wash->capped = true;
+          }
+        }
+        break;
+
+      case TRACE_FLOW:
+        //  checkWashVolume(), the counts are since the start
+        //  and the last one comes after the relay went off
+        if (meter && meter->running() && wash)
+        {
+          wash->pulses = r.pulses;
+          if (wash->recordedStop >= 0)
+          {
+            meter->stop(r.pulses, r.timeUs / 1000);
+            break;
+          }
+          WashAction action = meter->update(r.pulses, r.timeUs / 1000);
+          if (action != WASH_HOLD && wash->replayedStop < 0)
+          {
+            wash->replayedStop = r.timeUs - wash->startUs;
+            wash->replayedAction = action;
+          }
+        }
+        break;
+
+      case TRACE_RAW:
+        hostPushConversion(r.raw);
+        if (gateOpen && feeder)
+        {
+          //  checkAutoClose()
+          float weight = scale.get_units(1);
+          uint16_t position;
+          FeedAction action = feeder->update(weight, scale.get_rate(), gate.position(), gate.target(),
+                                             gate.moving(), position);
+          if (action == FEED_THROTTLE && feed && feed->replayedThrottle < 0)
+          {
+            feed->replayedThrottle = r.timeUs - feed->startUs;
+          }
+          if (action == FEED_CLOSE && feed && feed->replayedClose < 0)
+          {
+            feed->replayedClose = r.timeUs - feed->startUs;
+            feed->replayedDropped = feeder->dropped(weight);
+          }
+        }
+        else
+        {
+          scale.read();
+        }
+        break;
+    }
+  }
+  double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+  //  REPORT
+  double spanS = (lastUs - firstUs) / 1e6;
+  printf("trace    %u blocks, %u damaged, %u missing, %u reboots\n",
+         reader.blocks(), reader.damaged(), reader.missing(), reader.boots());
+  printf("records ");
+  for (uint8_t t = TRACE_RAW; t <= TRACE_FLOW; t++) printf(" %s %u", typeName(t), counts[t]);
+  printf("\n");
+  printf("replay   %.1f s of trace in %.1f ms, %.0fx real time\n",
+         spanS, wallMs, wallMs > 0 ? spanS * 1000 / wallMs : 0);
+
+  uint32_t mismatches = 0;
+  int64_t tolerance = (int64_t)(toleranceMs * 1000);
+  auto differs = [&](int64_t a, int64_t b)
+  {
+    if (a < 0 || b < 0) return a != b;
+    return llabs(a - b) > tolerance;
+  };
+  auto seconds = [](int64_t us) { return us < 0 ? -1.0 : us / 1e6; };
+
+  printf("\nfeed  start s   at open g  throttle s rec / replay  close s rec / replay  dropped g\n");
+  for (size_t i = 0; i < feeds.size(); i++)
+  {
+    const Feed &f = feeds[i];
+    bool bad = differs(f.recordedThrottle, f.replayedThrottle) || differs(f.recordedClose, f.replayedClose);
+    if (bad) mismatches++;
+    printf("%4zu  %8.3f  %9.2f  %8.3f / %-8.3f  %7.3f / %-7.3f  %9.2f%s\n", i,
+           (f.startUs - firstUs) / 1e6, f.weightAtOpen,
+           seconds(f.recordedThrottle), seconds(f.replayedThrottle),
+           seconds(f.recordedClose), seconds(f.replayedClose),
+           f.replayedDropped, bad ? "  DIFFERS" : "");
+  }
+
+  if (!washes.empty())
+  {
+    printf("\nwash  start s  target L  stop s rec / replay    litres  L/min\n");
+    for (size_t i = 0; i < washes.size(); i++)
+    {
+      const Wash &w = washes[i];
+      //  a timed wash is ended by its timer alone
+      bool bad = w.target > 0 && differs(w.recordedStop, w.replayedStop);
+      if (bad) mismatches++;
+      int64_t ranUs = w.recordedStop >= 0 ? w.recordedStop : lastUs - w.startUs;
+      float litres = w.pulses / config[TRACE_KEY_FLOW_PULSES];
+      printf("%4zu  %7.3f  %8.2f  %7.3f / %-7.3f  %8.2f  %5.1f  %s%s\n", i,
+             (w.startUs - firstUs) / 1e6, w.target,
+             seconds(w.recordedStop), seconds(w.replayedStop), litres,
+             ranUs > 0 ? litres * 60e6 / ranUs : 0.0,
+             w.capped ? "time cap" : w.replayedAction == WASH_VOLUME_REACHED ? "volume" :
+             w.replayedAction == WASH_NO_FLOW ? "no flow" : "-",
+             bad ? "  DIFFERS" : "");
+    }
+  }
+
+  bool schedulesMatch = recordedTriggers == replayedTriggers;
+  if (!schedulesMatch) mismatches++;
+  printf("\nschedules %zu recorded, %zu replayed triggers%s\n", recordedTriggers.size(),
+         replayedTriggers.size(), schedulesMatch ? "" : "  DIFFER");
+  if (!schedulesMatch)
+  {
+    for (size_t i = 0; i < recordedTriggers.size() || i < replayedTriggers.size(); i++)
+    {
+      auto show = [](const std::vector<Trigger> &v, size_t i)
+      {
+        if (i >= v.size()) { printf("%-16s", "-"); return; }
+        printf("%s %u %02u:%02u       ", v[i].kind == TRACE_FEED_SCHEDULE ? "feed" : "wash",
+               v[i].index, v[i].minute / 60, v[i].minute % 60);
+      };
+      show(recordedTriggers, i);
+      printf(" | ");
+      show(replayedTriggers, i);
+      printf("\n");
+    }
+  }
+
+  delete meter;
+  delete feeder;
+  delete flow;
+  printf("\n%s\n", mismatches ? "DIFFERENT decisions" : "same decisions");
+  return mismatches ? 1 : 0;
+}
+
+
+///////////////////////////////////////////////////////////////
+//
+//  SYNTHETIC TRACE
+//
+//  A hopper on the load cell empties through the gate; the flow grows
+//  with the opening. The controller is run the way the sketch runs it:
+//  a pass every 100 ms, one filtered conversion per pass while the gate
+//  is open, one plain read per second while it is closed (status polls).
+//  The wash runs water at the line's flow, give or take the pressure
+//  swings, through a meter counted by interrupt as in the sketch.
+//
+static std::vector<uint8_t> synthOut;
+static void synthSink(const uint8_t *block, uint16_t length)
+{
+  synthOut.insert(synthOut.end(), block, block + length);
+}
+
+static TraceWriter *synthTrace = NULL;
+static void synthConversion(int32_t raw)
+{
+  synthTrace->raw(micros(), raw);
+}
+
+static volatile uint32_t flowPulses = 0;
+static void countFlowPulse()
+{
+  flowPulses++;
+}
+
+
+static int synth(const char *path, int feedCount, int sps, uint32_t seed, float washFlow)
+{
+  const float    SCALE = 420.0;            //  counts per gram
+  const int32_t  OFFSET = 120000;
+  const float    NOISE = 0.3;              //  grams rms
+  const float    DROP = 50.0, SLOW = 15.0, DRIBBLE = 5.0;
+  const uint16_t GATE_OPEN = 900;
+  const uint32_t START_EPOCH = 1760000000UL / 86400 * 86400 + 8 * 3600 - 30;   //  07:59:30
+  const float    WASH_LITRES = 20.0;
+  const float    PULSES_PER_LITRE = 450.0;
+  const float    PRESSURE_SWING = 0.1;     //  of the flow, rms
+
+  static uint8_t ram[4 * TRACE_BLOCK_SIZE];
+  TraceWriter trace(ram, 4);
+  trace.setSink(synthSink);
+  synthTrace = &trace;
+
+  std::mt19937 rng(seed);
+  std::normal_distribution<float> noise(0, NOISE);
+
+  hostHX711(HX_DATA_PIN, HX_CLOCK_PIN);
+  hostSetMicros(0);
+  HX711 scale;
+  scale.begin(HX_DATA_PIN, HX_CLOCK_PIN);
+  scale.set_read_callback(synthConversion);
+  scale.set_scale(SCALE);
+  scale.set_offset(OFFSET);
+  scale.set_kalman_mode();
+
+  trace.configFloat(0, TRACE_KEY_DROP_AMOUNT, DROP);
+  trace.configFloat(0, TRACE_KEY_SLOW_ZONE, SLOW);
+  trace.configFloat(0, TRACE_KEY_DRIBBLE_FLOW, DRIBBLE);
+  trace.config(0, TRACE_KEY_GATE_OPEN, GATE_OPEN);
+  trace.configFloat(0, TRACE_KEY_SCALE, SCALE);
+  trace.config(0, TRACE_KEY_OFFSET, (uint32_t) OFFSET);
+  trace.configFloat(0, TRACE_KEY_FLOW_PULSES, PULSES_PER_LITRE);
+  attachInterrupt(digitalPinToInterrupt(FLOW_METER_PIN), countFlowPulse, FALLING);
+  std::normal_distribution<float> pressure(1, PRESSURE_SWING);
+
+  //  a feeding every minute from 08:00, then a wash
+  uint8_t  kinds[TRACE_MAX_SCHEDULES];
+  uint16_t minutes[TRACE_MAX_SCHEDULES];
+  int16_t  at[TRACE_MAX_SCHEDULES];
+  bool     triggered[TRACE_MAX_SCHEDULES] = { false };
+  if (feedCount > TRACE_MAX_SCHEDULES - 1) feedCount = TRACE_MAX_SCHEDULES - 1;
+  for (int i = 0; i <= feedCount; i++)
+  {
+    kinds[i]   = i < feedCount ? TRACE_FEED_SCHEDULE : TRACE_WASH_SCHEDULE;
+    minutes[i] = 8 * 60 + i;
+    at[i]      = minutes[i];
+  }
+  trace.schedules(0, feedCount + 1, kinds, minutes);
+
+  GateFlowMap flow(GATE_CLOSED, GATE_OPEN, GATE_FLOW_AT_OPEN);
+  FeedController feeder(flow, DROP, SLOW, DRIBBLE);
+  ServoMotion gate;
+  gate.set(GATE_CLOSED);
+  bool     gateOpen = false;
+  float    hopper = 3000.0;
+  float    lastWeight = hopper;
+  int      lastMinute = -1;
+  WashMeter meter(PULSES_PER_LITRE, WASH_NO_FLOW_TIMEOUT);
+  bool     washing = false;
+  uint64_t washStart = 0;
+  uint32_t lastFlowTrace = 0;
+  float    water = 0;                      //  litres not yet counted as a pulse
+  float    swing = 1;
+
+  const uint64_t STEP = 1000;
+  const uint64_t END = (uint64_t)(feedCount + 3) * 60 * 1000000;
+  uint64_t conversionEvery = 1000000 / sps;
+  uint64_t nextConversion = conversionEvery;
+  uint64_t nextFrame = 0;
+  uint64_t nextPass = 0;
+  uint64_t nextPoll = 0;
+  for (uint64_t t = 0; t < END; t += STEP)
+  {
+    hostSetMicros(t);
+    //  true flow, 45 g/s fully open, less than linear when partly open
+    float opening = gate.position() / (float) GATE_OPEN;
+    if (opening > 1) opening = 1;
+    hopper -= 45.0 * powf(opening, 1.3) * STEP / 1e6;
+    if (hopper < 0) hopper = 0;
+    if (washing)
+    {
+      water += washFlow * swing / 60 * STEP / 1e6;
+      uint32_t pulses = (uint32_t)(water * PULSES_PER_LITRE);
+      water -= pulses / PULSES_PER_LITRE;
+      hostPulse(FLOW_METER_PIN, pulses);
+    }
+
+    if (t >= nextFrame)
+    {
+      gate.frame();
+      nextFrame += SERVO_FRAME_US;
+    }
+    if (t >= nextConversion)
+    {
+      //  a conversion nobody read is overwritten by the next one
+      hostDropConversions();
+      nextConversion += conversionEvery;
+      int32_t raw = OFFSET + (int32_t) lroundf((hopper + noise(rng)) * SCALE);
+      hostPushConversion(raw);
+    }
+    if (t < nextPass) continue;
+    nextPass += 100000;
+
+    //  checkSchedules()
+    uint32_t epoch = START_EPOCH + t / 1000000;
+    int minute = (epoch % 86400) / 60;
+    if (minute != lastMinute)
+    {
+      trace.time(micros(), epoch);
+      lastMinute = minute;
+    }
+    for (int i = 0; i <= feedCount; i++)
+    {
+      if (!scheduleDue(minute, at[i], triggered[i])) continue;
+      trace.schedule(micros(), kinds[i], kinds[i] == TRACE_FEED_SCHEDULE ? i : 0, minute);
+      if (kinds[i] == TRACE_FEED_SCHEDULE)
+      {
+        gate.moveTo(GATE_OPEN, GATE_OPEN_PROFILE);
+        gateOpen = true;
+        trace.actuator(micros(), SERVO_OPEN, DONE, GATE_OPEN);
+        feeder.start(lastWeight);
+        trace.feed(micros(), lastWeight);
+      }
+      else
+      {
+        trace.configFloat(micros(), TRACE_KEY_WASH_LITRES, WASH_LITRES);
+        trace.actuator(micros(), WASH_START, DONE, 0);
+        meter.start(flowPulses, millis(), WASH_LITRES);
+        washing = true;
+        washStart = t;
+        lastFlowTrace = millis();
+      }
+    }
+
+    //  checkWashVolume(), the pressure swings once a pass
+    if (washing)
+    {
+      swing = pressure(rng);
+      if (swing < 0) swing = 0;
+      WashAction action = meter.update(flowPulses, millis());
+      if (action != WASH_HOLD || millis() - lastFlowTrace >= WASH_TRACE_INTERVAL)
+      {
+        trace.flow(micros(), meter.pulses());
+        lastFlowTrace = millis();
+      }
+      if (action != WASH_HOLD || t - washStart >= WASH_MAX_DURATION * 1000ULL)
+      {
+        washing = false;
+        trace.actuator(micros(), WASH_STOP, DONE, 0);
+        meter.stop(flowPulses, millis());
+        trace.flow(micros(), meter.pulses());
+      }
+    }
+
+    //  checkAutoClose()
+    if (gateOpen && hostPendingConversions() > 0)
+    {
+      lastWeight = scale.get_units(1);
+      uint16_t position;
+      FeedAction action = feeder.update(lastWeight, scale.get_rate(), gate.position(), gate.target(),
+                                        gate.moving(), position);
+      if (action == FEED_CLOSE)
+      {
+        gate.moveTo(GATE_CLOSED, GATE_CLOSE_PROFILE);
+        gateOpen = false;
+        trace.actuator(micros(), SERVO_CLOSE, DONE, 0);
+      }
+      else if (action == FEED_THROTTLE)
+      {
+        gate.moveTo(position, GATE_OPEN_PROFILE);
+        trace.actuator(micros(), SERVO_MOVE, DONE, position);
+      }
+    }
+    else if (!gateOpen && t >= nextPoll && hostPendingConversions() > 0)
+    {
+      //  a status poll
+      lastWeight = (scale.read() - OFFSET) / SCALE;
+      nextPoll = t + 1000000;
+    }
+  }
+
+  //  the block being filled
+  uint16_t length;
+  const uint8_t *last = trace.block(trace.blockCount() - 1, &length);
+  synthOut.insert(synthOut.end(), last, last + length);
+
+  FILE *f = fopen(path, "wb");
+  if (f == NULL)
+  {
+    perror(path);
+    return 2;
+  }
+  fwrite(synthOut.data(), 1, synthOut.size(), f);
+  fclose(f);
+  printf("%s: %zu bytes, %u records, %u blocks, %.1f g left in the hopper, "
+         "washed %.2f L in %.1f s at %.1f L/min\n",
+         path, synthOut.size(), trace.records(), trace.sequence(), hopper,
+         meter.litres(), meter.duration() / 1000.0, meter.meanFlow());
+  return 0;
+}
+
+
+static void usage()
+{
+  fprintf(stderr,
+          "usage: trace_replay trace.bin [--dump] [--tolerance ms] [--open-flow g/s]\n"
+          "       trace_replay --synth out.bin [--feeds n] [--sps n] [--seed n] [--wash-flow L/min]\n");
+}
+
+
+int main(int argc, char *argv[])
+{
+  const char *path = NULL;
+  const char *synthPath = NULL;
+  bool   dump = false;
+  double tolerance = 0;
+  float  openFlow = GATE_FLOW_AT_OPEN;
+  int    feeds = 3;
+  int    sps = 10;
+  uint32_t seed = 1;
+  float  washFlow = 12.0;
+  for (int i = 1; i < argc; i++)
+  {
+    bool more = i + 1 < argc;
+    if      (strcmp(argv[i], "--dump") == 0) dump = true;
+    else if (strcmp(argv[i], "--tolerance") == 0 && more) tolerance = atof(argv[++i]);
+    else if (strcmp(argv[i], "--open-flow") == 0 && more) openFlow = atof(argv[++i]);
+    else if (strcmp(argv[i], "--synth") == 0 && more) synthPath = argv[++i];
+    else if (strcmp(argv[i], "--feeds") == 0 && more) feeds = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--sps") == 0 && more) sps = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--seed") == 0 && more) seed = strtoul(argv[++i], NULL, 10);
+    else if (strcmp(argv[i], "--wash-flow") == 0 && more) washFlow = atof(argv[++i]);
+    else if (argv[i][0] != '-') path = argv[i];
+    else
+    {
+      usage();
+      return 2;
+    }
+  }
+
+  if (synthPath) return synth(synthPath, feeds, sps > 0 ? sps : 10, seed, washFlow);
+  if (path == NULL)
+  {
+    usage();
+    return 2;
+  }
+  std::vector<uint8_t> data;
+  if (!loadFile(path, data))
+  {
+    perror(path);
+    return 2;
+  }
+  return replay(data, dump, tolerance, openFlow);
+}
+
+
+//  -- END OF FILE --